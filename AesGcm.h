@@ -0,0 +1,1040 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define AESGCM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC lets any function use the AES-NI/VAES intrinsics; GCC and Clang need the instruction sets enabled per function
+// so that the rest of the binary still runs on CPUs without them.
+#if defined(AESGCM_X86) && !defined(_MSC_VER)
+#define AESGCM_TARGET_AESNI __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+#define AESGCM_TARGET_VAES __attribute__((target("aes,pclmul,ssse3,sse4.1,avx,avx2,vaes,vpclmulqdq")))
+#else
+#define AESGCM_TARGET_AESNI
+#define AESGCM_TARGET_VAES
+#endif
+
+// The per-lane loops below must be fully unrolled so the blocks stay in registers; GCC only does that at -O2 when asked.
+#if defined(__GNUC__) && !defined(__clang__)
+#define AESGCM_UNROLL _Pragma("GCC unroll 16")
+#elif defined(__clang__)
+#define AESGCM_UNROLL _Pragma("unroll")
+#else
+#define AESGCM_UNROLL
+#endif
+
+enum class AesGcmImplementation
+{
+    Software,
+    AesNi,  // AES-NI + PCLMULQDQ, 8 blocks in flight.
+    Vaes,   // VAES + VPCLMULQDQ on 256-bit registers, 16 blocks in flight.
+};
+
+inline const wchar_t* AesGcmImplementationName(AesGcmImplementation implementation)
+{
+    switch (implementation)
+    {
+    case AesGcmImplementation::AesNi:
+        return L"AES-NI";
+    case AesGcmImplementation::Vaes:
+        return L"VAES";
+    default:
+        return L"Software";
+    }
+}
+
+namespace details
+{
+    constexpr size_t c_aesBlockSize = 16;
+    constexpr int c_aes256Rounds = 14;
+    constexpr size_t c_ghashPowerCount = 16;
+
+    // Deliberately not over-aligned: the SIMD paths load the round keys and powers of H into registers once per call
+    // with unaligned loads, and an alignment specifier here would pad every class holding an AesGcm (MSVC C4324).
+    struct AesGcmState
+    {
+        uint8_t RoundKeys[c_aes256Rounds + 1][c_aesBlockSize];
+        uint8_t HPowers[c_ghashPowerCount][c_aesBlockSize]; // Byte-reflected H^1..H^16 for the carry-less multiply paths.
+        uint8_t H[c_aesBlockSize];
+    };
+
+    struct AesGcmDispatch
+    {
+        void (*Initialize)(AesGcmState& state);
+        void (*EncryptBlock)(AesGcmState const& state, uint8_t const* in, uint8_t* out);
+        void (*GhashBlock)(AesGcmState const& state, uint8_t* y, uint8_t const* block);
+        // Folds whole blocks into the GHASH accumulator 'y' without decrypting them.
+        void (*GhashBlocks)(AesGcmState const& state, uint8_t* y, uint8_t const* in, size_t blockCount);
+        // Runs CTR mode over whole blocks starting at 'counter' and folds the ciphertext into the GHASH accumulator 'y'.
+        void (*DecryptBlocks)(AesGcmState const& state, uint8_t const* nonce, uint32_t& counter, uint8_t const* in, uint8_t* out, size_t blockCount, uint8_t* y);
+        void (*EncryptBlocks)(AesGcmState const& state, uint8_t const* nonce, uint32_t& counter, uint8_t const* in, uint8_t* out, size_t blockCount, uint8_t* y);
+    };
+
+    inline constexpr uint8_t c_sbox[256] = {
+        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
+
+    inline void SecureZeroBytes(void* data, size_t size)
+    {
+        auto bytes = static_cast<volatile uint8_t*>(data);
+        while (size--)
+        {
+            *bytes++ = 0;
+        }
+    }
+
+    inline uint32_t ByteSwap32(uint32_t value)
+    {
+        return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+    }
+
+    inline uint64_t LoadBigEndian64(uint8_t const* bytes)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+
+    inline void StoreBigEndian64(uint8_t* bytes, uint64_t value)
+    {
+        for (int i = 7; i >= 0; i--)
+        {
+            bytes[i] = static_cast<uint8_t>(value);
+            value >>= 8;
+        }
+    }
+
+    inline void MakeCounterBlock(uint8_t const* nonce, uint32_t counter, uint8_t* block)
+    {
+        memcpy(block, nonce, 12);
+        block[12] = static_cast<uint8_t>(counter >> 24);
+        block[13] = static_cast<uint8_t>(counter >> 16);
+        block[14] = static_cast<uint8_t>(counter >> 8);
+        block[15] = static_cast<uint8_t>(counter);
+    }
+
+    // FIPS-197 key expansion. AES-NI consumes the same round key layout, so every implementation shares it.
+    inline void ExpandAes256Key(uint8_t const* key, AesGcmState& state)
+    {
+        constexpr uint8_t rcon[] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40 };
+        auto words = &state.RoundKeys[0][0];
+        memcpy(words, key, 32);
+        for (int i = 8; i < 4 * (c_aes256Rounds + 1); i++)
+        {
+            uint8_t temp[4];
+            memcpy(temp, words + 4 * (i - 1), 4);
+            if (i % 8 == 0)
+            {
+                const uint8_t first = temp[0];
+                temp[0] = c_sbox[temp[1]] ^ rcon[i / 8 - 1];
+                temp[1] = c_sbox[temp[2]];
+                temp[2] = c_sbox[temp[3]];
+                temp[3] = c_sbox[first];
+            }
+            else if (i % 8 == 4)
+            {
+                for (auto& byte : temp)
+                {
+                    byte = c_sbox[byte];
+                }
+            }
+
+            for (int j = 0; j < 4; j++)
+            {
+                words[4 * i + j] = words[4 * (i - 8) + j] ^ temp[j];
+            }
+        }
+    }
+
+    inline uint8_t Xtime(uint8_t value)
+    {
+        return static_cast<uint8_t>((value << 1) ^ ((value & 0x80) ? 0x1b : 0x00));
+    }
+
+    inline void SoftwareEncryptBlock(AesGcmState const& state, uint8_t const* in, uint8_t* out)
+    {
+        uint8_t s[16];
+        for (int i = 0; i < 16; i++)
+        {
+            s[i] = in[i] ^ state.RoundKeys[0][i];
+        }
+
+        for (int round = 1; round <= c_aes256Rounds; round++)
+        {
+            // SubBytes and ShiftRows; byte (row r, column c) lives at s[r + 4c].
+            uint8_t t[16];
+            for (int c = 0; c < 4; c++)
+            {
+                for (int r = 0; r < 4; r++)
+                {
+                    t[r + 4 * c] = c_sbox[s[r + 4 * ((c + r) % 4)]];
+                }
+            }
+
+            if (round != c_aes256Rounds)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    const uint8_t a0 = t[4 * c], a1 = t[4 * c + 1], a2 = t[4 * c + 2], a3 = t[4 * c + 3];
+                    const uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+                    t[4 * c] = a0 ^ all ^ Xtime(a0 ^ a1);
+                    t[4 * c + 1] = a1 ^ all ^ Xtime(a1 ^ a2);
+                    t[4 * c + 2] = a2 ^ all ^ Xtime(a2 ^ a3);
+                    t[4 * c + 3] = a3 ^ all ^ Xtime(a3 ^ a0);
+                }
+            }
+
+            for (int i = 0; i < 16; i++)
+            {
+                s[i] = t[i] ^ state.RoundKeys[round][i];
+            }
+        }
+
+        memcpy(out, s, sizeof(s));
+    }
+
+    // y = (y ^ block) * H in GF(2^128), bit by bit as in SP 800-38D algorithm 1.
+    inline void SoftwareGhashBlock(AesGcmState const& state, uint8_t* y, uint8_t const* block)
+    {
+        const uint64_t xHigh = LoadBigEndian64(y) ^ LoadBigEndian64(block);
+        const uint64_t xLow = LoadBigEndian64(y + 8) ^ LoadBigEndian64(block + 8);
+        uint64_t vHigh = LoadBigEndian64(state.H);
+        uint64_t vLow = LoadBigEndian64(state.H + 8);
+        uint64_t zHigh = 0;
+        uint64_t zLow = 0;
+        for (int i = 0; i < 128; i++)
+        {
+            const uint64_t bit = (i < 64) ? (xHigh >> (63 - i)) & 1 : (xLow >> (127 - i)) & 1;
+            const uint64_t mask = 0 - bit;
+            zHigh ^= vHigh & mask;
+            zLow ^= vLow & mask;
+
+            const uint64_t carry = 0 - (vLow & 1);
+            vLow = (vLow >> 1) | (vHigh << 63);
+            vHigh = (vHigh >> 1) ^ (carry & 0xe100000000000000ull);
+        }
+
+        StoreBigEndian64(y, zHigh);
+        StoreBigEndian64(y + 8, zLow);
+    }
+
+    inline void SoftwareGhashBlocks(AesGcmState const& state, uint8_t* y, uint8_t const* in, size_t blockCount)
+    {
+        for (size_t i = 0; i < blockCount; i++, in += c_aesBlockSize)
+        {
+            SoftwareGhashBlock(state, y, in);
+        }
+    }
+
+    inline void SoftwareInitialize(AesGcmState& state)
+    {
+        const uint8_t zero[c_aesBlockSize]{};
+        SoftwareEncryptBlock(state, zero, state.H);
+    }
+
+    template<bool Encrypt>
+    void SoftwareCryptBlocks(AesGcmState const& state, uint8_t const* nonce, uint32_t& counter, uint8_t const* in, uint8_t* out, size_t blockCount, uint8_t* y)
+    {
+        for (size_t i = 0; i < blockCount; i++, in += c_aesBlockSize, out += c_aesBlockSize)
+        {
+            uint8_t keyStream[c_aesBlockSize];
+            MakeCounterBlock(nonce, counter++, keyStream);
+            SoftwareEncryptBlock(state, keyStream, keyStream);
+
+            uint8_t block[c_aesBlockSize];
+            memcpy(block, in, c_aesBlockSize);
+            for (size_t j = 0; j < c_aesBlockSize; j++)
+            {
+                out[j] = block[j] ^ keyStream[j];
+            }
+            SoftwareGhashBlock(state, y, Encrypt ? out : block);
+        }
+    }
+
+    inline constexpr AesGcmDispatch c_softwareDispatch = {
+        SoftwareInitialize, SoftwareEncryptBlock, SoftwareGhashBlock, SoftwareGhashBlocks, SoftwareCryptBlocks<false>, SoftwareCryptBlocks<true> };
+
+#if defined(AESGCM_X86)
+    AESGCM_TARGET_AESNI inline __m128i ByteReflect(__m128i value)
+    {
+        return _mm_shuffle_epi8(value, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    AESGCM_TARGET_AESNI inline __m128i CounterBlock(__m128i nonceBlock, uint32_t counter)
+    {
+        return _mm_insert_epi32(nonceBlock, static_cast<int>(ByteSwap32(counter)), 3);
+    }
+
+    AESGCM_TARGET_AESNI inline __m128i LoadNonceBlock(uint8_t const* nonce)
+    {
+        alignas(16) uint8_t block[c_aesBlockSize]{};
+        memcpy(block, nonce, 12);
+        return _mm_load_si128(reinterpret_cast<__m128i const*>(block));
+    }
+
+    // Karatsuba carry-less multiply of two byte-reflected values, accumulated without reduction so that several
+    // products can share a single reduction (aggregated GHASH).
+    AESGCM_TARGET_AESNI inline void ClmulAccumulate(__m128i a, __m128i b, __m128i& low, __m128i& high)
+    {
+        const __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+        low = _mm_xor_si128(low, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+        high = _mm_xor_si128(high, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+    }
+
+    // Shift-and-reduce of a 256-bit reflected product modulo x^128 + x^7 + x^2 + x + 1 (Intel CLMUL white paper).
+    AESGCM_TARGET_AESNI inline __m128i GhashReduce(__m128i low, __m128i high)
+    {
+        __m128i carryLow = _mm_srli_epi32(low, 31);
+        __m128i carryHigh = _mm_srli_epi32(high, 31);
+        low = _mm_slli_epi32(low, 1);
+        high = _mm_slli_epi32(high, 1);
+        const __m128i crossCarry = _mm_srli_si128(carryLow, 12);
+        carryHigh = _mm_slli_si128(carryHigh, 4);
+        carryLow = _mm_slli_si128(carryLow, 4);
+        low = _mm_or_si128(low, carryLow);
+        high = _mm_or_si128(_mm_or_si128(high, carryHigh), crossCarry);
+
+        __m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+        const __m128i foldHigh = _mm_srli_si128(fold, 4);
+        fold = _mm_slli_si128(fold, 12);
+        low = _mm_xor_si128(low, fold);
+
+        __m128i result = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+        result = _mm_xor_si128(_mm_xor_si128(result, foldHigh), low);
+        return _mm_xor_si128(high, result);
+    }
+
+    AESGCM_TARGET_AESNI inline __m128i GhashMultiply(__m128i a, __m128i b)
+    {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        ClmulAccumulate(a, b, low, high);
+        return GhashReduce(low, high);
+    }
+
+    AESGCM_TARGET_AESNI inline __m128i AesNiEncrypt(__m128i const* roundKeys, __m128i block)
+    {
+        block = _mm_xor_si128(block, roundKeys[0]);
+        AESGCM_UNROLL
+        for (int round = 1; round < c_aes256Rounds; round++)
+        {
+            block = _mm_aesenc_si128(block, roundKeys[round]);
+        }
+        return _mm_aesenclast_si128(block, roundKeys[c_aes256Rounds]);
+    }
+
+    AESGCM_TARGET_AESNI inline void LoadRoundKeys(AesGcmState const& state, __m128i* roundKeys)
+    {
+        for (int round = 0; round <= c_aes256Rounds; round++)
+        {
+            roundKeys[round] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.RoundKeys[round]));
+        }
+    }
+
+    AESGCM_TARGET_AESNI inline void AesNiEncryptBlock(AesGcmState const& state, uint8_t const* in, uint8_t* out)
+    {
+        __m128i roundKeys[c_aes256Rounds + 1];
+        LoadRoundKeys(state, roundKeys);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), AesNiEncrypt(roundKeys, _mm_loadu_si128(reinterpret_cast<__m128i const*>(in))));
+    }
+
+    AESGCM_TARGET_AESNI inline void AesNiGhashBlock(AesGcmState const& state, uint8_t* y, uint8_t const* block)
+    {
+        const __m128i x = _mm_xor_si128(
+            ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y))),
+            ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(block))));
+        const __m128i h = _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[0]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReflect(GhashMultiply(x, h)));
+    }
+
+    // Aggregated like the GHASH half of AesNiCryptBlocks: eight blocks are multiplied by H^8..H^1 and reduced once,
+    // which keeps the carry-less multiplier busy instead of waiting on one reduction per block.
+    AESGCM_TARGET_AESNI inline void AesNiGhashBlocks(AesGcmState const& state, uint8_t* y, uint8_t const* in, size_t blockCount)
+    {
+        constexpr size_t lanes = 8;
+        __m128i hPowers[lanes];
+        AESGCM_UNROLL
+        for (size_t i = 0; i < lanes; i++)
+        {
+            hPowers[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[i]));
+        }
+
+        __m128i hash = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y)));
+        for (; blockCount >= lanes; blockCount -= lanes, in += lanes * c_aesBlockSize)
+        {
+            __m128i low = _mm_setzero_si128();
+            __m128i high = _mm_setzero_si128();
+            AESGCM_UNROLL
+            for (size_t i = 0; i < lanes; i++)
+            {
+                __m128i block = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in) + i));
+                if (i == 0)
+                {
+                    block = _mm_xor_si128(block, hash);
+                }
+                ClmulAccumulate(block, hPowers[lanes - 1 - i], low, high);
+            }
+            hash = GhashReduce(low, high);
+        }
+
+        for (; blockCount > 0; blockCount--, in += c_aesBlockSize)
+        {
+            hash = GhashMultiply(_mm_xor_si128(hash, ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in)))), hPowers[0]);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReflect(hash));
+    }
+
+    AESGCM_TARGET_AESNI inline void AesNiInitialize(AesGcmState& state)
+    {
+        const uint8_t zero[c_aesBlockSize]{};
+        AesNiEncryptBlock(state, zero, state.H);
+
+        const __m128i h = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(state.H)));
+        __m128i power = h;
+        for (size_t i = 0; i < c_ghashPowerCount; i++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state.HPowers[i]), power);
+            power = GhashMultiply(power, h);
+        }
+    }
+
+    template<bool Encrypt>
+    AESGCM_TARGET_AESNI void AesNiCryptBlocks(AesGcmState const& state, uint8_t const* nonce, uint32_t& counter, uint8_t const* in, uint8_t* out, size_t blockCount, uint8_t* y)
+    {
+        constexpr size_t lanes = 8;
+        __m128i roundKeys[c_aes256Rounds + 1];
+        LoadRoundKeys(state, roundKeys);
+        __m128i hPowers[lanes];
+        AESGCM_UNROLL
+        for (size_t i = 0; i < lanes; i++)
+        {
+            hPowers[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[i]));
+        }
+
+        const __m128i nonceBlock = LoadNonceBlock(nonce);
+        __m128i hash = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y)));
+
+        for (; blockCount >= lanes; blockCount -= lanes, in += lanes * c_aesBlockSize, out += lanes * c_aesBlockSize)
+        {
+            __m128i blocks[lanes];
+            AESGCM_UNROLL
+            for (size_t i = 0; i < lanes; i++)
+            {
+                blocks[i] = _mm_xor_si128(CounterBlock(nonceBlock, counter + static_cast<uint32_t>(i)), roundKeys[0]);
+            }
+            counter += lanes;
+
+            AESGCM_UNROLL
+            for (int round = 1; round < c_aes256Rounds; round++)
+            {
+                AESGCM_UNROLL
+                for (size_t i = 0; i < lanes; i++)
+                {
+                    blocks[i] = _mm_aesenc_si128(blocks[i], roundKeys[round]);
+                }
+            }
+
+            __m128i low = _mm_setzero_si128();
+            __m128i high = _mm_setzero_si128();
+            AESGCM_UNROLL
+            for (size_t i = 0; i < lanes; i++)
+            {
+                const __m128i input = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in) + i);
+                const __m128i output = _mm_xor_si128(input, _mm_aesenclast_si128(blocks[i], roundKeys[c_aes256Rounds]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + i, output);
+
+                __m128i ghashInput = ByteReflect(Encrypt ? output : input);
+                if (i == 0)
+                {
+                    ghashInput = _mm_xor_si128(ghashInput, hash);
+                }
+                ClmulAccumulate(ghashInput, hPowers[lanes - 1 - i], low, high);
+            }
+            hash = GhashReduce(low, high);
+        }
+
+        for (; blockCount > 0; blockCount--, in += c_aesBlockSize, out += c_aesBlockSize)
+        {
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+            const __m128i output = _mm_xor_si128(input, AesNiEncrypt(roundKeys, CounterBlock(nonceBlock, counter++)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), output);
+            hash = GhashMultiply(_mm_xor_si128(hash, ByteReflect(Encrypt ? output : input)), hPowers[0]);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReflect(hash));
+    }
+
+    inline constexpr AesGcmDispatch c_aesNiDispatch = {
+        AesNiInitialize, AesNiEncryptBlock, AesNiGhashBlock, AesNiGhashBlocks, AesNiCryptBlocks<false>, AesNiCryptBlocks<true> };
+
+    template<bool Encrypt>
+    AESGCM_TARGET_VAES void VaesCryptBlocks(AesGcmState const& state, uint8_t const* nonce, uint32_t& counter, uint8_t const* in, uint8_t* out, size_t blockCount, uint8_t* y)
+    {
+        // Each 256-bit register carries two consecutive blocks, so 8 registers keep 16 blocks in flight.
+        constexpr size_t registers = 8;
+        constexpr size_t blocksPerIteration = 2 * registers;
+        if (blockCount >= blocksPerIteration)
+        {
+            __m256i roundKeys[c_aes256Rounds + 1];
+            for (int round = 0; round <= c_aes256Rounds; round++)
+            {
+                roundKeys[round] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(state.RoundKeys[round])));
+            }
+
+            // Register j multiplies block 2j by H^(16-2j) in its low lane and block 2j+1 by H^(15-2j) in its high lane.
+            __m256i hPowers[registers];
+            AESGCM_UNROLL
+            for (size_t j = 0; j < registers; j++)
+            {
+                hPowers[j] = _mm256_set_m128i(
+                    _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[blocksPerIteration - 2 - 2 * j])),
+                    _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[blocksPerIteration - 1 - 2 * j])));
+            }
+
+            const __m256i reflectMask = _mm256_broadcastsi128_si256(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+            const __m128i nonceBlock = LoadNonceBlock(nonce);
+            __m128i hash = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y)));
+
+            for (; blockCount >= blocksPerIteration; blockCount -= blocksPerIteration, in += blocksPerIteration * c_aesBlockSize, out += blocksPerIteration * c_aesBlockSize)
+            {
+                __m256i blocks[registers];
+                AESGCM_UNROLL
+                for (size_t j = 0; j < registers; j++)
+                {
+                    const auto first = counter + static_cast<uint32_t>(2 * j);
+                    blocks[j] = _mm256_xor_si256(
+                        _mm256_set_m128i(CounterBlock(nonceBlock, first + 1), CounterBlock(nonceBlock, first)), roundKeys[0]);
+                }
+                counter += blocksPerIteration;
+
+                AESGCM_UNROLL
+                for (int round = 1; round < c_aes256Rounds; round++)
+                {
+                    AESGCM_UNROLL
+                    for (size_t j = 0; j < registers; j++)
+                    {
+                        blocks[j] = _mm256_aesenc_epi128(blocks[j], roundKeys[round]);
+                    }
+                }
+
+                __m256i low = _mm256_setzero_si256();
+                __m256i high = _mm256_setzero_si256();
+                AESGCM_UNROLL
+                for (size_t j = 0; j < registers; j++)
+                {
+                    const __m256i input = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in) + j);
+                    const __m256i output = _mm256_xor_si256(input, _mm256_aesenclast_epi128(blocks[j], roundKeys[c_aes256Rounds]));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out) + j, output);
+
+                    __m256i ghashInput = _mm256_shuffle_epi8(Encrypt ? output : input, reflectMask);
+                    if (j == 0)
+                    {
+                        ghashInput = _mm256_xor_si256(ghashInput, _mm256_inserti128_si256(_mm256_setzero_si256(), hash, 0));
+                    }
+
+                    const __m256i a = ghashInput;
+                    const __m256i b = hPowers[j];
+                    const __m256i middle = _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x10), _mm256_clmulepi64_epi128(a, b, 0x01));
+                    low = _mm256_xor_si256(low, _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x00), _mm256_bslli_epi128(middle, 8)));
+                    high = _mm256_xor_si256(high, _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x11), _mm256_bsrli_epi128(middle, 8)));
+                }
+
+                hash = GhashReduce(
+                    _mm_xor_si128(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1)),
+                    _mm_xor_si128(_mm256_castsi256_si128(high), _mm256_extracti128_si256(high, 1)));
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReflect(hash));
+            _mm256_zeroupper();
+        }
+
+        AesNiCryptBlocks<Encrypt>(state, nonce, counter, in, out, blockCount, y);
+    }
+
+    // The GHASH half of VaesCryptBlocks on its own: 16 blocks per reduction, two per 256-bit carry-less multiply.
+    AESGCM_TARGET_VAES inline void VaesGhashBlocks(AesGcmState const& state, uint8_t* y, uint8_t const* in, size_t blockCount)
+    {
+        constexpr size_t registers = 8;
+        constexpr size_t blocksPerIteration = 2 * registers;
+        if (blockCount >= blocksPerIteration)
+        {
+            __m256i hPowers[registers];
+            AESGCM_UNROLL
+            for (size_t j = 0; j < registers; j++)
+            {
+                hPowers[j] = _mm256_set_m128i(
+                    _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[blocksPerIteration - 2 - 2 * j])),
+                    _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.HPowers[blocksPerIteration - 1 - 2 * j])));
+            }
+
+            const __m256i reflectMask = _mm256_broadcastsi128_si256(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+            __m128i hash = ByteReflect(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y)));
+
+            for (; blockCount >= blocksPerIteration; blockCount -= blocksPerIteration, in += blocksPerIteration * c_aesBlockSize)
+            {
+                __m256i low = _mm256_setzero_si256();
+                __m256i high = _mm256_setzero_si256();
+                AESGCM_UNROLL
+                for (size_t j = 0; j < registers; j++)
+                {
+                    __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(in) + j), reflectMask);
+                    if (j == 0)
+                    {
+                        a = _mm256_xor_si256(a, _mm256_inserti128_si256(_mm256_setzero_si256(), hash, 0));
+                    }
+
+                    const __m256i b = hPowers[j];
+                    const __m256i middle = _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x10), _mm256_clmulepi64_epi128(a, b, 0x01));
+                    low = _mm256_xor_si256(low, _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x00), _mm256_bslli_epi128(middle, 8)));
+                    high = _mm256_xor_si256(high, _mm256_xor_si256(_mm256_clmulepi64_epi128(a, b, 0x11), _mm256_bsrli_epi128(middle, 8)));
+                }
+
+                hash = GhashReduce(
+                    _mm_xor_si128(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1)),
+                    _mm_xor_si128(_mm256_castsi256_si128(high), _mm256_extracti128_si256(high, 1)));
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReflect(hash));
+            _mm256_zeroupper();
+        }
+
+        AesNiGhashBlocks(state, y, in, blockCount);
+    }
+
+    inline constexpr AesGcmDispatch c_vaesDispatch = {
+        AesNiInitialize, AesNiEncryptBlock, AesNiGhashBlock, VaesGhashBlocks, VaesCryptBlocks<false>, VaesCryptBlocks<true> };
+
+    inline void CpuId(int leaf, int subLeaf, int (&registers)[4])
+    {
+#if defined(_MSC_VER)
+        __cpuidex(registers, leaf, subLeaf);
+#else
+        unsigned int a = 0, b = 0, c = 0, d = 0;
+        __cpuid_count(leaf, subLeaf, a, b, c, d);
+        registers[0] = static_cast<int>(a);
+        registers[1] = static_cast<int>(b);
+        registers[2] = static_cast<int>(c);
+        registers[3] = static_cast<int>(d);
+#endif
+    }
+
+    inline uint64_t ReadXcr0()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        uint32_t eax = 0, edx = 0;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+    }
+#endif
+
+    inline AesGcmImplementation DetectAesGcmImplementation()
+    {
+#if defined(AESGCM_X86)
+        int registers[4]{};
+        CpuId(0, 0, registers);
+        const int maxLeaf = registers[0];
+
+        CpuId(1, 0, registers);
+        const bool ssse3 = registers[2] & (1 << 9);
+        const bool sse41 = registers[2] & (1 << 19);
+        const bool pclmul = registers[2] & (1 << 1);
+        const bool aes = registers[2] & (1 << 25);
+        const bool osxsave = registers[2] & (1 << 27);
+        const bool avx = registers[2] & (1 << 28);
+        if (!(ssse3 && sse41 && pclmul && aes))
+        {
+            return AesGcmImplementation::Software;
+        }
+
+        if (maxLeaf >= 7 && osxsave && avx && ((ReadXcr0() & 0x6) == 0x6))
+        {
+            CpuId(7, 0, registers);
+            const bool avx2 = registers[1] & (1 << 5);
+            const bool vaes = registers[2] & (1 << 9);
+            const bool vpclmulqdq = registers[2] & (1 << 10);
+            if (avx2 && vaes && vpclmulqdq)
+            {
+                return AesGcmImplementation::Vaes;
+            }
+        }
+
+        return AesGcmImplementation::AesNi;
+#else
+        return AesGcmImplementation::Software;
+#endif
+    }
+
+    inline AesGcmDispatch const& GetAesGcmDispatch(AesGcmImplementation implementation)
+    {
+#if defined(AESGCM_X86)
+        switch (implementation)
+        {
+        case AesGcmImplementation::Vaes:
+            return c_vaesDispatch;
+        case AesGcmImplementation::AesNi:
+            return c_aesNiDispatch;
+        default:
+            break;
+        }
+#endif
+        (void)implementation;
+        return c_softwareDispatch;
+    }
+}
+
+// Fastest AES-GCM implementation the current CPU supports; detected once per process.
+inline AesGcmImplementation GetBestAesGcmImplementation()
+{
+    static const AesGcmImplementation best = details::DetectAesGcmImplementation();
+    return best;
+}
+
+// AES-256-GCM with a 96-bit nonce and no additional authenticated data, which is all the snapshot container uses.
+class AesGcm
+{
+public:
+    static constexpr size_t KeySize = 32;
+    static constexpr size_t NonceSize = 12;
+    static constexpr size_t TagSize = 16;
+
+    // Requests above what the CPU supports fall back to the best supported implementation.
+    explicit AesGcm(std::span<uint8_t const> key, AesGcmImplementation implementation = GetBestAesGcmImplementation())
+    {
+        if (key.size() != KeySize)
+        {
+            throw std::invalid_argument("AES-GCM key must be 256 bits.");
+        }
+
+        m_implementation = (static_cast<int>(implementation) <= static_cast<int>(GetBestAesGcmImplementation())) ? implementation : GetBestAesGcmImplementation();
+        m_dispatch = &details::GetAesGcmDispatch(m_implementation);
+        details::ExpandAes256Key(key.data(), m_state);
+        m_dispatch->Initialize(m_state);
+    }
+
+    ~AesGcm()
+    {
+        details::SecureZeroBytes(&m_state, sizeof(m_state));
+    }
+
+    AesGcm(AesGcm const&) = delete;
+    AesGcm& operator=(AesGcm const&) = delete;
+
+    AesGcmImplementation Implementation() const
+    {
+        return m_implementation;
+    }
+
+    // Decrypts 'ciphertext' into 'plaintext' (which may alias it) and verifies 'tag'. On a tag mismatch the
+    // plaintext is wiped and false is returned.
+    [[nodiscard]] bool Decrypt(
+        std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag, std::span<uint8_t> plaintext) const;
+
+    // Returns whether 'tag' authenticates 'ciphertext', without decrypting it. GCM's tag covers the ciphertext, so
+    // this only runs GHASH and a single block cipher call.
+    [[nodiscard]] bool Verify(std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag) const;
+
+    // Encrypts 'plaintext' into 'ciphertext' (which may alias it) and writes the tag. The export tool only reads
+    // containers; this exists to build synthetic ones.
+    void Encrypt(
+        std::span<uint8_t const> nonce, std::span<uint8_t const> plaintext, std::span<uint8_t> ciphertext, std::span<uint8_t> tag) const
+    {
+        if ((nonce.size() != NonceSize) || (tag.size() != TagSize) || (ciphertext.size() < plaintext.size()))
+        {
+            throw std::invalid_argument("Invalid AES-GCM buffer size.");
+        }
+
+        uint8_t hash[details::c_aesBlockSize] = {};
+        uint32_t counter = 2;
+        const auto blocks = plaintext.size() / details::c_aesBlockSize;
+        m_dispatch->EncryptBlocks(m_state, nonce.data(), counter, plaintext.data(), ciphertext.data(), blocks, hash);
+
+        const auto tail = plaintext.size() - blocks * details::c_aesBlockSize;
+        if (tail > 0)
+        {
+            uint8_t keyStream[details::c_aesBlockSize];
+            uint8_t block[details::c_aesBlockSize] = {};
+            details::MakeCounterBlock(nonce.data(), counter, keyStream);
+            m_dispatch->EncryptBlock(m_state, keyStream, keyStream);
+            for (size_t i = 0; i < tail; i++)
+            {
+                block[i] = plaintext[blocks * details::c_aesBlockSize + i] ^ keyStream[i];
+                ciphertext[blocks * details::c_aesBlockSize + i] = block[i];
+            }
+            m_dispatch->GhashBlock(m_state, hash, block);
+        }
+
+        ComputeTag(nonce.data(), 0, plaintext.size(), hash, tag.data());
+    }
+
+private:
+    friend class AesGcmDecryptor;
+    friend class AesGcmAuthenticator;
+
+    void ComputeTag(uint8_t const* nonce, uint64_t aadLength, uint64_t dataLength, uint8_t* hash, uint8_t* tag) const
+    {
+        uint8_t lengths[details::c_aesBlockSize];
+        details::StoreBigEndian64(lengths, aadLength * 8);
+        details::StoreBigEndian64(lengths + 8, dataLength * 8);
+        m_dispatch->GhashBlock(m_state, hash, lengths);
+
+        uint8_t initialCounter[details::c_aesBlockSize];
+        details::MakeCounterBlock(nonce, 1, initialCounter);
+        m_dispatch->EncryptBlock(m_state, initialCounter, tag);
+        for (size_t i = 0; i < TagSize; i++)
+        {
+            tag[i] ^= hash[i];
+        }
+    }
+
+    details::AesGcmState m_state{};
+    details::AesGcmDispatch const* m_dispatch = nullptr;
+    AesGcmImplementation m_implementation = AesGcmImplementation::Software;
+};
+
+// Incremental AES-GCM decryption. GHASH is carried across Update calls, so a message of any size can be
+// processed in fixed-size chunks. Plaintext is produced before the tag is known: callers must not commit it
+// until Finish returns true.
+class AesGcmDecryptor
+{
+public:
+    AesGcmDecryptor(AesGcm const& key, std::span<uint8_t const> nonce) : m_key(key)
+    {
+        if (nonce.size() != AesGcm::NonceSize)
+        {
+            throw std::invalid_argument("Invalid AES-GCM nonce size.");
+        }
+        memcpy(m_nonce, nonce.data(), sizeof(m_nonce));
+    }
+
+    ~AesGcmDecryptor()
+    {
+        details::SecureZeroBytes(m_keyStream, sizeof(m_keyStream));
+    }
+
+    AesGcmDecryptor(AesGcmDecryptor const&) = delete;
+    AesGcmDecryptor& operator=(AesGcmDecryptor const&) = delete;
+
+    // Chunks may be any size; 'plaintext' may alias 'ciphertext'.
+    void Update(std::span<uint8_t const> ciphertext, std::span<uint8_t> plaintext)
+    {
+        if (plaintext.size() < ciphertext.size())
+        {
+            throw std::invalid_argument("Invalid AES-GCM buffer size.");
+        }
+
+        auto in = ciphertext.data();
+        auto out = plaintext.data();
+        auto remaining = ciphertext.size();
+        m_totalLength += remaining;
+
+        for (; (m_partialLength > 0) && (remaining > 0); remaining--)
+        {
+            const uint8_t byte = *in++;
+            m_partialBlock[m_partialLength] = byte;
+            *out++ = byte ^ m_keyStream[m_partialLength];
+            if (++m_partialLength == details::c_aesBlockSize)
+            {
+                m_key.m_dispatch->GhashBlock(m_key.m_state, m_hash, m_partialBlock);
+                m_partialLength = 0;
+            }
+        }
+
+        const auto blocks = remaining / details::c_aesBlockSize;
+        m_key.m_dispatch->DecryptBlocks(m_key.m_state, m_nonce, m_counter, in, out, blocks, m_hash);
+        in += blocks * details::c_aesBlockSize;
+        out += blocks * details::c_aesBlockSize;
+        remaining -= blocks * details::c_aesBlockSize;
+
+        if (remaining > 0)
+        {
+            details::MakeCounterBlock(m_nonce, m_counter++, m_keyStream);
+            m_key.m_dispatch->EncryptBlock(m_key.m_state, m_keyStream, m_keyStream);
+            for (size_t i = 0; i < remaining; i++)
+            {
+                m_partialBlock[i] = in[i];
+                out[i] = in[i] ^ m_keyStream[i];
+            }
+            m_partialLength = remaining;
+        }
+    }
+
+    // Returns whether 'tag' authenticates everything passed to Update.
+    [[nodiscard]] bool Finish(std::span<uint8_t const> tag)
+    {
+        if (tag.size() != AesGcm::TagSize)
+        {
+            throw std::invalid_argument("Invalid AES-GCM tag size.");
+        }
+
+        if (m_partialLength > 0)
+        {
+            memset(m_partialBlock + m_partialLength, 0, details::c_aesBlockSize - m_partialLength);
+            m_key.m_dispatch->GhashBlock(m_key.m_state, m_hash, m_partialBlock);
+            m_partialLength = 0;
+        }
+
+        uint8_t expectedTag[AesGcm::TagSize];
+        m_key.ComputeTag(m_nonce, 0, m_totalLength, m_hash, expectedTag);
+
+        uint8_t difference = 0;
+        for (size_t i = 0; i < AesGcm::TagSize; i++)
+        {
+            difference |= expectedTag[i] ^ tag[i];
+        }
+        return difference == 0;
+    }
+
+private:
+    AesGcm const& m_key;
+    uint8_t m_nonce[AesGcm::NonceSize];
+    uint32_t m_counter = 2;
+    uint8_t m_hash[details::c_aesBlockSize]{};
+    uint8_t m_partialBlock[details::c_aesBlockSize]{};
+    uint8_t m_keyStream[details::c_aesBlockSize]{};
+    size_t m_partialLength = 0;
+    uint64_t m_totalLength = 0;
+};
+
+// Incremental tag check over ciphertext alone, for callers that need to know whether a message is intact but not
+// what it says. Same chunking rules as AesGcmDecryptor.
+class AesGcmAuthenticator
+{
+public:
+    AesGcmAuthenticator(AesGcm const& key, std::span<uint8_t const> nonce) : m_key(key)
+    {
+        if (nonce.size() != AesGcm::NonceSize)
+        {
+            throw std::invalid_argument("Invalid AES-GCM nonce size.");
+        }
+        memcpy(m_nonce, nonce.data(), sizeof(m_nonce));
+    }
+
+    AesGcmAuthenticator(AesGcmAuthenticator const&) = delete;
+    AesGcmAuthenticator& operator=(AesGcmAuthenticator const&) = delete;
+
+    void Update(std::span<uint8_t const> ciphertext)
+    {
+        auto in = ciphertext.data();
+        auto remaining = ciphertext.size();
+        m_totalLength += remaining;
+
+        for (; (m_partialLength > 0) && (remaining > 0); remaining--)
+        {
+            m_partialBlock[m_partialLength] = *in++;
+            if (++m_partialLength == details::c_aesBlockSize)
+            {
+                m_key.m_dispatch->GhashBlock(m_key.m_state, m_hash, m_partialBlock);
+                m_partialLength = 0;
+            }
+        }
+
+        const auto blocks = remaining / details::c_aesBlockSize;
+        m_key.m_dispatch->GhashBlocks(m_key.m_state, m_hash, in, blocks);
+        in += blocks * details::c_aesBlockSize;
+        remaining -= blocks * details::c_aesBlockSize;
+
+        // A chunk that did not complete the buffered partial block has nothing left here and must keep it.
+        if (remaining > 0)
+        {
+            memcpy(m_partialBlock, in, remaining);
+            m_partialLength = remaining;
+        }
+    }
+
+    // Returns whether 'tag' authenticates everything passed to Update.
+    [[nodiscard]] bool Finish(std::span<uint8_t const> tag)
+    {
+        if (tag.size() != AesGcm::TagSize)
+        {
+            throw std::invalid_argument("Invalid AES-GCM tag size.");
+        }
+
+        if (m_partialLength > 0)
+        {
+            memset(m_partialBlock + m_partialLength, 0, details::c_aesBlockSize - m_partialLength);
+            m_key.m_dispatch->GhashBlock(m_key.m_state, m_hash, m_partialBlock);
+            m_partialLength = 0;
+        }
+
+        uint8_t expectedTag[AesGcm::TagSize];
+        m_key.ComputeTag(m_nonce, 0, m_totalLength, m_hash, expectedTag);
+
+        uint8_t difference = 0;
+        for (size_t i = 0; i < AesGcm::TagSize; i++)
+        {
+            difference |= expectedTag[i] ^ tag[i];
+        }
+        return difference == 0;
+    }
+
+private:
+    AesGcm const& m_key;
+    uint8_t m_nonce[AesGcm::NonceSize];
+    uint8_t m_hash[details::c_aesBlockSize]{};
+    uint8_t m_partialBlock[details::c_aesBlockSize]{};
+    size_t m_partialLength = 0;
+    uint64_t m_totalLength = 0;
+};
+
+inline bool AesGcm::Decrypt(
+    std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag, std::span<uint8_t> plaintext) const
+{
+    if ((tag.size() != TagSize) || (plaintext.size() < ciphertext.size()))
+    {
+        throw std::invalid_argument("Invalid AES-GCM buffer size.");
+    }
+
+    AesGcmDecryptor decryptor(*this, nonce);
+    decryptor.Update(ciphertext, plaintext);
+    if (!decryptor.Finish(tag))
+    {
+        if (!ciphertext.empty())
+        {
+            memset(plaintext.data(), 0, ciphertext.size());
+        }
+        return false;
+    }
+
+    return true;
+}
+
+inline bool AesGcm::Verify(std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag) const
+{
+    AesGcmAuthenticator authenticator(*this, nonce);
+    authenticator.Update(ciphertext);
+    return authenticator.Finish(tag);
+}
@@ -0,0 +1,565 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "FileIo.h"
+
+enum class ArchiveFormat
+{
+    Tar,  // POSIX ustar, with pax headers for names that do not fit.
+    Zip,  // Uncompressed ("stored") entries, with ZIP64 records once the archive outgrows the classic limits.
+};
+
+namespace details
+{
+    // CRC-32 as ZIP uses it (reflected polynomial 0xEDB88320), eight bytes at a time with slicing-by-8 tables.
+    inline std::array<std::array<uint32_t, 256>, 8> const& Crc32Tables()
+    {
+        static const auto tables = []
+        {
+            std::array<std::array<uint32_t, 256>, 8> result{};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0u);
+                }
+                result[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                for (size_t slice = 1; slice < 8; slice++)
+                {
+                    result[slice][i] = (result[slice - 1][i] >> 8) ^ result[0][result[slice - 1][i] & 0xFF];
+                }
+            }
+            return result;
+        }();
+        return tables;
+    }
+
+    inline uint32_t Crc32(std::span<uint8_t const> data, uint32_t crc = 0)
+    {
+        auto const& tables = Crc32Tables();
+        crc = ~crc;
+        auto const* bytes = data.data();
+        auto remaining = data.size();
+        for (; remaining >= 8; bytes += 8, remaining -= 8)
+        {
+            uint32_t low;
+            uint32_t high;
+            memcpy(&low, bytes, 4);
+            memcpy(&high, bytes + 4, 4);
+            low ^= crc;
+            crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+                tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+        }
+        for (; remaining > 0; bytes++, remaining--)
+        {
+            crc = (crc >> 8) ^ tables[0][(crc ^ *bytes) & 0xFF];
+        }
+        return ~crc;
+    }
+
+    inline void AppendLittleEndian(std::vector<uint8_t>& output, uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            output.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+}
+
+// Sequential output for ArchiveWriter, double-buffered: bytes are gathered into one c_bufferSize buffer while the
+// other is written by a background thread, so every write but the last is a whole, page-aligned buffer and the
+// pipeline only waits on the disk when it gets two buffers ahead of it. The path "-" is standard output, which is
+// written through its handle, so nothing is translated even where the C runtime has it in text mode.
+class ArchiveOutput
+{
+public:
+    static constexpr size_t c_bufferSize = size_t{ 4 } << 20;
+
+    explicit ArchiveOutput(std::filesystem::path const& path) : m_full(1), m_empty(2)
+    {
+#if defined(_WIN32)
+        if (path == L"-")
+        {
+            m_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        }
+        else
+        {
+            m_file.reset(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+            m_handle = m_file.get();
+        }
+        if (!m_handle || (m_handle == INVALID_HANDLE_VALUE))
+        {
+            throw std::system_error(details::LastFileIoError(), "Unable to create the archive.");
+        }
+#else
+        m_fd = (path == "-") ? STDOUT_FILENO : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            throw std::system_error(details::LastFileIoError(), "Unable to create the archive.");
+        }
+        m_ownsFd = (m_fd != STDOUT_FILENO);
+#endif
+
+        m_current = BufferPool::Shared().Acquire(c_bufferSize);
+        m_empty.Push(BufferPool::Shared().Acquire(c_bufferSize));
+        m_writer = std::thread([this] { WriteBuffers(); });
+    }
+
+    // Without Close the archive is left incomplete.
+    ~ArchiveOutput()
+    {
+        if (m_writer.joinable())
+        {
+            m_full.Close();
+            m_writer.join();
+        }
+#if !defined(_WIN32)
+        if (m_ownsFd)
+        {
+            close(m_fd);
+        }
+#endif
+    }
+
+    ArchiveOutput(ArchiveOutput const&) = delete;
+    ArchiveOutput& operator=(ArchiveOutput const&) = delete;
+
+    // Throws std::system_error once an earlier buffer has failed to write.
+    void Write(std::span<uint8_t const> data)
+    {
+        ThrowIfFailed();
+        while (!data.empty())
+        {
+            const auto count = (std::min)(data.size(), c_bufferSize - m_filled);
+            memcpy(m_current.data() + m_filled, data.data(), count);
+            m_filled += count;
+            m_offset += count;
+            data = data.subspan(count);
+            if (m_filled == c_bufferSize)
+            {
+                SubmitCurrent();
+            }
+        }
+    }
+
+    void WriteZeros(size_t count)
+    {
+        static constexpr uint8_t c_zeros[512] = {};
+        for (; count > 0; count -= (std::min)(count, sizeof(c_zeros)))
+        {
+            Write({ c_zeros, (std::min)(count, sizeof(c_zeros)) });
+        }
+    }
+
+    // Writes what is buffered and closes the file. Throws std::system_error if anything failed to write.
+    void Close()
+    {
+        if (m_filled > 0)
+        {
+            SubmitCurrent();
+        }
+        m_full.Close();
+        m_writer.join();
+
+        std::error_code error = m_error;
+#if defined(_WIN32)
+        m_file.reset();
+#else
+        if (m_ownsFd && (close(m_fd) != 0) && !error)
+        {
+            error = details::LastFileIoError();
+        }
+        m_ownsFd = false;
+#endif
+        if (error)
+        {
+            throw std::system_error(error, "Writing the archive has failed.");
+        }
+    }
+
+    // Bytes written so far, buffered or not.
+    uint64_t Offset() const
+    {
+        return m_offset;
+    }
+
+private:
+    void SubmitCurrent()
+    {
+        m_current.resize(m_filled);
+        m_full.Push(std::move(m_current));
+        m_current = std::move(*m_empty.Pop());
+        m_current.resize(c_bufferSize);
+        m_filled = 0;
+    }
+
+    void ThrowIfFailed() const
+    {
+        if (m_failed.load(std::memory_order_acquire))
+        {
+            throw std::system_error(m_error, "Writing the archive has failed.");
+        }
+    }
+
+    // Once a write fails, later buffers are handed back without being written, and the error is reported to the
+    // next Write or to Close.
+    void WriteBuffers()
+    {
+        while (auto buffer = m_full.Pop())
+        {
+            if (!m_failed.load(std::memory_order_relaxed))
+            {
+                if (const auto error = WriteOut(*buffer))
+                {
+                    m_error = error;
+                    m_failed.store(true, std::memory_order_release);
+                }
+            }
+            m_empty.Push(std::move(*buffer));
+        }
+    }
+
+    std::error_code WriteOut(std::span<uint8_t const> data)
+    {
+        for (size_t offset = 0; offset < data.size();)
+        {
+#if defined(_WIN32)
+            DWORD written = 0;
+            if (!WriteFile(m_handle, data.data() + offset, static_cast<DWORD>(data.size() - offset), &written, nullptr))
+            {
+                return details::LastFileIoError();
+            }
+#else
+            const auto written = write(m_fd, data.data() + offset, data.size() - offset);
+            if ((written < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (written < 0)
+            {
+                return details::LastFileIoError();
+            }
+#endif
+            offset += static_cast<size_t>(written);
+        }
+        return {};
+    }
+
+#if defined(_WIN32)
+    wil::unique_hfile m_file;
+    HANDLE m_handle = nullptr;
+#else
+    int m_fd = -1;
+    bool m_ownsFd = false;
+#endif
+    BoundedQueue<PooledBuffer> m_full;
+    BoundedQueue<PooledBuffer> m_empty;
+    PooledBuffer m_current;
+    size_t m_filled = 0;
+    uint64_t m_offset = 0;
+    std::error_code m_error;
+    std::atomic<bool> m_failed{ false };
+    std::thread m_writer;
+};
+
+// Streams files into a single tar or ZIP archive, in the order they are added, without ever seeking, so the archive
+// can be written to a pipe. ZIP entries are stored uncompressed, since the images are JPEGs already; each entry's
+// CRC-32 is computed before its local header is written, so no data descriptors are needed, and the central
+// directory is kept in memory and written by Finish. Every entry gets the time the archive was created. Not
+// thread-safe: the export pipeline calls it from its writer thread.
+class ArchiveWriter
+{
+public:
+    ArchiveWriter(ArchiveFormat format, std::filesystem::path const& path) :
+        m_format(format), m_output(path), m_created(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))
+    {
+    }
+
+    ArchiveWriter(ArchiveWriter const&) = delete;
+    ArchiveWriter& operator=(ArchiveWriter const&) = delete;
+
+    // 'name' is relative, e.g. "sub/snapshot.jpg"; it is stored as UTF-8 with '/' separators. Throws
+    // std::system_error if the archive cannot be written.
+    void Add(std::filesystem::path const& name, std::span<uint8_t const> data)
+    {
+        const auto u8name = name.generic_u8string();
+        const std::string_view entryName(reinterpret_cast<char const*>(u8name.data()), u8name.size());
+        if (m_format == ArchiveFormat::Tar)
+        {
+            AddTarEntry(entryName, data);
+        }
+        else
+        {
+            AddZipEntry(entryName, data);
+        }
+        m_entryCount++;
+    }
+
+    // Writes the end of the archive and closes it. Nothing may be added afterwards.
+    void Finish()
+    {
+        if (m_format == ArchiveFormat::Tar)
+        {
+            m_output.WriteZeros(2 * c_tarBlockSize);
+        }
+        else
+        {
+            WriteZipCentralDirectory();
+        }
+        m_output.Close();
+    }
+
+    uint64_t EntryCount() const
+    {
+        return m_entryCount;
+    }
+
+    uint64_t Size() const
+    {
+        return m_output.Offset();
+    }
+
+private:
+    static constexpr size_t c_tarBlockSize = 512;
+    static constexpr uint32_t c_zip32Limit = 0xFFFFFFFF;
+    static constexpr uint16_t c_zipUtf8Flag = 0x0800;
+    static constexpr uint16_t c_zipVersion = 20;
+    static constexpr uint16_t c_zip64Version = 45;
+
+    struct ZipEntry
+    {
+        std::string Name;
+        uint32_t Crc32 = 0;
+        uint32_t Size = 0;
+        uint64_t HeaderOffset = 0;
+    };
+
+    // Octal with a terminating NUL, or, for a number too large for the field (sizes of 8 GB and up), the base-256
+    // form GNU tar and pax readers accept.
+    static void PutTarNumber(char* field, size_t width, uint64_t value)
+    {
+        if ((value >> ((width - 1) * 3)) == 0)
+        {
+            for (size_t i = width - 1; i-- > 0; value >>= 3)
+            {
+                field[i] = static_cast<char>('0' + (value & 7));
+            }
+            field[width - 1] = '\0';
+            return;
+        }
+
+        for (size_t i = width; i-- > 1; value >>= 8)
+        {
+            field[i] = static_cast<char>(value & 0xFF);
+        }
+        field[0] = static_cast<char>(0x80);
+    }
+
+    void WriteTarHeader(std::string_view name, std::string_view prefix, uint64_t size, char type)
+    {
+        std::array<char, c_tarBlockSize> header{};
+        memcpy(header.data(), name.data(), (std::min)(name.size(), size_t{ 100 }));
+        PutTarNumber(header.data() + 100, 8, 0644);
+        PutTarNumber(header.data() + 108, 8, 0);
+        PutTarNumber(header.data() + 116, 8, 0);
+        PutTarNumber(header.data() + 124, 12, size);
+        PutTarNumber(header.data() + 136, 12, static_cast<uint64_t>((std::max)(m_created, std::time_t{ 0 })));
+        header[156] = type;
+        memcpy(header.data() + 257, "ustar", 6);
+        memcpy(header.data() + 263, "00", 2);
+        if (!prefix.empty())
+        {
+            memcpy(header.data() + 345, prefix.data(), (std::min)(prefix.size(), size_t{ 155 }));
+        }
+
+        // The checksum is taken with its own field as spaces, and written as six octal digits, a NUL and a space.
+        memset(header.data() + 148, ' ', 8);
+        uint32_t checksum = 0;
+        for (const auto c : header)
+        {
+            checksum += static_cast<uint8_t>(c);
+        }
+        PutTarNumber(header.data() + 148, 7, checksum);
+        header[155] = ' ';
+
+        m_output.Write({ reinterpret_cast<uint8_t const*>(header.data()), header.size() });
+    }
+
+    void WriteTarData(std::span<uint8_t const> data)
+    {
+        m_output.Write(data);
+        m_output.WriteZeros((c_tarBlockSize - data.size() % c_tarBlockSize) % c_tarBlockSize);
+    }
+
+    // Names of up to 100 bytes go in the header. Longer ones are split at a '/' between the 155-byte prefix field
+    // and the name field where possible, and otherwise recorded in a pax extended header before the entry.
+    void AddTarEntry(std::string_view name, std::span<uint8_t const> data)
+    {
+        std::string_view prefix;
+        if (name.size() > 100)
+        {
+            for (auto slash = name.find('/', 1); (slash != std::string_view::npos) && (slash <= 155); slash = name.find('/', slash + 1))
+            {
+                if (name.size() - slash - 1 <= 100)
+                {
+                    prefix = name.substr(0, slash);
+                    name = name.substr(slash + 1);
+                    break;
+                }
+            }
+        }
+
+        if (name.size() > 100)
+        {
+            // "<length> path=<name>\n", where the length counts its own digits.
+            const auto recordBody = " path=" + std::string(name) + "\n";
+            auto length = recordBody.size() + 1;
+            while (std::to_string(length).size() + recordBody.size() > length)
+            {
+                length++;
+            }
+            const auto record = std::to_string(length) + recordBody;
+            WriteTarHeader("PaxHeader", {}, record.size(), 'x');
+            WriteTarData({ reinterpret_cast<uint8_t const*>(record.data()), record.size() });
+        }
+
+        WriteTarHeader(name, prefix, data.size(), '0');
+        WriteTarData(data);
+    }
+
+    void AddZipEntry(std::string_view name, std::span<uint8_t const> data)
+    {
+        if ((data.size() >= c_zip32Limit) || (name.size() > 0xFFFF))
+        {
+            throw std::system_error(std::make_error_code(std::errc::file_too_large), "The file is too large for a ZIP entry.");
+        }
+
+        ZipEntry entry{ std::string(name), details::Crc32(data), static_cast<uint32_t>(data.size()), m_output.Offset() };
+        m_header.clear();
+        details::AppendLittleEndian(m_header, 0x04034b50, 4);
+        details::AppendLittleEndian(m_header, c_zipVersion, 2);
+        details::AppendLittleEndian(m_header, c_zipUtf8Flag, 2);
+        details::AppendLittleEndian(m_header, 0, 2);  // Stored.
+        AppendDosTime(m_header);
+        details::AppendLittleEndian(m_header, entry.Crc32, 4);
+        details::AppendLittleEndian(m_header, entry.Size, 4);
+        details::AppendLittleEndian(m_header, entry.Size, 4);
+        details::AppendLittleEndian(m_header, name.size(), 2);
+        details::AppendLittleEndian(m_header, 0, 2);
+        m_header.insert(m_header.end(), name.begin(), name.end());
+        m_output.Write(m_header);
+        m_output.Write(data);
+        m_zipEntries.push_back(std::move(entry));
+    }
+
+    // Entries whose local header starts past 4 GB keep their offset in a ZIP64 extra field. The ZIP64 end records
+    // are only written when the entry count, the directory's size or its offset no longer fit the classic ones.
+    void WriteZipCentralDirectory()
+    {
+        const auto directoryOffset = m_output.Offset();
+        for (auto const& entry : m_zipEntries)
+        {
+            const bool zip64 = entry.HeaderOffset >= c_zip32Limit;
+            m_header.clear();
+            details::AppendLittleEndian(m_header, 0x02014b50, 4);
+            details::AppendLittleEndian(m_header, c_zip64Version, 2);
+            details::AppendLittleEndian(m_header, zip64 ? c_zip64Version : c_zipVersion, 2);
+            details::AppendLittleEndian(m_header, c_zipUtf8Flag, 2);
+            details::AppendLittleEndian(m_header, 0, 2);
+            AppendDosTime(m_header);
+            details::AppendLittleEndian(m_header, entry.Crc32, 4);
+            details::AppendLittleEndian(m_header, entry.Size, 4);
+            details::AppendLittleEndian(m_header, entry.Size, 4);
+            details::AppendLittleEndian(m_header, entry.Name.size(), 2);
+            details::AppendLittleEndian(m_header, zip64 ? 12 : 0, 2);
+            details::AppendLittleEndian(m_header, 0, 2);  // Comment length.
+            details::AppendLittleEndian(m_header, 0, 2);  // Disk number.
+            details::AppendLittleEndian(m_header, 0, 2);  // Internal attributes.
+            details::AppendLittleEndian(m_header, 0, 4);  // External attributes.
+            details::AppendLittleEndian(m_header, zip64 ? c_zip32Limit : entry.HeaderOffset, 4);
+            m_header.insert(m_header.end(), entry.Name.begin(), entry.Name.end());
+            if (zip64)
+            {
+                details::AppendLittleEndian(m_header, 0x0001, 2);
+                details::AppendLittleEndian(m_header, 8, 2);
+                details::AppendLittleEndian(m_header, entry.HeaderOffset, 8);
+            }
+            m_output.Write(m_header);
+        }
+
+        const auto directorySize = m_output.Offset() - directoryOffset;
+        const uint64_t entryCount = m_zipEntries.size();
+        m_header.clear();
+        if ((entryCount >= 0xFFFF) || (directorySize >= c_zip32Limit) || (directoryOffset >= c_zip32Limit))
+        {
+            const auto zip64EndOffset = m_output.Offset();
+            details::AppendLittleEndian(m_header, 0x06064b50, 4);
+            details::AppendLittleEndian(m_header, 44, 8);  // Size of the rest of the record.
+            details::AppendLittleEndian(m_header, c_zip64Version, 2);
+            details::AppendLittleEndian(m_header, c_zip64Version, 2);
+            details::AppendLittleEndian(m_header, 0, 4);
+            details::AppendLittleEndian(m_header, 0, 4);
+            details::AppendLittleEndian(m_header, entryCount, 8);
+            details::AppendLittleEndian(m_header, entryCount, 8);
+            details::AppendLittleEndian(m_header, directorySize, 8);
+            details::AppendLittleEndian(m_header, directoryOffset, 8);
+
+            details::AppendLittleEndian(m_header, 0x07064b50, 4);
+            details::AppendLittleEndian(m_header, 0, 4);
+            details::AppendLittleEndian(m_header, zip64EndOffset, 8);
+            details::AppendLittleEndian(m_header, 1, 4);  // Total disks.
+        }
+
+        details::AppendLittleEndian(m_header, 0x06054b50, 4);
+        details::AppendLittleEndian(m_header, 0, 2);
+        details::AppendLittleEndian(m_header, 0, 2);
+        details::AppendLittleEndian(m_header, (std::min)(entryCount, uint64_t{ 0xFFFF }), 2);
+        details::AppendLittleEndian(m_header, (std::min)(entryCount, uint64_t{ 0xFFFF }), 2);
+        details::AppendLittleEndian(m_header, (std::min)(directorySize, uint64_t{ c_zip32Limit }), 4);
+        details::AppendLittleEndian(m_header, (std::min)(directoryOffset, uint64_t{ c_zip32Limit }), 4);
+        details::AppendLittleEndian(m_header, 0, 2);  // Comment length.
+        m_output.Write(m_header);
+    }
+
+    // ZIP stores local time in MS-DOS form, which starts in 1980.
+    void AppendDosTime(std::vector<uint8_t>& output) const
+    {
+        std::tm local{};
+#if defined(_WIN32)
+        localtime_s(&local, &m_created);
+#else
+        localtime_r(&m_created, &local);
+#endif
+        const int year = (std::max)(local.tm_year + 1900, 1980) - 1980;
+        details::AppendLittleEndian(output, (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2), 2);
+        details::AppendLittleEndian(output, ((year & 0x7F) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday, 2);
+    }
+
+    ArchiveFormat m_format;
+    ArchiveOutput m_output;
+    std::time_t m_created;
+    uint64_t m_entryCount = 0;
+    std::vector<ZipEntry> m_zipEntries;
+    std::vector<uint8_t> m_header;
+};
@@ -0,0 +1,137 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cwchar>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BenchmarkResult
+{
+    std::wstring Name;
+    uint64_t Iterations = 0;
+    double NanosecondsPerIteration = 0;
+    uint64_t BytesPerIteration = 0;  // 0 when throughput is not meaningful.
+
+    double BytesPerSecond() const
+    {
+        return (NanosecondsPerIteration > 0) ? BytesPerIteration * 1e9 / NanosecondsPerIteration : 0;
+    }
+};
+
+// A small harness in the style of Google Benchmark: each benchmark runs a batch of iterations, and the batch grows
+// until it takes at least the minimum time, so short and long operations are both measured over a stable interval.
+// Benchmark bodies return a value that is folded into a volatile sink, which keeps the work from being optimized
+// away.
+class BenchmarkRunner
+{
+public:
+    BenchmarkRunner(std::chrono::milliseconds minimumTime, std::wstring filter) : m_minimumTime(minimumTime), m_filter(std::move(filter)) {}
+
+    // Whether 'name' passes the filter, so callers can skip setting up benchmarks that will not run.
+    bool IsEnabled(std::wstring const& name) const
+    {
+        return m_filter.empty() || (name.find(m_filter) != std::wstring::npos);
+    }
+
+    template <typename Body>
+    void Run(std::wstring const& name, uint64_t bytesPerIteration, Body&& body)
+    {
+        if (!IsEnabled(name))
+        {
+            return;
+        }
+
+        using Clock = std::chrono::steady_clock;
+        constexpr uint64_t c_maximumIterations = 1000000000;
+
+        uint64_t iterations = 1;
+        for (;;)
+        {
+            const auto start = Clock::now();
+            for (uint64_t i = 0; i < iterations; i++)
+            {
+                m_sink = m_sink + static_cast<uint64_t>(body());
+            }
+            const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            const double minimum = std::chrono::duration<double, std::nano>(m_minimumTime).count();
+            if ((elapsed >= minimum) || (iterations >= c_maximumIterations))
+            {
+                m_results.push_back({ name, iterations, elapsed / iterations, bytesPerIteration });
+                return;
+            }
+
+            // Aim 40% past the minimum, but never grow by more than 10x from a single sample.
+            const double multiplier = (elapsed > 0) ? (std::min)(10.0, 1.4 * minimum / elapsed) : 10.0;
+            iterations = (std::min)(c_maximumIterations, (std::max)(iterations + 1, static_cast<uint64_t>(iterations * multiplier)));
+        }
+    }
+
+    std::vector<BenchmarkResult> const& Results() const
+    {
+        return m_results;
+    }
+
+    // The table is laid out in a local stream, so the caller's stream keeps its own flags and precision.
+    void Print(std::wostream& output) const
+    {
+        std::wostringstream table;
+        size_t nameWidth = 9;
+        for (auto const& result : m_results)
+        {
+            nameWidth = (std::max)(nameWidth, result.Name.size());
+        }
+
+        table << std::left << std::setw(static_cast<int>(nameWidth)) << L"Benchmark" << std::right
+            << std::setw(16) << L"Time" << std::setw(14) << L"Iterations" << std::setw(16) << L"Throughput" << std::endl;
+        table << std::wstring(nameWidth + 46, L'-') << std::endl;
+        for (auto const& result : m_results)
+        {
+            table << std::left << std::setw(static_cast<int>(nameWidth)) << result.Name << std::right
+                << std::setw(13) << FormatTime(result.NanosecondsPerIteration) << std::setw(14) << result.Iterations;
+            if (result.BytesPerIteration > 0)
+            {
+                table << std::setw(12) << std::fixed << std::setprecision(1) << result.BytesPerSecond() / (1 << 20) << L" MB/s";
+            }
+            table << std::endl;
+        }
+        output << table.str() << std::flush;
+    }
+
+private:
+    static std::wstring FormatTime(double nanoseconds)
+    {
+        wchar_t buffer[32];
+        if (nanoseconds >= 1e9)
+        {
+            swprintf(buffer, std::size(buffer), L"%.2f s", nanoseconds / 1e9);
+        }
+        else if (nanoseconds >= 1e6)
+        {
+            swprintf(buffer, std::size(buffer), L"%.2f ms", nanoseconds / 1e6);
+        }
+        else if (nanoseconds >= 1e3)
+        {
+            swprintf(buffer, std::size(buffer), L"%.2f us", nanoseconds / 1e3);
+        }
+        else
+        {
+            swprintf(buffer, std::size(buffer), L"%.1f ns", nanoseconds);
+        }
+        return buffer;
+    }
+
+    std::chrono::milliseconds m_minimumTime;
+    std::wstring m_filter;
+    std::vector<BenchmarkResult> m_results;
+    volatile uint64_t m_sink = 0;
+};
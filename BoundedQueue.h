@@ -0,0 +1,93 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Multi-producer, multi-consumer FIFO that blocks producers while full, so a slow stage applies backpressure
+// to the stages in front of it.
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : m_capacity(capacity > 0 ? capacity : 1) {}
+
+    BoundedQueue(BoundedQueue const&) = delete;
+    BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool Push(T value)
+    {
+        std::unique_lock lock(m_mutex);
+        m_notFull.wait(lock, [&] { return m_closed || (m_items.size() < m_capacity); });
+        if (m_closed)
+        {
+            return false;
+        }
+
+        m_items.push_back(std::move(value));
+        lock.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns std::nullopt once the queue is closed and drained.
+    std::optional<T> Pop()
+    {
+        std::unique_lock lock(m_mutex);
+        m_notEmpty.wait(lock, [&] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+        {
+            return std::nullopt;
+        }
+
+        return TakeFront(lock);
+    }
+
+    std::optional<T> TryPop()
+    {
+        std::unique_lock lock(m_mutex);
+        if (m_items.empty())
+        {
+            return std::nullopt;
+        }
+
+        return TakeFront(lock);
+    }
+
+    void Close()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_closed = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t Size() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_items.size();
+    }
+
+private:
+    std::optional<T> TakeFront(std::unique_lock<std::mutex>& lock)
+    {
+        std::optional<T> value(std::move(m_items.front()));
+        m_items.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        return value;
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed = false;
+};
@@ -0,0 +1,262 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+class BufferPool;
+
+// A page-aligned byte buffer borrowed from a BufferPool and given back to it when destroyed. Only the parts of
+// std::vector's interface the export pipeline uses are provided; unlike std::vector, resize does not initialize or
+// (when the buffer has to grow) preserve the contents.
+class PooledBuffer
+{
+public:
+    PooledBuffer() = default;
+
+    PooledBuffer(PooledBuffer&& other) noexcept :
+        m_pool(std::exchange(other.m_pool, nullptr)), m_data(std::exchange(other.m_data, nullptr)),
+        m_size(std::exchange(other.m_size, 0)), m_capacity(std::exchange(other.m_capacity, 0))
+    {
+    }
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            m_pool = std::exchange(other.m_pool, nullptr);
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+            m_capacity = std::exchange(other.m_capacity, 0);
+        }
+        return *this;
+    }
+
+    PooledBuffer(PooledBuffer const&) = delete;
+    PooledBuffer& operator=(PooledBuffer const&) = delete;
+
+    ~PooledBuffer()
+    {
+        clear();
+    }
+
+    uint8_t* data() { return m_data; }
+    uint8_t const* data() const { return m_data; }
+    uint8_t* begin() { return m_data; }
+    uint8_t* end() { return m_data + m_size; }
+    uint8_t const* begin() const { return m_data; }
+    uint8_t const* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
+
+    // Borrows a new buffer from the pool the current one came from (the shared pool by default) if 'size' is over
+    // the capacity.
+    void resize(size_t size);
+
+    // Gives the buffer back to its pool.
+    void clear();
+
+private:
+    friend class BufferPool;
+
+    BufferPool* m_pool = nullptr;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
+
+// Recycles page-aligned buffers between snapshots, so that a long export does not allocate and free a
+// container-sized block per file. Buffers come in size classes, four per power of two from 4 KB to 256 MB, which
+// bounds the slack to a quarter of a request. Each class has its own lock, so workers borrowing different sizes do
+// not contend. Larger requests are allocated exactly and freed on return. Idle buffers are kept up to the retain
+// limit; past it, returned buffers are freed.
+class BufferPool
+{
+public:
+    static constexpr size_t c_pageSize = 4096;
+    static constexpr size_t c_largestClassSize = size_t{ 256 } << 20;
+    static constexpr size_t c_defaultRetainLimit = size_t{ 256 } << 20;
+
+    explicit BufferPool(size_t retainLimit = c_defaultRetainLimit) : m_retainLimit(retainLimit) {}
+
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    ~BufferPool()
+    {
+        for (size_t index = 0; index < c_classCount; index++)
+        {
+            for (auto* buffer : m_classes[index].Idle)
+            {
+                Free(buffer);
+            }
+        }
+    }
+
+    // The pool PooledBuffer falls back to, shared by the whole process. Never destroyed, so buffers may outlive
+    // static destruction.
+    static BufferPool& Shared()
+    {
+        static auto* pool = new BufferPool();
+        return *pool;
+    }
+
+    PooledBuffer Acquire(size_t size)
+    {
+        PooledBuffer buffer;
+        buffer.m_pool = this;
+        buffer.m_size = size;
+        if (size == 0)
+        {
+            return buffer;
+        }
+
+        if (size > c_largestClassSize)
+        {
+            buffer.m_capacity = (size + c_pageSize - 1) & ~(c_pageSize - 1);
+            buffer.m_data = Allocate(buffer.m_capacity);
+            return buffer;
+        }
+
+        const auto index = ClassIndex(size);
+        buffer.m_capacity = ClassSize(index);
+        {
+            auto& sizeClass = m_classes[index];
+            std::lock_guard lock(sizeClass.Mutex);
+            if (!sizeClass.Idle.empty())
+            {
+                buffer.m_data = sizeClass.Idle.back();
+                sizeClass.Idle.pop_back();
+                m_retainedBytes.fetch_sub(buffer.m_capacity, std::memory_order_relaxed);
+                m_reused.fetch_add(1, std::memory_order_relaxed);
+                return buffer;
+            }
+        }
+
+        buffer.m_data = Allocate(buffer.m_capacity);
+        return buffer;
+    }
+
+    // Caps the bytes held by idle buffers. Lowering it does not free anything immediately.
+    void SetRetainLimit(size_t bytes)
+    {
+        m_retainLimit.store(bytes, std::memory_order_relaxed);
+    }
+
+    // Buffers handed out from the idle lists rather than newly allocated.
+    uint64_t Reused() const
+    {
+        return m_reused.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Allocated() const
+    {
+        return m_allocated.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class PooledBuffer;
+
+    static constexpr unsigned c_smallestClassShift = 12;  // c_pageSize
+    static constexpr unsigned c_largestClassShift = 28;   // c_largestClassSize
+    static constexpr size_t c_classCount = 1 + 4 * (c_largestClassShift - c_smallestClassShift);
+
+    struct SizeClass
+    {
+        std::mutex Mutex;
+        std::vector<uint8_t*> Idle;
+    };
+
+    // Class 0 is one page; after it, each power of two 2^k < size <= 2^(k+1) is split into four classes of
+    // 2^k * 5/4, 6/4, 7/4 and 8/4.
+    static size_t ClassIndex(size_t size)
+    {
+        if (size <= c_pageSize)
+        {
+            return 0;
+        }
+
+        const auto shift = static_cast<unsigned>(std::bit_width(size - 1)) - 1;
+        const auto base = size_t{ 1 } << shift;
+        const auto quarter = (size - base + (base / 4) - 1) / (base / 4);
+        return 4 * (shift - c_smallestClassShift) + quarter;
+    }
+
+    static size_t ClassSize(size_t index)
+    {
+        if (index == 0)
+        {
+            return c_pageSize;
+        }
+
+        const auto base = size_t{ 1 } << (c_smallestClassShift + (index - 1) / 4);
+        return base + ((index - 1) % 4 + 1) * (base / 4);
+    }
+
+    uint8_t* Allocate(size_t size)
+    {
+        m_allocated.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<uint8_t*>(::operator new(size, std::align_val_t{ c_pageSize }));
+    }
+
+    static void Free(uint8_t* buffer)
+    {
+        ::operator delete(buffer, std::align_val_t{ c_pageSize });
+    }
+
+    void Return(uint8_t* buffer, size_t capacity)
+    {
+        if ((capacity <= c_largestClassSize) &&
+            (m_retainedBytes.fetch_add(capacity, std::memory_order_relaxed) + capacity <= m_retainLimit.load(std::memory_order_relaxed)))
+        {
+            auto& sizeClass = m_classes[ClassIndex(capacity)];
+            std::lock_guard lock(sizeClass.Mutex);
+            sizeClass.Idle.push_back(buffer);
+            return;
+        }
+
+        if (capacity <= c_largestClassSize)
+        {
+            m_retainedBytes.fetch_sub(capacity, std::memory_order_relaxed);
+        }
+        Free(buffer);
+    }
+
+    std::array<SizeClass, c_classCount> m_classes;
+    std::atomic<size_t> m_retainedBytes{ 0 };
+    std::atomic<size_t> m_retainLimit;
+    std::atomic<uint64_t> m_reused{ 0 };
+    std::atomic<uint64_t> m_allocated{ 0 };
+};
+
+inline void PooledBuffer::resize(size_t size)
+{
+    if (size > m_capacity)
+    {
+        auto& pool = m_pool ? *m_pool : BufferPool::Shared();
+        *this = pool.Acquire(size);
+        return;
+    }
+    m_size = size;
+}
+
+inline void PooledBuffer::clear()
+{
+    if (m_data)
+    {
+        m_pool->Return(m_data, m_capacity);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+}
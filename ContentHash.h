@@ -0,0 +1,257 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CONTENTHASH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace details
+{
+    constexpr uint32_t c_xxhPrime32_1 = 0x9E3779B1u;
+    constexpr uint32_t c_xxhPrime32_2 = 0x85EBCA77u;
+    constexpr uint32_t c_xxhPrime32_3 = 0xC2B2AE3Du;
+    constexpr uint64_t c_xxhPrime64_1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t c_xxhPrime64_2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t c_xxhPrime64_3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t c_xxhPrime64_4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t c_xxhPrime64_5 = 0x27D4EB2F165667C5ull;
+    constexpr uint64_t c_xxhPrimeMx1 = 0x165667919E3779F9ull;
+    constexpr uint64_t c_xxhPrimeMx2 = 0x9FB21C651E98DF25ull;
+
+    constexpr size_t c_xxh3StripeSize = 64;
+    constexpr size_t c_xxh3SecretConsumeRate = 8;
+    constexpr size_t c_xxh3SecretSize = 192;
+
+    alignas(64) inline constexpr uint8_t c_xxh3Secret[c_xxh3SecretSize] = {
+        0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+        0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+        0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+        0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+        0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+        0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+        0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+        0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+        0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+        0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+        0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+        0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e };
+
+    // XXH3 reads its input little-endian; the tool only targets little-endian machines.
+    inline uint64_t ReadLittleEndian64(uint8_t const* bytes)
+    {
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t ReadLittleEndian32(uint8_t const* bytes)
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t RotateLeft64(uint64_t value, int shift)
+    {
+        return (value << shift) | (value >> (64 - shift));
+    }
+
+    // Low and high halves of the 128-bit product, folded together.
+    inline uint64_t MultiplyFold64(uint64_t left, uint64_t right)
+    {
+#if defined(__SIZEOF_INT128__)
+        const auto product = static_cast<unsigned __int128>(left) * right;
+        return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+        const uint64_t lowLow = (left & 0xffffffff) * (right & 0xffffffff);
+        const uint64_t highLow = (left >> 32) * (right & 0xffffffff);
+        const uint64_t lowHigh = (left & 0xffffffff) * (right >> 32);
+        const uint64_t highHigh = (left >> 32) * (right >> 32);
+        const uint64_t cross = (lowLow >> 32) + (highLow & 0xffffffff) + lowHigh;
+        const uint64_t high = (highLow >> 32) + (cross >> 32) + highHigh;
+        const uint64_t low = (cross << 32) | (lowLow & 0xffffffff);
+        return low ^ high;
+#endif
+    }
+
+    inline uint64_t Xxh64Avalanche(uint64_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= c_xxhPrime64_2;
+        hash ^= hash >> 29;
+        hash *= c_xxhPrime64_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    inline uint64_t Xxh3Avalanche(uint64_t hash)
+    {
+        hash ^= hash >> 37;
+        hash *= c_xxhPrimeMx1;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    inline uint64_t Xxh3Mix16(uint8_t const* input, uint8_t const* secret)
+    {
+        return MultiplyFold64(ReadLittleEndian64(input) ^ ReadLittleEndian64(secret), ReadLittleEndian64(input + 8) ^ ReadLittleEndian64(secret + 8));
+    }
+
+    // Inputs of up to 240 bytes, which are mixed directly without the stripe accumulators.
+    inline uint64_t Xxh3HashShort(uint8_t const* input, size_t length)
+    {
+        auto const* secret = c_xxh3Secret;
+        if (length == 0)
+        {
+            return Xxh64Avalanche(ReadLittleEndian64(secret + 56) ^ ReadLittleEndian64(secret + 64));
+        }
+        if (length <= 3)
+        {
+            const uint32_t combined = (uint32_t{ input[0] } << 16) | (uint32_t{ input[length >> 1] } << 24) |
+                uint32_t{ input[length - 1] } | (static_cast<uint32_t>(length) << 8);
+            return Xxh64Avalanche(combined ^ (uint64_t{ ReadLittleEndian32(secret) } ^ ReadLittleEndian32(secret + 4)));
+        }
+        if (length <= 8)
+        {
+            const uint64_t value = ReadLittleEndian32(input + length - 4) + (uint64_t{ ReadLittleEndian32(input) } << 32);
+            uint64_t hash = value ^ (ReadLittleEndian64(secret + 8) ^ ReadLittleEndian64(secret + 16));
+            hash ^= RotateLeft64(hash, 49) ^ RotateLeft64(hash, 24);
+            hash *= c_xxhPrimeMx2;
+            hash ^= (hash >> 35) + length;
+            hash *= c_xxhPrimeMx2;
+            return hash ^ (hash >> 28);
+        }
+        if (length <= 16)
+        {
+            const uint64_t low = ReadLittleEndian64(input) ^ (ReadLittleEndian64(secret + 24) ^ ReadLittleEndian64(secret + 32));
+            const uint64_t high = ReadLittleEndian64(input + length - 8) ^ (ReadLittleEndian64(secret + 40) ^ ReadLittleEndian64(secret + 48));
+            uint64_t swapped = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                swapped = (swapped << 8) | ((low >> (8 * i)) & 0xff);
+            }
+            return Xxh3Avalanche(length + swapped + high + MultiplyFold64(low, high));
+        }
+
+        uint64_t hash = length * c_xxhPrime64_1;
+        if (length <= 128)
+        {
+            // Pairs of 16-byte blocks from both ends, working inwards.
+            for (size_t i = 0; i <= (length - 1) / 32; i++)
+            {
+                hash += Xxh3Mix16(input + 16 * i, secret + 32 * i);
+                hash += Xxh3Mix16(input + length - 16 * (i + 1), secret + 32 * i + 16);
+            }
+            return Xxh3Avalanche(hash);
+        }
+
+        for (size_t i = 0; i < 8; i++)
+        {
+            hash += Xxh3Mix16(input + 16 * i, secret + 16 * i);
+        }
+        hash = Xxh3Avalanche(hash);
+        uint64_t tail = Xxh3Mix16(input + length - 16, secret + 136 - 17);
+        for (size_t i = 8; i < length / 16; i++)
+        {
+            tail += Xxh3Mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+        }
+        return Xxh3Avalanche(hash + tail);
+    }
+
+    // One 64-byte stripe into the eight accumulators.
+    inline void Xxh3Accumulate(uint64_t* accumulators, uint8_t const* input, uint8_t const* secret)
+    {
+#if defined(CONTENTHASH_SSE2)
+        auto* lanes = reinterpret_cast<__m128i*>(accumulators);
+        for (size_t i = 0; i < 4; i++)
+        {
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<__m128i const*>(input) + i);
+            const __m128i key = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<__m128i const*>(secret) + i));
+            const __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+            const __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm_add_epi64(product, _mm_add_epi64(lanes[i], swapped));
+        }
+#else
+        for (size_t i = 0; i < 8; i++)
+        {
+            const uint64_t data = ReadLittleEndian64(input + 8 * i);
+            const uint64_t key = data ^ ReadLittleEndian64(secret + 8 * i);
+            accumulators[i ^ 1] += data;
+            accumulators[i] += (key & 0xffffffff) * (key >> 32);
+        }
+#endif
+    }
+
+    inline void Xxh3Scramble(uint64_t* accumulators, uint8_t const* secret)
+    {
+#if defined(CONTENTHASH_SSE2)
+        auto* lanes = reinterpret_cast<__m128i*>(accumulators);
+        const __m128i prime = _mm_set1_epi32(static_cast<int>(c_xxhPrime32_1));
+        for (size_t i = 0; i < 4; i++)
+        {
+            const __m128i value = _mm_xor_si128(_mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(secret) + i));
+            const __m128i productLow = _mm_mul_epu32(value, prime);
+            const __m128i productHigh = _mm_mul_epu32(_mm_shuffle_epi32(value, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+            lanes[i] = _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32));
+        }
+#else
+        for (size_t i = 0; i < 8; i++)
+        {
+            uint64_t value = accumulators[i];
+            value ^= value >> 47;
+            value ^= ReadLittleEndian64(secret + 8 * i);
+            accumulators[i] = value * c_xxhPrime32_1;
+        }
+#endif
+    }
+
+    inline uint64_t Xxh3HashLong(uint8_t const* input, size_t length)
+    {
+        auto const* secret = c_xxh3Secret;
+        alignas(16) uint64_t accumulators[8] = {
+            c_xxhPrime32_3, c_xxhPrime64_1, c_xxhPrime64_2, c_xxhPrime64_3, c_xxhPrime64_4, c_xxhPrime32_2, c_xxhPrime64_5, c_xxhPrime32_1 };
+
+        // Blocks of 16 stripes, each stripe keyed by the secret 8 bytes further on, with a scramble between blocks.
+        constexpr size_t stripesPerBlock = (c_xxh3SecretSize - c_xxh3StripeSize) / c_xxh3SecretConsumeRate;
+        constexpr size_t blockSize = c_xxh3StripeSize * stripesPerBlock;
+        const size_t blockCount = (length - 1) / blockSize;
+        for (size_t block = 0; block < blockCount; block++, input += blockSize)
+        {
+            for (size_t stripe = 0; stripe < stripesPerBlock; stripe++)
+            {
+                Xxh3Accumulate(accumulators, input + stripe * c_xxh3StripeSize, secret + stripe * c_xxh3SecretConsumeRate);
+            }
+            Xxh3Scramble(accumulators, secret + c_xxh3SecretSize - c_xxh3StripeSize);
+        }
+
+        const size_t remaining = length - blockCount * blockSize;
+        const size_t stripeCount = (remaining - 1) / c_xxh3StripeSize;
+        for (size_t stripe = 0; stripe < stripeCount; stripe++)
+        {
+            Xxh3Accumulate(accumulators, input + stripe * c_xxh3StripeSize, secret + stripe * c_xxh3SecretConsumeRate);
+        }
+        Xxh3Accumulate(accumulators, input + remaining - c_xxh3StripeSize, secret + c_xxh3SecretSize - c_xxh3StripeSize - 7);
+
+        uint64_t hash = length * c_xxhPrime64_1;
+        for (size_t i = 0; i < 4; i++)
+        {
+            hash += MultiplyFold64(accumulators[2 * i] ^ ReadLittleEndian64(secret + 11 + 16 * i), accumulators[2 * i + 1] ^ ReadLittleEndian64(secret + 11 + 16 * i + 8));
+        }
+        return Xxh3Avalanche(hash);
+    }
+}
+
+// XXH3-64 with the default secret and seed 0, matching XXH3_64bits from the reference xxHash library. Not
+// cryptographic: callers that act on a match must compare the bytes.
+inline uint64_t Xxh3Hash64(std::span<uint8_t const> data)
+{
+    return (data.size() <= 240) ? details::Xxh3HashShort(data.data(), data.size()) : details::Xxh3HashLong(data.data(), data.size());
+}
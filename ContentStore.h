@@ -0,0 +1,181 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "BufferPool.h"
+#include "FileIo.h"
+
+// Where ContentStore put a snapshot's image.
+struct StoredContent
+{
+    // Relative to the output folder, e.g. "objects/3f/3fa1c0d29e4b7a65.jpg".
+    std::filesystem::path RelativePath;
+
+    // The same bytes were already stored, by an earlier snapshot or an earlier run, so nothing was written.
+    bool Duplicate = false;
+};
+
+// Content-addressed storage for decrypted images under <output>/objects, so that byte-identical screenshots (an idle
+// desktop captured over and over) are written once. Objects are named by their XXH3 hash; since that hash is not
+// cryptographic, a snapshot only counts as a duplicate after its bytes have been compared with the stored object,
+// and different content with the same hash gets a numbered object of its own. Objects left by an earlier run into
+// the same folder are picked up the same way. Thread-safe.
+class ContentStore
+{
+public:
+    static constexpr wchar_t c_folderName[] = L"objects";
+
+    explicit ContentStore(std::filesystem::path outputFolder) : m_outputFolder(std::move(outputFolder)) {}
+
+    ContentStore(ContentStore const&) = delete;
+    ContentStore& operator=(ContentStore const&) = delete;
+
+    // Writes 'content' as a new object unless an identical one is already stored. 'hash' is Xxh3Hash64(content).
+    // Throws std::system_error if the object cannot be read or written.
+    StoredContent Store(std::span<uint8_t const> content, uint64_t hash)
+    {
+        std::lock_guard lock(m_mutex);
+        auto& candidates = m_objects[hash];
+        for (auto const& candidate : candidates)
+        {
+            if (Matches(m_outputFolder / candidate, content))
+            {
+                return Stored({ candidate, true }, content.size());
+            }
+        }
+
+        for (auto index = candidates.size();; index++)
+        {
+            auto relativePath = ObjectPath(hash, index);
+            const auto path = m_outputFolder / relativePath;
+            std::error_code error;
+            if (!std::filesystem::exists(path, error))
+            {
+                std::filesystem::create_directories(path.parent_path());
+                if ((error = details::WriteWholeFile(path, content)))
+                {
+                    std::filesystem::remove(path, error);
+                    throw std::system_error(error, "Writing the content object has failed.");
+                }
+                candidates.push_back(relativePath);
+                return Stored({ std::move(relativePath), false }, content.size());
+            }
+
+            candidates.push_back(relativePath);
+            if (Matches(path, content))
+            {
+                return Stored({ std::move(relativePath), true }, content.size());
+            }
+        }
+    }
+
+    // Makes 'outputPath' a hard link to the stored object. Where the file system has no hard links, or the object has
+    // run out of them, 'content' is written to 'outputPath' in full instead. Returns whether it was linked.
+    bool Link(StoredContent const& stored, std::filesystem::path const& outputPath, std::span<uint8_t const> content)
+    {
+        std::error_code error;
+        std::filesystem::remove(outputPath, error);
+        std::filesystem::create_hard_link(m_outputFolder / stored.RelativePath, outputPath, error);
+        if (!error)
+        {
+            return true;
+        }
+
+        if ((error = details::WriteWholeFile(outputPath, content)))
+        {
+            throw std::system_error(error, "Writing the screenshot has failed.");
+        }
+        m_copies.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t UniqueObjects() const
+    {
+        return m_unique.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Duplicates() const
+    {
+        return m_duplicates.load(std::memory_order_relaxed);
+    }
+
+    // Image bytes that did not have to be written because they were already stored.
+    uint64_t BytesSaved() const
+    {
+        return m_bytesSaved.load(std::memory_order_relaxed);
+    }
+
+    // Outputs that had to be written in full because they could not be linked.
+    uint64_t Copies() const
+    {
+        return m_copies.load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::filesystem::path ObjectPath(uint64_t hash, size_t index)
+    {
+        wchar_t name[32];
+        static constexpr wchar_t c_digits[] = L"0123456789abcdef";
+        for (int i = 0; i < 16; i++)
+        {
+            name[i] = c_digits[(hash >> (60 - 4 * i)) & 0xf];
+        }
+        name[16] = L'\0';
+
+        std::wstring fileName(name);
+        if (index > 0)
+        {
+            fileName += L"-" + std::to_wstring(index);
+        }
+        return std::filesystem::path(c_folderName) / std::wstring(name, 2) / (fileName + L".jpg");
+    }
+
+    static bool Matches(std::filesystem::path const& path, std::span<uint8_t const> content)
+    {
+        std::error_code error;
+        if ((std::filesystem::file_size(path, error) != content.size()) || error)
+        {
+            return false;
+        }
+
+        PooledBuffer stored;
+        if ((error = details::ReadWholeFile(path, stored)))
+        {
+            throw std::system_error(error, "Reading the content object has failed.");
+        }
+        return (stored.size() == content.size()) && (memcmp(stored.data(), content.data(), content.size()) == 0);
+    }
+
+    StoredContent Stored(StoredContent stored, uint64_t size)
+    {
+        if (stored.Duplicate)
+        {
+            m_duplicates.fetch_add(1, std::memory_order_relaxed);
+            m_bytesSaved.fetch_add(size, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_unique.fetch_add(1, std::memory_order_relaxed);
+        }
+        return stored;
+    }
+
+    std::filesystem::path m_outputFolder;
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, std::vector<std::filesystem::path>> m_objects;
+    std::atomic<uint64_t> m_unique{ 0 };
+    std::atomic<uint64_t> m_duplicates{ 0 };
+    std::atomic<uint64_t> m_bytesSaved{ 0 };
+    std::atomic<uint64_t> m_copies{ 0 };
+};
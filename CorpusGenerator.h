@@ -0,0 +1,383 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "AesGcm.h"
+#include "ExifReader.h"
+#include "ExportOptions.h"
+#include "SnapshotCrypto.h"
+
+#if defined(_WIN32)
+#include "JsonHelper.h"
+#endif
+
+// Shape of a synthetic snapshot corpus. Image sizes are spread log-uniformly between the bounds; the metadata has
+// MetadataProperties entries per set, nested MetadataDepth levels deep, with arrays of MetadataArrayLength
+// elements. The same options and seed always produce the same files.
+struct CorpusOptions
+{
+    unsigned FileCount = 100;
+    size_t MinImageSize = 256 * 1024;
+    size_t MaxImageSize = 2 * 1024 * 1024;
+    unsigned MetadataProperties = 12;
+    unsigned MetadataDepth = 1;
+    unsigned MetadataArrayLength = 16;
+    uint64_t Seed = 1;
+};
+
+namespace details
+{
+    // An APP1 segment holds at most 65533 bytes, of which the Exif identifier and TIFF structures take 56.
+    constexpr size_t c_maximumSyntheticMetadataSize = 65533 - 6 - 50;
+
+    inline void FillRandom(std::mt19937_64& random, std::span<uint8_t> bytes)
+    {
+        size_t i = 0;
+        for (; i + 8 <= bytes.size(); i += 8)
+        {
+            const uint64_t value = random();
+            memcpy(bytes.data() + i, &value, 8);
+        }
+        const uint64_t value = random();
+        memcpy(bytes.data() + i, &value, bytes.size() - i);
+    }
+
+    inline void AppendBigEndian16(std::vector<uint8_t>& output, size_t value)
+    {
+        output.push_back(static_cast<uint8_t>(value >> 8));
+        output.push_back(static_cast<uint8_t>(value));
+    }
+
+#if defined(_WIN32)
+    inline std::wstring RandomWords(std::mt19937_64& random, size_t count)
+    {
+        static constexpr wchar_t const* c_words[] = {
+            L"report", L"quarterly", L"draft", L"meeting", L"notes", L"photo", L"budget", L"Recall", L"search",
+            L"review", L"design", L"tab", L"inbox", L"chart", L"plan", L"été", L"日本", L"\"quoted\"",
+        };
+
+        std::wstring text;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i > 0)
+            {
+                text.push_back(L' ');
+            }
+            text.append(c_words[random() % std::size(c_words)]);
+        }
+        return text;
+    }
+
+    inline void FillSyntheticMetadataSet(winrt::ValueSet const& valueSet, CorpusOptions const& options, unsigned depth, std::mt19937_64& random)
+    {
+        static constexpr wchar_t const* c_appNames[] = { L"msedge.exe", L"WINWORD.EXE", L"explorer.exe", L"Teams.exe", L"notepad.exe" };
+
+        std::vector<double> doubles(options.MetadataArrayLength);
+        std::vector<uint32_t> integers(options.MetadataArrayLength);
+        std::vector<winrt::hstring> words(options.MetadataArrayLength);
+        for (unsigned i = 0; i < options.MetadataArrayLength; i++)
+        {
+            doubles[i] = std::ldexp(static_cast<double>(random() >> 11), -53) * 1000.0;
+            integers[i] = static_cast<uint32_t>(random());
+            words[i] = winrt::hstring(RandomWords(random, 1));
+        }
+
+        static constexpr wchar_t const* c_keys[] = {
+            L"AppName", L"WindowTitle", L"TimeStamp", L"ScreenRect", L"ActivityId", L"ProcessId",
+            L"Scale", L"IsForeground", L"SessionId", L"Weights", L"Histogram", L"Keywords",
+        };
+
+        for (unsigned i = 0; i < options.MetadataProperties; i++)
+        {
+            // Keys repeat with a numeric suffix once the names run out: AppName, ..., Keywords, AppName1, ...
+            std::wstring key = c_keys[i % std::size(c_keys)];
+            if (i >= std::size(c_keys))
+            {
+                key += std::to_wstring(i / std::size(c_keys));
+            }
+
+            winrt::IInspectable value;
+            switch (i % std::size(c_keys))
+            {
+            case 0: value = winrt::PropertyValue::CreateString(c_appNames[random() % std::size(c_appNames)]); break;
+            case 1: value = winrt::PropertyValue::CreateString(RandomWords(random, 3 + random() % 8)); break;
+            case 2:
+                // DateTime ticks somewhere in 2024.
+                value = winrt::PropertyValue::CreateDateTime(
+                    winrt::DateTime(winrt::TimeSpan(int64_t{ 133485408000000000 } + static_cast<int64_t>(random() % 315360000000000))));
+                break;
+            case 3:
+                value = winrt::PropertyValue::CreateRect({ static_cast<float>(random() % 1920), static_cast<float>(random() % 1080), 1280.0f, 720.0f });
+                break;
+            case 4:
+            {
+                winrt::guid guid{};
+                FillRandom(random, { reinterpret_cast<uint8_t*>(&guid), sizeof(guid) });
+                value = winrt::PropertyValue::CreateGuid(guid);
+                break;
+            }
+            case 5: value = winrt::PropertyValue::CreateUInt32(static_cast<uint32_t>(random() % 65536)); break;
+            case 6: value = winrt::PropertyValue::CreateDouble(1.0 + static_cast<double>(random() % 4) / 4); break;
+            case 7: value = winrt::PropertyValue::CreateBoolean((random() & 1) != 0); break;
+            case 8: value = winrt::PropertyValue::CreateInt64(static_cast<int64_t>(random())); break;
+            case 9: value = winrt::PropertyValue::CreateDoubleArray(doubles); break;
+            case 10: value = winrt::PropertyValue::CreateUInt32Array(integers); break;
+            default: value = winrt::PropertyValue::CreateStringArray(words); break;
+            }
+            valueSet.Insert(key, value);
+        }
+
+        if (depth < options.MetadataDepth)
+        {
+            winrt::ValueSet nested;
+            FillSyntheticMetadataSet(nested, options, depth + 1, random);
+            valueSet.Insert(L"Details", nested);
+        }
+    }
+#endif
+}
+
+// A PropertySet shaped like the metadata Recall attaches to a snapshot, serialized by the WinRT IPropertySetSerializer
+// as Recall's own are, so that it takes the export's default metadata path. No other platform has that serializer, so
+// elsewhere it is empty and the synthetic images carry no metadata.
+inline std::vector<uint8_t> BuildSyntheticMetadata([[maybe_unused]] CorpusOptions const& options, [[maybe_unused]] std::mt19937_64& random)
+{
+#if defined(_WIN32)
+    winrt::ValueSet valueSet;
+    details::FillSyntheticMetadataSet(valueSet, options, 0, random);
+    auto metadata = SerializePropertySet(valueSet);
+    if (metadata.size() > details::c_maximumSyntheticMetadataSize)
+    {
+        throw std::invalid_argument("The synthetic metadata does not fit in an Exif segment; use fewer or shorter properties.");
+    }
+    return metadata;
+#else
+    return {};
+#endif
+}
+
+// A structurally valid baseline JPEG of about 'targetSize' bytes: Exif APP1 carrying 'metadata' as the MakerNote,
+// random-filled COM segments standing in for the compressed image, and one 8x8 grey block as the scan.
+inline std::vector<uint8_t> BuildSyntheticJpeg(std::span<uint8_t const> metadata, size_t targetSize, std::mt19937_64& random)
+{
+    if (metadata.size() > details::c_maximumSyntheticMetadataSize)
+    {
+        throw std::invalid_argument("The synthetic metadata does not fit in an Exif segment.");
+    }
+
+    // Little-endian TIFF: IFD0 holds only the Exif IFD pointer, and the Exif IFD only the MakerNote.
+    std::vector<uint8_t> tiff = { 'I', 'I', 42, 0, 8, 0, 0, 0 };
+    auto append16 = [&](uint32_t value) { tiff.push_back(static_cast<uint8_t>(value)); tiff.push_back(static_cast<uint8_t>(value >> 8)); };
+    auto append32 = [&](uint32_t value) { append16(value & 0xFFFF); append16(value >> 16); };
+    constexpr uint32_t exifIfdOffset = 8 + 2 + 12 + 4;
+    constexpr uint32_t makerNoteOffset = exifIfdOffset + 2 + 12 + 4;
+    append16(1);
+    append16(details::c_tiffExifIfdPointerTag);
+    append16(4);  // LONG
+    append32(1);
+    append32(exifIfdOffset);
+    append32(0);
+    append16(1);
+    append16(c_exifMakerNoteTag);
+    append16(7);  // UNDEFINED
+    append32(static_cast<uint32_t>(metadata.size()));
+    append32(makerNoteOffset);
+    append32(0);
+    tiff.insert(tiff.end(), metadata.begin(), metadata.end());
+
+    std::vector<uint8_t> jpeg = { 0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    jpeg.reserve(targetSize + 1024);
+    jpeg.insert(jpeg.end(), { 0xFF, 0xE1 });
+    details::AppendBigEndian16(jpeg, 2 + 6 + tiff.size());
+    jpeg.insert(jpeg.end(), { 'E', 'x', 'i', 'f', 0, 0 });
+    jpeg.insert(jpeg.end(), tiff.begin(), tiff.end());
+
+    // One 8x8 greyscale block: an all-ones quantization table, and Huffman tables with a single one-bit code each,
+    // so the whole scan is "DC difference 0, end of block" padded to a byte.
+    std::vector<uint8_t> frame = { 0xFF, 0xDB, 0, 67, 0 };
+    frame.insert(frame.end(), 64, 1);
+    frame.insert(frame.end(), { 0xFF, 0xC0, 0, 11, 8, 0, 8, 0, 8, 1, 1, 0x11, 0 });
+    for (const uint8_t tableClass : { 0x00, 0x10 })
+    {
+        frame.insert(frame.end(), { 0xFF, 0xC4, 0, 20, tableClass, 1 });
+        frame.insert(frame.end(), 16, 0);
+    }
+    frame.insert(frame.end(), { 0xFF, 0xDA, 0, 8, 1, 1, 0x00, 0, 63, 0, 0x3F, 0xFF, 0xD9 });
+
+    constexpr size_t c_maximumSegmentPayload = 65533;
+    const size_t fixedSize = jpeg.size() + frame.size();
+    size_t filler = (targetSize > fixedSize) ? targetSize - fixedSize : 0;
+    while (filler > 4)
+    {
+        const auto payload = (std::min)(filler - 4, c_maximumSegmentPayload);
+        jpeg.insert(jpeg.end(), { 0xFF, 0xFE });
+        details::AppendBigEndian16(jpeg, payload + 2);
+        const auto start = jpeg.size();
+        jpeg.resize(start + payload);
+        details::FillRandom(random, { jpeg.data() + start, payload });
+        filler -= payload + 4;
+    }
+
+    jpeg.insert(jpeg.end(), frame.begin(), frame.end());
+    return jpeg;
+}
+
+// Builds a v2 container the way Recall does: a random content key wrapped under the export key with a random nonce,
+// and the content sealed under the content key with a zero nonce.
+inline std::vector<uint8_t> SealSnapshotContainer(std::span<uint8_t const> exportKey, std::span<uint8_t const> plaintext, std::mt19937_64& random)
+{
+    if (plaintext.size() > UINT32_MAX - c_tagSizeInBytes)
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Invalid payload size.");
+    }
+
+    std::array<uint8_t, c_childKeySizeInBytes> contentKey{};
+    std::array<uint8_t, c_nonceSizeInBytes> keyNonce{};
+    details::FillRandom(random, contentKey);
+    details::FillRandom(random, keyNonce);
+
+    const EncryptedSnapshotHeader header{
+        c_snapshotContainerVersion, c_totalSizeInBytes, static_cast<uint32_t>(plaintext.size() + c_tagSizeInBytes), 0 };
+    std::vector<uint8_t> container(sizeof(EncryptedSnapshotHeader) + header.KeySize + header.ContentSize);
+    for (size_t i = 0; i < 4; i++)
+    {
+        container[i] = static_cast<uint8_t>(header.Version >> (8 * i));
+        container[4 + i] = static_cast<uint8_t>(header.KeySize >> (8 * i));
+        container[8 + i] = static_cast<uint8_t>(header.ContentSize >> (8 * i));
+        container[12 + i] = static_cast<uint8_t>(header.ContentType >> (8 * i));
+    }
+
+    const auto wrappedKey = std::span(container).subspan(sizeof(EncryptedSnapshotHeader), c_totalSizeInBytes);
+    std::copy(keyNonce.begin(), keyNonce.end(), wrappedKey.begin());
+    AesGcm(exportKey).Encrypt(
+        keyNonce, contentKey, wrappedKey.subspan(c_nonceSizeInBytes, c_childKeySizeInBytes), wrappedKey.subspan(c_nonceSizeInBytes + c_childKeySizeInBytes));
+
+    const auto payload = std::span(container).subspan(sizeof(EncryptedSnapshotHeader) + c_totalSizeInBytes);
+    const uint8_t zeroNonce[c_nonceSizeInBytes] = {};
+    AesGcm(contentKey).Encrypt(zeroNonce, plaintext, payload.first(plaintext.size()), payload.subspan(plaintext.size()));
+    details::SecureZeroBytes(contentKey.data(), contentKey.size());
+    return container;
+}
+
+// Writes options.FileCount containers decryptable with 'exportCodeBytes' into 'folder' and returns their total size.
+inline uint64_t GenerateSnapshotCorpus(std::filesystem::path const& folder, std::span<uint8_t const> exportCodeBytes, CorpusOptions const& options)
+{
+    if ((options.MinImageSize == 0) || (options.MinImageSize > options.MaxImageSize))
+    {
+        throw std::invalid_argument("Invalid image size range.");
+    }
+
+    std::filesystem::create_directories(folder);
+    auto exportKey = DeriveExportKey(exportCodeBytes);
+    std::mt19937_64 random(options.Seed);
+    std::uniform_real_distribution<double> logSize(std::log(static_cast<double>(options.MinImageSize)), std::log(static_cast<double>(options.MaxImageSize)));
+
+    uint64_t totalSize = 0;
+    for (unsigned i = 0; i < options.FileCount; i++)
+    {
+        const auto metadata = BuildSyntheticMetadata(options, random);
+        const auto imageSize = static_cast<size_t>(std::exp(logSize(random)));
+        const auto container = SealSnapshotContainer(exportKey, BuildSyntheticJpeg(metadata, imageSize, random), random);
+
+        const auto name = std::to_wstring(i);
+        std::ofstream output(folder / (std::wstring(8 - (std::min)(name.size(), size_t{ 8 }), L'0') + name), std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(container.data()), static_cast<std::streamsize>(container.size()));
+        if (!output)
+        {
+            details::SecureZeroBytes(exportKey.data(), exportKey.size());
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to write a corpus file.");
+        }
+        totalSize += container.size();
+    }
+
+    details::SecureZeroBytes(exportKey.data(), exportKey.size());
+    return totalSize;
+}
+
+namespace details
+{
+    inline bool TryParseCorpusNumber(std::wstring const& text, uint64_t maximum, uint64_t& value)
+    {
+        try
+        {
+            size_t parsed = 0;
+            value = std::stoull(text, &parsed);
+            return (parsed == text.size()) && (value <= maximum);
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+}
+
+// Parses the corpus options in 'arguments' and collects everything that is not an option into 'positional'.
+inline bool TryParseCorpusOptions(std::span<wchar_t* const> arguments, CorpusOptions& options, std::vector<std::wstring>& positional)
+{
+    for (size_t i = 0; i < arguments.size(); i++)
+    {
+        const std::wstring argument = arguments[i];
+        const std::wstring value = (argument.starts_with(L"--") && (i + 1 < arguments.size())) ? arguments[i + 1] : L"";
+        uint64_t number = 0;
+        if (argument == L"--count")
+        {
+            if (!details::TryParseCorpusNumber(value, 1000000, number) || (number == 0))
+            {
+                return false;
+            }
+            options.FileCount = static_cast<unsigned>(number);
+            i++;
+        }
+        else if ((argument == L"--min-size") || (argument == L"--max-size"))
+        {
+            if (!TryParseByteSize(value, (argument == L"--min-size") ? options.MinImageSize : options.MaxImageSize))
+            {
+                return false;
+            }
+            i++;
+        }
+        else if ((argument == L"--properties") || (argument == L"--depth") || (argument == L"--array-length"))
+        {
+            const uint64_t maximum = (argument == L"--depth") ? 16 : 4096;
+            if (!details::TryParseCorpusNumber(value, maximum, number))
+            {
+                return false;
+            }
+            auto& field = (argument == L"--properties") ? options.MetadataProperties :
+                (argument == L"--depth") ? options.MetadataDepth : options.MetadataArrayLength;
+            field = static_cast<unsigned>(number);
+            i++;
+        }
+        else if (argument == L"--seed")
+        {
+            if (!details::TryParseCorpusNumber(value, UINT64_MAX, options.Seed))
+            {
+                return false;
+            }
+            i++;
+        }
+        else if (argument.starts_with(L"--"))
+        {
+            return false;
+        }
+        else
+        {
+            positional.push_back(argument);
+        }
+    }
+
+    return options.MinImageSize <= options.MaxImageSize;
+}
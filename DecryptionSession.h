@@ -0,0 +1,193 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SnapshotCrypto.h"
+
+inline std::vector<uint8_t> HexStringToBytes(const std::wstring& hexString)
+{
+    std::vector<uint8_t> bytes;
+    if (hexString.length() % 2 != 0)
+    {
+        throw std::invalid_argument("Hex string must have an even length");
+    }
+
+    for (size_t i = 0; i < hexString.length(); i += 2)
+    {
+        std::wstring byteString = hexString.substr(i, 2);
+        uint8_t byte = static_cast<uint8_t>(std::stoi(byteString, nullptr, 16));
+        bytes.push_back(byte);
+    }
+
+    return bytes;
+}
+
+// Holds the export key for one export code, derived once, and decrypts any number of snapshot containers with
+// it. Decrypt may be called concurrently from any number of threads: the per-snapshot header, wrapped key and
+// content key schedule live on the calling thread's stack, so the native backend performs no heap allocation
+// per snapshot.
+class DecryptionSession
+{
+public:
+    explicit DecryptionSession(std::span<uint8_t const> exportCodeBytes, CryptoBackend backend = DefaultCryptoBackend()) :
+        m_backend(backend)
+    {
+        auto exportKeyBytes = DeriveExportKey(exportCodeBytes);
+        m_exportKey = CreateSnapshotCipher(exportKeyBytes, backend);
+        details::SecureZeroBytes(exportKeyBytes.data(), exportKeyBytes.size());
+    }
+
+    explicit DecryptionSession(std::wstring const& exportCode, CryptoBackend backend = DefaultCryptoBackend()) :
+        DecryptionSession(HexStringToBytes(exportCode), backend)
+    {
+    }
+
+    DecryptionSession(DecryptionSession const&) = delete;
+    DecryptionSession& operator=(DecryptionSession const&) = delete;
+
+    CryptoBackend Backend() const
+    {
+        return m_backend;
+    }
+
+    // Number of plaintext bytes 'container' decrypts to. Throws if the header is malformed or truncated.
+    static size_t GetDecryptedSize(std::span<uint8_t const> container)
+    {
+        const auto parsed = ParseSnapshotContainer(container);
+        if (parsed.Payload.size() < c_tagSizeInBytes)
+        {
+            throw SnapshotException(c_hrInvalidArgument, "Invalid payload size.");
+        }
+        return parsed.Payload.size() - c_tagSizeInBytes;
+    }
+
+    // Authenticates and decrypts a whole v2 container into 'output' and returns the plaintext size. 'output' must
+    // hold at least GetDecryptedSize(container) bytes and may alias the container's payload.
+    size_t Decrypt(std::span<uint8_t const> container, std::span<uint8_t> output) const
+    {
+        const auto parsed = ParseSnapshotContainer(container);
+
+        std::array<uint8_t, c_childKeySizeInBytes> contentKey{};
+        try
+        {
+            UnwrapContentKey(parsed.WrappedKey, contentKey);
+            const auto size = DecryptWithContentKey(contentKey, parsed.Payload, output);
+            details::SecureZeroBytes(contentKey.data(), contentKey.size());
+            return size;
+        }
+        catch (...)
+        {
+            details::SecureZeroBytes(contentKey.data(), contentKey.size());
+            throw;
+        }
+    }
+
+    std::vector<uint8_t> Decrypt(std::span<uint8_t const> container) const
+    {
+        std::vector<uint8_t> plaintext(GetDecryptedSize(container));
+        plaintext.resize(Decrypt(container, plaintext));
+        return plaintext;
+    }
+
+    // Authenticates a whole v2 container without decrypting its content. Throws SnapshotException with
+    // c_hrAuthTagMismatch if the wrapped key or the content does not authenticate. Always uses the native AES-GCM
+    // implementation for the content, since CNG has no authenticate-only mode.
+    void Verify(std::span<uint8_t const> container) const
+    {
+        const auto parsed = ParseSnapshotContainer(container);
+        std::optional<AesGcm> aesGcm;
+        VerifyContent(parsed, aesGcm);
+    }
+
+    // Authenticates a whole v2 container like Verify, but decrypts only the first output.size() bytes of its
+    // content, for readers that need no more than the start of an image (where its Exif metadata is). Returns the
+    // number of bytes decrypted. When 'output' holds the whole content, this is Decrypt, which needs one pass rather
+    // than two.
+    size_t DecryptPrefix(std::span<uint8_t const> container, std::span<uint8_t> output) const
+    {
+        const auto parsed = ParseSnapshotContainer(container);
+        if ((parsed.Payload.size() >= c_tagSizeInBytes) && (output.size() >= parsed.Payload.size() - c_tagSizeInBytes))
+        {
+            return Decrypt(container, output);
+        }
+
+        std::optional<AesGcm> aesGcm;
+        VerifyContent(parsed, aesGcm);
+
+        const auto size = (std::min)(output.size(), parsed.Payload.size() - c_tagSizeInBytes);
+        const uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
+        AesGcmDecryptor decryptor(*aesGcm, zeroNonce);
+        decryptor.Update(parsed.Payload.first(size), output.first(size));
+        return size;
+    }
+
+    // Unwraps a container's content key with the export key, for callers that decrypt the payload themselves.
+    void UnwrapContentKey(std::span<uint8_t const> wrappedKey, std::span<uint8_t, c_childKeySizeInBytes> contentKey) const
+    {
+        ::UnwrapContentKey(*m_exportKey, wrappedKey, contentKey);
+    }
+
+    // Decrypts the payload over itself and returns the plaintext, which is a view into 'container'.
+    std::span<uint8_t> DecryptInPlace(std::span<uint8_t> container) const
+    {
+        const auto parsed = ParseSnapshotContainer(container);
+        const auto output = container.subspan(static_cast<size_t>(parsed.Payload.data() - container.data()));
+        return output.first(Decrypt(container, output));
+    }
+
+private:
+    // Unwraps the content key into 'aesGcm' and checks the content's tag with it.
+    void VerifyContent(SnapshotContainer const& parsed, std::optional<AesGcm>& aesGcm) const
+    {
+        if (parsed.Payload.size() < c_tagSizeInBytes)
+        {
+            throw SnapshotException(c_hrInvalidArgument, "Invalid payload size.");
+        }
+
+        std::array<uint8_t, c_childKeySizeInBytes> contentKey{};
+        try
+        {
+            UnwrapContentKey(parsed.WrappedKey, contentKey);
+            aesGcm.emplace(contentKey);
+        }
+        catch (...)
+        {
+            details::SecureZeroBytes(contentKey.data(), contentKey.size());
+            throw;
+        }
+        details::SecureZeroBytes(contentKey.data(), contentKey.size());
+
+        const auto dataSize = parsed.Payload.size() - c_tagSizeInBytes;
+        const uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
+        if (!aesGcm->Verify(zeroNonce, parsed.Payload.first(dataSize), parsed.Payload.subspan(dataSize)))
+        {
+            throw SnapshotException(c_hrAuthTagMismatch, "The authentication tag does not match.");
+        }
+    }
+
+    size_t DecryptWithContentKey(std::span<uint8_t const> contentKey, std::span<uint8_t const> payload, std::span<uint8_t> output) const
+    {
+#if defined(_WIN32)
+        if (m_backend == CryptoBackend::BCrypt)
+        {
+            const BCryptSnapshotCipher key(contentKey);
+            return DecryptPackedData(key, payload, output);
+        }
+#endif
+
+        const NativeSnapshotCipher key(contentKey);
+        return DecryptPackedData(key, payload, output);
+    }
+
+    CryptoBackend m_backend;
+    std::unique_ptr<SnapshotCipher> m_exportKey;
+};
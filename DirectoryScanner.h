@@ -0,0 +1,205 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct ScanOptions
+{
+    // Descend into subfolders; files are then named by their path relative to the root.
+    bool Recursive = false;
+
+    // Only files whose name matches this pattern, where '*' matches any run of characters and '?' any single one.
+    // Empty matches everything.
+    std::filesystem::path::string_type Pattern;
+};
+
+// A file found by ScanDirectory. Nothing about it has been stat'ed: its size and times are read by whichever stage
+// opens it first.
+struct ScannedFile
+{
+    std::filesystem::path Path;
+    std::filesystem::path RelativePath;
+};
+
+// Case-sensitive glob match of a file name against '*' and '?' wildcards.
+template <typename Char>
+bool MatchesNamePattern(std::basic_string_view<Char> name, std::basic_string_view<Char> pattern)
+{
+    // Greedy matching with backtracking to the most recent '*', which is linear for patterns with a single '*'.
+    size_t n = 0;
+    size_t p = 0;
+    size_t starPattern = std::basic_string_view<Char>::npos;
+    size_t starName = 0;
+    while (n < name.size())
+    {
+        if ((p < pattern.size()) && ((pattern[p] == Char('?')) || (pattern[p] == name[n])))
+        {
+            n++;
+            p++;
+        }
+        else if ((p < pattern.size()) && (pattern[p] == Char('*')))
+        {
+            starPattern = p++;
+            starName = n;
+        }
+        else if (starPattern != std::basic_string_view<Char>::npos)
+        {
+            p = starPattern + 1;
+            n = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while ((p < pattern.size()) && (pattern[p] == Char('*')))
+    {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+namespace details
+{
+    inline bool IsScanMatch(std::filesystem::path::string_type const& name, ScanOptions const& options)
+    {
+        using View = std::basic_string_view<std::filesystem::path::value_type>;
+        return options.Pattern.empty() || MatchesNamePattern(View(name), View(options.Pattern));
+    }
+
+#if defined(__linux__)
+    // Lists one directory with getdents64, 64 KB of entries per call, without stat'ing anything whose type the file
+    // system reports in the entry itself.
+    template <typename OnFile>
+    void ScanLinuxDirectory(std::filesystem::path const& path, std::filesystem::path const& relativePath, ScanOptions const& options,
+        std::vector<std::pair<std::filesystem::path, std::filesystem::path>>& subfolders, OnFile& onFile)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "open directory");
+        }
+
+        alignas(8) char buffer[64 * 1024];
+        try
+        {
+            for (;;)
+            {
+                const auto length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+                if (length < 0)
+                {
+                    throw std::system_error(errno, std::system_category(), "getdents64");
+                }
+                if (length == 0)
+                {
+                    break;
+                }
+
+                // struct linux_dirent64 { ino64_t d_ino; off64_t d_off; unsigned short d_reclen; unsigned char d_type; char d_name[]; }
+                for (long offset = 0; offset < length;)
+                {
+                    uint16_t recordLength = 0;
+                    memcpy(&recordLength, buffer + offset + 16, sizeof(recordLength));
+                    auto type = static_cast<unsigned char>(buffer[offset + 18]);
+                    const std::string name(buffer + offset + 19);
+                    offset += recordLength;
+
+                    if ((name == ".") || (name == ".."))
+                    {
+                        continue;
+                    }
+
+                    // Some file systems do not report types. Links count as what they point to, except that links to
+                    // folders are not followed.
+                    if ((type == DT_UNKNOWN) || (type == DT_LNK))
+                    {
+                        struct stat status{};
+                        if (fstatat(fd, name.c_str(), &status, 0) != 0)
+                        {
+                            continue;
+                        }
+                        type = (S_ISDIR(status.st_mode) && (type == DT_UNKNOWN)) ? DT_DIR : (S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN);
+                    }
+
+                    if (type == DT_DIR)
+                    {
+                        if (options.Recursive)
+                        {
+                            subfolders.emplace_back(path / name, relativePath / name);
+                        }
+                    }
+                    else if ((type == DT_REG) && IsScanMatch(name, options))
+                    {
+                        onFile(ScannedFile{ path / name, relativePath / name });
+                    }
+                }
+            }
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+#else
+    template <typename OnFile>
+    void ScanPortableDirectory(std::filesystem::path const& path, std::filesystem::path const& relativePath, ScanOptions const& options,
+        std::vector<std::pair<std::filesystem::path, std::filesystem::path>>& subfolders, OnFile& onFile)
+    {
+        // On Windows the entry's type comes from the directory listing itself, so this does not stat either.
+        for (auto const& entry : std::filesystem::directory_iterator(path))
+        {
+            const auto name = entry.path().filename();
+            if (entry.is_directory() && !entry.is_symlink())
+            {
+                if (options.Recursive)
+                {
+                    subfolders.emplace_back(entry.path(), relativePath / name);
+                }
+            }
+            else if (entry.is_regular_file() && IsScanMatch(name.native(), options))
+            {
+                onFile(ScannedFile{ entry.path(), relativePath / name });
+            }
+        }
+    }
+#endif
+}
+
+// Calls 'onFile' for each matching file under 'root' as soon as its directory listing returns it, so callers can start
+// on the first files while the rest are still being listed. Subfolders are visited depth first, each after the folder
+// that contains them has been listed; links to folders are not followed, so link cycles cannot recurse forever.
+// Throws std::system_error if a folder cannot be listed.
+template <typename OnFile>
+void ScanDirectory(std::filesystem::path const& root, ScanOptions const& options, OnFile&& onFile)
+{
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> folders{ { root, {} } };
+    while (!folders.empty())
+    {
+        auto [path, relativePath] = std::move(folders.back());
+        folders.pop_back();
+#if defined(__linux__)
+        details::ScanLinuxDirectory(path, relativePath, options, folders, onFile);
+#else
+        details::ScanPortableDirectory(path, relativePath, options, folders, onFile);
+#endif
+    }
+}
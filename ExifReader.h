@@ -0,0 +1,236 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+// Tag of the EXIF MakerNote entry that carries the serialized snapshot metadata, i.e. what WIC addresses as
+// "/app1/ifd/exif/{ushort=37500}".
+constexpr uint16_t c_exifMakerNoteTag = 37500;
+
+namespace details
+{
+    constexpr uint8_t c_jpegMarkerPrefix = 0xFF;
+    constexpr uint8_t c_jpegStartOfImage = 0xD8;
+    constexpr uint8_t c_jpegEndOfImage = 0xD9;
+    constexpr uint8_t c_jpegStartOfScan = 0xDA;
+    constexpr uint8_t c_jpegApp1 = 0xE1;
+
+    constexpr uint16_t c_tiffExifIfdPointerTag = 0x8769;
+    constexpr size_t c_tiffIfdEntrySize = 12;
+
+    // TIFF data is addressed by offsets relative to its own header and may be either byte order.
+    class TiffReader
+    {
+    public:
+        explicit TiffReader(std::span<uint8_t const> data) : m_data(data) {}
+
+        bool ReadHeader(uint32_t& firstIfdOffset)
+        {
+            if (m_data.size() < 8)
+            {
+                return false;
+            }
+
+            if ((m_data[0] == 'I') && (m_data[1] == 'I'))
+            {
+                m_bigEndian = false;
+            }
+            else if ((m_data[0] == 'M') && (m_data[1] == 'M'))
+            {
+                m_bigEndian = true;
+            }
+            else
+            {
+                return false;
+            }
+
+            return (Read16(2) == 42) && TryRead32(4, firstIfdOffset);
+        }
+
+        // Finds 'tag' in the IFD at 'ifdOffset' and returns its value bytes, which are stored inline in the entry
+        // when they fit in four bytes.
+        std::optional<std::span<uint8_t const>> FindTag(uint32_t ifdOffset, uint16_t tag) const
+        {
+            if ((ifdOffset > m_data.size()) || (m_data.size() - ifdOffset < 2))
+            {
+                return std::nullopt;
+            }
+
+            const uint16_t entryCount = Read16(ifdOffset);
+            if ((m_data.size() - ifdOffset - 2) / c_tiffIfdEntrySize < entryCount)
+            {
+                return std::nullopt;
+            }
+
+            for (uint16_t i = 0; i < entryCount; i++)
+            {
+                const size_t entry = ifdOffset + 2 + i * c_tiffIfdEntrySize;
+                if (Read16(entry) != tag)
+                {
+                    continue;
+                }
+
+                const uint64_t size = uint64_t{ TypeSize(Read16(entry + 2)) } * Read32(entry + 4);
+                if (size <= 4)
+                {
+                    return m_data.subspan(entry + 8, static_cast<size_t>(size));
+                }
+
+                const uint32_t valueOffset = Read32(entry + 8);
+                if ((valueOffset > m_data.size()) || (m_data.size() - valueOffset < size))
+                {
+                    return std::nullopt;
+                }
+                return m_data.subspan(valueOffset, static_cast<size_t>(size));
+            }
+
+            return std::nullopt;
+        }
+
+        std::optional<uint32_t> FindOffsetTag(uint32_t ifdOffset, uint16_t tag) const
+        {
+            const auto value = FindTag(ifdOffset, tag);
+            if (!value || (value->size() != 4))
+            {
+                return std::nullopt;
+            }
+            return Read32(static_cast<size_t>(value->data() - m_data.data()));
+        }
+
+    private:
+        static uint32_t TypeSize(uint16_t type)
+        {
+            switch (type)
+            {
+            case 1: case 2: case 6: case 7: return 1;  // BYTE, ASCII, SBYTE, UNDEFINED
+            case 3: case 8: return 2;                  // SHORT, SSHORT
+            case 4: case 9: case 11: case 13: return 4; // LONG, SLONG, FLOAT, IFD
+            case 5: case 10: case 12: return 8;        // RATIONAL, SRATIONAL, DOUBLE
+            default: return 0;
+            }
+        }
+
+        uint16_t Read16(size_t offset) const
+        {
+            const auto bytes = m_data.data() + offset;
+            return m_bigEndian ? static_cast<uint16_t>((bytes[0] << 8) | bytes[1]) : static_cast<uint16_t>((bytes[1] << 8) | bytes[0]);
+        }
+
+        uint32_t Read32(size_t offset) const
+        {
+            const auto bytes = m_data.data() + offset;
+            return m_bigEndian ?
+                (uint32_t{ bytes[0] } << 24) | (uint32_t{ bytes[1] } << 16) | (uint32_t{ bytes[2] } << 8) | bytes[3] :
+                (uint32_t{ bytes[3] } << 24) | (uint32_t{ bytes[2] } << 16) | (uint32_t{ bytes[1] } << 8) | bytes[0];
+        }
+
+        bool TryRead32(size_t offset, uint32_t& value) const
+        {
+            if ((offset > m_data.size()) || (m_data.size() - offset < 4))
+            {
+                return false;
+            }
+            value = Read32(offset);
+            return true;
+        }
+
+        std::span<uint8_t const> m_data;
+        bool m_bigEndian = false;
+    };
+
+    // Returns the TIFF block of the first Exif APP1 segment. Only the marker segments ahead of the scan data are
+    // visited, so the cost does not depend on the size of the image.
+    inline std::optional<std::span<uint8_t const>> FindExifApp1(std::span<uint8_t const> jpeg)
+    {
+        static constexpr uint8_t c_exifIdentifier[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+        if ((jpeg.size() < 4) || (jpeg[0] != c_jpegMarkerPrefix) || (jpeg[1] != c_jpegStartOfImage))
+        {
+            return std::nullopt;
+        }
+
+        size_t position = 2;
+        for (;;)
+        {
+            // Markers may be preceded by any number of 0xFF fill bytes.
+            if ((position >= jpeg.size()) || (jpeg[position] != c_jpegMarkerPrefix))
+            {
+                return std::nullopt;
+            }
+            while ((position < jpeg.size()) && (jpeg[position] == c_jpegMarkerPrefix))
+            {
+                position++;
+            }
+            if (position >= jpeg.size())
+            {
+                return std::nullopt;
+            }
+
+            const uint8_t marker = jpeg[position++];
+            if ((marker == c_jpegStartOfScan) || (marker == c_jpegEndOfImage))
+            {
+                return std::nullopt;
+            }
+            if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7)))
+            {
+                continue;  // TEM and RSTn carry no length.
+            }
+
+            if (jpeg.size() - position < 2)
+            {
+                return std::nullopt;
+            }
+            const size_t length = (size_t{ jpeg[position] } << 8) | jpeg[position + 1];
+            if ((length < 2) || (jpeg.size() - position < length))
+            {
+                return std::nullopt;
+            }
+
+            const auto segment = jpeg.subspan(position + 2, length - 2);
+            if ((marker == c_jpegApp1) &&
+                (segment.size() >= sizeof(c_exifIdentifier)) &&
+                (memcmp(segment.data(), c_exifIdentifier, sizeof(c_exifIdentifier)) == 0))
+            {
+                return segment.subspan(sizeof(c_exifIdentifier));
+            }
+
+            position += length;
+        }
+    }
+}
+
+// Finds 'tag' in the Exif sub-IFD of a JPEG (APP1 -> IFD0 -> Exif IFD) and returns a view of its value inside
+// 'jpeg'. Nothing is decoded or copied; malformed or missing structures yield std::nullopt.
+inline std::optional<std::span<uint8_t const>> FindExifTag(std::span<uint8_t const> jpeg, uint16_t tag)
+{
+    const auto tiff = details::FindExifApp1(jpeg);
+    if (!tiff)
+    {
+        return std::nullopt;
+    }
+
+    details::TiffReader reader(*tiff);
+    uint32_t ifd0Offset = 0;
+    if (!reader.ReadHeader(ifd0Offset))
+    {
+        return std::nullopt;
+    }
+
+    const auto exifIfdOffset = reader.FindOffsetTag(ifd0Offset, details::c_tiffExifIfdPointerTag);
+    if (!exifIfdOffset)
+    {
+        return std::nullopt;
+    }
+
+    return reader.FindTag(*exifIfdOffset, tag);
+}
+
+// The serialized PropertySet Recall stores in each snapshot's MakerNote.
+inline std::optional<std::span<uint8_t const>> FindSnapshotMetadata(std::span<uint8_t const> jpeg)
+{
+    return FindExifTag(jpeg, c_exifMakerNoteTag);
+}
@@ -0,0 +1,173 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ExportOptions.h"
+
+// One line of a job file: an export folder to export, where to, and with which export code.
+struct ExportJob
+{
+    std::wstring ExportFolderPath;
+    std::wstring OutputFolderPath;
+    std::wstring ExportCode;
+
+    // 1-based line in the job file, for messages.
+    size_t Line = 0;
+};
+
+// Exports every job of a job file in one process. The jobs share one scheduler, whose worker threads take turns
+// between the jobs that are running, and one limit on the reads and writes in flight.
+struct BatchOptions
+{
+    // Options every job is exported with; each job's folders and export code come from the job file.
+    ExportOptions Export;
+
+    std::wstring JobFilePath;
+
+    // Jobs exported at the same time; the others wait until one of them finishes.
+    unsigned ParallelJobs = 4;
+
+    // Reads and writes in flight at once across all running jobs.
+    unsigned IoLimit = 16;
+};
+
+// Parses "[export options] [--parallel-jobs N] [--io-limit N] <jobFilePath>", starting at argv[first]. The export
+// options are the ones a single export takes, except those naming one output (--report, --trace and --verify) and
+// --watch, which never finishes.
+inline bool TryParseBatchOptions(int argc, wchar_t* argv[], int first, BatchOptions& options)
+{
+    std::vector<std::wstring> positional;
+    for (int i = first; i < argc; i++)
+    {
+        const std::wstring argument = argv[i];
+        if ((argument == L"--parallel-jobs") || (argument == L"--io-limit"))
+        {
+            if ((++i >= argc) || !TryParseUnsigned(argv[i], (argument == L"--io-limit") ? options.IoLimit : options.ParallelJobs))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const auto result = details::TryParseExportOption(argc, argv, i, options.Export);
+        if (result == details::OptionParseResult::Invalid)
+        {
+            return false;
+        }
+        if (result == details::OptionParseResult::NotAnOption)
+        {
+            positional.push_back(argument);
+        }
+    }
+
+    auto const& exportOptions = options.Export;
+    if ((positional.size() != 1) || !details::AreExportOptionsCompatible(exportOptions) || exportOptions.VerifyOnly || exportOptions.Watch ||
+        !exportOptions.ReportPath.empty() || !exportOptions.TracePath.empty())
+    {
+        return false;
+    }
+
+    options.JobFilePath = positional[0];
+    return true;
+}
+
+namespace details
+{
+    inline bool IsJobFileSpace(char character)
+    {
+        return (character == ' ') || (character == '\t') || (character == '\r');
+    }
+
+    // Splits a job file line into fields separated by spaces or tabs; a field in double quotes may contain either.
+    // Fails on an unterminated quote.
+    inline bool TrySplitJobFields(std::string_view line, std::vector<std::string_view>& fields)
+    {
+        fields.clear();
+        size_t position = 0;
+        for (;;)
+        {
+            while ((position < line.size()) && IsJobFileSpace(line[position]))
+            {
+                position++;
+            }
+            if (position == line.size())
+            {
+                return true;
+            }
+
+            if (line[position] == '"')
+            {
+                const auto end = line.find('"', position + 1);
+                if (end == std::string_view::npos)
+                {
+                    return false;
+                }
+                fields.push_back(line.substr(position + 1, end - position - 1));
+                position = end + 1;
+            }
+            else
+            {
+                const auto start = position;
+                while ((position < line.size()) && !IsJobFileSpace(line[position]))
+                {
+                    position++;
+                }
+                fields.push_back(line.substr(start, position - start));
+            }
+        }
+    }
+
+    inline std::wstring WidenUtf8(std::string_view text)
+    {
+        return std::filesystem::path(std::u8string(text.begin(), text.end())).wstring();
+    }
+}
+
+// Parses a job file: UTF-8 text with one job per line, "<exportFolderPath> <outputFolderPath> <recoveryKey>". Paths
+// containing spaces are written in double quotes; the recovery key may be written in groups separated by spaces.
+// Blank lines and lines starting with '#' are skipped. On failure, errorLine is the first malformed line.
+inline bool TryParseJobFile(std::string_view text, std::vector<ExportJob>& jobs, size_t& errorLine)
+{
+    if (text.starts_with("\xEF\xBB\xBF"))
+    {
+        text.remove_prefix(3);
+    }
+
+    jobs.clear();
+    std::vector<std::string_view> fields;
+    size_t lineNumber = 0;
+    while (!text.empty())
+    {
+        const auto end = text.find('\n');
+        const auto line = text.substr(0, end);
+        text.remove_prefix((end == std::string_view::npos) ? text.size() : end + 1);
+        lineNumber++;
+
+        const auto first = line.find_first_not_of(" \t\r");
+        if ((first == std::string_view::npos) || (line[first] == '#'))
+        {
+            continue;
+        }
+        if (!details::TrySplitJobFields(line, fields) || (fields.size() < 3) || fields[0].empty() || fields[1].empty())
+        {
+            errorLine = lineNumber;
+            return false;
+        }
+
+        ExportJob job;
+        job.ExportFolderPath = details::WidenUtf8(fields[0]);
+        job.OutputFolderPath = details::WidenUtf8(fields[1]);
+        for (size_t i = 2; i < fields.size(); i++)
+        {
+            job.ExportCode += details::WidenUtf8(fields[i]) + ((i + 1 < fields.size()) ? L" " : L"");
+        }
+        job.Line = lineNumber;
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
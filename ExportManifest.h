@@ -0,0 +1,293 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "Sha256.h"
+#include "SnapshotFormat.h"
+
+// What identifies one input container: its size and modification time, its header, and a hash of its GCM tag,
+// which changes whenever the content does even if the file's timestamps were preserved.
+struct SnapshotFingerprint
+{
+    uint64_t FileSize = 0;
+    int64_t LastWriteTime = 0;
+    EncryptedSnapshotHeader Header{};
+    uint64_t TagHash = 0;
+
+    bool operator==(SnapshotFingerprint const& other) const
+    {
+        return (FileSize == other.FileSize) && (LastWriteTime == other.LastWriteTime) &&
+            (Header.Version == other.Header.Version) && (Header.KeySize == other.Header.KeySize) &&
+            (Header.ContentSize == other.Header.ContentSize) && (Header.ContentType == other.Header.ContentType) &&
+            (TagHash == other.TagHash);
+    }
+};
+
+// Reads only the header and the trailing tag, so fingerprinting does not depend on the size of the snapshot.
+inline SnapshotFingerprint ReadSnapshotFingerprint(std::filesystem::path const& path)
+{
+    SnapshotFingerprint fingerprint;
+    fingerprint.FileSize = std::filesystem::file_size(path);
+    fingerprint.LastWriteTime = static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+
+    std::ifstream input(path, std::ios::binary);
+    uint8_t headerBytes[sizeof(EncryptedSnapshotHeader)];
+    input.read(reinterpret_cast<char*>(headerBytes), sizeof(headerBytes));
+    if (static_cast<size_t>(input.gcount()) != sizeof(headerBytes))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+    fingerprint.Header = ReadSnapshotHeader(headerBytes);
+
+    const uint64_t contentEnd = sizeof(EncryptedSnapshotHeader) + uint64_t{ fingerprint.Header.KeySize } + fingerprint.Header.ContentSize;
+    if ((fingerprint.Header.ContentSize < c_tagSizeInBytes) || (contentEnd > fingerprint.FileSize))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    uint8_t tag[c_tagSizeInBytes];
+    input.seekg(static_cast<std::streamoff>(contentEnd - c_tagSizeInBytes));
+    input.read(reinterpret_cast<char*>(tag), sizeof(tag));
+    if (static_cast<size_t>(input.gcount()) != sizeof(tag))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    const auto digest = Sha256::Hash(tag);
+    memcpy(&fingerprint.TagHash, digest.data(), sizeof(fingerprint.TagHash));
+    return fingerprint;
+}
+
+enum class ManifestStatus : uint8_t
+{
+    Complete = 1,  // Image and metadata were written.
+    Failed = 2,    // Retried on the next run.
+};
+
+struct ManifestEntry
+{
+    std::filesystem::path Name;
+    SnapshotFingerprint Fingerprint;
+    ManifestStatus Status = ManifestStatus::Failed;
+};
+
+namespace details
+{
+    inline uint64_t Fnv1a64(std::span<uint8_t const> data)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (auto byte : data)
+        {
+            hash = (hash ^ byte) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    inline void AppendLittleEndian(std::string& buffer, uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            buffer.push_back(static_cast<char>(value >> (8 * i)));
+        }
+    }
+
+    inline uint64_t TakeLittleEndian(uint8_t const*& bytes, size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            value |= uint64_t{ bytes[i] } << (8 * i);
+        }
+        bytes += size;
+        return value;
+    }
+}
+
+// Append-only record of what earlier runs exported, kept in the output folder so later runs only process new or
+// changed snapshots. Each record is length-prefixed and checksummed; a record torn by a crash is dropped (and the
+// file truncated back to the last good one) when the manifest is next opened, and later records for a name
+// supersede earlier ones. Records are buffered until Flush.
+//
+// Layout, little-endian: "RSEM" version:u32, then per record
+//   size:u32 checksum:u64 (FNV-1a of the body) body{size}
+//   body := status:u8 fileSize:u64 lastWriteTime:i64 version:u32 keySize:u32 contentSize:u32 contentType:u32
+//           tagHash:u64 nameLength:u16 name (UTF-8){nameLength}
+class ExportManifest
+{
+public:
+    static constexpr wchar_t c_fileName[] = L"export.manifest";
+
+    explicit ExportManifest(std::filesystem::path const& path) : m_path(path)
+    {
+        const auto validSize = Load();
+        if (validSize == 0)
+        {
+            std::ofstream create(m_path, std::ios::binary | std::ios::trunc);
+            create.write(c_magic, sizeof(c_magic));
+            const char version[4] = { c_version, 0, 0, 0 };
+            create.write(version, sizeof(version));
+            if (!create)
+            {
+                throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to create the export manifest.");
+            }
+        }
+        else if (validSize < std::filesystem::file_size(m_path))
+        {
+            std::filesystem::resize_file(m_path, validSize);
+        }
+
+        m_output.open(m_path, std::ios::binary | std::ios::app);
+        if (!m_output)
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to open the export manifest.");
+        }
+    }
+
+    ~ExportManifest()
+    {
+        try
+        {
+            Flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    ExportManifest(ExportManifest const&) = delete;
+    ExportManifest& operator=(ExportManifest const&) = delete;
+
+    // Whether 'name' was exported by an earlier run from an input with exactly this fingerprint.
+    bool IsUpToDate(std::filesystem::path const& name, SnapshotFingerprint const& fingerprint) const
+    {
+        std::lock_guard lock(m_mutex);
+        const auto entry = m_entries.find(name.u8string());
+        return (entry != m_entries.end()) && (entry->second.Status == ManifestStatus::Complete) && (entry->second.Fingerprint == fingerprint);
+    }
+
+    void Record(ManifestEntry const& entry)
+    {
+        const auto name = entry.Name.u8string();
+        if (name.size() > UINT16_MAX)
+        {
+            return;
+        }
+
+        std::string body;
+        body.push_back(static_cast<char>(entry.Status));
+        details::AppendLittleEndian(body, entry.Fingerprint.FileSize, 8);
+        details::AppendLittleEndian(body, static_cast<uint64_t>(entry.Fingerprint.LastWriteTime), 8);
+        details::AppendLittleEndian(body, entry.Fingerprint.Header.Version, 4);
+        details::AppendLittleEndian(body, entry.Fingerprint.Header.KeySize, 4);
+        details::AppendLittleEndian(body, entry.Fingerprint.Header.ContentSize, 4);
+        details::AppendLittleEndian(body, entry.Fingerprint.Header.ContentType, 4);
+        details::AppendLittleEndian(body, entry.Fingerprint.TagHash, 8);
+        details::AppendLittleEndian(body, name.size(), 2);
+        body.append(reinterpret_cast<char const*>(name.data()), name.size());
+
+        std::lock_guard lock(m_mutex);
+        details::AppendLittleEndian(m_pending, body.size(), 4);
+        details::AppendLittleEndian(m_pending, details::Fnv1a64({ reinterpret_cast<uint8_t const*>(body.data()), body.size() }), 8);
+        m_pending.append(body);
+        m_entries[name] = entry;
+    }
+
+    void Flush()
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_pending.empty())
+        {
+            return;
+        }
+
+        m_output.write(m_pending.data(), static_cast<std::streamsize>(m_pending.size()));
+        m_output.flush();
+        m_pending.clear();
+        if (!m_output)
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to write the export manifest.");
+        }
+    }
+
+    size_t Size() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_entries.size();
+    }
+
+private:
+    static constexpr char c_magic[4] = { 'R', 'S', 'E', 'M' };
+    static constexpr char c_version = 1;
+    static constexpr size_t c_recordPrefixSize = 12;
+    static constexpr size_t c_bodyFixedSize = 1 + 8 + 8 + 16 + 8 + 2;
+
+    // Returns the size of the valid prefix of the file, or 0 if there is no usable manifest.
+    uint64_t Load()
+    {
+        std::error_code error;
+        if (!std::filesystem::exists(m_path, error))
+        {
+            return 0;
+        }
+
+        std::ifstream input(m_path, std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        if ((data.size() < 8) || (memcmp(data.data(), c_magic, sizeof(c_magic)) != 0) || (data[4] != c_version))
+        {
+            return 0;
+        }
+
+        size_t position = 8;
+        while (data.size() - position >= c_recordPrefixSize)
+        {
+            uint8_t const* prefix = data.data() + position;
+            const auto size = static_cast<size_t>(details::TakeLittleEndian(prefix, 4));
+            const auto checksum = details::TakeLittleEndian(prefix, 8);
+            if ((size < c_bodyFixedSize) || (data.size() - position - c_recordPrefixSize < size) ||
+                (details::Fnv1a64({ prefix, size }) != checksum))
+            {
+                break;
+            }
+
+            auto body = prefix;
+            ManifestEntry entry;
+            entry.Status = static_cast<ManifestStatus>(*body++);
+            entry.Fingerprint.FileSize = details::TakeLittleEndian(body, 8);
+            entry.Fingerprint.LastWriteTime = static_cast<int64_t>(details::TakeLittleEndian(body, 8));
+            entry.Fingerprint.Header.Version = static_cast<uint32_t>(details::TakeLittleEndian(body, 4));
+            entry.Fingerprint.Header.KeySize = static_cast<uint32_t>(details::TakeLittleEndian(body, 4));
+            entry.Fingerprint.Header.ContentSize = static_cast<uint32_t>(details::TakeLittleEndian(body, 4));
+            entry.Fingerprint.Header.ContentType = static_cast<uint32_t>(details::TakeLittleEndian(body, 4));
+            entry.Fingerprint.TagHash = details::TakeLittleEndian(body, 8);
+            const auto nameLength = static_cast<size_t>(details::TakeLittleEndian(body, 2));
+            if (c_bodyFixedSize + nameLength != size)
+            {
+                break;
+            }
+
+            std::u8string name(reinterpret_cast<char8_t const*>(body), nameLength);
+            entry.Name = std::filesystem::path(name);
+            m_entries[std::move(name)] = std::move(entry);
+            position += c_recordPrefixSize + size;
+        }
+
+        return position;
+    }
+
+    std::filesystem::path m_path;
+    std::ofstream m_output;
+    std::string m_pending;
+    std::unordered_map<std::u8string, ManifestEntry> m_entries;
+    mutable std::mutex m_mutex;
+};
@@ -0,0 +1,684 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "JsonWriter.h"
+#include "SnapshotFormat.h"
+
+enum class ExportStage
+{
+    Read,           // Reading or mapping the container, and fingerprinting it for --incremental.
+    Decrypt,        // Includes writing the image for --mmap and --stream, which decrypt straight into it.
+    Metadata,       // Finding, parsing and serializing the metadata.
+    WriteImage,
+    WriteMetadata,
+    Hash,           // --dedup: hashing the decrypted image.
+    Thumbnail,      // --thumbnails: scaling and re-encoding the decrypted image; writing it counts as writeImage.
+    Verify,         // --verify: reading and authenticating a container, with nothing decrypted or written.
+};
+
+constexpr size_t c_exportStageCount = 8;
+
+inline char const* ExportStageName(ExportStage stage)
+{
+    switch (stage)
+    {
+    case ExportStage::Read: return "read";
+    case ExportStage::Decrypt: return "decrypt";
+    case ExportStage::Metadata: return "metadata";
+    case ExportStage::WriteImage: return "writeImage";
+    case ExportStage::WriteMetadata: return "writeMetadata";
+    case ExportStage::Hash: return "hash";
+    case ExportStage::Thumbnail: return "thumbnail";
+    default: return "verify";
+    }
+}
+
+// What a failure HRESULT means for someone tuning or debugging an export.
+inline char const* ExportFailureKind(int32_t hr)
+{
+    if (hr == c_hrAuthTagMismatch)
+    {
+        return "tagMismatch";  // Wrong export code, or a corrupted container.
+    }
+    if ((hr == c_hrInvalidData) || (hr == c_hrInvalidArgument))
+    {
+        return "invalidContainer";
+    }
+    if ((static_cast<uint32_t>(hr) >> 16) == 0x8007)
+    {
+        return "io";  // Any other FACILITY_WIN32 error.
+    }
+    return "other";
+}
+
+// "0x" and eight hex digits. Formatted into a string rather than with std::hex, whose flags every thread printing to
+// the same stream shares.
+inline std::string FormatHResult(int32_t hr)
+{
+    std::string text = "0x";
+    for (int i = 0; i < 8; i++)
+    {
+        text.push_back(details::c_hexDigits[(static_cast<uint32_t>(hr) >> (28 - 4 * i)) & 0xF]);
+    }
+    return text;
+}
+
+// Latency histogram with logarithmic buckets, each split into 8 linear sub-buckets, so percentiles are accurate to
+// within 12.5% from nanoseconds to hours in a fixed 4KB of counters. Record is lock-free.
+class LatencyHistogram
+{
+public:
+    void Record(uint64_t nanoseconds)
+    {
+        m_buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_total.fetch_add(nanoseconds, std::memory_order_relaxed);
+        auto maximum = m_maximum.load(std::memory_order_relaxed);
+        while ((nanoseconds > maximum) && !m_maximum.compare_exchange_weak(maximum, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t Count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t TotalNanoseconds() const
+    {
+        return m_total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t MaximumNanoseconds() const
+    {
+        return m_maximum.load(std::memory_order_relaxed);
+    }
+
+    // The midpoint of the bucket holding the given percentile (0-100), capped at the maximum seen.
+    uint64_t PercentileNanoseconds(double percentile) const
+    {
+        const auto count = Count();
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        const auto rank = (std::max)(uint64_t{ 1 }, static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < c_bucketCount; i++)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                const auto [lower, width] = BucketRange(i);
+                return (std::min)(lower + width / 2, MaximumNanoseconds());
+            }
+        }
+        return MaximumNanoseconds();
+    }
+
+private:
+    static constexpr size_t c_subBucketBits = 3;
+    static constexpr size_t c_subBuckets = size_t{ 1 } << c_subBucketBits;
+    static constexpr size_t c_bucketCount = c_subBuckets + (64 - c_subBucketBits) * c_subBuckets;
+
+    static size_t BucketIndex(uint64_t value)
+    {
+        if (value < c_subBuckets)
+        {
+            return static_cast<size_t>(value);
+        }
+        const auto exponent = static_cast<size_t>(std::bit_width(value)) - 1;
+        const auto subBucket = static_cast<size_t>(value >> (exponent - c_subBucketBits)) & (c_subBuckets - 1);
+        return c_subBuckets + (exponent - c_subBucketBits) * c_subBuckets + subBucket;
+    }
+
+    static std::pair<uint64_t, uint64_t> BucketRange(size_t index)
+    {
+        if (index < c_subBuckets)
+        {
+            return { index, 1 };
+        }
+        const auto shift = (index - c_subBuckets) / c_subBuckets;
+        const auto subBucket = (index - c_subBuckets) % c_subBuckets;
+        return { (c_subBuckets + subBucket) << shift, uint64_t{ 1 } << shift };
+    }
+
+    std::array<std::atomic<uint64_t>, c_bucketCount> m_buckets{};
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_total{ 0 };
+    std::atomic<uint64_t> m_maximum{ 0 };
+};
+
+// Records complete ("X") and counter ("C") events and writes them in the Chrome trace-event format, which
+// chrome://tracing and Perfetto open directly. Events are kept in memory until Write.
+class TraceEventRecorder
+{
+public:
+    explicit TraceEventRecorder(std::chrono::steady_clock::time_point origin) : m_origin(origin) {}
+
+    void Complete(char const* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, std::wstring_view fileName)
+    {
+        Event event{ name, ThreadIndex(), Microseconds(start), Microseconds(end) - Microseconds(start), std::wstring(fileName), 0, 0 };
+        std::lock_guard lock(m_mutex);
+        m_events.push_back(std::move(event));
+    }
+
+    void Counter(char const* name, std::chrono::steady_clock::time_point time, uint64_t first, uint64_t second)
+    {
+        Event event{ name, 0, Microseconds(time), -1, {}, first, second };
+        std::lock_guard lock(m_mutex);
+        m_events.push_back(std::move(event));
+    }
+
+    void Write(std::filesystem::path const& path) const
+    {
+        std::string json;
+        JsonWriter writer(json);
+        writer.BeginObject();
+        writer.Key("displayTimeUnit");
+        writer.String("ms");
+        writer.Key("traceEvents");
+        writer.BeginArray();
+
+        std::lock_guard lock(m_mutex);
+        for (auto const& event : m_events)
+        {
+            writer.BeginObject();
+            writer.Key("name");
+            writer.String(event.Name);
+            writer.Key("ph");
+            writer.String((event.Duration < 0) ? "C" : "X");
+            writer.Key("pid");
+            writer.Number(1);
+            writer.Key("tid");
+            writer.Number(event.Thread);
+            writer.Key("ts");
+            writer.Number(event.Timestamp);
+            if (event.Duration >= 0)
+            {
+                writer.Key("dur");
+                writer.Number(event.Duration);
+            }
+            writer.Key("args");
+            writer.BeginObject();
+            if (event.Duration >= 0)
+            {
+                writer.Key("file");
+                writer.String(event.FileName);
+            }
+            else
+            {
+                writer.Key("pool");
+                writer.Number(event.First);
+                writer.Key("write");
+                writer.Number(event.Second);
+            }
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        writer.EndArray();
+        writer.EndObject();
+        WriteTextFile(path, json);
+    }
+
+    static void WriteTextFile(std::filesystem::path const& path, std::string const& text)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(text.data(), static_cast<std::streamsize>(text.size()));
+        if (!output)
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to write the report.");
+        }
+    }
+
+private:
+    struct Event
+    {
+        char const* Name;
+        uint32_t Thread;
+        int64_t Timestamp;
+        int64_t Duration;  // Negative for counter events.
+        std::wstring FileName;
+        uint64_t First;
+        uint64_t Second;
+    };
+
+    int64_t Microseconds(std::chrono::steady_clock::time_point time) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time - m_origin).count();
+    }
+
+    // Small, stable thread numbers read better in the trace viewer than OS thread ids.
+    static uint32_t ThreadIndex()
+    {
+        static std::atomic<uint32_t> nextIndex{ 1 };
+        thread_local const uint32_t index = nextIndex.fetch_add(1);
+        return index;
+    }
+
+    std::chrono::steady_clock::time_point m_origin;
+    mutable std::mutex m_mutex;
+    std::vector<Event> m_events;
+};
+
+// The outcome of one export run, as batch mode reports it for each job.
+struct ExportSummary
+{
+    uint64_t FilesCompleted = 0;
+    uint64_t FilesFailed = 0;
+    uint64_t FilesSkipped = 0;
+    uint64_t BytesRead = 0;
+    double Seconds = 0;
+    std::array<uint64_t, c_exportStageCount> FailuresByStage{};
+
+    // Listing the export folder, finishing the archive or writing the index failed, so the output is missing more
+    // than the failed snapshots.
+    bool Incomplete = false;
+};
+
+// Counters and per-stage latencies for one export run. Every method may be called from any thread. A trace is only
+// recorded when EnableTrace has been called.
+class ExportMetrics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ExportMetrics() : m_start(Clock::now()) {}
+
+    void EnableTrace()
+    {
+        m_trace.emplace(m_start);
+    }
+
+    void RecordStage(ExportStage stage, Clock::time_point start, Clock::time_point end, std::wstring_view fileName)
+    {
+        m_stages[static_cast<size_t>(stage)].Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+        if (m_trace)
+        {
+            m_trace->Complete(ExportStageName(stage), start, end, fileName);
+        }
+    }
+
+    void AddBytesRead(uint64_t bytes)
+    {
+        m_bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void AddBytesWritten(uint64_t bytes)
+    {
+        m_bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Known after a pre-scan: the total size of the inputs to export, against which progress is measured.
+    void SetExpectedBytes(uint64_t bytes)
+    {
+        m_expectedBytes.store(bytes, std::memory_order_relaxed);
+    }
+
+    // Input bytes of snapshots that have been exported or have failed.
+    void AddBytesFinished(uint64_t bytes)
+    {
+        m_bytesFinished.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // The fraction of the expected input finished so far and the seconds left at the rate so far, or std::nullopt
+    // when the expected size is not known.
+    std::optional<std::pair<double, double>> Progress() const
+    {
+        const auto expected = m_expectedBytes.load(std::memory_order_relaxed);
+        if (expected == 0)
+        {
+            return std::nullopt;
+        }
+
+        const auto fraction = (std::min)(1.0, static_cast<double>(m_bytesFinished.load(std::memory_order_relaxed)) / expected);
+        const auto seconds = ElapsedSeconds();
+        return std::pair{ fraction, (fraction > 0) ? seconds * (1 - fraction) / fraction : 0.0 };
+    }
+
+    void RecordSkipped()
+    {
+        m_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RecordCompleted()
+    {
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The stage and HRESULT of each failed file go to the report only; the console keeps its one line per file.
+    void RecordFailure(ExportStage stage, int32_t hr, std::wstring_view fileName)
+    {
+        std::lock_guard lock(m_failureMutex);
+        m_failuresByStage[static_cast<size_t>(stage)]++;
+        m_failuresByHResult[hr]++;
+        m_failedFiles.push_back({ std::wstring(fileName), stage, hr });
+    }
+
+    // --dedup: images stored once, images found to be duplicates of a stored one, and the bytes those did not write.
+    void SetDeduplication(uint64_t unique, uint64_t duplicates, uint64_t bytesSaved)
+    {
+        m_uniqueImages.store(unique, std::memory_order_relaxed);
+        m_duplicateImages.store(duplicates, std::memory_order_relaxed);
+        m_bytesDeduplicated.store(bytesSaved, std::memory_order_relaxed);
+    }
+
+    // Sampled by the reader between submissions: tasks waiting in the pool, and items waiting for the writer.
+    void SampleQueueDepths(size_t poolDepth, size_t writeDepth)
+    {
+        std::lock_guard lock(m_queueMutex);
+        m_queueSamples++;
+        m_poolDepth.Add(poolDepth);
+        m_writeDepth.Add(writeDepth);
+        if (m_trace)
+        {
+            m_trace->Counter("queues", Clock::now(), poolDepth, writeDepth);
+        }
+    }
+
+    // Stops the wall clock; the report covers the run up to this call.
+    void Finish()
+    {
+        m_end = Clock::now();
+    }
+
+    double ElapsedSeconds() const
+    {
+        return std::chrono::duration<double>(((m_end > m_start) ? m_end : Clock::now()) - m_start).count();
+    }
+
+    uint64_t FilesCompleted() const
+    {
+        return m_completed.load();
+    }
+
+    uint64_t FilesFailed() const
+    {
+        std::lock_guard lock(m_failureMutex);
+        uint64_t failed = 0;
+        for (auto count : m_failuresByStage)
+        {
+            failed += count;
+        }
+        return failed;
+    }
+
+    uint64_t FilesSkipped() const
+    {
+        return m_skipped.load();
+    }
+
+    uint64_t BytesRead() const
+    {
+        return m_bytesRead.load();
+    }
+
+    ExportSummary Summary() const
+    {
+        ExportSummary summary;
+        summary.FilesCompleted = FilesCompleted();
+        summary.FilesSkipped = FilesSkipped();
+        summary.BytesRead = BytesRead();
+        summary.Seconds = ElapsedSeconds();
+        {
+            std::lock_guard lock(m_failureMutex);
+            summary.FailuresByStage = m_failuresByStage;
+        }
+        for (const auto count : summary.FailuresByStage)
+        {
+            summary.FilesFailed += count;
+        }
+        return summary;
+    }
+
+    void WriteReport(JsonWriter& writer) const
+    {
+        const auto seconds = ElapsedSeconds();
+        const auto perSecond = [&](double value) { return (seconds > 0) ? value / seconds : 0.0; };
+        const auto milliseconds = [](uint64_t nanoseconds) { return static_cast<double>(nanoseconds) / 1e6; };
+
+        writer.BeginObject();
+        writer.Key("elapsedSeconds");
+        writer.Number(seconds);
+
+        writer.Key("files");
+        writer.BeginObject();
+        writer.Key("completed");
+        writer.Number(FilesCompleted());
+        writer.Key("failed");
+        writer.Number(FilesFailed());
+        writer.Key("skipped");
+        writer.Number(m_skipped.load());
+        writer.Key("perSecond");
+        writer.Number(perSecond(static_cast<double>(FilesCompleted() + FilesFailed())));
+        writer.EndObject();
+
+        writer.Key("bytes");
+        writer.BeginObject();
+        writer.Key("read");
+        writer.Number(m_bytesRead.load());
+        writer.Key("written");
+        writer.Number(m_bytesWritten.load());
+        writer.Key("readPerSecond");
+        writer.Number(perSecond(static_cast<double>(m_bytesRead.load())));
+        writer.Key("writtenPerSecond");
+        writer.Number(perSecond(static_cast<double>(m_bytesWritten.load())));
+        if (m_expectedBytes.load() > 0)
+        {
+            writer.Key("expected");
+            writer.Number(m_expectedBytes.load());
+        }
+        writer.EndObject();
+
+        if (m_uniqueImages.load() + m_duplicateImages.load() > 0)
+        {
+            writer.Key("dedup");
+            writer.BeginObject();
+            writer.Key("unique");
+            writer.Number(m_uniqueImages.load());
+            writer.Key("duplicates");
+            writer.Number(m_duplicateImages.load());
+            writer.Key("bytesSaved");
+            writer.Number(m_bytesDeduplicated.load());
+            writer.EndObject();
+        }
+
+        writer.Key("stages");
+        writer.BeginObject();
+        for (size_t i = 0; i < c_exportStageCount; i++)
+        {
+            auto const& histogram = m_stages[i];
+            writer.Key(ExportStageName(static_cast<ExportStage>(i)));
+            writer.BeginObject();
+            writer.Key("count");
+            writer.Number(histogram.Count());
+            writer.Key("totalMs");
+            writer.Number(milliseconds(histogram.TotalNanoseconds()));
+            writer.Key("meanMs");
+            writer.Number((histogram.Count() > 0) ? milliseconds(histogram.TotalNanoseconds()) / histogram.Count() : 0.0);
+            for (auto [name, percentile] : { std::pair{ "p50Ms", 50.0 }, std::pair{ "p90Ms", 90.0 }, std::pair{ "p99Ms", 99.0 } })
+            {
+                writer.Key(name);
+                writer.Number(milliseconds(histogram.PercentileNanoseconds(percentile)));
+            }
+            writer.Key("maxMs");
+            writer.Number(milliseconds(histogram.MaximumNanoseconds()));
+            writer.EndObject();
+        }
+        writer.EndObject();
+
+        {
+            std::lock_guard lock(m_queueMutex);
+            writer.Key("queues");
+            writer.BeginObject();
+            for (auto [name, gauge] : { std::pair{ "pool", &m_poolDepth }, std::pair{ "write", &m_writeDepth } })
+            {
+                writer.Key(name);
+                writer.BeginObject();
+                writer.Key("mean");
+                writer.Number((m_queueSamples > 0) ? static_cast<double>(gauge->Total) / m_queueSamples : 0.0);
+                writer.Key("max");
+                writer.Number(gauge->Maximum);
+                writer.EndObject();
+            }
+            writer.EndObject();
+        }
+
+        {
+            std::lock_guard lock(m_failureMutex);
+            writer.Key("failures");
+            writer.BeginObject();
+            writer.Key("byStage");
+            writer.BeginObject();
+            for (size_t i = 0; i < c_exportStageCount; i++)
+            {
+                writer.Key(ExportStageName(static_cast<ExportStage>(i)));
+                writer.Number(m_failuresByStage[i]);
+            }
+            writer.EndObject();
+            writer.Key("byHResult");
+            writer.BeginArray();
+            for (auto const& [hr, count] : m_failuresByHResult)
+            {
+                writer.BeginObject();
+                writer.Key("hresult");
+                writer.String(FormatHResult(hr));
+                writer.Key("kind");
+                writer.String(ExportFailureKind(hr));
+                writer.Key("count");
+                writer.Number(count);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.Key("files");
+            writer.BeginArray();
+            for (auto const& failure : m_failedFiles)
+            {
+                writer.BeginObject();
+                writer.Key("file");
+                writer.String(failure.FileName);
+                writer.Key("stage");
+                writer.String(ExportStageName(failure.Stage));
+                writer.Key("hresult");
+                writer.String(FormatHResult(failure.HResult));
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.EndObject();
+        }
+
+        writer.EndObject();
+    }
+
+    void WriteReportFile(std::filesystem::path const& path) const
+    {
+        std::string json;
+        JsonWriter writer(json);
+        WriteReport(writer);
+        json.push_back('\n');
+        TraceEventRecorder::WriteTextFile(path, json);
+    }
+
+    void WriteTraceFile(std::filesystem::path const& path) const
+    {
+        if (m_trace)
+        {
+            m_trace->Write(path);
+        }
+    }
+
+private:
+    struct FailedFile
+    {
+        std::wstring FileName;
+        ExportStage Stage;
+        int32_t HResult;
+    };
+
+    struct Gauge
+    {
+        uint64_t Total = 0;
+        uint64_t Maximum = 0;
+
+        void Add(uint64_t value)
+        {
+            Total += value;
+            Maximum = (std::max)(Maximum, value);
+        }
+    };
+
+    Clock::time_point m_start;
+    Clock::time_point m_end{};
+    std::array<LatencyHistogram, c_exportStageCount> m_stages;
+    std::atomic<uint64_t> m_bytesRead{ 0 };
+    std::atomic<uint64_t> m_bytesWritten{ 0 };
+    std::atomic<uint64_t> m_expectedBytes{ 0 };
+    std::atomic<uint64_t> m_bytesFinished{ 0 };
+    std::atomic<uint64_t> m_completed{ 0 };
+    std::atomic<uint64_t> m_skipped{ 0 };
+    std::atomic<uint64_t> m_uniqueImages{ 0 };
+    std::atomic<uint64_t> m_duplicateImages{ 0 };
+    std::atomic<uint64_t> m_bytesDeduplicated{ 0 };
+
+    mutable std::mutex m_failureMutex;
+    std::array<uint64_t, c_exportStageCount> m_failuresByStage{};
+    std::map<int32_t, uint64_t> m_failuresByHResult;
+    std::vector<FailedFile> m_failedFiles;
+
+    mutable std::mutex m_queueMutex;
+    uint64_t m_queueSamples = 0;
+    Gauge m_poolDepth;
+    Gauge m_writeDepth;
+
+    std::optional<TraceEventRecorder> m_trace;
+};
+
+// Times one stage for one file, from construction to destruction.
+class StageTimer
+{
+public:
+    StageTimer(ExportMetrics& metrics, ExportStage stage, std::wstring_view fileName) :
+        m_metrics(metrics), m_stage(stage), m_fileName(fileName), m_start(ExportMetrics::Clock::now())
+    {
+    }
+
+    ~StageTimer()
+    {
+        try
+        {
+            m_metrics.RecordStage(m_stage, m_start, ExportMetrics::Clock::now(), m_fileName);
+        }
+        catch (...)
+        {
+        }
+    }
+
+    StageTimer(StageTimer const&) = delete;
+    StageTimer& operator=(StageTimer const&) = delete;
+
+private:
+    ExportMetrics& m_metrics;
+    ExportStage m_stage;
+    std::wstring_view m_fileName;
+    ExportMetrics::Clock::time_point m_start;
+};
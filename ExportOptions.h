@@ -0,0 +1,391 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class MetadataOutputFormat
+{
+    PerFileJson,  // <snapshot>.json next to each image.
+    Ndjson,       // One record per snapshot in metadata.ndjson.
+};
+
+enum class ArchiveOutputFormat
+{
+    None,  // Separate files in the output folder.
+    Tar,   // One POSIX tar archive.
+    Zip,   // One uncompressed ZIP archive.
+};
+
+struct ExportOptions
+{
+    // Only authenticate each container, without decrypting or writing anything; there is no output folder.
+    bool VerifyOnly = false;
+
+    std::wstring ExportFolderPath;
+    std::wstring OutputFolderPath;
+    std::wstring ExportCode;
+
+    // Also export snapshots in subfolders of the export folder, into matching subfolders of the output folder.
+    bool Recursive = false;
+
+    // Only export files whose name matches this '*'/'?' pattern; empty for all files.
+    std::wstring NamePattern;
+
+    // Worker threads for the CPU stages of the export pipeline.
+    unsigned Jobs = (std::max)(1u, std::thread::hardware_concurrency());
+
+    // Map inputs and decrypt straight into mapped output files instead of going through buffers and streams.
+    bool UseMappedIo = false;
+
+    // Decrypt file to file in chunks of StreamingChunkSize bytes, so memory per in-flight snapshot is constant.
+    bool UseStreaming = false;
+    size_t StreamingChunkSize = 1024 * 1024;
+
+    // Read containers and write outputs through a FileIoBackend, keeping up to IoQueueDepth requests in flight in
+    // each direction instead of one blocking request at a time.
+    bool UseBatchedIo = false;
+    unsigned IoQueueDepth = 32;
+
+    // Store each distinct image once under <output>/objects and hard-link every snapshot's image to it.
+    bool Deduplicate = false;
+
+    // Also write <snapshot>.thumb.jpg at 1/ThumbnailScale of the image's size (2, 4 or 8); 0 for none.
+    unsigned ThumbnailScale = 0;
+
+    // Write metadata numbers as strings, the shape earlier releases produced.
+    bool CompatibleJsonNumbers = false;
+
+    MetadataOutputFormat MetadataFormat = MetadataOutputFormat::PerFileJson;
+
+    // Write every image and JSON file into one archive at OutputFolderPath instead of a folder; "-" is standard
+    // output.
+    ArchiveOutputFormat Archive = ArchiveOutputFormat::None;
+
+    // Read every input's header before exporting anything: malformed inputs are reported up front, the total size
+    // gives progress and an ETA, and snapshots are exported largest first.
+    bool Prescan = false;
+
+    // Upper bound on the snapshot bytes in flight across all stages; 0 for none.
+    size_t MemoryBudget = 0;
+
+    // Keep a manifest in the output folder and skip inputs an earlier run already exported unchanged.
+    bool Incremental = false;
+
+    // Write a searchable index of the exported snapshots' metadata to the output folder, for the query command.
+    // With --incremental the existing index is extended, otherwise it is replaced.
+    bool BuildIndex = false;
+
+    // After exporting what is in the export folder, keep watching it and export each new or rewritten snapshot as soon
+    // as it has been written in full, until stopped.
+    bool Watch = false;
+
+    // Export only these files, relative to the export folder, instead of listing it; the query command sets this.
+    std::vector<std::wstring> Files;
+
+    // Only print failures and the end-of-run summary, not a line per file.
+    bool Quiet = false;
+
+    // Where to write the JSON run report and the Chrome trace-event file; empty for none.
+    std::wstring ReportPath;
+    std::wstring TracePath;
+};
+
+inline bool TryParseUnsigned(std::wstring const& text, unsigned& value)
+{
+    try
+    {
+        size_t parsed = 0;
+        const auto result = std::stoul(text, &parsed);
+        if ((parsed != text.size()) || (result == 0) || (result > 4096))
+        {
+            return false;
+        }
+        value = static_cast<unsigned>(result);
+        return true;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+// Parses a byte count with an optional K, M or G suffix, between 4K and 'maximum'.
+inline bool TryParseByteSize(std::wstring const& text, size_t& value, uint64_t maximum = 1ull << 30)
+{
+    try
+    {
+        size_t parsed = 0;
+        auto result = std::stoull(text, &parsed);
+        int shift = 0;
+        if (parsed + 1 == text.size())
+        {
+            switch (text.back())
+            {
+            case L'K': case L'k': shift = 10; break;
+            case L'M': case L'm': shift = 20; break;
+            case L'G': case L'g': shift = 30; break;
+            default: return false;
+            }
+        }
+        else if (parsed != text.size())
+        {
+            return false;
+        }
+
+        // Checked before shifting, so a large count with a suffix cannot overflow.
+        if ((result > (maximum >> shift)) || ((result << shift) < 4096))
+        {
+            return false;
+        }
+        value = static_cast<size_t>(result << shift);
+        return true;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+namespace details
+{
+    enum class OptionParseResult
+    {
+        Parsed,
+        Invalid,
+        NotAnOption,  // A positional argument.
+    };
+
+    // Parses the export option at argv[i], advancing i past its value if it has one.
+    inline OptionParseResult TryParseExportOption(int argc, wchar_t* argv[], int& i, ExportOptions& options)
+    {
+        const std::wstring argument = argv[i];
+        if ((argument == L"--jobs") || (argument == L"-j"))
+        {
+            if ((++i >= argc) || !TryParseUnsigned(argv[i], options.Jobs))
+            {
+                return OptionParseResult::Invalid;
+            }
+        }
+        else if (argument == L"--verify")
+        {
+            options.VerifyOnly = true;
+        }
+        else if (argument == L"--mmap")
+        {
+            options.UseMappedIo = true;
+        }
+        else if (argument == L"--stream")
+        {
+            options.UseStreaming = true;
+        }
+        else if ((argument == L"--recursive") || (argument == L"-r"))
+        {
+            options.Recursive = true;
+        }
+        else if (argument == L"--pattern")
+        {
+            if (++i >= argc)
+            {
+                return OptionParseResult::Invalid;
+            }
+            options.NamePattern = argv[i];
+        }
+        else if (argument == L"--prescan")
+        {
+            options.Prescan = true;
+        }
+        else if (argument == L"--memory-budget")
+        {
+            if ((++i >= argc) || !TryParseByteSize(argv[i], options.MemoryBudget, 1ull << 40))
+            {
+                return OptionParseResult::Invalid;
+            }
+        }
+        else if (argument == L"--batched-io")
+        {
+            options.UseBatchedIo = true;
+        }
+        else if (argument == L"--io-depth")
+        {
+            if ((++i >= argc) || !TryParseUnsigned(argv[i], options.IoQueueDepth))
+            {
+                return OptionParseResult::Invalid;
+            }
+            options.UseBatchedIo = true;
+        }
+        else if (argument == L"--dedup")
+        {
+            options.Deduplicate = true;
+        }
+        else if (argument == L"--thumbnails")
+        {
+            const std::wstring scale = (++i < argc) ? argv[i] : L"";
+            if ((scale != L"2") && (scale != L"4") && (scale != L"8"))
+            {
+                return OptionParseResult::Invalid;
+            }
+            options.ThumbnailScale = static_cast<unsigned>(std::stoul(scale));
+        }
+        else if (argument == L"--incremental")
+        {
+            options.Incremental = true;
+        }
+        else if (argument == L"--index")
+        {
+            options.BuildIndex = true;
+        }
+        else if (argument == L"--watch")
+        {
+            options.Watch = true;
+        }
+        else if ((argument == L"--quiet") || (argument == L"-q"))
+        {
+            options.Quiet = true;
+        }
+        else if ((argument == L"--report") || (argument == L"--trace"))
+        {
+            if (++i >= argc)
+            {
+                return OptionParseResult::Invalid;
+            }
+            ((argument == L"--report") ? options.ReportPath : options.TracePath) = argv[i];
+        }
+        else if (argument == L"--json-compat")
+        {
+            options.CompatibleJsonNumbers = true;
+        }
+        else if (argument == L"--metadata")
+        {
+            const std::wstring format = (++i < argc) ? argv[i] : L"";
+            if (format == L"json")
+            {
+                options.MetadataFormat = MetadataOutputFormat::PerFileJson;
+            }
+            else if (format == L"ndjson")
+            {
+                options.MetadataFormat = MetadataOutputFormat::Ndjson;
+            }
+            else
+            {
+                return OptionParseResult::Invalid;
+            }
+        }
+        else if (argument == L"--archive")
+        {
+            const std::wstring format = (++i < argc) ? argv[i] : L"";
+            if (format == L"tar")
+            {
+                options.Archive = ArchiveOutputFormat::Tar;
+            }
+            else if (format == L"zip")
+            {
+                options.Archive = ArchiveOutputFormat::Zip;
+            }
+            else
+            {
+                return OptionParseResult::Invalid;
+            }
+        }
+        else if (argument == L"--chunk-size")
+        {
+            if ((++i >= argc) || !TryParseByteSize(argv[i], options.StreamingChunkSize))
+            {
+                return OptionParseResult::Invalid;
+            }
+            options.UseStreaming = true;
+        }
+        else if (argument.starts_with(L"--"))
+        {
+            return OptionParseResult::Invalid;
+        }
+        else
+        {
+            return OptionParseResult::NotAnOption;
+        }
+        return OptionParseResult::Parsed;
+    }
+
+    // Rejects combinations of export options that cannot work together.
+    inline bool AreExportOptionsCompatible(ExportOptions const& options)
+    {
+        if ((options.UseMappedIo + options.UseStreaming + options.UseBatchedIo) > 1)
+        {
+            return false;
+        }
+
+        // --dedup hashes images in memory, which --mmap and --stream never hold.
+        if (options.Deduplicate && (options.UseMappedIo || options.UseStreaming))
+        {
+            return false;
+        }
+
+        // --archive writes one sequential stream: there are no separate files to map, stream, batch, link, track or
+        // index, and no metadata.ndjson beside it.
+        if ((options.Archive != ArchiveOutputFormat::None) && (options.UseMappedIo || options.UseStreaming || options.UseBatchedIo ||
+            options.Deduplicate || options.Incremental || options.BuildIndex || (options.MetadataFormat == MetadataOutputFormat::Ndjson) ||
+            options.VerifyOnly))
+        {
+            return false;
+        }
+
+        // --watch never finishes listing the export folder, which --prescan waits for.
+        if (options.Watch && (options.Prescan || options.VerifyOnly))
+        {
+            return false;
+        }
+
+        return true;
+    }
+}
+
+// Parses "[options] <exportFolderPath> <outputFolderPath> <recoveryKey>", where the output path names the archive
+// with --archive, or "--verify [options] <exportFolderPath> <recoveryKey>".
+inline bool TryParseExportOptions(int argc, wchar_t* argv[], ExportOptions& options)
+{
+    std::vector<std::wstring> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        const auto result = details::TryParseExportOption(argc, argv, i, options);
+        if (result == details::OptionParseResult::Invalid)
+        {
+            return false;
+        }
+        if (result == details::OptionParseResult::NotAnOption)
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (!details::AreExportOptionsCompatible(options))
+    {
+        return false;
+    }
+
+    // --verify reads each container either mapped or in chunks, and writes nothing for --incremental to track,
+    // --index to index or --thumbnails to scale.
+    if (options.VerifyOnly)
+    {
+        if ((positional.size() != 2) || options.UseBatchedIo || options.Incremental || options.BuildIndex || (options.ThumbnailScale != 0))
+        {
+            return false;
+        }
+        options.ExportFolderPath = positional[0];
+        options.ExportCode = positional[1];
+        return true;
+    }
+
+    if (positional.size() != 3)
+    {
+        return false;
+    }
+
+    options.ExportFolderPath = positional[0];
+    options.OutputFolderPath = positional[1];
+    options.ExportCode = positional[2];
+    return true;
+}
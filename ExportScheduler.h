@@ -0,0 +1,364 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "SnapshotFormat.h"
+#include "WorkStealingPool.h"
+
+// What the pre-scan learns about one input from its header and wrapped key, without reading its content.
+struct SnapshotPrescan
+{
+    uint64_t FileSize = 0;
+    EncryptedSnapshotHeader Header{};
+};
+
+// Reads the 16-byte header and the wrapped key that follows it, and rejects what decryption would only reject after
+// reading the whole file: another container version, a wrapped key of the wrong size, or content that does not fit
+// in the file. Throws SnapshotException for those, and std::filesystem_error if the file cannot be read.
+inline SnapshotPrescan PrescanSnapshot(std::filesystem::path const& path)
+{
+    SnapshotPrescan prescan;
+    prescan.FileSize = std::filesystem::file_size(path);
+
+    std::ifstream input(path, std::ios::binary);
+    uint8_t bytes[sizeof(EncryptedSnapshotHeader) + c_totalSizeInBytes];
+    input.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+    if (static_cast<size_t>(input.gcount()) != sizeof(bytes))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    prescan.Header = ReadSnapshotHeader(bytes);
+    if (prescan.Header.KeySize != c_totalSizeInBytes)
+    {
+        throw SnapshotException(c_hrInvalidData, "Invalid wrapped key size.");
+    }
+
+    const uint64_t contentEnd = sizeof(EncryptedSnapshotHeader) + uint64_t{ prescan.Header.KeySize } + prescan.Header.ContentSize;
+    if ((prescan.Header.ContentSize < c_tagSizeInBytes) || (contentEnd > prescan.FileSize))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    return prescan;
+}
+
+// Largest first, so the longest snapshots start while there is still other work to overlap them with instead of
+// running alone at the end. Ties keep their listing order.
+template <typename T, typename SizeOf>
+void OrderLargestFirst(std::span<T> items, SizeOf&& sizeOf)
+{
+    std::stable_sort(items.begin(), items.end(), [&](T const& left, T const& right) { return sizeOf(left) > sizeOf(right); });
+}
+
+// Bytes of snapshot data that may be in flight at once across all stages. The reader acquires each snapshot's
+// size before loading it and the writer releases it once the snapshot is done, so a slow writer or a run of large
+// snapshots throttles reading. A snapshot larger than the whole budget is still let through, alone.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(uint64_t limit) : m_limit(limit) {}
+
+    MemoryBudget(MemoryBudget const&) = delete;
+    MemoryBudget& operator=(MemoryBudget const&) = delete;
+
+    void Acquire(uint64_t bytes)
+    {
+        std::unique_lock lock(m_mutex);
+        m_released.wait(lock, [&] { return Fits(bytes); });
+        m_inUse += bytes;
+        m_peak = (std::max)(m_peak, m_inUse);
+    }
+
+    bool TryAcquire(uint64_t bytes)
+    {
+        std::lock_guard lock(m_mutex);
+        if (!Fits(bytes))
+        {
+            return false;
+        }
+        m_inUse += bytes;
+        m_peak = (std::max)(m_peak, m_inUse);
+        return true;
+    }
+
+    void Release(uint64_t bytes)
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_inUse -= (std::min)(bytes, m_inUse);
+        }
+        m_released.notify_all();
+    }
+
+    uint64_t Limit() const
+    {
+        return m_limit;
+    }
+
+    // The most ever acquired at once.
+    uint64_t Peak() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_peak;
+    }
+
+private:
+    bool Fits(uint64_t bytes) const
+    {
+        return (m_inUse == 0) || (bytes <= m_limit - (std::min)(m_limit, m_inUse));
+    }
+
+    uint64_t m_limit;
+    uint64_t m_inUse = 0;
+    uint64_t m_peak = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+};
+
+// How many threads may do something at once; a batch bounds the reads and writes in flight across all of its
+// exports with one, so running many exports together does not turn into hundreds of competing requests.
+class ConcurrencyLimit
+{
+public:
+    explicit ConcurrencyLimit(unsigned limit) : m_limit((std::max)(1u, limit)) {}
+
+    ConcurrencyLimit(ConcurrencyLimit const&) = delete;
+    ConcurrencyLimit& operator=(ConcurrencyLimit const&) = delete;
+
+    void Acquire()
+    {
+        std::unique_lock lock(m_mutex);
+        m_released.wait(lock, [&] { return m_inUse < m_limit; });
+        m_inUse++;
+    }
+
+    void Release()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_inUse--;
+        }
+        m_released.notify_one();
+    }
+
+    unsigned Limit() const
+    {
+        return m_limit;
+    }
+
+private:
+    unsigned m_limit;
+    unsigned m_inUse = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+};
+
+// Holds one slot of a ConcurrencyLimit for its lifetime; a null limit holds nothing.
+class ConcurrencySlot
+{
+public:
+    explicit ConcurrencySlot(ConcurrencyLimit* limit) : m_limit(limit)
+    {
+        if (m_limit != nullptr)
+        {
+            m_limit->Acquire();
+        }
+    }
+
+    ~ConcurrencySlot()
+    {
+        if (m_limit != nullptr)
+        {
+            m_limit->Release();
+        }
+    }
+
+    ConcurrencySlot(ConcurrencySlot const&) = delete;
+    ConcurrencySlot& operator=(ConcurrencySlot const&) = delete;
+
+private:
+    ConcurrencyLimit* m_limit;
+};
+
+// Runs the tasks of several exports on one WorkStealingPool. Each export submits through its own Lane, which holds up
+// to 'capacity' waiting tasks; the scheduler moves them into the pool one lane at a time, round-robin, and keeps no
+// more than 'inFlightLimit' of them in the pool, so an export with ten snapshots is not stuck behind one with ten
+// thousand. A task that a lane's task submits in turn (the metadata stage after decryption) continues work that
+// already has its turn: it goes straight to the pool, to the same worker, and only counts toward its lane's WaitIdle.
+class FairScheduler
+{
+public:
+    class Lane
+    {
+    public:
+        Lane(FairScheduler& scheduler, size_t capacity) : m_scheduler(scheduler), m_capacity((std::max)(size_t{ 1 }, capacity))
+        {
+            std::lock_guard lock(m_scheduler.m_mutex);
+            m_scheduler.m_lanes.push_back(this);
+        }
+
+        ~Lane()
+        {
+            WaitIdle();
+            std::lock_guard lock(m_scheduler.m_mutex);
+            auto& lanes = m_scheduler.m_lanes;
+            const auto index = static_cast<size_t>(std::find(lanes.begin(), lanes.end(), this) - lanes.begin());
+            lanes.erase(lanes.begin() + index);
+            if (m_scheduler.m_nextLane > index)
+            {
+                m_scheduler.m_nextLane--;
+            }
+        }
+
+        Lane(Lane const&) = delete;
+        Lane& operator=(Lane const&) = delete;
+
+        // Blocks while the lane is full. Called from outside the pool, or from one of this lane's own tasks. Tasks
+        // must not throw.
+        void Submit(std::function<void()> task)
+        {
+            if (t_currentLane == this)
+            {
+                {
+                    std::lock_guard lock(m_scheduler.m_mutex);
+                    m_outstanding++;
+                    m_notStarted++;
+                }
+                m_scheduler.m_pool.Submit([this, task = std::move(task)] { m_scheduler.Run(*this, task, false); });
+                return;
+            }
+
+            {
+                std::unique_lock lock(m_scheduler.m_mutex);
+                m_changed.wait(lock, [&] { return m_waiting.size() < m_capacity; });
+                m_waiting.push_back(std::move(task));
+                m_outstanding++;
+                m_notStarted++;
+            }
+            m_scheduler.Dispatch();
+        }
+
+        // Blocks until every task submitted through this lane, including the ones they submitted in turn, has
+        // finished.
+        void WaitIdle()
+        {
+            std::unique_lock lock(m_scheduler.m_mutex);
+            m_changed.wait(lock, [&] { return m_outstanding == 0; });
+        }
+
+        // Tasks submitted but not yet started, whether still in the lane or already in the pool.
+        size_t QueuedTasks() const
+        {
+            std::lock_guard lock(m_scheduler.m_mutex);
+            return m_notStarted;
+        }
+
+    private:
+        friend class FairScheduler;
+
+        FairScheduler& m_scheduler;
+        size_t m_capacity;
+        std::deque<std::function<void()>> m_waiting;
+        size_t m_outstanding = 0;
+        size_t m_notStarted = 0;
+        std::condition_variable m_changed;
+    };
+
+    FairScheduler(unsigned threadCount, size_t inFlightLimit) :
+        m_inFlightLimit((std::max)(size_t{ 1 }, inFlightLimit)), m_pool(threadCount, m_inFlightLimit)
+    {
+    }
+
+    FairScheduler(FairScheduler const&) = delete;
+    FairScheduler& operator=(FairScheduler const&) = delete;
+
+    unsigned ThreadCount() const
+    {
+        return m_pool.ThreadCount();
+    }
+
+private:
+    // Moves waiting tasks into the pool while there is room. The pool's injection queue holds the whole in-flight
+    // limit, so submitting outside the lock never blocks.
+    void Dispatch()
+    {
+        for (;;)
+        {
+            Lane* lane = nullptr;
+            std::function<void()> task;
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_inFlight >= m_inFlightLimit)
+                {
+                    return;
+                }
+
+                for (size_t offset = 0; (offset < m_lanes.size()) && (lane == nullptr); offset++)
+                {
+                    const size_t index = (m_nextLane + offset) % m_lanes.size();
+                    if (!m_lanes[index]->m_waiting.empty())
+                    {
+                        lane = m_lanes[index];
+                        m_nextLane = index + 1;
+                    }
+                }
+                if (lane == nullptr)
+                {
+                    return;
+                }
+
+                task = std::move(lane->m_waiting.front());
+                lane->m_waiting.pop_front();
+                m_inFlight++;
+            }
+            lane->m_changed.notify_all();
+            m_pool.Submit([this, lane, task = std::move(task)] { Run(*lane, task, true); });
+        }
+    }
+
+    void Run(Lane& lane, std::function<void()> const& task, bool dispatched)
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            lane.m_notStarted--;
+        }
+
+        auto* const previousLane = t_currentLane;
+        t_currentLane = &lane;
+        task();
+        t_currentLane = previousLane;
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_inFlight -= dispatched ? 1 : 0;
+            if (--lane.m_outstanding == 0)
+            {
+                lane.m_changed.notify_all();
+            }
+        }
+        if (dispatched)
+        {
+            Dispatch();
+        }
+    }
+
+    static inline thread_local Lane* t_currentLane = nullptr;
+
+    size_t m_inFlightLimit;
+    size_t m_inFlight = 0;
+    std::vector<Lane*> m_lanes;
+    size_t m_nextLane = 0;
+    mutable std::mutex m_mutex;
+    WorkStealingPool m_pool;
+};
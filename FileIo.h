@@ -0,0 +1,779 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <wil/resource.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define FILEIO_IO_URING 1
+#include <atomic>
+#include <cstdlib>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// Whole-file reads and writes, many in flight at once. Requests are tagged with caller-chosen user data and their
+// completions are collected with Reap. A backend is driven by one thread: the export pipeline uses one for reading
+// containers and another for writing outputs.
+struct FileIoCompletion
+{
+    uint64_t UserData = 0;
+    std::error_code Error;
+    PooledBuffer Data;  // The file's contents, for reads, in a buffer from the shared BufferPool.
+};
+
+class FileIoBackend
+{
+public:
+    virtual ~FileIoBackend() = default;
+
+    virtual wchar_t const* Name() const = 0;
+
+    // Reads all of 'path'.
+    virtual void SubmitRead(std::filesystem::path const& path, uint64_t userData) = 0;
+
+    // Creates or replaces 'path' with 'data', which must stay alive until the request's completion is reaped.
+    virtual void SubmitWrite(std::filesystem::path const& path, std::span<uint8_t const> data, uint64_t userData) = 0;
+
+    // Appends finished requests to 'completions', first waiting until at least 'minimum' have finished or nothing is
+    // left in flight. Returns the number appended.
+    virtual size_t Reap(std::vector<FileIoCompletion>& completions, size_t minimum) = 0;
+
+    // Requests submitted and not yet reaped.
+    virtual size_t InFlight() const = 0;
+};
+
+namespace details
+{
+#if defined(_WIN32)
+    inline std::error_code LastFileIoError()
+    {
+        return { static_cast<int>(GetLastError()), std::system_category() };
+    }
+
+    inline std::error_code ReadWholeFile(std::filesystem::path const& path, PooledBuffer& data)
+    {
+        wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        LARGE_INTEGER size{};
+        if (!file || !GetFileSizeEx(file.get(), &size))
+        {
+            return LastFileIoError();
+        }
+
+        data.resize(static_cast<size_t>(size.QuadPart));
+        for (size_t offset = 0; offset < data.size();)
+        {
+            DWORD read = 0;
+            const auto request = static_cast<DWORD>((std::min)(data.size() - offset, size_t{ 1 } << 30));
+            if (!ReadFile(file.get(), data.data() + offset, request, &read, nullptr))
+            {
+                return LastFileIoError();
+            }
+            if (read == 0)
+            {
+                return std::make_error_code(std::errc::io_error);  // The file shrank.
+            }
+            offset += read;
+        }
+        return {};
+    }
+
+    inline std::error_code WriteWholeFile(std::filesystem::path const& path, std::span<uint8_t const> data)
+    {
+        wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            return LastFileIoError();
+        }
+
+        for (size_t offset = 0; offset < data.size();)
+        {
+            DWORD written = 0;
+            const auto request = static_cast<DWORD>((std::min)(data.size() - offset, size_t{ 1 } << 30));
+            if (!WriteFile(file.get(), data.data() + offset, request, &written, nullptr))
+            {
+                return LastFileIoError();
+            }
+            if (written == 0)
+            {
+                return std::make_error_code(std::errc::io_error);
+            }
+            offset += written;
+        }
+        return {};
+    }
+#else
+    inline std::error_code LastFileIoError()
+    {
+        return { errno, std::system_category() };
+    }
+
+    inline std::error_code ReadWholeFile(std::filesystem::path const& path, PooledBuffer& data)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return LastFileIoError();
+        }
+
+        std::error_code error;
+        struct stat status{};
+        if (fstat(fd, &status) != 0)
+        {
+            error = LastFileIoError();
+        }
+        else
+        {
+            data.resize(static_cast<size_t>(status.st_size));
+            for (size_t offset = 0; offset < data.size();)
+            {
+                const auto read = pread(fd, data.data() + offset, data.size() - offset, static_cast<off_t>(offset));
+                if ((read < 0) && (errno == EINTR))
+                {
+                    continue;
+                }
+                if (read <= 0)
+                {
+                    error = (read < 0) ? LastFileIoError() : std::make_error_code(std::errc::io_error);
+                    break;
+                }
+                offset += static_cast<size_t>(read);
+            }
+        }
+        close(fd);
+        return error;
+    }
+
+    inline std::error_code WriteWholeFile(std::filesystem::path const& path, std::span<uint8_t const> data)
+    {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return LastFileIoError();
+        }
+
+        std::error_code error;
+        for (size_t offset = 0; offset < data.size();)
+        {
+            const auto written = pwrite(fd, data.data() + offset, data.size() - offset, static_cast<off_t>(offset));
+            if ((written < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                error = (written < 0) ? LastFileIoError() : std::make_error_code(std::errc::io_error);  // No progress; retrying would spin.
+                break;
+            }
+            offset += static_cast<size_t>(written);
+        }
+        if ((close(fd) != 0) && !error)
+        {
+            error = LastFileIoError();
+        }
+        return error;
+    }
+#endif
+}
+
+// Portable backend: a fixed set of threads performs blocking reads and writes, so up to 'queueDepth' requests are
+// in progress at once.
+class ThreadPoolFileIo final : public FileIoBackend
+{
+public:
+    explicit ThreadPoolFileIo(unsigned queueDepth)
+    {
+        for (unsigned i = 0; i < (std::max)(queueDepth, 1u); i++)
+        {
+            m_threads.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ~ThreadPoolFileIo() override
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_requestAvailable.notify_all();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    wchar_t const* Name() const override
+    {
+        return L"threads";
+    }
+
+    void SubmitRead(std::filesystem::path const& path, uint64_t userData) override
+    {
+        Submit({ path, {}, userData, true });
+    }
+
+    void SubmitWrite(std::filesystem::path const& path, std::span<uint8_t const> data, uint64_t userData) override
+    {
+        Submit({ path, data, userData, false });
+    }
+
+    size_t Reap(std::vector<FileIoCompletion>& completions, size_t minimum) override
+    {
+        std::unique_lock lock(m_mutex);
+        m_completionAvailable.wait(lock, [&] { return (m_completions.size() >= minimum) || (m_completions.size() == m_inFlight); });
+        const auto count = m_completions.size();
+        for (auto& completion : m_completions)
+        {
+            completions.push_back(std::move(completion));
+        }
+        m_completions.clear();
+        m_inFlight -= count;
+        return count;
+    }
+
+    size_t InFlight() const override
+    {
+        std::lock_guard lock(m_mutex);
+        return m_inFlight;
+    }
+
+private:
+    struct Request
+    {
+        std::filesystem::path Path;
+        std::span<uint8_t const> Data;
+        uint64_t UserData;
+        bool IsRead;
+    };
+
+    void Submit(Request request)
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_requests.push_back(std::move(request));
+            m_inFlight++;
+        }
+        m_requestAvailable.notify_one();
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            std::unique_lock lock(m_mutex);
+            m_requestAvailable.wait(lock, [&] { return m_stopping || !m_requests.empty(); });
+            if (m_requests.empty())
+            {
+                return;
+            }
+            auto request = std::move(m_requests.front());
+            m_requests.pop_front();
+            lock.unlock();
+
+            FileIoCompletion completion;
+            completion.UserData = request.UserData;
+            completion.Error = request.IsRead ? details::ReadWholeFile(request.Path, completion.Data) : details::WriteWholeFile(request.Path, request.Data);
+
+            lock.lock();
+            m_completions.push_back(std::move(completion));
+            lock.unlock();
+            m_completionAvailable.notify_one();
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestAvailable;
+    std::condition_variable m_completionAvailable;
+    std::deque<Request> m_requests;
+    std::vector<FileIoCompletion> m_completions;
+    size_t m_inFlight = 0;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+};
+
+#if defined(FILEIO_IO_URING)
+// io_uring backend, driven through the raw system calls. Files are opened and closed synchronously, and their data
+// moves in chunks through a pool of fixed-size buffers registered with the kernel once, so the kernel does not pin
+// and unpin pages per request. Chunks of many files (and several chunks of one large file) are in flight at once,
+// one per pool buffer, and each Reap submits everything queued with a single io_uring_enter. If the buffers
+// cannot be registered (e.g. RLIMIT_MEMLOCK on older kernels) the same pool is used with plain reads and writes.
+//
+// Each chunk is copied once between its pool buffer and the caller's memory: a read's contents are handed over in a
+// PooledBuffer that outlives the request, and a write's data is wherever the caller keeps it, so neither is in the
+// registered region. Registering that memory instead would pin and unpin it per file, which is the cost the fixed
+// pool exists to avoid.
+class IoUringFileIo final : public FileIoBackend
+{
+public:
+    static constexpr size_t c_defaultBufferSize = 256 * 1024;
+
+    // Throws std::system_error if io_uring is unavailable, e.g. disabled by the kernel or a seccomp policy.
+    explicit IoUringFileIo(unsigned queueDepth, size_t bufferSize = c_defaultBufferSize) :
+        m_bufferSize(bufferSize), m_bufferCount((std::max)(queueDepth, 1u))
+    {
+        io_uring_params params{};
+        m_ring = static_cast<int>(syscall(__NR_io_uring_setup, m_bufferCount, &params));
+        if (m_ring < 0)
+        {
+            throw std::system_error(details::LastFileIoError(), "io_uring_setup");
+        }
+
+        try
+        {
+            MapRings(params);
+            AllocateBuffers();
+        }
+        catch (...)
+        {
+            Unmap();
+            close(m_ring);
+            free(m_buffers);
+            throw;
+        }
+    }
+
+    ~IoUringFileIo() override
+    {
+        // Requests still in the kernel reference the buffers, so wait for them before releasing anything.
+        std::vector<FileIoCompletion> discarded;
+        try
+        {
+            while (m_chunksInFlight > 0)
+            {
+                Enter(true);
+                ProcessCompletions(discarded);
+            }
+        }
+        catch (...)
+        {
+            m_buffers = nullptr;  // Leaked rather than freed under the kernel.
+        }
+        for (auto& operation : m_operations)
+        {
+            if (operation && (operation->Fd >= 0))
+            {
+                close(operation->Fd);
+            }
+        }
+        Unmap();
+        close(m_ring);
+        free(m_buffers);
+    }
+
+    IoUringFileIo(IoUringFileIo const&) = delete;
+    IoUringFileIo& operator=(IoUringFileIo const&) = delete;
+
+    wchar_t const* Name() const override
+    {
+        return m_buffersRegistered ? L"io_uring" : L"io_uring (unregistered buffers)";
+    }
+
+    void SubmitRead(std::filesystem::path const& path, uint64_t userData) override
+    {
+        auto operation = std::make_unique<Operation>();
+        operation->UserData = userData;
+        operation->IsRead = true;
+        operation->Fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status{};
+        if ((operation->Fd < 0) || (fstat(operation->Fd, &status) != 0))
+        {
+            operation->Error = details::LastFileIoError();
+        }
+        else
+        {
+            operation->Result.resize(static_cast<size_t>(status.st_size));
+            operation->Size = operation->Result.size();
+        }
+        Queue(std::move(operation));
+    }
+
+    void SubmitWrite(std::filesystem::path const& path, std::span<uint8_t const> data, uint64_t userData) override
+    {
+        auto operation = std::make_unique<Operation>();
+        operation->UserData = userData;
+        operation->Source = data;
+        operation->Size = data.size();
+        operation->Fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (operation->Fd < 0)
+        {
+            operation->Error = details::LastFileIoError();
+        }
+        Queue(std::move(operation));
+    }
+
+    size_t Reap(std::vector<FileIoCompletion>& completions, size_t minimum) override
+    {
+        const auto start = completions.size();
+        for (;;)
+        {
+            FillSubmissionQueue();
+            Enter((completions.size() - start < minimum) && (m_chunksInFlight > 0));
+            ProcessCompletions(completions);
+
+            const auto reaped = completions.size() - start;
+            if ((reaped >= minimum) || (reaped == m_inFlight))
+            {
+                m_inFlight -= reaped;
+                return reaped;
+            }
+        }
+    }
+
+    size_t InFlight() const override
+    {
+        return m_inFlight;
+    }
+
+private:
+    struct Operation
+    {
+        uint64_t UserData = 0;
+        bool IsRead = false;
+        int Fd = -1;
+        size_t Size = 0;
+        size_t NextOffset = 0;     // Start of the next chunk to submit.
+        size_t Transferred = 0;
+        unsigned ChunksInFlight = 0;
+        std::error_code Error;
+        PooledBuffer Result;
+        std::span<uint8_t const> Source;
+        size_t Index = 0;          // Slot in m_operations.
+        bool Finished = false;
+    };
+
+    struct Chunk
+    {
+        Operation* Owner = nullptr;
+        size_t Offset = 0;
+        size_t Length = 0;
+        size_t Done = 0;  // For short transfers, which are resubmitted for the remainder.
+    };
+
+    template <typename T>
+    static T* RingField(void* base, uint32_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<uint8_t*>(base) + offset);
+    }
+
+    void MapRings(io_uring_params const& params)
+    {
+        m_submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            m_submissionRingSize = m_completionRingSize = (std::max)(m_submissionRingSize, m_completionRingSize);
+        }
+
+        m_submissionRing = mmap(nullptr, m_submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+        if (m_submissionRing == MAP_FAILED)
+        {
+            m_submissionRing = nullptr;
+            throw std::system_error(details::LastFileIoError(), "mmap");
+        }
+        m_completionRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_submissionRing :
+            mmap(nullptr, m_completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+        if (m_completionRing == MAP_FAILED)
+        {
+            m_completionRing = nullptr;
+            throw std::system_error(details::LastFileIoError(), "mmap");
+        }
+        m_submissionEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* entries = mmap(nullptr, m_submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+        if (entries == MAP_FAILED)
+        {
+            throw std::system_error(details::LastFileIoError(), "mmap");
+        }
+        m_submissionEntries = static_cast<io_uring_sqe*>(entries);
+
+        m_submissionHead = RingField<uint32_t>(m_submissionRing, params.sq_off.head);
+        m_submissionTail = RingField<uint32_t>(m_submissionRing, params.sq_off.tail);
+        m_submissionMask = *RingField<uint32_t>(m_submissionRing, params.sq_off.ring_mask);
+        m_submissionArray = RingField<uint32_t>(m_submissionRing, params.sq_off.array);
+        m_submissionCapacity = params.sq_entries;
+        m_completionHead = RingField<uint32_t>(m_completionRing, params.cq_off.head);
+        m_completionTail = RingField<uint32_t>(m_completionRing, params.cq_off.tail);
+        m_completionMask = *RingField<uint32_t>(m_completionRing, params.cq_off.ring_mask);
+        m_completionEntries = RingField<io_uring_cqe>(m_completionRing, params.cq_off.cqes);
+    }
+
+    void Unmap()
+    {
+        if (m_submissionEntries)
+        {
+            munmap(m_submissionEntries, m_submissionEntriesSize);
+        }
+        if (m_completionRing && (m_completionRing != m_submissionRing))
+        {
+            munmap(m_completionRing, m_completionRingSize);
+        }
+        if (m_submissionRing)
+        {
+            munmap(m_submissionRing, m_submissionRingSize);
+        }
+    }
+
+    void AllocateBuffers()
+    {
+        if (posix_memalign(&m_buffers, 4096, m_bufferSize * m_bufferCount) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        std::vector<iovec> vectors(m_bufferCount);
+        for (size_t i = 0; i < m_bufferCount; i++)
+        {
+            vectors[i] = { Buffer(i), m_bufferSize };
+            m_freeBuffers.push_back(i);
+        }
+        m_chunks.resize(m_bufferCount);
+        m_buffersRegistered = syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS, vectors.data(), m_bufferCount) == 0;
+    }
+
+    uint8_t* Buffer(size_t index) const
+    {
+        return static_cast<uint8_t*>(m_buffers) + index * m_bufferSize;
+    }
+
+    void Queue(std::unique_ptr<Operation> operation)
+    {
+        m_inFlight++;
+        if (m_freeOperationSlots.empty())
+        {
+            m_freeOperationSlots.push_back(m_operations.size());
+            m_operations.emplace_back();
+        }
+        operation->Index = m_freeOperationSlots.back();
+        m_freeOperationSlots.pop_back();
+        m_waiting.push_back(operation->Index);
+        m_operations[operation->Index] = std::move(operation);
+    }
+
+    // Queues an operation for completion once it has failed or transferred everything and no chunk of it is still
+    // with the kernel.
+    void TryFinish(Operation& operation)
+    {
+        if (!operation.Finished && (operation.ChunksInFlight == 0) && (operation.Error || (operation.Transferred == operation.Size)))
+        {
+            operation.Finished = true;
+            m_finished.push_back(operation.Index);
+        }
+    }
+
+    // Writes submission entries for waiting chunks, as many as there are free buffers.
+    void FillSubmissionQueue()
+    {
+        while (!m_waiting.empty())
+        {
+            auto& operation = *m_operations[m_waiting.front()];
+            if (operation.Error || (operation.NextOffset >= operation.Size))
+            {
+                m_waiting.pop_front();
+                TryFinish(operation);
+                continue;
+            }
+            if (m_freeBuffers.empty())
+            {
+                break;
+            }
+
+            const auto buffer = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+            auto& chunk = m_chunks[buffer];
+            chunk = { &operation, operation.NextOffset, (std::min)(m_bufferSize, operation.Size - operation.NextOffset), 0 };
+            operation.NextOffset += chunk.Length;
+            operation.ChunksInFlight++;
+            if (!operation.IsRead)
+            {
+                // The caller's data is not registered memory (see above).
+                memcpy(Buffer(buffer), operation.Source.data() + chunk.Offset, chunk.Length);
+            }
+            PrepareChunk(buffer);
+        }
+    }
+
+    // Fills the next submission entry with the untransferred part of the buffer's chunk and publishes it.
+    void PrepareChunk(size_t buffer)
+    {
+        auto const& chunk = m_chunks[buffer];
+        auto tail = std::atomic_ref(*m_submissionTail);
+        const auto position = tail.load(std::memory_order_relaxed);
+        const auto index = position & m_submissionMask;
+        auto& entry = m_submissionEntries[index];
+        memset(&entry, 0, sizeof(entry));
+        if (m_buffersRegistered)
+        {
+            entry.opcode = chunk.Owner->IsRead ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            entry.buf_index = static_cast<uint16_t>(buffer);
+        }
+        else
+        {
+            entry.opcode = chunk.Owner->IsRead ? IORING_OP_READ : IORING_OP_WRITE;
+        }
+        entry.fd = chunk.Owner->Fd;
+        entry.off = chunk.Offset + chunk.Done;
+        entry.addr = reinterpret_cast<uint64_t>(Buffer(buffer) + chunk.Done);
+        entry.len = static_cast<uint32_t>(chunk.Length - chunk.Done);
+        entry.user_data = buffer;
+        m_submissionArray[index] = index;
+        tail.store(position + 1, std::memory_order_release);
+        m_chunksInFlight++;
+    }
+
+    // Hands every published entry to the kernel and, if 'wait' is set, blocks until at least one chunk completes.
+    void Enter(bool wait)
+    {
+        for (;;)
+        {
+            const auto toSubmit = std::atomic_ref(*m_submissionTail).load(std::memory_order_relaxed) - std::atomic_ref(*m_submissionHead).load(std::memory_order_acquire);
+            if ((toSubmit == 0) && !wait)
+            {
+                return;
+            }
+
+            const auto result = syscall(__NR_io_uring_enter, m_ring, toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0)
+            {
+                return;
+            }
+            if (errno == EAGAIN || errno == EBUSY)
+            {
+                wait = true;  // The kernel is short of resources; let some requests complete before submitting more.
+            }
+            else if (errno != EINTR)
+            {
+                throw std::system_error(details::LastFileIoError(), "io_uring_enter");
+            }
+        }
+    }
+
+    void ProcessCompletions(std::vector<FileIoCompletion>& completions)
+    {
+        auto head = std::atomic_ref(*m_completionHead);
+        auto position = head.load(std::memory_order_relaxed);
+        const auto tail = std::atomic_ref(*m_completionTail).load(std::memory_order_acquire);
+        for (; position != tail; position++)
+        {
+            auto const& entry = m_completionEntries[position & m_completionMask];
+            const auto buffer = static_cast<size_t>(entry.user_data);
+            auto& chunk = m_chunks[buffer];
+            auto& operation = *chunk.Owner;
+            m_chunksInFlight--;
+
+            if (entry.res < 0)
+            {
+                operation.Error = { -entry.res, std::system_category() };
+            }
+            else if (entry.res == 0)
+            {
+                operation.Error = std::make_error_code(std::errc::io_error);  // The file shrank while being read.
+            }
+            else if (chunk.Done + static_cast<size_t>(entry.res) < chunk.Length)
+            {
+                // A short transfer; the buffer stays with this chunk and the remainder goes back to the kernel.
+                chunk.Done += static_cast<size_t>(entry.res);
+                PrepareChunk(buffer);
+                continue;
+            }
+            else
+            {
+                if (operation.IsRead)
+                {
+                    // The pool buffer goes back to the ring; the result outlives it (see above).
+                    memcpy(operation.Result.data() + chunk.Offset, Buffer(buffer), chunk.Length);
+                }
+                operation.Transferred += chunk.Length;
+            }
+
+            operation.ChunksInFlight--;
+            m_freeBuffers.push_back(buffer);
+            TryFinish(operation);
+        }
+        head.store(position, std::memory_order_release);
+
+        for (auto index : m_finished)
+        {
+            auto operation = std::move(m_operations[index]);
+            std::erase(m_waiting, index);
+            m_freeOperationSlots.push_back(index);
+            if ((operation->Fd >= 0) && (close(operation->Fd) != 0) && !operation->Error && !operation->IsRead)
+            {
+                operation->Error = details::LastFileIoError();
+            }
+            completions.push_back({ operation->UserData, operation->Error, std::move(operation->Result) });
+        }
+        m_finished.clear();
+    }
+
+    int m_ring = -1;
+    size_t m_bufferSize;
+    size_t m_bufferCount;
+    void* m_buffers = nullptr;
+    bool m_buffersRegistered = false;
+
+    void* m_submissionRing = nullptr;
+    void* m_completionRing = nullptr;
+    size_t m_submissionRingSize = 0;
+    size_t m_completionRingSize = 0;
+    io_uring_sqe* m_submissionEntries = nullptr;
+    size_t m_submissionEntriesSize = 0;
+    uint32_t* m_submissionHead = nullptr;
+    uint32_t* m_submissionTail = nullptr;
+    uint32_t* m_submissionArray = nullptr;
+    uint32_t m_submissionMask = 0;
+    uint32_t m_submissionCapacity = 0;
+    uint32_t* m_completionHead = nullptr;
+    uint32_t* m_completionTail = nullptr;
+    uint32_t m_completionMask = 0;
+    io_uring_cqe* m_completionEntries = nullptr;
+
+    std::vector<std::unique_ptr<Operation>> m_operations;
+    std::vector<size_t> m_freeOperationSlots;
+    std::deque<size_t> m_waiting;
+    std::vector<size_t> m_finished;
+    std::vector<Chunk> m_chunks;
+    std::vector<size_t> m_freeBuffers;
+    size_t m_chunksInFlight = 0;
+    size_t m_inFlight = 0;
+};
+#endif
+
+// io_uring where the platform and kernel provide it, otherwise the thread-pool backend.
+inline std::unique_ptr<FileIoBackend> CreateFileIoBackend(unsigned queueDepth)
+{
+#if defined(FILEIO_IO_URING)
+    try
+    {
+        return std::make_unique<IoUringFileIo>(queueDepth);
+    }
+    catch (std::system_error const&)
+    {
+    }
+#endif
+    return std::make_unique<ThreadPoolFileIo>(queueDepth);
+}
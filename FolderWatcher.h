@@ -0,0 +1,380 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "DirectoryScanner.h"
+#include "SnapshotFormat.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <wil/resource.h>
+#include <wil/result.h>
+#elif defined(__linux__) && __has_include(<sys/inotify.h>)
+#define FOLDERWATCHER_INOTIFY 1
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+#endif
+
+enum class SnapshotFileState
+{
+    Incomplete,  // Shorter than its header says: still being written, or truncated.
+    Complete,
+    Malformed,   // No amount of further writing makes this a container; decryption reports it.
+};
+
+// Whether a file that may still be being written holds its whole container: its 16-byte header has arrived and the
+// file reaches the end of the wrapped key and content the header declares. Reads only the header.
+inline SnapshotFileState CheckSnapshotFile(std::filesystem::path const& path, uint64_t fileSize)
+{
+    if (fileSize < sizeof(EncryptedSnapshotHeader))
+    {
+        return SnapshotFileState::Incomplete;
+    }
+
+    std::ifstream input(path, std::ios::binary);
+    uint8_t bytes[sizeof(EncryptedSnapshotHeader)];
+    input.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+    if (static_cast<size_t>(input.gcount()) != sizeof(bytes))
+    {
+        return SnapshotFileState::Incomplete;
+    }
+
+    const auto keySize = ReadLittleEndian32(bytes + 4);
+    const auto contentSize = ReadLittleEndian32(bytes + 8);
+    if ((ReadLittleEndian32(bytes) != c_snapshotContainerVersion) || (keySize != c_totalSizeInBytes) || (contentSize < c_tagSizeInBytes))
+    {
+        return SnapshotFileState::Malformed;
+    }
+
+    const uint64_t contentEnd = sizeof(EncryptedSnapshotHeader) + uint64_t{ keySize } + contentSize;
+    return (fileSize >= contentEnd) ? SnapshotFileState::Complete : SnapshotFileState::Incomplete;
+}
+
+// Waits for files in a folder to change: ReadDirectoryChangesW on Windows, inotify on Linux, and elsewhere nothing, in
+// which case the caller lists the folder on a timer. A notification only names a file that may have changed; the
+// caller looks at the file itself.
+class FolderWatcher
+{
+public:
+    FolderWatcher(std::filesystem::path const& root, bool recursive) : m_root(root), m_recursive(recursive)
+    {
+#if defined(_WIN32)
+        m_directory.reset(CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr));
+        THROW_LAST_ERROR_IF(!m_directory);
+        m_event.create(wil::EventOptions::ManualReset);
+        m_overlapped.hEvent = m_event.get();
+        m_buffer.resize(c_bufferSize / sizeof(DWORD));
+        Issue();
+#elif defined(FOLDERWATCHER_INOTIFY)
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "inotify_init1");
+        }
+        try
+        {
+            AddWatches({});
+        }
+        catch (...)
+        {
+            close(m_fd);
+            throw;
+        }
+#endif
+    }
+
+    ~FolderWatcher()
+    {
+#if defined(_WIN32)
+        // The buffer must outlive the request, so the cancellation is waited for.
+        DWORD bytes = 0;
+        if (CancelIoEx(m_directory.get(), &m_overlapped) || (GetLastError() != ERROR_NOT_FOUND))
+        {
+            GetOverlappedResult(m_directory.get(), &m_overlapped, &bytes, TRUE);
+        }
+#elif defined(FOLDERWATCHER_INOTIFY)
+        close(m_fd);
+#endif
+    }
+
+    FolderWatcher(FolderWatcher const&) = delete;
+    FolderWatcher& operator=(FolderWatcher const&) = delete;
+
+    wchar_t const* Name() const
+    {
+#if defined(_WIN32)
+        return L"ReadDirectoryChangesW";
+#elif defined(FOLDERWATCHER_INOTIFY)
+        return L"inotify";
+#else
+        return L"polling";
+#endif
+    }
+
+    // Whether Wait reports changes at all; without notifications it only ever waits out the timeout.
+    bool Notifies() const
+    {
+#if defined(_WIN32) || defined(FOLDERWATCHER_INOTIFY)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Waits up to 'timeout' for changes, and appends the paths, relative to the root, of files and folders that may
+    // have changed. Returns false if changes may have been missed (too many arrived at once, or there are no
+    // notifications), in which case the caller lists the whole folder again.
+    bool Wait(std::chrono::milliseconds timeout, std::vector<std::filesystem::path>& changed)
+    {
+#if defined(_WIN32)
+        DWORD bytes = 0;
+        if (!GetOverlappedResultEx(m_directory.get(), &m_overlapped, &bytes, static_cast<DWORD>(timeout.count()), FALSE))
+        {
+            const auto error = GetLastError();
+            if (error == WAIT_TIMEOUT)
+            {
+                return true;
+            }
+            if (error != ERROR_NOTIFY_ENUM_DIR)
+            {
+                THROW_WIN32(error);
+            }
+        }
+
+        // No bytes means the changes did not fit in the buffer.
+        for (DWORD offset = 0; bytes > 0;)
+        {
+            auto const& entry = *reinterpret_cast<FILE_NOTIFY_INFORMATION const*>(reinterpret_cast<uint8_t const*>(m_buffer.data()) + offset);
+            if ((entry.Action == FILE_ACTION_ADDED) || (entry.Action == FILE_ACTION_MODIFIED) || (entry.Action == FILE_ACTION_RENAMED_NEW_NAME))
+            {
+                changed.emplace_back(std::wstring(entry.FileName, entry.FileNameLength / sizeof(wchar_t)));
+            }
+            if (entry.NextEntryOffset == 0)
+            {
+                break;
+            }
+            offset += entry.NextEntryOffset;
+        }
+        Issue();
+        return bytes > 0;
+#elif defined(FOLDERWATCHER_INOTIFY)
+        pollfd descriptor{ m_fd, POLLIN, 0 };
+        const int ready = poll(&descriptor, 1, static_cast<int>(timeout.count()));
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                return true;
+            }
+            throw std::system_error(errno, std::system_category(), "poll");
+        }
+
+        bool complete = true;
+        alignas(inotify_event) char buffer[c_bufferSize];
+        for (;;)
+        {
+            const auto length = read(m_fd, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                if ((length < 0) && (errno != EAGAIN) && (errno != EINTR))
+                {
+                    throw std::system_error(errno, std::system_category(), "read inotify");
+                }
+                break;
+            }
+
+            for (ssize_t offset = 0; offset < length;)
+            {
+                auto const& event = *reinterpret_cast<inotify_event const*>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+                if (event.mask & IN_Q_OVERFLOW)
+                {
+                    complete = false;
+                    continue;
+                }
+
+                const auto folder = m_folders.find(event.wd);
+                if ((folder == m_folders.end()) || (event.len == 0))
+                {
+                    continue;
+                }
+
+                // A new subfolder is watched from now on, and whatever was written to it before that is found by
+                // the caller, which lists folders it is told about.
+                const auto relativePath = folder->second / event.name;
+                if (m_recursive && (event.mask & IN_ISDIR) && (event.mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    AddWatches(relativePath);
+                }
+                changed.push_back(relativePath);
+            }
+        }
+        return complete;
+#else
+        static_cast<void>(changed);
+        std::this_thread::sleep_for(timeout);
+        return false;
+#endif
+    }
+
+private:
+    static constexpr size_t c_bufferSize = 64 * 1024;
+
+#if defined(_WIN32)
+    void Issue()
+    {
+        THROW_IF_WIN32_BOOL_FALSE(ReadDirectoryChangesW(m_directory.get(), m_buffer.data(), static_cast<DWORD>(c_bufferSize), m_recursive,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr,
+            &m_overlapped, nullptr));
+    }
+
+    wil::unique_hfile m_directory;
+    wil::unique_event m_event;
+    OVERLAPPED m_overlapped{};
+    std::vector<DWORD> m_buffer;
+#elif defined(FOLDERWATCHER_INOTIFY)
+    // Watches a folder and, when recursive, every folder below it; links to folders are not followed, as in
+    // ScanDirectory.
+    void AddWatches(std::filesystem::path const& relativePath)
+    {
+        std::vector<std::filesystem::path> folders{ relativePath };
+        while (!folders.empty())
+        {
+            const auto folder = std::move(folders.back());
+            folders.pop_back();
+            const int wd = inotify_add_watch(m_fd, (m_root / folder).c_str(),
+                IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW);
+            if (wd < 0)
+            {
+                // A subfolder that is already gone is not worth failing the watch for.
+                if (!folder.empty() && (errno == ENOENT))
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "inotify_add_watch");
+            }
+            m_folders[wd] = folder;
+
+            std::error_code error;
+            for (std::filesystem::directory_iterator entry(m_root / folder, error), end; m_recursive && !error && (entry != end); entry.increment(error))
+            {
+                if (entry->is_directory(error) && !entry->is_symlink(error))
+                {
+                    folders.push_back(folder / entry->path().filename());
+                }
+            }
+        }
+    }
+
+    int m_fd = -1;
+    std::unordered_map<int, std::filesystem::path> m_folders;
+#endif
+
+    std::filesystem::path m_root;
+    bool m_recursive;
+};
+
+// --watch: how long a watch waits for notifications before looking at its incomplete files again, and how often the
+// folder is listed when there are no notifications. Also bounds how long stopping a watch takes.
+constexpr std::chrono::milliseconds c_watchRecheckInterval{ 100 };
+constexpr std::chrono::milliseconds c_watchPollInterval{ 500 };
+
+// --watch: lists the folder, then keeps watching it until 'stop' is set. 'onReady' is called for each matching file
+// once it holds its whole container (see CheckSnapshotFile), and again whenever its size or modification time changes
+// after that, so a snapshot written in place after being exported is exported again. A file that cannot be read is
+// looked at again on its next change.
+template <typename OnReady>
+void WatchSnapshotFolder(FolderWatcher& watcher, std::filesystem::path const& root, ScanOptions const& options, std::atomic<bool> const& stop,
+    OnReady&& onReady)
+{
+    struct FileVersion
+    {
+        uint64_t Size = 0;
+        std::filesystem::file_time_type LastWriteTime;
+
+        bool operator==(FileVersion const&) const = default;
+    };
+
+    std::map<std::filesystem::path, FileVersion> handed;
+    std::set<std::filesystem::path> incomplete;
+    auto examine = [&](std::filesystem::path const& relativePath)
+    {
+        const auto path = root / relativePath;
+        std::error_code error;
+        const FileVersion version{ std::filesystem::file_size(path, error), std::filesystem::last_write_time(path, error) };
+        if (error)
+        {
+            incomplete.erase(relativePath);
+            return;
+        }
+
+        const auto previous = handed.find(relativePath);
+        if ((previous != handed.end()) && (previous->second == version))
+        {
+            incomplete.erase(relativePath);
+            return;
+        }
+
+        if (CheckSnapshotFile(path, version.Size) == SnapshotFileState::Incomplete)
+        {
+            incomplete.insert(relativePath);
+            return;
+        }
+        incomplete.erase(relativePath);
+        handed[relativePath] = version;
+        onReady(ScannedFile{ path, relativePath });
+    };
+
+    bool listAll = true;
+    std::vector<std::filesystem::path> changed;
+    for (;;)
+    {
+        // A file being written is named once per write.
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        for (auto const& relativePath : changed)
+        {
+            std::error_code error;
+            if (std::filesystem::is_directory(root / relativePath, error))
+            {
+                listAll = listAll || options.Recursive;
+            }
+            else if ((options.Recursive || !relativePath.has_parent_path()) && details::IsScanMatch(relativePath.filename().native(), options))
+            {
+                examine(relativePath);
+            }
+        }
+        changed.clear();
+
+        if (listAll)
+        {
+            ScanDirectory(root, options, [&](ScannedFile const& file) { examine(file.RelativePath); });
+        }
+        for (auto const& relativePath : std::vector(incomplete.begin(), incomplete.end()))
+        {
+            examine(relativePath);
+        }
+
+        if (stop.load())
+        {
+            return;
+        }
+        listAll = !watcher.Wait((watcher.Notifies() && !incomplete.empty()) ? c_watchRecheckInterval : c_watchPollInterval, changed);
+    }
+}
@@ -0,0 +1,358 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <wincodec.h>
+#include <wil/com.h>
+#include <wil/result.h>
+#elif __has_include(<jpeglib.h>)
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#include <jerror.h>
+#define RSE_HAS_LIBJPEG 1
+#endif
+
+#include "SnapshotFormat.h"
+
+constexpr int c_thumbnailQuality = 85;
+
+// Scale denominators a JPEG decoder can apply while inverse-transforming each 8x8 block, so that only an 8/N x 8/N
+// IDCT is computed per block instead of decoding at full size and then resampling.
+inline bool IsSupportedThumbnailScale(unsigned denominator)
+{
+    return (denominator == 1) || (denominator == 2) || (denominator == 4) || (denominator == 8);
+}
+
+namespace details
+{
+#if defined(_WIN32)
+    // WIC needs COM on every worker thread; the export's threads belong to the multithreaded apartment.
+    inline IWICImagingFactory* ThreadImagingFactory()
+    {
+        struct ComApartment
+        {
+            HRESULT Result = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+            ~ComApartment()
+            {
+                if (SUCCEEDED(Result))
+                {
+                    CoUninitialize();
+                }
+            }
+        };
+
+        thread_local ComApartment apartment;
+        thread_local wil::com_ptr<IWICImagingFactory> factory = wil::CoCreateInstance<IWICImagingFactory>(CLSID_WICImagingFactory);
+        return factory.get();
+    }
+
+    inline std::vector<uint8_t> EncodeWicJpeg(IWICImagingFactory* factory, IWICBitmapSource* source, int quality)
+    {
+        wil::com_ptr<IStream> stream;
+        THROW_IF_FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream));
+        wil::com_ptr<IWICBitmapEncoder> encoder;
+        THROW_IF_FAILED(factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder));
+        THROW_IF_FAILED(encoder->Initialize(stream.get(), WICBitmapEncoderNoCache));
+
+        wil::com_ptr<IWICBitmapFrameEncode> frame;
+        wil::com_ptr<IPropertyBag2> properties;
+        THROW_IF_FAILED(encoder->CreateNewFrame(&frame, &properties));
+        PROPBAG2 option{};
+        option.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+        VARIANT value{};
+        value.vt = VT_R4;
+        value.fltVal = static_cast<float>(quality) / 100.0f;
+        THROW_IF_FAILED(properties->Write(1, &option, &value));
+        THROW_IF_FAILED(frame->Initialize(properties.get()));
+
+        // WriteSource converts to a pixel format the encoder takes, so the source's format never has to be checked.
+        UINT width = 0;
+        UINT height = 0;
+        THROW_IF_FAILED(source->GetSize(&width, &height));
+        THROW_IF_FAILED(frame->SetSize(width, height));
+        THROW_IF_FAILED(frame->WriteSource(source, nullptr));
+        THROW_IF_FAILED(frame->Commit());
+        THROW_IF_FAILED(encoder->Commit());
+
+        STATSTG status{};
+        THROW_IF_FAILED(stream->Stat(&status, STATFLAG_NONAME));
+        std::vector<uint8_t> jpeg(static_cast<size_t>(status.cbSize.QuadPart));
+        THROW_IF_FAILED(stream->Seek({}, STREAM_SEEK_SET, nullptr));
+        ULONG read = 0;
+        THROW_IF_FAILED(stream->Read(jpeg.data(), static_cast<ULONG>(jpeg.size()), &read));
+        jpeg.resize(read);
+        return jpeg;
+    }
+#elif defined(RSE_HAS_LIBJPEG)
+    // libjpeg reports errors through error_exit, which must not return, and throwing through its C frames is not
+    // safe, so errors long-jump back to the setjmp in the function that owns the codec objects.
+    struct JpegErrorManager
+    {
+        jpeg_error_mgr Manager;
+        jmp_buf Jump;
+    };
+
+    inline jpeg_error_mgr* InitializeJpegErrors(JpegErrorManager& errors)
+    {
+        jpeg_std_error(&errors.Manager);
+        errors.Manager.error_exit = [](j_common_ptr codec) { longjmp(reinterpret_cast<JpegErrorManager*>(codec->err)->Jump, 1); };
+        errors.Manager.output_message = [](j_common_ptr) {};
+        return &errors.Manager;
+    }
+
+    // Compresses straight into a vector, grown by doubling, instead of jpeg_mem_dest's malloc'd buffer.
+    struct JpegVectorDestination
+    {
+        jpeg_destination_mgr Manager;
+        std::vector<uint8_t>* Output;
+    };
+
+    inline void AttachJpegDestination(jpeg_compress_struct& codec, JpegVectorDestination& destination, std::vector<uint8_t>& output)
+    {
+        destination.Output = &output;
+        destination.Manager.init_destination = [](j_compress_ptr codec)
+        {
+            auto& self = *reinterpret_cast<JpegVectorDestination*>(codec->dest);
+            self.Manager.next_output_byte = self.Output->data();
+            self.Manager.free_in_buffer = self.Output->size();
+        };
+        destination.Manager.empty_output_buffer = [](j_compress_ptr codec) -> boolean
+        {
+            auto& self = *reinterpret_cast<JpegVectorDestination*>(codec->dest);
+            const auto used = self.Output->size();
+            bool grown = true;
+            try
+            {
+                self.Output->resize(2 * used);
+            }
+            catch (...)
+            {
+                grown = false;
+            }
+            if (!grown)
+            {
+                codec->err->msg_code = JERR_OUT_OF_MEMORY;
+                codec->err->error_exit(reinterpret_cast<j_common_ptr>(codec));
+            }
+            self.Manager.next_output_byte = self.Output->data() + used;
+            self.Manager.free_in_buffer = self.Output->size() - used;
+            return TRUE;
+        };
+        destination.Manager.term_destination = [](j_compress_ptr codec)
+        {
+            auto& self = *reinterpret_cast<JpegVectorDestination*>(codec->dest);
+            self.Output->resize(self.Output->size() - self.Manager.free_in_buffer);
+        };
+        codec.dest = &destination.Manager;
+    }
+
+    // Decodes at 1/denominator scale and re-encodes row group by row group, so no full-size (or even thumbnail-size)
+    // pixel buffer exists. YCbCr images stay in YCbCr throughout, which skips the colour conversion in both
+    // directions. 'output' must not be empty; it is grown as needed. Returns false if libjpeg rejected the image.
+    inline bool TryScaleJpeg(std::span<uint8_t const> jpeg, unsigned denominator, int quality, std::vector<uint8_t>& output)
+    {
+        // Both codecs report to the same manager, so either one's errors land here.
+        JpegErrorManager errors;
+        jpeg_decompress_struct decoder{};
+        jpeg_compress_struct encoder{};
+        JpegVectorDestination destination{};
+        decoder.err = InitializeJpegErrors(errors);
+        encoder.err = decoder.err;
+        jpeg_create_decompress(&decoder);
+        jpeg_create_compress(&encoder);
+        if (setjmp(errors.Jump))
+        {
+            jpeg_destroy_compress(&encoder);
+            jpeg_destroy_decompress(&decoder);
+            return false;
+        }
+
+        jpeg_mem_src(&decoder, jpeg.data(), static_cast<unsigned long>(jpeg.size()));
+        jpeg_read_header(&decoder, TRUE);
+        decoder.scale_num = 1;
+        decoder.scale_denom = denominator;
+        decoder.do_fancy_upsampling = FALSE;  // Chroma is replicated rather than interpolated; invisible at thumbnail size.
+        if ((decoder.jpeg_color_space != JCS_YCbCr) && (decoder.jpeg_color_space != JCS_GRAYSCALE))
+        {
+            decoder.out_color_space = JCS_RGB;
+        }
+        else
+        {
+            decoder.out_color_space = decoder.jpeg_color_space;
+        }
+        jpeg_start_decompress(&decoder);
+
+        AttachJpegDestination(encoder, destination, output);
+        encoder.image_width = decoder.output_width;
+        encoder.image_height = decoder.output_height;
+        encoder.input_components = decoder.output_components;
+        encoder.in_color_space = decoder.out_color_space;
+        jpeg_set_defaults(&encoder);
+        jpeg_set_quality(&encoder, quality, TRUE);
+        jpeg_start_compress(&encoder, TRUE);
+
+        const auto stride = static_cast<size_t>(decoder.output_width) * decoder.output_components;
+        const auto rowsPerCall = static_cast<size_t>(decoder.rec_outbuf_height);
+        auto* rows = static_cast<JSAMPARRAY>((*decoder.mem->alloc_sarray)(
+            reinterpret_cast<j_common_ptr>(&decoder), JPOOL_IMAGE, static_cast<JDIMENSION>(stride), static_cast<JDIMENSION>(rowsPerCall)));
+        while (decoder.output_scanline < decoder.output_height)
+        {
+            const auto decoded = jpeg_read_scanlines(&decoder, rows, static_cast<JDIMENSION>(rowsPerCall));
+            jpeg_write_scanlines(&encoder, rows, decoded);
+        }
+
+        jpeg_finish_compress(&encoder);
+        jpeg_finish_decompress(&decoder);
+        jpeg_destroy_compress(&encoder);
+        jpeg_destroy_decompress(&decoder);
+        return true;
+    }
+
+    inline bool TryEncodeJpeg(std::span<uint8_t const> pixels, uint32_t width, uint32_t height, unsigned components, int quality,
+        std::vector<uint8_t>& output)
+    {
+        JpegErrorManager errors;
+        jpeg_compress_struct encoder{};
+        JpegVectorDestination destination{};
+        encoder.err = InitializeJpegErrors(errors);
+        jpeg_create_compress(&encoder);
+        if (setjmp(errors.Jump))
+        {
+            jpeg_destroy_compress(&encoder);
+            return false;
+        }
+
+        AttachJpegDestination(encoder, destination, output);
+        encoder.image_width = width;
+        encoder.image_height = height;
+        encoder.input_components = static_cast<int>(components);
+        encoder.in_color_space = (components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_set_defaults(&encoder);
+        jpeg_set_quality(&encoder, quality, TRUE);
+        jpeg_start_compress(&encoder, TRUE);
+        const auto stride = static_cast<size_t>(width) * components;
+        while (encoder.next_scanline < height)
+        {
+            auto* row = const_cast<JSAMPROW>(pixels.data() + encoder.next_scanline * stride);
+            jpeg_write_scanlines(&encoder, &row, 1);
+        }
+        jpeg_finish_compress(&encoder);
+        jpeg_destroy_compress(&encoder);
+        return true;
+    }
+#endif
+}
+
+// Re-encodes a JPEG at 1/denominator of its width and height (rounded up), where the denominator is 1, 2, 4 or 8.
+// The scaling happens inside the decoder's inverse DCT (WIC's IWICBitmapSourceTransform on Windows, libjpeg-turbo
+// elsewhere), so a 1/8 thumbnail decodes only each block's DC coefficient and costs a fraction of a full decode.
+// Throws SnapshotException with c_hrInvalidData if the image cannot be decoded, std::system_error if this build has
+// no JPEG codec, and, on Windows, a WIL exception for any other codec failure.
+inline std::vector<uint8_t> ScaleJpeg(std::span<uint8_t const> jpeg, unsigned denominator, int quality = c_thumbnailQuality)
+{
+    if (!IsSupportedThumbnailScale(denominator))
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Unsupported thumbnail scale.");
+    }
+
+#if defined(_WIN32)
+    auto* factory = details::ThreadImagingFactory();
+    wil::com_ptr<IWICStream> stream;
+    THROW_IF_FAILED(factory->CreateStream(&stream));
+    THROW_IF_FAILED(stream->InitializeFromMemory(const_cast<BYTE*>(jpeg.data()), static_cast<DWORD>(jpeg.size())));
+    wil::com_ptr<IWICBitmapDecoder> decoder;
+    if (FAILED(factory->CreateDecoderFromStream(stream.get(), nullptr, WICDecodeMetadataCacheOnDemand, &decoder)))
+    {
+        throw SnapshotException(c_hrInvalidData, "The screenshot is not a JPEG image.");
+    }
+    wil::com_ptr<IWICBitmapFrameDecode> frame;
+    THROW_IF_FAILED(decoder->GetFrame(0, &frame));
+
+    UINT width = 0;
+    UINT height = 0;
+    THROW_IF_FAILED(frame->GetSize(&width, &height));
+    width = (width + denominator - 1) / denominator;
+    height = (height + denominator - 1) / denominator;
+
+    // The JPEG decoder implements the transform by scaling its IDCT; the decoder picks the pixel format closest to the
+    // image's own, so there is no colour conversion either. Other decoders fall back to a Fant resampler.
+    wil::com_ptr<IWICBitmapSource> scaled;
+    if (const auto transform = frame.try_query<IWICBitmapSourceTransform>())
+    {
+        WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+        THROW_IF_FAILED(transform->GetClosestSize(&width, &height));
+        THROW_IF_FAILED(transform->GetClosestPixelFormat(&format));
+        wil::com_ptr<IWICComponentInfo> info;
+        THROW_IF_FAILED(factory->CreateComponentInfo(format, &info));
+        UINT bitsPerPixel = 0;
+        THROW_IF_FAILED(info.query<IWICPixelFormatInfo>()->GetBitsPerPixel(&bitsPerPixel));
+
+        const UINT stride = (width * bitsPerPixel + 7) / 8;
+        std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height);
+        THROW_IF_FAILED(transform->CopyPixels(nullptr, width, height, &format, WICBitmapTransformRotate0, stride, static_cast<UINT>(pixels.size()), pixels.data()));
+        wil::com_ptr<IWICBitmap> bitmap;
+        THROW_IF_FAILED(factory->CreateBitmapFromMemory(width, height, format, stride, static_cast<UINT>(pixels.size()), pixels.data(), &bitmap));
+        scaled = bitmap;
+    }
+    else
+    {
+        wil::com_ptr<IWICBitmapScaler> scaler;
+        THROW_IF_FAILED(factory->CreateBitmapScaler(&scaler));
+        THROW_IF_FAILED(scaler->Initialize(frame.get(), width, height, WICBitmapInterpolationModeFant));
+        scaled = scaler;
+    }
+    return details::EncodeWicJpeg(factory, scaled.get(), quality);
+#elif defined(RSE_HAS_LIBJPEG)
+    std::vector<uint8_t> output(64 * 1024 + jpeg.size() / (denominator * denominator) / 2);
+    if (!details::TryScaleJpeg(jpeg, denominator, quality, output))
+    {
+        throw SnapshotException(c_hrInvalidData, "The screenshot is not a JPEG image that can be decoded.");
+    }
+    return output;
+#else
+    (void)jpeg;
+    (void)quality;
+    throw std::system_error(std::make_error_code(std::errc::not_supported), "This build has no JPEG codec for thumbnails.");
+#endif
+}
+
+// Compresses 8-bit RGB (components == 3) or greyscale (components == 1) pixels, rows top to bottom with no padding.
+// The benchmarks use it to build full-size screenshots to scale. Throws like ScaleJpeg.
+inline std::vector<uint8_t> EncodeJpeg(std::span<uint8_t const> pixels, uint32_t width, uint32_t height, unsigned components, int quality)
+{
+    if (((components != 1) && (components != 3)) || (pixels.size() != static_cast<size_t>(width) * height * components))
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Invalid pixel buffer.");
+    }
+
+#if defined(_WIN32)
+    auto* factory = details::ThreadImagingFactory();
+    const auto format = (components == 1) ? GUID_WICPixelFormat8bppGray : GUID_WICPixelFormat24bppRGB;
+    wil::com_ptr<IWICBitmap> bitmap;
+    THROW_IF_FAILED(factory->CreateBitmapFromMemory(width, height, format, width * components, static_cast<UINT>(pixels.size()),
+        const_cast<BYTE*>(pixels.data()), &bitmap));
+    return details::EncodeWicJpeg(factory, bitmap.get(), quality);
+#elif defined(RSE_HAS_LIBJPEG)
+    std::vector<uint8_t> output(64 * 1024 + pixels.size() / 8);
+    if (!details::TryEncodeJpeg(pixels, width, height, components, quality, output))
+    {
+        throw SnapshotException(c_hrInvalidData, "Encoding the JPEG image has failed.");
+    }
+    return output;
+#else
+    (void)width;
+    (void)height;
+    (void)quality;
+    throw std::system_error(std::make_error_code(std::errc::not_supported), "This build has no JPEG codec for thumbnails.");
+#endif
+}
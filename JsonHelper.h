@@ -2,23 +2,23 @@
 
 #pragma once
 
+#include <rometadataresolution.h>
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Foundation.Collections.h>
-#include <winrt/Windows.Data.Json.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <cstring>
+#include <span>
 #include <string>
+#include <vector>
+
+#include "JsonWriter.h"
 
 namespace winrt
 {
     using namespace winrt::Windows::Foundation;
     using namespace winrt::Windows::Foundation::Collections;
-    using namespace winrt::Windows::Data::Json;
 }
 
-struct JsonValueMaker : winrt::Windows::Data::Json::IJsonValueStatics
-{
-    JsonValueMaker() : IJsonValueStatics(winrt::get_activation_factory<winrt::Windows::Data::Json::JsonValue, IJsonValueStatics>()) {}
-};
-
 inline std::wstring guid_to_wstring(const winrt::guid& value)
 {
     auto converted = winrt::to_hstring(value);
@@ -36,185 +36,179 @@ inline std::wstring guid_to_wstring(const winrt::guid& value)
 }
 
 template<typename T>
-winrt::IJsonValue NumberArrayToJson(winrt::com_array<T> const& numberArray)
+void NumberArrayToJson(winrt::com_array<T> const& numberArray, JsonWriter& writer)
 {
-    winrt::JsonArray jsonArray;
-    JsonValueMaker valueMaker;
+    writer.BeginArray();
     for (const auto& number : numberArray)
     {
-        jsonArray.Append(valueMaker.CreateStringValue(std::to_wstring(number)));
+        writer.Number(number);
     }
-
-    return jsonArray;
+    writer.EndArray();
 }
 
-winrt::IJsonValue RectToJsonArray(winrt::Windows::Foundation::Rect const& rect)
+inline void RectToJsonArray(winrt::Windows::Foundation::Rect const& rect, JsonWriter& writer)
 {
-    winrt::JsonArray jsonArray;
-    JsonValueMaker valueMaker;
-
-    jsonArray.ReplaceAll({
-        valueMaker.CreateStringValue(std::to_wstring(rect.X)),
-        valueMaker.CreateStringValue(std::to_wstring(rect.Y)),
-        valueMaker.CreateStringValue(std::to_wstring(rect.Height)),
-        valueMaker.CreateStringValue(std::to_wstring(rect.Width)) });
-
-    return jsonArray;
+    writer.BeginArray();
+    writer.Number(rect.X);
+    writer.Number(rect.Y);
+    writer.Number(rect.Height);
+    writer.Number(rect.Width);
+    writer.EndArray();
 }
 
-winrt::IJsonValue DateTimeToJson(winrt::Windows::Foundation::DateTime const& dateTime)
+inline void DateTimeToJson(winrt::Windows::Foundation::DateTime const& dateTime, JsonWriter& writer)
 {
-    JsonValueMaker valueMaker;
     auto sysTime = winrt::clock::to_sys(dateTime);
     int64_t timeIntegerRep = std::chrono::duration_cast<std::chrono::milliseconds>(sysTime.time_since_epoch()).count();
-    return valueMaker.CreateStringValue(std::to_wstring(timeIntegerRep));
+    writer.Number(timeIntegerRep);
 }
 
-winrt::IJsonValue TimeSpanToJson(winrt::Windows::Foundation::TimeSpan const& timeSpan)
+inline void TimeSpanToJson(winrt::Windows::Foundation::TimeSpan const& timeSpan, JsonWriter& writer)
 {
-    JsonValueMaker valueMaker;
     int64_t durationIntegerRep = std::chrono::duration_cast<std::chrono::milliseconds>(timeSpan).count();
-    return valueMaker.CreateStringValue(std::to_wstring(durationIntegerRep));
+    writer.Number(durationIntegerRep);
 }
 
-winrt::IJsonValue TypedPropertyValueToJson(winrt::IPropertyValue const& propertyValue)
+inline void TypedPropertyValueToJson(winrt::IPropertyValue const& propertyValue, JsonWriter& writer)
 {
-    JsonValueMaker valueMaker;
-    winrt::IJsonValue jsonValue;
     switch (propertyValue.Type())
     {
     case winrt::PropertyType::Int16:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetInt16()));
+        writer.Number(propertyValue.GetInt16());
         break;
     case winrt::PropertyType::Int32:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetInt32()));
+        writer.Number(propertyValue.GetInt32());
         break;
     case winrt::PropertyType::UInt8:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetUInt8()));
+        writer.Number(propertyValue.GetUInt8());
         break;
     case winrt::PropertyType::UInt16:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetUInt16()));
+        writer.Number(propertyValue.GetUInt16());
         break;
     case winrt::PropertyType::UInt32:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetUInt32()));
+        writer.Number(propertyValue.GetUInt32());
         break;
     case winrt::PropertyType::Single:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetSingle()));
+        writer.Number(propertyValue.GetSingle());
         break;
     case winrt::PropertyType::Double:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetDouble()));
+        writer.Number(propertyValue.GetDouble());
         break;
     case winrt::PropertyType::Char16:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetChar16()));
+        writer.Number(static_cast<uint32_t>(propertyValue.GetChar16()));
         break;
     case winrt::PropertyType::Int64:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetInt64()));
+        writer.Number(propertyValue.GetInt64());
         break;
     case winrt::PropertyType::UInt64:
-        jsonValue = valueMaker.CreateStringValue(std::to_wstring(propertyValue.GetUInt64()));
+        writer.Number(propertyValue.GetUInt64());
         break;
     case winrt::PropertyType::Guid:
-        jsonValue = valueMaker.CreateStringValue(guid_to_wstring(propertyValue.GetGuid()));
+        writer.String(guid_to_wstring(propertyValue.GetGuid()));
         break;
     case winrt::PropertyType::Rect:
-        jsonValue = RectToJsonArray(propertyValue.GetRect());
+        RectToJsonArray(propertyValue.GetRect(), writer);
         break;
     case winrt::PropertyType::Int16Array:
     {
         winrt::com_array<int16_t> numberArray;
         propertyValue.GetInt16Array(numberArray);
-        jsonValue = NumberArrayToJson<int16_t>(numberArray);
+        NumberArrayToJson<int16_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::Int32Array:
     {
         winrt::com_array<int32_t> numberArray;
         propertyValue.GetInt32Array(numberArray);
-        jsonValue = NumberArrayToJson<int32_t>(numberArray);
+        NumberArrayToJson<int32_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::UInt8Array:
     {
         winrt::com_array<uint8_t> numberArray;
         propertyValue.GetUInt8Array(numberArray);
-        jsonValue = NumberArrayToJson<uint8_t>(numberArray);
+        NumberArrayToJson<uint8_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::UInt16Array:
     {
         winrt::com_array<uint16_t> numberArray;
         propertyValue.GetUInt16Array(numberArray);
-        jsonValue = NumberArrayToJson<uint16_t>(numberArray);
+        NumberArrayToJson<uint16_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::UInt32Array:
     {
         winrt::com_array<uint32_t> numberArray;
         propertyValue.GetUInt32Array(numberArray);
-        jsonValue = NumberArrayToJson<uint32_t>(numberArray);
+        NumberArrayToJson<uint32_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::SingleArray:
     {
         winrt::com_array<float_t> numberArray;
         propertyValue.GetSingleArray(numberArray);
-        jsonValue = NumberArrayToJson<float_t>(numberArray);
+        NumberArrayToJson<float_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::DoubleArray:
     {
         winrt::com_array<double_t> numberArray;
         propertyValue.GetDoubleArray(numberArray);
-        jsonValue = NumberArrayToJson<double_t>(numberArray);
+        NumberArrayToJson<double_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::Char16Array:
     {
         winrt::com_array<char16_t> numberArray;
         propertyValue.GetChar16Array(numberArray);
-        jsonValue = NumberArrayToJson<char16_t>(numberArray);
+        writer.BeginArray();
+        for (const auto& number : numberArray)
+        {
+            writer.Number(static_cast<uint32_t>(number));
+        }
+        writer.EndArray();
         break;
     }
     case winrt::PropertyType::Int64Array:
     {
         winrt::com_array<int64_t> numberArray;
         propertyValue.GetInt64Array(numberArray);
-        jsonValue = NumberArrayToJson<int64_t>(numberArray);
+        NumberArrayToJson<int64_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::UInt64Array:
     {
         winrt::com_array<uint64_t> numberArray;
         propertyValue.GetUInt64Array(numberArray);
-        jsonValue = NumberArrayToJson<uint64_t>(numberArray);
+        NumberArrayToJson<uint64_t>(numberArray, writer);
         break;
     }
     case winrt::PropertyType::DateTime:
     {
-        jsonValue = DateTimeToJson(propertyValue.GetDateTime());
+        DateTimeToJson(propertyValue.GetDateTime(), writer);
         break;
     }
     case winrt::PropertyType::TimeSpan:
     {
-        jsonValue = TimeSpanToJson(propertyValue.GetTimeSpan());
+        TimeSpanToJson(propertyValue.GetTimeSpan(), writer);
         break;
     }
     default:
         throw winrt::hresult_invalid_argument();
     }
-
-    return jsonValue;
 }
 
-winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
+// Writes a ValueSet produced by the WinRT PropertySet serializer as one JSON object.
+inline void SerializeValueSet(winrt::ValueSet const& valueSet, JsonWriter& writer)
 {
-    winrt::JsonObject jsonObject;
+    writer.BeginObject();
     for (auto&& pair : valueSet)
     {
-        winrt::hstring key = pair.Key();
+        writer.Key(std::wstring_view(pair.Key()));
         if (auto nestedValueSet = pair.Value().try_as<winrt::ValueSet>())
         {
-            jsonObject.Insert(key, SerializeValueSet(nestedValueSet));
+            SerializeValueSet(nestedValueSet, writer);
             continue;
         }
 
@@ -224,13 +218,13 @@ winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
         case winrt::PropertyType::String:
         {
             const winrt::hstring value = propertyValue.GetString();
-            jsonObject.Insert(key, winrt::JsonValue::CreateStringValue(value));
+            writer.String(std::wstring_view(value));
             break;
         }
         case winrt::PropertyType::Boolean:
         {
             const bool value = propertyValue.GetBoolean();
-            jsonObject.Insert(key, winrt::JsonValue::CreateBooleanValue(value));
+            writer.Bool(value);
             break;
         }
         case winrt::PropertyType::Int16:
@@ -258,7 +252,7 @@ winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
         case winrt::PropertyType::DateTime:
         case winrt::PropertyType::TimeSpan:
         {
-            jsonObject.Insert(key, TypedPropertyValueToJson(propertyValue));
+            TypedPropertyValueToJson(propertyValue, writer);
             break;
         }
         case winrt::PropertyType::StringArray:
@@ -266,13 +260,12 @@ winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
             winrt::com_array<winrt::hstring> stringArray;
             propertyValue.GetStringArray(stringArray);
 
-            winrt::JsonArray jsonArray;
+            writer.BeginArray();
             for (const auto& value : stringArray)
             {
-                jsonArray.Append(winrt::JsonValue::CreateStringValue(value));
+                writer.String(std::wstring_view(value));
             }
-
-            jsonObject.Insert(key, jsonArray);
+            writer.EndArray();
             break;
         }
         case winrt::PropertyType::BooleanArray:
@@ -280,13 +273,12 @@ winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
             winrt::com_array<bool> boolArray;
             propertyValue.GetBooleanArray(boolArray);
 
-            winrt::JsonArray jsonArray;
+            writer.BeginArray();
             for (const auto& value : boolArray)
             {
-                jsonArray.Append(winrt::JsonValue::CreateBooleanValue(value));
+                writer.Bool(value);
             }
-
-            jsonObject.Insert(key, jsonArray);
+            writer.EndArray();
             break;
         }
         default:
@@ -294,6 +286,32 @@ winrt::JsonObject SerializeValueSet(winrt::ValueSet const& valueSet)
             throw winrt::hresult_not_implemented();
         }
     }
+    writer.EndObject();
+}
+
+inline winrt::Windows::Storage::Streams::IPropertySetSerializer CreatePropertySetSerializer()
+{
+    winrt::Windows::Storage::Streams::IPropertySetSerializer serializer;
+    winrt::check_hresult(RoCreatePropertySetSerializer(
+        reinterpret_cast<ABI::Windows::Storage::Streams::IPropertySetSerializer**>(winrt::put_abi(serializer))));
+    return serializer;
+}
+
+// Deserializes a PropertySet with the WinRT serializer. Throws winrt::hresult_error if it is not one.
+inline winrt::ValueSet DeserializePropertySet(std::span<uint8_t const> metadataBytes)
+{
+    winrt::Windows::Storage::Streams::Buffer buffer(static_cast<uint32_t>(metadataBytes.size()));
+    buffer.Length(static_cast<uint32_t>(metadataBytes.size()));
+    memcpy_s(buffer.data(), buffer.Length(), metadataBytes.data(), metadataBytes.size());
+
+    winrt::ValueSet valueSet;
+    CreatePropertySetSerializer().Deserialize(valueSet, buffer);
+    return valueSet;
+}
 
-    return jsonObject;
-}
\ No newline at end of file
+// Serializes a ValueSet in the format Recall stores in each snapshot's MakerNote.
+inline std::vector<uint8_t> SerializePropertySet(winrt::ValueSet const& valueSet)
+{
+    const auto buffer = CreatePropertySetSerializer().Serialize(valueSet);
+    return { buffer.data(), buffer.data() + buffer.Length() };
+}
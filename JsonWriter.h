@@ -0,0 +1,358 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define JSONWRITER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// How numbers are written. Earlier releases wrote every number as a string holding std::to_wstring's output;
+// CompatibleStrings keeps that shape for consumers that depend on it.
+enum class JsonNumberStyle
+{
+    Native,
+    CompatibleStrings,
+};
+
+namespace details
+{
+    constexpr char c_hexDigits[] = "0123456789abcdef";
+
+    inline bool NeedsJsonEscape(uint32_t codeUnit)
+    {
+        return (codeUnit < 0x20) || (codeUnit == '"') || (codeUnit == '\\');
+    }
+
+    inline char* AppendJsonEscape(char* out, uint32_t codeUnit)
+    {
+        *out++ = '\\';
+        switch (codeUnit)
+        {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        default:
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = c_hexDigits[codeUnit >> 4];
+            *out++ = c_hexDigits[codeUnit & 0xF];
+            break;
+        }
+        return out;
+    }
+
+    inline char* AppendUtf8(char* out, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            *out++ = static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            *out++ = static_cast<char>(0xC0 | (codePoint >> 6));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            *out++ = static_cast<char>(0xE0 | (codePoint >> 12));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xF0 | (codePoint >> 18));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        return out;
+    }
+}
+
+// Writes compact UTF-8 JSON by appending to a std::string. Calls must form a valid document: Key before each
+// object member, and matched Begin/End calls. Strings are scanned 16 bytes at a time for characters that need
+// escaping, and numbers are formatted with std::to_chars (shortest round-trip for floating point).
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::string& output, JsonNumberStyle numberStyle = JsonNumberStyle::Native) :
+        m_output(output), m_numberStyle(numberStyle)
+    {
+    }
+
+    void BeginObject()
+    {
+        BeforeValue();
+        m_output.push_back('{');
+        m_hasMembers.push_back(false);
+    }
+
+    void EndObject()
+    {
+        m_hasMembers.pop_back();
+        m_output.push_back('}');
+    }
+
+    void BeginArray()
+    {
+        BeforeValue();
+        m_output.push_back('[');
+        m_hasMembers.push_back(false);
+    }
+
+    void EndArray()
+    {
+        m_hasMembers.pop_back();
+        m_output.push_back(']');
+    }
+
+    void Key(std::string_view utf8)
+    {
+        String(utf8);
+        m_output.push_back(':');
+        m_afterKey = true;
+    }
+
+    void Key(std::wstring_view text)
+    {
+        String(text);
+        m_output.push_back(':');
+        m_afterKey = true;
+    }
+
+    void String(std::string_view utf8)
+    {
+        BeforeValue();
+        const auto start = m_output.size();
+        m_output.resize(start + 2 + 6 * utf8.size());
+        char* out = m_output.data() + start;
+        *out++ = '"';
+
+        auto in = reinterpret_cast<uint8_t const*>(utf8.data());
+        auto end = in + utf8.size();
+        while (in < end)
+        {
+#if defined(JSONWRITER_SSE2)
+            // Copy runs of 16 bytes that need no escaping; UTF-8 sequences pass through untouched.
+            if (end - in >= 16)
+            {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+                const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(bytes, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+                const __m128i quote = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'));
+                const __m128i backslash = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'));
+                if (_mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, backslash))) == 0)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+                    in += 16;
+                    out += 16;
+                    continue;
+                }
+            }
+#endif
+            const uint8_t byte = *in++;
+            if (details::NeedsJsonEscape(byte))
+            {
+                out = details::AppendJsonEscape(out, byte);
+            }
+            else
+            {
+                *out++ = static_cast<char>(byte);
+            }
+        }
+
+        *out++ = '"';
+        m_output.resize(static_cast<size_t>(out - m_output.data()));
+    }
+
+    void Utf16String(std::span<uint8_t const> utf16)
+    {
+        const auto length = utf16.size() / 2;
+        AppendUtf16String(length, [&](size_t index)
+        {
+            return static_cast<uint32_t>(utf16[2 * index] | (utf16[2 * index + 1] << 8));
+        }, utf16.data());
+    }
+
+    // wchar_t text is UTF-16 on Windows and UTF-32 elsewhere.
+    void String(std::wstring_view text)
+    {
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            Utf16String({ reinterpret_cast<uint8_t const*>(text.data()), text.size() * 2 });
+        }
+        else
+        {
+            AppendUtf16String(text.size(), [&](size_t index) { return static_cast<uint32_t>(text[index]); }, nullptr);
+        }
+    }
+
+    void Bool(bool value)
+    {
+        BeforeValue();
+        m_output.append(value ? "true" : "false");
+    }
+
+    void Null()
+    {
+        BeforeValue();
+        m_output.append("null");
+    }
+
+    template <typename T>
+    void Number(T value)
+    {
+        static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>);
+        BeforeValue();
+
+        char buffer[512];
+        std::to_chars_result result{};
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (m_numberStyle == JsonNumberStyle::CompatibleStrings)
+            {
+                // std::to_wstring formats floating point as "%f".
+                result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, 6);
+            }
+            else if (!std::isfinite(value))
+            {
+                m_output.append("null");
+                return;
+            }
+            else
+            {
+                result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            }
+        }
+        else
+        {
+            result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        }
+
+        if (m_numberStyle == JsonNumberStyle::CompatibleStrings)
+        {
+            m_output.push_back('"');
+            m_output.append(buffer, result.ptr);
+            m_output.push_back('"');
+        }
+        else
+        {
+            m_output.append(buffer, result.ptr);
+        }
+    }
+
+    // Inserts 'json', which must be a complete, valid JSON value, as the next value.
+    void RawValue(std::string_view json)
+    {
+        BeforeValue();
+        m_output.append(json);
+    }
+
+    JsonNumberStyle NumberStyle() const
+    {
+        return m_numberStyle;
+    }
+
+private:
+    void BeforeValue()
+    {
+        if (m_afterKey)
+        {
+            m_afterKey = false;
+            return;
+        }
+
+        if (!m_hasMembers.empty())
+        {
+            if (m_hasMembers.back())
+            {
+                m_output.push_back(',');
+            }
+            m_hasMembers.back() = true;
+        }
+    }
+
+    // 'readUnit' returns the code unit at an index. When 'littleEndianUtf16' is set it points at the same code
+    // units as raw bytes, which lets runs of printable ASCII be copied 16 characters at a time.
+    template <typename ReadUnit>
+    void AppendUtf16String(size_t length, ReadUnit&& readUnit, uint8_t const* littleEndianUtf16)
+    {
+        BeforeValue();
+        const auto start = m_output.size();
+        m_output.resize(start + 2 + 6 * length);
+        char* out = m_output.data() + start;
+        *out++ = '"';
+
+        size_t i = 0;
+        while (i < length)
+        {
+#if defined(JSONWRITER_SSE2)
+            if (littleEndianUtf16 && (length - i >= 16))
+            {
+                // Saturating the 16-bit units to bytes maps everything outside ASCII to 0x80..0xFF, which compares as
+                // negative, so one signed compare catches non-ASCII and control characters together.
+                auto units = littleEndianUtf16 + 2 * i;
+                const __m128i low = _mm_loadu_si128(reinterpret_cast<__m128i const*>(units));
+                const __m128i high = _mm_loadu_si128(reinterpret_cast<__m128i const*>(units + 16));
+                const __m128i bytes = _mm_packus_epi16(low, high);
+                const __m128i special = _mm_or_si128(
+                    _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+                    _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))));
+                if (_mm_movemask_epi8(special) == 0)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+                    i += 16;
+                    out += 16;
+                    continue;
+                }
+            }
+#endif
+            uint32_t codePoint = readUnit(i++);
+            if (details::NeedsJsonEscape(codePoint))
+            {
+                out = details::AppendJsonEscape(out, codePoint);
+                continue;
+            }
+
+            if ((codePoint >= 0xD800) && (codePoint < 0xDC00) && (i < length))
+            {
+                const uint32_t next = readUnit(i);
+                if ((next >= 0xDC00) && (next < 0xE000))
+                {
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (next - 0xDC00);
+                    i++;
+                }
+            }
+
+            // Unpaired surrogates cannot be represented in UTF-8.
+            if (((codePoint >= 0xD800) && (codePoint < 0xE000)) || (codePoint > 0x10FFFF))
+            {
+                codePoint = 0xFFFD;
+            }
+            out = details::AppendUtf8(out, codePoint);
+        }
+
+        *out++ = '"';
+        m_output.resize(static_cast<size_t>(out - m_output.data()));
+    }
+
+    std::string& m_output;
+    JsonNumberStyle m_numberStyle;
+    std::vector<bool> m_hasMembers;
+    bool m_afterKey = false;
+};
@@ -0,0 +1,179 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <wil/resource.h>
+#include <wil/result.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped into memory, either read-only or as a pre-sized writable output.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    MappedFile(MappedFile&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+        }
+        return *this;
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    static MappedFile OpenRead(std::filesystem::path const& path)
+    {
+        MappedFile mapped;
+#if defined(_WIN32)
+        wil::unique_hfile file(CreateFileW(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        THROW_LAST_ERROR_IF(!file);
+
+        LARGE_INTEGER size{};
+        THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &size));
+        mapped.m_size = static_cast<size_t>(size.QuadPart);
+        if (mapped.m_size > 0)
+        {
+            wil::unique_handle mapping(CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+            THROW_LAST_ERROR_IF(!mapping);
+            mapped.m_data = static_cast<uint8_t*>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0));
+            THROW_LAST_ERROR_IF(!mapped.m_data);
+        }
+#else
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        ThrowIfPosixFailed(fd < 0, "open");
+        FileDescriptor closer{ fd };
+
+        struct stat status{};
+        ThrowIfPosixFailed(fstat(fd, &status) != 0, "fstat");
+        mapped.m_size = static_cast<size_t>(status.st_size);
+        if (mapped.m_size > 0)
+        {
+            void* data = mmap(nullptr, mapped.m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ThrowIfPosixFailed(data == MAP_FAILED, "mmap");
+            mapped.m_data = static_cast<uint8_t*>(data);
+            madvise(data, mapped.m_size, MADV_SEQUENTIAL);
+        }
+#endif
+        return mapped;
+    }
+
+    // Creates (or truncates) 'path', allocates 'size' bytes on disk and maps it for writing.
+    static MappedFile Create(std::filesystem::path const& path, size_t size)
+    {
+        MappedFile mapped;
+        mapped.m_size = size;
+#if defined(_WIN32)
+        wil::unique_hfile file(CreateFileW(
+            path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        THROW_LAST_ERROR_IF(!file);
+        if (size > 0)
+        {
+            const auto size64 = static_cast<uint64_t>(size);
+            wil::unique_handle mapping(CreateFileMappingW(
+                file.get(), nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), nullptr));
+            THROW_LAST_ERROR_IF(!mapping);
+            mapped.m_data = static_cast<uint8_t*>(MapViewOfFile(mapping.get(), FILE_MAP_WRITE, 0, 0, size));
+            THROW_LAST_ERROR_IF(!mapped.m_data);
+        }
+#else
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ThrowIfPosixFailed(fd < 0, "open");
+        FileDescriptor closer{ fd };
+        if (size > 0)
+        {
+            // Reserve real blocks up front; fall back to a sparse extension where fallocate isn't supported.
+            if (posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0)
+            {
+                ThrowIfPosixFailed(ftruncate(fd, static_cast<off_t>(size)) != 0, "ftruncate");
+            }
+
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ThrowIfPosixFailed(data == MAP_FAILED, "mmap");
+            mapped.m_data = static_cast<uint8_t*>(data);
+        }
+#endif
+        return mapped;
+    }
+
+    std::span<uint8_t const> Data() const
+    {
+        return { m_data, m_size };
+    }
+
+    std::span<uint8_t> MutableData()
+    {
+        return { m_data, m_size };
+    }
+
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+    void Close() noexcept
+    {
+        if (m_data)
+        {
+#if defined(_WIN32)
+            UnmapViewOfFile(m_data);
+#else
+            munmap(m_data, m_size);
+#endif
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+private:
+#if !defined(_WIN32)
+    struct FileDescriptor
+    {
+        int Value;
+        ~FileDescriptor()
+        {
+            close(Value);
+        }
+    };
+
+    static void ThrowIfPosixFailed(bool failed, const char* operation)
+    {
+        if (failed)
+        {
+            throw std::system_error(errno, std::generic_category(), operation);
+        }
+    }
+#endif
+
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
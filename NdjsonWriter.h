@@ -0,0 +1,135 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "JsonWriter.h"
+
+// Collects every snapshot's metadata into one newline-delimited JSON file, one
+// {"file": <snapshot file name>, "metadata": {...}} record per line. Records are batched in memory and written
+// once the batch grows past c_batchSize or c_flushInterval has passed, so a large export costs a handful of
+// writes instead of a file per snapshot. Not thread-safe: the export pipeline calls it from its writer thread.
+// With 'append' set, records are added to an existing file, which is how incremental exports extend it.
+class NdjsonMetadataWriter
+{
+public:
+    static constexpr size_t c_batchSize = 1024 * 1024;
+    static constexpr std::chrono::seconds c_flushInterval{ 2 };
+
+    explicit NdjsonMetadataWriter(std::filesystem::path const& path, bool append = false) :
+        m_path(path),
+        m_output((append ? DropTornRecord(path) : path), std::ios::binary | (append ? std::ios::app : std::ios::trunc)),
+        m_lastFlush(std::chrono::steady_clock::now())
+    {
+        if (!m_output)
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to create the metadata file.");
+        }
+        m_batch.reserve(c_batchSize + c_batchSize / 4);
+    }
+
+    ~NdjsonMetadataWriter()
+    {
+        try
+        {
+            Flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    NdjsonMetadataWriter(NdjsonMetadataWriter const&) = delete;
+    NdjsonMetadataWriter& operator=(NdjsonMetadataWriter const&) = delete;
+
+    std::filesystem::path const& Path() const
+    {
+        return m_path;
+    }
+
+    // 'metadataJson' is one complete JSON object as produced by JsonWriter. With --dedup, 'content' names the stored
+    // object holding the snapshot's image and is recorded as "content".
+    void Append(std::wstring_view fileName, std::string_view metadataJson, std::wstring_view content = {})
+    {
+        JsonWriter writer(m_batch);
+        writer.BeginObject();
+        writer.Key("file");
+        writer.String(fileName);
+        if (!content.empty())
+        {
+            writer.Key("content");
+            writer.String(content);
+        }
+        writer.Key("metadata");
+        writer.RawValue(metadataJson);
+        writer.EndObject();
+        m_batch.push_back('\n');
+
+        if ((m_batch.size() >= c_batchSize) || (std::chrono::steady_clock::now() - m_lastFlush >= c_flushInterval))
+        {
+            Flush();
+        }
+    }
+
+    // Whether some appended records have not been written to the file yet.
+    bool HasPendingRecords() const
+    {
+        return !m_batch.empty();
+    }
+
+    void Flush()
+    {
+        m_output.write(m_batch.data(), static_cast<std::streamsize>(m_batch.size()));
+        m_output.flush();
+        m_batch.clear();
+        m_lastFlush = std::chrono::steady_clock::now();
+        if (!m_output)
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "Unable to write the metadata file.");
+        }
+    }
+
+private:
+    // A run that was interrupted mid-write can leave a partial last line; cut the file back to the last complete
+    // record so that appended records start on a line of their own.
+    static std::filesystem::path const& DropTornRecord(std::filesystem::path const& path)
+    {
+        std::error_code error;
+        const auto size = std::filesystem::file_size(path, error);
+        if (error || (size == 0))
+        {
+            return path;
+        }
+
+        std::ifstream input(path, std::ios::binary);
+        uint64_t validSize = size;
+        char last = 0;
+        for (; validSize > 0; validSize--)
+        {
+            input.seekg(static_cast<std::streamoff>(validSize - 1));
+            input.get(last);
+            if (!input || (last == '\n'))
+            {
+                break;
+            }
+        }
+        input.close();
+
+        if (validSize != size)
+        {
+            std::filesystem::resize_file(path, validSize);
+        }
+        return path;
+    }
+
+    std::filesystem::path m_path;
+    std::ofstream m_output;
+    std::string m_batch;
+    std::chrono::steady_clock::time_point m_lastFlush;
+};
@@ -1,320 +1,1929 @@
 // Copyright (C) Microsoft Corporation. All rights reserved.
 // RecallSnapshotsExport.cpp : This file contains the 'main' function. Program execution begins and ends there.
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <streambuf>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <rometadataresolution.h>
 #include <wil/resource.h>
 #include <winrt/base.h>
 #include <winrt/Windows.ApplicationModel.Activation.h>
-#include <winrt/Windows.Data.Json.h>
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Foundation.Collections.h>
 #include <winrt/Windows.Globalization.h>
 #include <winrt/Windows.Globalization.DateTimeFormatting.h>
-#include <winrt/windows.graphics.imaging.h>
 #include <winrt/Windows.Storage.h>
 #include <winrt/Windows.Storage.FileProperties.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.Graphics.h>
 
+#include "ArchiveWriter.h"
+#include "Benchmark.h"
+#include "BoundedQueue.h"
+#include "ContentHash.h"
+#include "ContentStore.h"
+#include "CorpusGenerator.h"
+#include "DecryptionSession.h"
+#include "DirectoryScanner.h"
+#include "ExifReader.h"
+#include "ExportBatch.h"
+#include "ExportManifest.h"
+#include "ExportMetrics.h"
+#include "ExportOptions.h"
+#include "ExportScheduler.h"
+#include "FileIo.h"
+#include "FolderWatcher.h"
+#include "JpegThumbnail.h"
 #include "JsonHelper.h"
+#include "MappedFile.h"
+#include "NdjsonWriter.h"
+#include "SnapshotBenchmarks.h"
+#include "SnapshotCrypto.h"
+#include "SnapshotIndex.h"
+#include "StreamingDecrypt.h"
+#include "WorkStealingPool.h"
 
-inline constexpr std::wstring_view ImageMetadataStorageTag = L"/app1/ifd/exif/{ushort=37500}";
+namespace winrt
+{
+    using namespace winrt::Windows::Foundation;
+    using namespace winrt::Windows::Foundation::Collections;
+    using namespace winrt::Windows::Storage;
+    using namespace winrt::Windows::Storage::FileProperties;
+    using namespace winrt::Windows::Storage::Streams;
+    using namespace winrt::Windows::ApplicationModel::Activation;
+}
+
+// 'json' is already UTF-8, so it is written as is.
+void WriteJSONToFile(std::string const& json, std::filesystem::path const& outputPath)
+{
+    if (const auto error = details::WriteWholeFile(outputPath, { reinterpret_cast<uint8_t const*>(json.data()), json.size() }))
+    {
+        throw std::system_error(error, "Writing the metadata file has failed.");
+    }
+}
+
+// Adds the terms of one ValueSet to 'record': strings, string arrays and GUIDs under keys joined by '.' (see FieldTerm
+// and WordTerm), plus the first top-level DateTime. 'key' is the folded key of the set itself.
+void AddIndexTerms(winrt::ValueSet const& valueSet, std::string const& key, SnapshotIndexRecord& record)
+{
+    for (auto&& pair : valueSet)
+    {
+        const auto memberKey = (key.empty() ? std::string() : key + '.') + details::FoldIndexText(std::wstring_view(pair.Key()));
+        if (auto nestedValueSet = pair.Value().try_as<winrt::ValueSet>())
+        {
+            AddIndexTerms(nestedValueSet, memberKey, record);
+            continue;
+        }
+
+        auto addString = [&](std::wstring_view value)
+        {
+            const auto folded = details::FoldIndexText(value);
+            record.Terms.push_back(FieldTerm(memberKey, folded));
+            details::SplitIndexWords(folded, [&](std::string_view word) { record.Terms.push_back(WordTerm(word)); });
+        };
+
+        const auto propertyValue = pair.Value().as<winrt::IPropertyValue>();
+        switch (propertyValue.Type())
+        {
+        case winrt::PropertyType::String:
+            addString(propertyValue.GetString());
+            break;
+        case winrt::PropertyType::StringArray:
+        {
+            winrt::com_array<winrt::hstring> stringArray;
+            propertyValue.GetStringArray(stringArray);
+            for (const auto& value : stringArray)
+            {
+                addString(value);
+            }
+            break;
+        }
+        case winrt::PropertyType::Guid:
+            record.Terms.push_back(FieldTerm(memberKey, details::FoldIndexText(guid_to_wstring(propertyValue.GetGuid()))));
+            break;
+        case winrt::PropertyType::DateTime:
+            if (key.empty() && (record.Time == c_noSnapshotTime))
+            {
+                const auto sysTime = winrt::clock::to_sys(propertyValue.GetDateTime());
+                record.Time = std::chrono::duration_cast<std::chrono::milliseconds>(sysTime.time_since_epoch()).count();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Fills in a record's time and terms from a snapshot's deserialized metadata; the name is left to the caller. ValueSet
+// does not keep the blob's order, so "first DateTime" is only well defined for metadata with one top-level DateTime,
+// which is all Recall writes.
+SnapshotIndexRecord ExtractIndexRecord(winrt::ValueSet const& valueSet)
+{
+    SnapshotIndexRecord record;
+    AddIndexTerms(valueSet, std::string(), record);
+    std::sort(record.Terms.begin(), record.Terms.end());
+    record.Terms.erase(std::unique(record.Terms.begin(), record.Terms.end()), record.Terms.end());
+    return record;
+}
+
+// Reads the serialized PropertySet straight out of the image's Exif MakerNote; the image itself is never decoded.
+// The JSON is built in a per-thread buffer that is reset, not freed, between snapshots. With 'indexRecord', the
+// snapshot's time and terms are also taken from the deserialized ValueSet for the index.
+std::string TryGetSnapshotMetadata(std::span<uint8_t const> image, JsonNumberStyle numberStyle, SnapshotIndexRecord* indexRecord = nullptr)
+{
+    thread_local std::string json;
+    json.clear();
+    JsonWriter writer(json, numberStyle);
+
+    auto metadataBytes = FindSnapshotMetadata(image);
+    if (!metadataBytes)
+    {
+        writer.BeginObject();
+        writer.EndObject();
+        return json;
+    }
+
+    const auto valueSet = DeserializePropertySet(*metadataBytes);
+    SerializeValueSet(valueSet, writer);
+    if (indexRecord)
+    {
+        *indexRecord = ExtractIndexRecord(valueSet);
+    }
+    return json;
+}
+
+// The container goes into a pooled buffer, which is recycled for a later snapshot once this one has been written.
+PooledBuffer ReadSnapshotFile(std::filesystem::path const& path)
+{
+    PooledBuffer containerBytes;
+    if (const auto error = details::ReadWholeFile(path, containerBytes))
+    {
+        throw std::system_error(error, "Reading the snapshot has failed.");
+    }
+    return containerBytes;
+}
+
+void WriteSnapshotToOutputFolder(std::filesystem::path const& outputPath, std::span<uint8_t const> decryptedImage)
+{
+    if (const auto error = details::WriteWholeFile(outputPath, decryptedImage))
+    {
+        throw std::system_error(error, "Writing the screenshot has failed.");
+    }
+}
+
+// Zero-copy path: authenticates and decrypts straight from the mapped container into the mapped output file.
+// A partially written output is removed if decryption fails.
+void DecryptSnapshotToMappedFile(MappedFile const& input, std::filesystem::path const& outputPath, DecryptionSession const& session)
+{
+    auto output = MappedFile::Create(outputPath, DecryptionSession::GetDecryptedSize(input.Data()));
+    try
+    {
+        session.Decrypt(input.Data(), output.MutableData());
+    }
+    catch (...)
+    {
+        output.Close();
+        std::error_code error;
+        std::filesystem::remove(outputPath, error);
+        throw;
+    }
+}
+
+// std::filesystem and the file I/O backends report Win32 errors; errors raised with a portable std::errc are counted
+// as I/O.
+int32_t HResultFromErrorCode(std::error_code const& error)
+{
+    return (error.category() == std::system_category()) ? HRESULT_FROM_WIN32(static_cast<DWORD>(error.value())) : HRESULT_FROM_WIN32(ERROR_IO_DEVICE);
+}
+
+// Maps the exception being handled to the HRESULT reported for it. Must be called from a catch block.
+int32_t HResultFromCurrentException()
+{
+    try
+    {
+        throw;
+    }
+    catch (SnapshotException const& exception)
+    {
+        return exception.HResult();
+    }
+    catch (std::system_error const& exception)
+    {
+        return HResultFromErrorCode(exception.code());
+    }
+    catch (winrt::hresult_error const& exception)
+    {
+        return exception.code();
+    }
+    catch (...)
+    {
+        return wil::ResultFromCaughtException();
+    }
+}
+
+// A snapshot as it moves through the read -> decrypt -> metadata -> write stages of the export pipeline.
+struct SnapshotWorkItem
+{
+    winrt::hstring FileName;
+    PooledBuffer ContainerBytes;
+
+    // --incremental: recorded in the manifest once the outputs have been written.
+    std::optional<SnapshotFingerprint> Fingerprint;
+
+    // Decrypted in place: a view into ContainerBytes, which therefore lives until the image has been written.
+    std::span<uint8_t const> DecryptedImage;
+    std::optional<std::string> MetadataJson;
+    bool Failed = false;
+
+    // --index: what the index keeps of the snapshot, added once it has been written.
+    std::optional<SnapshotIndexRecord> IndexRecord;
+
+    // The first failure, for the run report.
+    ExportStage FailedStage = ExportStage::Read;
+    int32_t FailureCode = 0;
+
+    // --mmap: the container is mapped rather than read, and decrypted directly into OutputImagePath.
+    // --stream: the container is left on disk and decrypted from InputPath into OutputImagePath chunk by chunk.
+    std::optional<MappedFile> InputMapping;
+    std::filesystem::path InputPath;
+    std::filesystem::path OutputImagePath;
+    bool ImageWritten = false;
+    bool MetadataWritten = false;
+
+    // --dedup: the image's XXH3 hash, and the stored object its output was linked to, relative to the output folder.
+    std::optional<uint64_t> ContentHash;
+    std::wstring ContentPath;
+
+    // --thumbnails: the scaled image, written next to the full-size one.
+    std::vector<uint8_t> Thumbnail;
+    bool ThumbnailWritten = false;
+
+    // The container's size when known before reading it (--prescan or --memory-budget), and how much of the memory
+    // budget it holds until it is done.
+    uint64_t InputSize = 0;
+    uint64_t ReservedBytes = 0;
+};
+
+void MarkWorkItemFailed(SnapshotWorkItem& item, ExportStage stage, int32_t failureCode)
+{
+    if (!item.Failed)
+    {
+        item.Failed = true;
+        item.FailedStage = stage;
+        item.FailureCode = failureCode;
+    }
+}
+
+// Must be called from a catch block.
+void MarkWorkItemFailed(SnapshotWorkItem& item, ExportStage stage)
+{
+    if (!item.Failed)
+    {
+        MarkWorkItemFailed(item, stage, HResultFromCurrentException());
+    }
+}
+
+// --mmap and --stream read and write while decrypting, so they hold an I/O slot for it.
+void DecryptWorkItem(SnapshotWorkItem& item, DecryptionSession const& session, size_t streamingChunkSize, ConcurrencyLimit* ioLimit, ExportMetrics& metrics)
+{
+    const StageTimer timer(metrics, ExportStage::Decrypt, item.FileName);
+    try
+    {
+        if (item.InputMapping)
+        {
+            const ConcurrencySlot ioSlot(ioLimit);
+            DecryptSnapshotToMappedFile(*item.InputMapping, item.OutputImagePath, session);
+            item.ImageWritten = true;
+        }
+        else if (!item.InputPath.empty())
+        {
+            const ConcurrencySlot ioSlot(ioLimit);
+            DecryptSnapshotFile(session, item.InputPath, item.OutputImagePath, streamingChunkSize);
+            item.ImageWritten = true;
+        }
+        else
+        {
+            item.DecryptedImage = session.DecryptInPlace(item.ContainerBytes);
+        }
+    }
+    catch (...)
+    {
+        MarkWorkItemFailed(item, ExportStage::Decrypt);
+    }
+
+    if (item.Failed)
+    {
+        item.ContainerBytes.clear();
+    }
+    item.InputMapping.reset();
+}
+
+void ExtractWorkItemMetadata(SnapshotWorkItem& item, JsonNumberStyle numberStyle, bool buildIndex, ExportMetrics& metrics)
+{
+    const StageTimer timer(metrics, ExportStage::Metadata, item.FileName);
+    try
+    {
+        // An output written by --mmap or --stream is still in the page cache, and only its header pages are touched.
+        std::optional<MappedFile> writtenImage;
+        if (item.ImageWritten)
+        {
+            writtenImage = MappedFile::OpenRead(item.OutputImagePath);
+        }
+        if (buildIndex)
+        {
+            item.IndexRecord.emplace();
+        }
+        item.MetadataJson = TryGetSnapshotMetadata(writtenImage ? writtenImage->Data() : item.DecryptedImage, numberStyle,
+            item.IndexRecord ? &*item.IndexRecord : nullptr);
+    }
+    catch (...)
+    {
+        MarkWorkItemFailed(item, ExportStage::Metadata);
+    }
+}
+
+void HashWorkItemImage(SnapshotWorkItem& item, ExportMetrics& metrics)
+{
+    if (!item.DecryptedImage.empty())
+    {
+        const StageTimer timer(metrics, ExportStage::Hash, item.FileName);
+        item.ContentHash = Xxh3Hash64(item.DecryptedImage);
+    }
+}
+
+// --thumbnails: scales the image while it is still in memory, or for --mmap and --stream in the page cache, so the
+// full-size image is never read back. Runs on the pool, like the metadata stage, while earlier snapshots are written.
+void ScaleWorkItemImage(SnapshotWorkItem& item, unsigned scale, ExportMetrics& metrics)
+{
+    const StageTimer timer(metrics, ExportStage::Thumbnail, item.FileName);
+    try
+    {
+        std::optional<MappedFile> writtenImage;
+        if (item.ImageWritten)
+        {
+            writtenImage = MappedFile::OpenRead(item.OutputImagePath);
+        }
+        item.Thumbnail = ScaleJpeg(writtenImage ? writtenImage->Data() : item.DecryptedImage, scale);
+    }
+    catch (...)
+    {
+        MarkWorkItemFailed(item, ExportStage::Thumbnail);
+    }
+}
+
+// --dedup: stores the image unless an identical one already is, then links the snapshot's output to it. Only new
+// objects, and outputs that could not be linked, count as bytes written.
+void WriteDeduplicatedImage(SnapshotWorkItem& item, std::filesystem::path const& outputPath, ContentStore& contentStore, ExportMetrics& metrics)
+{
+    const auto stored = contentStore.Store(item.DecryptedImage, *item.ContentHash);
+    if (!stored.Duplicate)
+    {
+        metrics.AddBytesWritten(item.DecryptedImage.size());
+    }
+    if (!contentStore.Link(stored, outputPath, item.DecryptedImage))
+    {
+        metrics.AddBytesWritten(item.DecryptedImage.size());
+    }
+    item.ContentPath = stored.RelativePath.generic_wstring();
+    item.ImageWritten = true;
+}
+
+// Prints the progress lines for what was written and records the outcome. Every failure is reported once per file,
+// with its stage and HRESULT; progress lines for files that succeed are only printed when 'logProgress' is set.
+// Returns whether everything was written.
+bool ReportWorkItem(SnapshotWorkItem const& item, NdjsonMetadataWriter const* metadataWriter, ExportMetrics& metrics, bool logProgress)
+{
+    if (logProgress && item.ImageWritten)
+    {
+        std::wcout << L"Decrypted screenshot: " << item.FileName.c_str() << L".jpg" << std::endl;
+    }
+    if (logProgress && item.ThumbnailWritten)
+    {
+        std::wcout << L"Scaled screenshot: " << item.FileName.c_str() << L".thumb.jpg" << std::endl;
+    }
+    if (logProgress && item.MetadataWritten)
+    {
+        if (metadataWriter)
+        {
+            std::wcout << L"Decrypted metadata: " << item.FileName.c_str() << L" -> " << metadataWriter->Path().filename().c_str() << std::endl;
+        }
+        else
+        {
+            std::wcout << L"Decrypted metadata: " << item.FileName.c_str() << L".json" << std::endl;
+        }
+    }
+
+    if (item.Failed)
+    {
+        metrics.RecordFailure(item.FailedStage, item.FailureCode, item.FileName);
+        std::wcout << L"Decryption of the file has failed. FileName: " << item.FileName.c_str() << std::endl;
+        return false;
+    }
+
+    metrics.RecordCompleted();
+    return true;
+}
+
+// Writes whatever the earlier stages produced. As before, the screenshot is still written when only the
+// metadata failed. Returns whether everything was written.
+bool WriteWorkItemToOutputFolder(SnapshotWorkItem& item, std::filesystem::path const& outputFolder, NdjsonMetadataWriter* metadataWriter,
+    ContentStore* contentStore, ExportMetrics& metrics, bool logProgress)
+{
+    auto stage = ExportStage::WriteImage;
+    try
+    {
+        if (!item.DecryptedImage.empty())
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            const auto outputPath = outputFolder / (std::wstring(item.FileName) + L".jpg");
+            if (contentStore && item.ContentHash)
+            {
+                WriteDeduplicatedImage(item, outputPath, *contentStore, metrics);
+            }
+            else
+            {
+                WriteSnapshotToOutputFolder(outputPath, item.DecryptedImage);
+                metrics.AddBytesWritten(item.DecryptedImage.size());
+                item.ImageWritten = true;
+            }
+        }
+
+        if (!item.Thumbnail.empty())
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            WriteSnapshotToOutputFolder(outputFolder / (std::wstring(item.FileName) + L".thumb.jpg"), item.Thumbnail);
+            metrics.AddBytesWritten(item.Thumbnail.size());
+            item.ThumbnailWritten = true;
+        }
+
+        stage = ExportStage::WriteMetadata;
+        if (item.MetadataJson)
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            if (metadataWriter)
+            {
+                metadataWriter->Append(std::wstring_view(item.FileName), *item.MetadataJson, item.ContentPath);
+            }
+            else
+            {
+                WriteJSONToFile(*item.MetadataJson, outputFolder / (std::wstring(item.FileName) + L".json"));
+            }
+            metrics.AddBytesWritten(item.MetadataJson->size());
+            item.MetadataWritten = true;
+        }
+    }
+    catch (...)
+    {
+        MarkWorkItemFailed(item, stage);
+    }
+
+    return ReportWorkItem(item, metadataWriter, metrics, logProgress);
+}
+
+// --archive: appends the snapshot's image and JSON file to the archive, under the names they would have in the output
+// folder. Returns whether everything was written.
+bool WriteWorkItemToArchive(SnapshotWorkItem& item, ArchiveWriter& archive, ExportMetrics& metrics, bool logProgress)
+{
+    auto stage = ExportStage::WriteImage;
+    try
+    {
+        if (!item.DecryptedImage.empty())
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            archive.Add(std::wstring(item.FileName) + L".jpg", item.DecryptedImage);
+            metrics.AddBytesWritten(item.DecryptedImage.size());
+            item.ImageWritten = true;
+        }
+
+        if (!item.Thumbnail.empty())
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            archive.Add(std::wstring(item.FileName) + L".thumb.jpg", item.Thumbnail);
+            metrics.AddBytesWritten(item.Thumbnail.size());
+            item.ThumbnailWritten = true;
+        }
+
+        stage = ExportStage::WriteMetadata;
+        if (item.MetadataJson)
+        {
+            const StageTimer timer(metrics, stage, item.FileName);
+            auto const& json = *item.MetadataJson;
+            archive.Add(std::wstring(item.FileName) + L".json", { reinterpret_cast<uint8_t const*>(json.data()), json.size() });
+            metrics.AddBytesWritten(json.size());
+            item.MetadataWritten = true;
+        }
+    }
+    catch (...)
+    {
+        MarkWorkItemFailed(item, stage);
+    }
+
+    return ReportWorkItem(item, nullptr, metrics, logProgress);
+}
+
+// --batched-io, on the writer thread: a snapshot's image and JSON file are submitted together, and the snapshot is
+// reported once all of its writes have completed. NDJSON records are still appended as snapshots arrive, since every
+// snapshot shares that file. With --dedup, images are stored and linked on the writer thread before the snapshot's
+// other writes are submitted, since most of them are links rather than writes.
+class BatchedOutputWriter
+{
+public:
+    BatchedOutputWriter(FileIoBackend& io, std::filesystem::path outputFolder, NdjsonMetadataWriter* metadataWriter, ContentStore* contentStore,
+        ExportMetrics& metrics, bool logProgress) :
+        m_io(io), m_outputFolder(std::move(outputFolder)), m_metadataWriter(metadataWriter), m_contentStore(contentStore), m_metrics(metrics),
+        m_logProgress(logProgress)
+    {
+    }
+
+    // 'onFinished(item, written)' is called for the snapshot once its writes are done, possibly from this call.
+    template <typename OnFinished>
+    void Submit(std::shared_ptr<SnapshotWorkItem> item, OnFinished&& onFinished)
+    {
+        auto& workItem = *item;
+        const bool deduplicate = m_contentStore && workItem.ContentHash && !workItem.DecryptedImage.empty();
+        if (deduplicate)
+        {
+            try
+            {
+                const StageTimer timer(m_metrics, ExportStage::WriteImage, workItem.FileName);
+                WriteDeduplicatedImage(workItem, m_outputFolder / (std::wstring(workItem.FileName) + L".jpg"), *m_contentStore, m_metrics);
+            }
+            catch (...)
+            {
+                MarkWorkItemFailed(workItem, ExportStage::WriteImage);
+            }
+        }
+
+        if (workItem.MetadataJson && m_metadataWriter)
+        {
+            try
+            {
+                const StageTimer timer(m_metrics, ExportStage::WriteMetadata, workItem.FileName);
+                m_metadataWriter->Append(std::wstring_view(workItem.FileName), *workItem.MetadataJson, workItem.ContentPath);
+                m_metrics.AddBytesWritten(workItem.MetadataJson->size());
+                workItem.MetadataWritten = true;
+            }
+            catch (...)
+            {
+                MarkWorkItemFailed(workItem, ExportStage::WriteMetadata);
+            }
+        }
+
+        const auto id = m_nextId++;
+        auto& pending = m_pending[id];
+        pending.Start = ExportMetrics::Clock::now();
+        if (!workItem.DecryptedImage.empty() && !deduplicate)
+        {
+            m_io.SubmitWrite(m_outputFolder / (std::wstring(workItem.FileName) + L".jpg"), workItem.DecryptedImage, id * 4 + c_image);
+            pending.Remaining++;
+        }
+        if (workItem.MetadataJson && !m_metadataWriter)
+        {
+            auto const& json = *workItem.MetadataJson;
+            m_io.SubmitWrite(m_outputFolder / (std::wstring(workItem.FileName) + L".json"), { reinterpret_cast<uint8_t const*>(json.data()), json.size() },
+                id * 4 + c_metadata);
+            pending.Remaining++;
+        }
+        if (!workItem.Thumbnail.empty())
+        {
+            m_io.SubmitWrite(m_outputFolder / (std::wstring(workItem.FileName) + L".thumb.jpg"), workItem.Thumbnail, id * 4 + c_thumbnail);
+            pending.Remaining++;
+        }
+
+        pending.Item = std::move(item);
+        if (pending.Remaining == 0)
+        {
+            Finish(id, onFinished);
+        }
+    }
+
+    // Waits until at least one write has completed, then finishes every snapshot whose writes are all done.
+    template <typename OnFinished>
+    void Reap(OnFinished&& onFinished)
+    {
+        m_completions.clear();
+        m_io.Reap(m_completions, 1);
+        for (auto& completion : m_completions)
+        {
+            const auto id = completion.UserData / 4;
+            const auto output = completion.UserData % 4;
+            const auto stage = (output == c_metadata) ? ExportStage::WriteMetadata : ExportStage::WriteImage;
+            auto& pending = m_pending.at(id);
+            auto& workItem = *pending.Item;
+            m_metrics.RecordStage(stage, pending.Start, ExportMetrics::Clock::now(), std::wstring_view(workItem.FileName));
+            if (completion.Error)
+            {
+                MarkWorkItemFailed(workItem, stage, HResultFromErrorCode(completion.Error));
+            }
+            else if (output == c_image)
+            {
+                m_metrics.AddBytesWritten(workItem.DecryptedImage.size());
+                workItem.ImageWritten = true;
+            }
+            else if (output == c_metadata)
+            {
+                m_metrics.AddBytesWritten(workItem.MetadataJson->size());
+                workItem.MetadataWritten = true;
+            }
+            else
+            {
+                m_metrics.AddBytesWritten(workItem.Thumbnail.size());
+                workItem.ThumbnailWritten = true;
+            }
+
+            if (--pending.Remaining == 0)
+            {
+                Finish(id, onFinished);
+            }
+        }
+    }
+
+    // Snapshots submitted and not yet finished.
+    size_t Pending() const
+    {
+        return m_pending.size();
+    }
+
+private:
+    // Each write's user data is the snapshot's id times 4 plus which of its outputs it is.
+    static constexpr uint64_t c_image = 0;
+    static constexpr uint64_t c_metadata = 1;
+    static constexpr uint64_t c_thumbnail = 2;
+
+    struct PendingOutputs
+    {
+        std::shared_ptr<SnapshotWorkItem> Item;
+        unsigned Remaining = 0;
+        ExportMetrics::Clock::time_point Start;
+    };
+
+    template <typename OnFinished>
+    void Finish(uint64_t id, OnFinished& onFinished)
+    {
+        auto item = std::move(m_pending.at(id).Item);
+        m_pending.erase(id);
+        onFinished(*item, ReportWorkItem(*item, m_metadataWriter, m_metrics, m_logProgress));
+    }
+
+    FileIoBackend& m_io;
+    std::filesystem::path m_outputFolder;
+    NdjsonMetadataWriter* m_metadataWriter;
+    ContentStore* m_contentStore;
+    ExportMetrics& m_metrics;
+    bool m_logProgress;
+    std::unordered_map<uint64_t, PendingOutputs> m_pending;
+    std::vector<FileIoCompletion> m_completions;
+    uint64_t m_nextId = 0;
+};
+
+// Manifest records are only flushed once the NDJSON records before them are on disk, so after a crash the
+// manifest never claims a snapshot whose metadata was lost; at worst a few snapshots are exported again.
+void RecordWorkItemInManifest(SnapshotWorkItem const& item, bool written, ExportManifest& manifest, NdjsonMetadataWriter const* metadataWriter)
+{
+    if (!item.Fingerprint)
+    {
+        return;
+    }
+
+    manifest.Record({ std::wstring_view(item.FileName), *item.Fingerprint, written ? ManifestStatus::Complete : ManifestStatus::Failed });
+    if (!metadataWriter || !metadataWriter->HasPendingRecords())
+    {
+        manifest.Flush();
+    }
+}
+
+// What the exports of a batch share: one scheduler, whose workers take turns between them, and one limit on the reads
+// and writes they have in flight together.
+struct SharedExportResources
+{
+    FairScheduler& Scheduler;
+    ConcurrencyLimit& IoLimit;
+};
+
+// Set by Ctrl+C or Ctrl+Break during --watch. The watch then stops, and the snapshots it has already found are finished
+// and summarized as at the end of any other run.
+std::atomic<bool>& WatchStopRequested()
+{
+    static std::atomic<bool> stopRequested{ false };
+    return stopRequested;
+}
+
+BOOL WINAPI StopWatchOnControl(DWORD controlType)
+{
+    if ((controlType == CTRL_C_EVENT) || (controlType == CTRL_BREAK_EVENT))
+    {
+        WatchStopRequested() = true;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Prefix of the lines the calling thread prints; batch mode sets it to the number of the job the thread works for.
+thread_local std::wstring t_consoleLabel;
+
+ExportSummary ExportSnapshotsToFolder(ExportOptions const& options, SharedExportResources const* shared = nullptr)
+{
+    auto const& outputFolderPath = options.OutputFolderPath;
+    const bool toArchive = (options.Archive != ArchiveOutputFormat::None);
+    if (!toArchive && !std::filesystem::is_directory(outputFolderPath))
+    {
+        std::wcout << L"The output folder path doesn't exist." << std::endl;
+        std::wcout << L"Creating directory: " << outputFolderPath << std::endl << std::endl;
+        std::filesystem::create_directory(outputFolderPath);
+    }
+
+    if (!std::filesystem::is_directory(options.ExportFolderPath))
+    {
+        throw std::system_error(std::make_error_code(std::errc::not_a_directory), "The export folder path doesn't exist.");
+    }
+    const std::filesystem::path outputFolder(outputFolderPath);
+
+    // Derive the export key once for the whole run.
+    const DecryptionSession session(options.ExportCode);
+
+    ExportMetrics metrics;
+    if (!options.TracePath.empty())
+    {
+        metrics.EnableTrace();
+    }
+
+    // Declared before the metadata writer so that it is flushed last.
+    std::optional<ExportManifest> manifest;
+    if (options.Incremental)
+    {
+        manifest.emplace(std::filesystem::path(outputFolderPath) / ExportManifest::c_fileName);
+    }
+
+    // --incremental: a snapshot is only skipped while the earlier run's outputs are still there. With NDJSON metadata,
+    // its manifest entry was flushed after its record, so the entry stands for the record as long as the file the
+    // records went to was not removed since.
+    std::optional<NdjsonMetadataWriter> metadataWriter;
+    bool metadataKept = true;
+    if (options.MetadataFormat == MetadataOutputFormat::Ndjson)
+    {
+        const auto metadataPath = std::filesystem::path(outputFolderPath) / L"metadata.ndjson";
+        metadataKept = std::filesystem::exists(metadataPath);
+        metadataWriter.emplace(metadataPath, options.Incremental);
+    }
+
+    std::optional<ContentStore> contentStore;
+    if (options.Deduplicate)
+    {
+        contentStore.emplace(outputFolder);
+    }
+
+    std::optional<ArchiveWriter> archive;
+    if (toArchive)
+    {
+        archive.emplace((options.Archive == ArchiveOutputFormat::Zip) ? ArchiveFormat::Zip : ArchiveFormat::Tar, outputFolder);
+    }
+
+    // --index with --incremental: snapshots skipped as unchanged keep the records the last run indexed.
+    std::optional<SnapshotIndexBuilder> indexBuilder;
+    const auto indexPath = outputFolder / SnapshotIndex::c_fileName;
+    if (options.BuildIndex)
+    {
+        indexBuilder.emplace();
+        if (options.Incremental && std::filesystem::exists(indexPath))
+        {
+            try
+            {
+                indexBuilder->Load(SnapshotIndex(indexPath));
+            }
+            catch (...)
+            {
+                indexBuilder.emplace();
+                std::wcout << L"Reading the snapshot index has failed; it will be rebuilt from this run's snapshots." << std::endl;
+            }
+        }
+    }
+
+    // The calling thread reads, the pool decrypts and extracts metadata, and a dedicated thread writes. The
+    // scheduler lane and the write queue are bounded so a slow stage throttles the ones before it.
+    const size_t queueCapacity = 2 * static_cast<size_t>(options.Jobs);
+    BoundedQueue<std::shared_ptr<SnapshotWorkItem>> writeQueue(queueCapacity);
+    // A quarter of --memory-budget is left to the buffer pool's idle buffers, so in-flight snapshots and recycled
+    // buffers together stay within it.
+    std::optional<MemoryBudget> budget;
+    if (options.MemoryBudget > 0)
+    {
+        BufferPool::Shared().SetRetainLimit(options.MemoryBudget / 4);
+        budget.emplace(options.MemoryBudget - options.MemoryBudget / 4);
+    }
+
+    // --batched-io: one backend per direction, since each is driven by a single thread.
+    std::unique_ptr<FileIoBackend> readIo;
+    std::unique_ptr<FileIoBackend> writeIo;
+    if (options.UseBatchedIo)
+    {
+        readIo = CreateFileIoBackend(options.IoQueueDepth);
+        writeIo = CreateFileIoBackend(options.IoQueueDepth);
+        if (!options.Quiet)
+        {
+            std::wcout << L"Batched I/O: " << readIo->Name() << L", queue depth " << options.IoQueueDepth << std::endl;
+        }
+    }
+
+    // In a batch, each blocking read and write holds a slot of the limit the jobs share.
+    ConcurrencyLimit* const ioLimit = shared ? &shared->IoLimit : nullptr;
+    std::thread writer([&, consoleLabel = t_consoleLabel]
+    {
+        t_consoleLabel = consoleLabel;
+        auto lastProgress = ExportMetrics::Clock::now();
+        auto finishWorkItem = [&](SnapshotWorkItem const& workItem, bool written)
+        {
+            if (manifest)
+            {
+                try
+                {
+                    RecordWorkItemInManifest(workItem, written, *manifest, metadataWriter ? &*metadataWriter : nullptr);
+                }
+                catch (...)
+                {
+                    std::wcout << L"Updating the export manifest has failed. FileName: " << workItem.FileName.c_str() << std::endl;
+                }
+            }
+
+            if (indexBuilder && written && workItem.IndexRecord)
+            {
+                auto record = *workItem.IndexRecord;
+                const auto name = std::filesystem::path(std::wstring_view(workItem.FileName)).generic_u8string();
+                record.Name.assign(name.begin(), name.end());
+                indexBuilder->Add(std::move(record));
+            }
+
+            if (budget)
+            {
+                budget->Release(workItem.ReservedBytes);
+            }
+
+            // With --prescan the total is known, so progress and an estimate of the time left are printed once a second.
+            metrics.AddBytesFinished(workItem.InputSize);
+            const auto progress = metrics.Progress();
+            if (progress && !options.Quiet && (ExportMetrics::Clock::now() - lastProgress >= std::chrono::seconds(1)))
+            {
+                lastProgress = ExportMetrics::Clock::now();
+                std::wcout << L"Progress: " << static_cast<int>(progress->first * 100) << L"%, about "
+                    << static_cast<int64_t>(progress->second + 0.5) << L" s left" << std::endl;
+            }
+
+            // --watch can wait a long time for the next snapshot, so buffered metadata records and manifest entries
+            // are written out whenever the writer has caught up.
+            if (options.Watch && (writeQueue.Size() == 0))
+            {
+                try
+                {
+                    if (metadataWriter)
+                    {
+                        metadataWriter->Flush();
+                    }
+                    if (manifest)
+                    {
+                        manifest->Flush();
+                    }
+                }
+                catch (...)
+                {
+                    std::wcout << L"Writing the metadata file has failed." << std::endl;
+                }
+            }
+        };
+
+        if (archive)
+        {
+            while (auto item = writeQueue.Pop())
+            {
+                bool written = false;
+                {
+                    const ConcurrencySlot ioSlot(ioLimit);
+                    written = WriteWorkItemToArchive(**item, *archive, metrics, !options.Quiet);
+                }
+                finishWorkItem(**item, written);
+            }
+            return;
+        }
+
+        if (!writeIo)
+        {
+            while (auto item = writeQueue.Pop())
+            {
+                auto& workItem = **item;
+                bool written = false;
+                {
+                    const ConcurrencySlot ioSlot(ioLimit);
+                    written = WriteWorkItemToOutputFolder(workItem, outputFolder, metadataWriter ? &*metadataWriter : nullptr,
+                        contentStore ? &*contentStore : nullptr, metrics, !options.Quiet);
+                }
+                finishWorkItem(workItem, written);
+            }
+            return;
+        }
+
+        // Keep taking snapshots while the queue has them and the backend has room, and only block on the queue
+        // when no write is outstanding. The backend's queue depth bounds these writes, not the batch's I/O limit.
+        BatchedOutputWriter batchedWriter(*writeIo, outputFolderPath, metadataWriter ? &*metadataWriter : nullptr, contentStore ? &*contentStore : nullptr,
+            metrics, !options.Quiet);
+        for (;;)
+        {
+            auto item = (batchedWriter.Pending() > 0) ? writeQueue.TryPop() : writeQueue.Pop();
+            if (item)
+            {
+                batchedWriter.Submit(std::move(*item), finishWorkItem);
+                if (writeIo->InFlight() < options.IoQueueDepth)
+                {
+                    continue;
+                }
+            }
+            else if (batchedWriter.Pending() == 0)
+            {
+                break;
+            }
+            batchedWriter.Reap(finishWorkItem);
+        }
+    });
 
-constexpr auto c_keySizeInBytes = 32;
-constexpr auto c_tagSizeInBytes = 16;
-constexpr auto c_nonceSizeInBytes = 12;
-constexpr auto c_childKeySizeInBytes = 32;
-const auto c_totalSizeInBytes = c_nonceSizeInBytes + c_childKeySizeInBytes + c_tagSizeInBytes;
+    // The export folder is listed on its own thread, and each snapshot is read as soon as it has been listed rather
+    // than after the whole listing.
+    BoundedQueue<ScannedFile> scanQueue(4096);
+    std::exception_ptr scanError;
+    std::thread scanner([&]
+    {
+        try
+        {
+            if (!options.Files.empty())
+            {
+                for (auto const& file : options.Files)
+                {
+                    scanQueue.Push({ std::filesystem::path(options.ExportFolderPath) / file, file });
+                }
+            }
+            else if (options.Watch)
+            {
+                // The watch starts before the first listing, so nothing written while it runs is missed.
+                FolderWatcher watcher(options.ExportFolderPath, options.Recursive);
+                std::wcout << L"Watching for new snapshots (" << watcher.Name() << L"); press Ctrl+C to stop." << std::endl;
+                WatchSnapshotFolder(watcher, options.ExportFolderPath, ScanOptions{ options.Recursive, options.NamePattern }, WatchStopRequested(),
+                    [&](ScannedFile file)
+                    {
+                        scanQueue.Push(std::move(file));
+                    });
+            }
+            else
+            {
+                ScanDirectory(options.ExportFolderPath, ScanOptions{ options.Recursive, options.NamePattern }, [&](ScannedFile file)
+                {
+                    scanQueue.Push(std::move(file));
+                });
+            }
+        }
+        catch (...)
+        {
+            scanError = std::current_exception();
+        }
+        scanQueue.Close();
+    });
 
-namespace winrt
-{
-    using namespace winrt::Windows::Data::Json;
-    using namespace winrt::Windows::Foundation;
-    using namespace winrt::Windows::Foundation::Collections;
-    using namespace winrt::Windows::Graphics::Imaging;
-    using namespace winrt::Windows::Storage;
-    using namespace winrt::Windows::Storage::FileProperties;
-    using namespace winrt::Windows::Storage::Streams;
-    using namespace winrt::Windows::ApplicationModel::Activation;
-}
+    {
+        // A single export has a scheduler to itself; in a batch, its lane takes turns with the other jobs' lanes.
+        std::optional<FairScheduler> ownScheduler;
+        if (!shared)
+        {
+            ownScheduler.emplace(options.Jobs, queueCapacity);
+        }
+        FairScheduler::Lane lane(shared ? shared->Scheduler : *ownScheduler, queueCapacity);
+        auto decryptAndExtract = [&lane, &writeQueue, &session, &options, ioLimit, &metrics](std::shared_ptr<SnapshotWorkItem> item)
+        {
+            lane.Submit([&lane, &writeQueue, &session, &options, ioLimit, &metrics, item]
+            {
+                DecryptWorkItem(*item, session, options.StreamingChunkSize, ioLimit, metrics);
+                if (item->Failed)
+                {
+                    writeQueue.Push(item);
+                    return;
+                }
 
-inline HRESULT HResultFromBCryptStatus(NTSTATUS status)
-{
-    #define STATUS_AUTH_TAG_MISMATCH ((NTSTATUS)0xC000A002L)
+                lane.Submit([&writeQueue, &options, &metrics, item]
+                {
+                    ExtractWorkItemMetadata(*item, options.CompatibleJsonNumbers ? JsonNumberStyle::CompatibleStrings : JsonNumberStyle::Native,
+                        options.BuildIndex, metrics);
+                    if (options.Deduplicate)
+                    {
+                        HashWorkItemImage(*item, metrics);
+                    }
+                    if (options.ThumbnailScale != 0)
+                    {
+                        ScaleWorkItemImage(*item, options.ThumbnailScale, metrics);
+                    }
+                    writeQueue.Push(item);
+                });
+            });
+        };
 
-    RETURN_HR_IF_EXPECTED((HRESULT)STATUS_AUTH_TAG_MISMATCH, status == STATUS_AUTH_TAG_MISMATCH);
-    RETURN_IF_NTSTATUS_FAILED_EXPECTED(status);
-    return S_OK;
-}
+        // --batched-io: reads in flight by file index, with when they were submitted. Read time is measured from
+        // submission to completion.
+        std::unordered_map<uint64_t, std::pair<std::shared_ptr<SnapshotWorkItem>, ExportMetrics::Clock::time_point>> pendingReads;
+        std::vector<FileIoCompletion> readCompletions;
+        auto reapReads = [&]
+        {
+            readCompletions.clear();
+            readIo->Reap(readCompletions, 1);
+            for (auto& completion : readCompletions)
+            {
+                auto [item, start] = std::move(pendingReads.at(completion.UserData));
+                pendingReads.erase(completion.UserData);
+                metrics.RecordStage(ExportStage::Read, start, ExportMetrics::Clock::now(), std::wstring_view(item->FileName));
+                if (completion.Error)
+                {
+                    MarkWorkItemFailed(*item, ExportStage::Read, HResultFromErrorCode(completion.Error));
+                    writeQueue.Push(item);
+                    continue;
+                }
 
-void WriteJSONToFile(winrt::JsonObject const& jsonObject, winrt::hstring const& fileName, winrt::StorageFolder const& outputFolder)
-{
-    auto storageFile = outputFolder.CreateFileAsync(fileName + L".json", winrt::CreationCollisionOption::ReplaceExisting).get();
-    
-    auto jsonString = jsonObject.Stringify();
-    winrt::FileIO::WriteTextAsync(storageFile, jsonString).get();
-    
-    std::wcout << L"Decrypted metadata: " << fileName.c_str() << L".json" << std::endl;
-}
+                item->ContainerBytes = std::move(completion.Data);
+                metrics.AddBytesRead(item->ContainerBytes.size());
+                decryptAndExtract(std::move(item));
+            }
+        };
 
-winrt::ValueSet TryGetSnapshotMetadataAsync(winrt::IRandomAccessStream const& decryptedStream)
-{
-    auto decoder = winrt::BitmapDecoder::CreateAsync(decryptedStream).get();
-    auto properties = decoder.BitmapProperties().GetPropertiesAsync({ winrt::hstring{ImageMetadataStorageTag} }).get();
-    auto prop = properties.TryLookup(ImageMetadataStorageTag);
+        // --prescan: the whole listing and every header are read first. Inputs the headers already show to be
+        // malformed are reported before anything is exported, and the rest are exported largest first.
+        std::vector<std::pair<ScannedFile, SnapshotPrescan>> scheduled;
+        size_t nextScheduled = 0;
+        if (options.Prescan)
+        {
+            std::vector<ScannedFile> listed;
+            while (auto scanned = scanQueue.Pop())
+            {
+                listed.push_back(std::move(*scanned));
+            }
+
+            std::vector<SnapshotPrescan> prescans(listed.size());
+            std::vector<std::exception_ptr> errors(listed.size());
+            for (size_t i = 0; i < listed.size(); i++)
+            {
+                lane.Submit([&listed, &prescans, &errors, i]
+                {
+                    try
+                    {
+                        prescans[i] = PrescanSnapshot(listed[i].Path);
+                    }
+                    catch (...)
+                    {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+            lane.WaitIdle();
+
+            uint64_t totalBytes = 0;
+            for (size_t i = 0; i < listed.size(); i++)
+            {
+                if (!errors[i])
+                {
+                    totalBytes += prescans[i].FileSize;
+                    scheduled.emplace_back(std::move(listed[i]), prescans[i]);
+                    continue;
+                }
+
+                auto item = std::make_shared<SnapshotWorkItem>();
+                item->FileName = winrt::hstring(listed[i].RelativePath.wstring());
+                try
+                {
+                    std::rethrow_exception(errors[i]);
+                }
+                catch (...)
+                {
+                    MarkWorkItemFailed(*item, ExportStage::Read);
+                }
+                writeQueue.Push(item);
+            }
+
+            OrderLargestFirst(std::span(scheduled), [](auto const& entry) { return entry.second.FileSize; });
+            metrics.SetExpectedBytes(totalBytes);
+            if (!options.Quiet)
+            {
+                std::wcout << L"Pre-scanned " << listed.size() << L" files: " << scheduled.size() << L" snapshots to export ("
+                    << totalBytes << L" bytes), " << (listed.size() - scheduled.size()) << L" rejected." << std::endl;
+            }
+        }
+
+        uint64_t fileIndex = 0;
+        for (;;)
+        {
+            std::optional<ScannedFile> scanned;
+            std::optional<SnapshotPrescan> prescan;
+            if (!options.Prescan)
+            {
+                scanned = scanQueue.Pop();
+            }
+            else if (nextScheduled < scheduled.size())
+            {
+                scanned = std::move(scheduled[nextScheduled].first);
+                prescan = scheduled[nextScheduled++].second;
+            }
+            if (!scanned)
+            {
+                break;
+            }
+
+            auto const& file = *scanned;
+            auto item = std::make_shared<SnapshotWorkItem>();
+            item->FileName = winrt::hstring(file.RelativePath.wstring());
+            item->InputSize = prescan ? prescan->FileSize : 0;
+            metrics.SampleQueueDepths(lane.QueuedTasks(), writeQueue.Size());
+            try
+            {
+                const auto start = ExportMetrics::Clock::now();
+                std::optional<StageTimer> timer;
+                if (!readIo)
+                {
+                    timer.emplace(metrics, ExportStage::Read, item->FileName);
+                }
+
+                if (manifest)
+                {
+                    const auto outputPath = std::filesystem::path(outputFolderPath) / std::wstring(item->FileName);
+                    const ConcurrencySlot ioSlot(ioLimit);
+                    item->Fingerprint = ReadSnapshotFingerprint(file.Path);
+                    if (manifest->IsUpToDate(std::wstring_view(item->FileName), *item->Fingerprint) &&
+                        std::filesystem::exists(outputPath.native() + L".jpg") &&
+                        (metadataWriter ? metadataKept : std::filesystem::exists(outputPath.native() + L".json")))
+                    {
+                        metrics.RecordSkipped();
+                        metrics.AddBytesFinished(item->InputSize);
+                        if (!options.Quiet)
+                        {
+                            std::wcout << L"Skipped unchanged snapshot: " << item->FileName.c_str() << std::endl;
+                        }
+                        continue;
+                    }
+                }
+
+                if (budget)
+                {
+                    if (!prescan)
+                    {
+                        item->InputSize = std::filesystem::file_size(file.Path);
+                    }
+
+                    // Reads still in flight hold budget too, so they are completed before waiting on the writer.
+                    bool acquired = budget->TryAcquire(item->InputSize);
+                    while (!acquired && readIo && (readIo->InFlight() > 0))
+                    {
+                        reapReads();
+                        acquired = budget->TryAcquire(item->InputSize);
+                    }
+                    if (!acquired)
+                    {
+                        budget->Acquire(item->InputSize);
+                    }
+                    item->ReservedBytes = item->InputSize;
+                }
+
+                // --recursive mirrors the export folder's subfolders in the output folder.
+                if (!archive && file.RelativePath.has_parent_path())
+                {
+                    std::filesystem::create_directories(outputFolder / file.RelativePath.parent_path());
+                }
+
+                const ConcurrencySlot ioSlot(readIo ? nullptr : ioLimit);
+                if (options.UseMappedIo)
+                {
+                    item->InputMapping = MappedFile::OpenRead(file.Path);
+                    item->OutputImagePath = std::filesystem::path(outputFolderPath) / (std::wstring(item->FileName) + L".jpg");
+                    metrics.AddBytesRead(item->InputMapping->Data().size());
+                }
+                else if (options.UseStreaming)
+                {
+                    item->InputPath = file.Path;
+                    item->OutputImagePath = std::filesystem::path(outputFolderPath) / (std::wstring(item->FileName) + L".jpg");
+                    metrics.AddBytesRead(std::filesystem::file_size(item->InputPath));
+                }
+                else if (readIo)
+                {
+                    readIo->SubmitRead(file.Path, fileIndex);
+                    pendingReads.emplace(fileIndex++, std::pair(item, start));
+                }
+                else
+                {
+                    item->ContainerBytes = ReadSnapshotFile(file.Path);
+                    metrics.AddBytesRead(item->ContainerBytes.size());
+                }
+            }
+            catch (...)
+            {
+                MarkWorkItemFailed(*item, ExportStage::Read);
+                writeQueue.Push(item);
+                continue;
+            }
+
+            if (readIo)
+            {
+                if (readIo->InFlight() >= options.IoQueueDepth)
+                {
+                    reapReads();
+                }
+                continue;
+            }
+            decryptAndExtract(std::move(item));
+        }
+
+        while (readIo && (readIo->InFlight() > 0))
+        {
+            reapReads();
+        }
+        lane.WaitIdle();
+    }
+
+    scanner.join();
+    writeQueue.Close();
+    writer.join();
+
+    // Snapshots that were written are already counted as exported, so a failure to finish the archive is reported on
+    // its own: the archive holds them but has no end (tar) or central directory (ZIP).
+    bool archiveFinished = false;
+    if (archive)
+    {
+        try
+        {
+            archive->Finish();
+            archiveFinished = true;
+        }
+        catch (...)
+        {
+            std::wcout << L"Writing the archive has failed; it is incomplete." << std::endl;
+        }
+    }
+
+    // The index is written whole once the run is over; if that fails the snapshots are still exported, and the
+    // previous index, if any, is left in place.
+    bool indexWritten = false;
+    if (indexBuilder)
+    {
+        try
+        {
+            indexBuilder->Write(indexPath, std::filesystem::absolute(options.ExportFolderPath));
+            indexWritten = true;
+        }
+        catch (...)
+        {
+            std::wcout << L"Writing the snapshot index has failed." << std::endl;
+        }
+    }
+    metrics.Finish();
 
-    winrt::ValueSet valueSet;
-    if (prop && (prop.Type() == winrt::PropertyType::UInt8Array))
+    if (scanError)
     {
-        auto propValue = prop.Value().as<winrt::IPropertyValue>();
-        winrt::com_array<uint8_t> propArray;
-        propValue.GetUInt8Array(propArray);
+        std::wcout << L"Listing the export folder has failed; only the snapshots listed before the failure were exported." << std::endl;
+    }
 
-        winrt::Buffer buffer(propArray.size());
-        buffer.Length(propArray.size());
-        memcpy_s(buffer.data(), buffer.Length(), propArray.data(), propArray.size());
+    if (contentStore)
+    {
+        metrics.SetDeduplication(contentStore->UniqueObjects(), contentStore->Duplicates(), contentStore->BytesSaved());
+    }
 
-        winrt::IPropertySetSerializer serializer;
-        winrt::check_hresult(RoCreatePropertySetSerializer(
-            reinterpret_cast<ABI::Windows::Storage::Streams::IPropertySetSerializer**>(winrt::put_abi(serializer))));
+    const auto seconds = metrics.ElapsedSeconds();
+    std::wcout << std::endl << L"Exported " << metrics.FilesCompleted() << L" snapshots (" << metrics.FilesFailed() << L" failed) in "
+        << seconds << L" s, " << ((seconds > 0) ? metrics.BytesRead() / seconds / (1 << 20) : 0.0) << L" MB/s." << std::endl;
+    if (archiveFinished)
+    {
+        std::wcout << L"Wrote " << archive->EntryCount() << L" files (" << archive->Size() << L" bytes) to the archive." << std::endl;
+    }
+    if (indexWritten)
+    {
+        std::wcout << L"Indexed " << indexBuilder->Size() << L" snapshots: " << indexPath.c_str() << std::endl;
+    }
+    if (contentStore)
+    {
+        std::wcout << L"Stored " << contentStore->UniqueObjects() << L" distinct images; " << contentStore->Duplicates() << L" duplicates saved "
+            << contentStore->BytesSaved() << L" bytes." << std::endl;
+        if (contentStore->Copies() > 0)
+        {
+            std::wcout << contentStore->Copies() << L" images could not be hard-linked and were written in full." << std::endl;
+        }
+    }
 
-        serializer.Deserialize(valueSet, buffer);
+    try
+    {
+        if (!options.ReportPath.empty())
+        {
+            metrics.WriteReportFile(options.ReportPath);
+            std::wcout << L"Run report: " << options.ReportPath << std::endl;
+        }
+        if (!options.TracePath.empty())
+        {
+            metrics.WriteTraceFile(options.TracePath);
+            std::wcout << L"Trace: " << options.TracePath << std::endl;
+        }
+    }
+    catch (...)
+    {
+        std::wcout << L"Writing the run report has failed." << std::endl;
     }
 
-    return valueSet;
+    auto summary = metrics.Summary();
+    summary.Incomplete = scanError || (archive && !archiveFinished) || (indexBuilder && !indexWritten);
+    return summary;
 }
 
-std::vector<uint8_t> DecryptPackedData(BCRYPT_KEY_HANDLE key, std::span<uint8_t const> payload)
+// --verify: authenticates every container under the export folder without decrypting or writing anything, so an
+// audit is bound by reading and GHASH rather than by AES and writes. Files are verified on the pool as soon as they
+// are listed. Returns whether every file passed.
+bool VerifySnapshotsInFolder(ExportOptions const& options)
 {
-    THROW_HR_IF(E_INVALIDARG, payload.size() < c_tagSizeInBytes);
-    const auto dataSize = payload.size() - c_tagSizeInBytes;
-    const auto data = payload.data();
+    if (!std::filesystem::is_directory(options.ExportFolderPath))
+    {
+        throw std::system_error(std::make_error_code(std::errc::not_a_directory), "The export folder path doesn't exist.");
+    }
+
+    const DecryptionSession session(options.ExportCode);
+
+    ExportMetrics metrics;
+    if (!options.TracePath.empty())
+    {
+        metrics.EnableTrace();
+    }
+
+    // Tag mismatches (a wrong export code or a corrupted payload) are counted apart from malformed or unreadable files.
+    std::atomic<uint64_t> tagMismatches{ 0 };
+    std::mutex outputMutex;
+    bool listingFailed = false;
+    {
+        WorkStealingPool pool(options.Jobs, 2 * static_cast<size_t>(options.Jobs));
+        try
+        {
+            ScanDirectory(options.ExportFolderPath, ScanOptions{ options.Recursive, options.NamePattern }, [&](ScannedFile file)
+            {
+                pool.Submit([&, file = std::move(file)]
+                {
+                    const auto fileName = file.RelativePath.wstring();
+                    int32_t failureCode = 0;
+                    {
+                        const StageTimer timer(metrics, ExportStage::Verify, fileName);
+                        try
+                        {
+                            if (options.UseMappedIo)
+                            {
+                                const auto mapping = MappedFile::OpenRead(file.Path);
+                                session.Verify(mapping.Data());
+                                metrics.AddBytesRead(mapping.Data().size());
+                            }
+                            else
+                            {
+                                metrics.AddBytesRead(VerifySnapshotFile(session, file.Path, options.StreamingChunkSize));
+                            }
+                        }
+                        catch (...)
+                        {
+                            failureCode = HResultFromCurrentException();
+                        }
+                    }
 
-    uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
-    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO authInfo{};
-    BCRYPT_INIT_AUTH_MODE_INFO(authInfo);
-    authInfo.pbNonce = zeroNonce;
-    authInfo.cbNonce = c_nonceSizeInBytes;
-    authInfo.pbTag = const_cast<uint8_t*>(payload.data() + dataSize);
-    authInfo.cbTag = c_tagSizeInBytes;
+                    if (failureCode == 0)
+                    {
+                        metrics.RecordCompleted();
+                        if (!options.Quiet)
+                        {
+                            std::lock_guard lock(outputMutex);
+                            std::wcout << L"Verified: " << fileName << std::endl;
+                        }
+                        return;
+                    }
 
-    std::vector<uint8_t> decryptedContent(dataSize);
-    ULONG decryptedSize = 0;
-    const auto result = BCryptDecrypt(
-        key, const_cast<uint8_t*>(data), static_cast<ULONG>(dataSize), &authInfo, nullptr, 0, decryptedContent.data(), static_cast<ULONG>(dataSize), &decryptedSize, 0);
-    decryptedContent.resize(decryptedSize);
+                    metrics.RecordFailure(ExportStage::Verify, failureCode, fileName);
+                    if (failureCode == c_hrAuthTagMismatch)
+                    {
+                        tagMismatches.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    std::lock_guard lock(outputMutex);
+                    std::wcout << L"Verification of the file has failed. FileName: " << fileName << L" (" << ExportFailureKind(failureCode)
+                        << L", " << FormatHResult(failureCode).c_str() << L")" << std::endl;
+                });
+            });
+        }
+        catch (...)
+        {
+            listingFailed = true;
+        }
+        pool.WaitIdle();
+    }
+    metrics.Finish();
+
+    if (listingFailed)
+    {
+        std::wcout << L"Listing the export folder has failed; only the snapshots listed before the failure were verified." << std::endl;
+    }
 
-    THROW_IF_FAILED(HResultFromBCryptStatus(result));
+    const auto seconds = metrics.ElapsedSeconds();
+    std::wcout << std::endl << L"Verified " << metrics.FilesCompleted() << L" snapshots (" << metrics.FilesFailed() << L" failed, "
+        << tagMismatches.load() << L" of them tag mismatches) in " << seconds << L" s, "
+        << ((seconds > 0) ? metrics.BytesRead() / seconds / (1 << 20) : 0.0) << L" MB/s." << std::endl;
+
+    try
+    {
+        if (!options.ReportPath.empty())
+        {
+            metrics.WriteReportFile(options.ReportPath);
+            std::wcout << L"Run report: " << options.ReportPath << std::endl;
+        }
+        if (!options.TracePath.empty())
+        {
+            metrics.WriteTraceFile(options.TracePath);
+            std::wcout << L"Trace: " << options.TracePath << std::endl;
+        }
+    }
+    catch (...)
+    {
+        std::wcout << L"Writing the run report has failed." << std::endl;
+    }
 
-    return decryptedContent;
+    return !listingFailed && (metrics.FilesFailed() == 0);
 }
 
-wil::unique_bcrypt_key DecryptExportKey(BCRYPT_KEY_HANDLE key, std::span<uint8_t const> encryptedKey)
+std::wstring UnexpandExportCode(std::wstring code)
 {
-    THROW_HR_IF(E_INVALIDARG, encryptedKey.size() != c_totalSizeInBytes);
+    if (code.size() > 32)
+    {
+        code.erase(std::remove(code.begin(), code.end(), ' '), code.end()); // Remove spaces
+        code.erase(std::remove(code.begin(), code.end(), '-'), code.end()); // Remove hyphens
+    }
 
-    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO AuthInfo{};
-    BCRYPT_INIT_AUTH_MODE_INFO(AuthInfo);
-    AuthInfo.pbNonce = const_cast<uint8_t*>(encryptedKey.data()); 
-    AuthInfo.cbNonce = c_nonceSizeInBytes;
-    AuthInfo.pbTag = const_cast<uint8_t*>(encryptedKey.data() + c_nonceSizeInBytes + c_childKeySizeInBytes);
-    AuthInfo.cbTag = c_tagSizeInBytes;
+    if (code.size() != 32)
+    {
+        std::wcout << L"The export code has incorrect number of characters."<< std::endl;
+    }
 
-    uint8_t decryptedKey[c_childKeySizeInBytes] = { 0 };
+    return code;
+}
 
-    ULONG decryptedByteCount{};
-    THROW_IF_FAILED(HResultFromBCryptStatus(BCryptDecrypt(
-        key,
-        const_cast<uint8_t*>(encryptedKey.data() + c_nonceSizeInBytes),
-        c_childKeySizeInBytes,
-        &AuthInfo,
-        nullptr,
-        0,
-        decryptedKey,
-        sizeof(decryptedKey),
-        &decryptedByteCount,
-        0)));
+// RecallSnapshotsExport.exe generate-corpus [corpus options] <outputFolderPath> <recoveryKey>
+int GenerateCorpusCommand(int argc, wchar_t* argv[])
+{
+    CorpusOptions options;
+    std::vector<std::wstring> positional;
+    if (!TryParseCorpusOptions({ argv + 2, argv + argc }, options, positional) || (positional.size() != 2))
+    {
+        std::wcout << L"Usage: RecallSnapshotsExport.exe generate-corpus [--count N] [--min-size BYTES] [--max-size BYTES] [--properties N] [--depth N] [--array-length N] [--seed N] <outputFolderPath> <recoveryKey>" << std::endl;
+        return 0;
+    }
 
-    wil::unique_bcrypt_key childKey;
-    THROW_IF_NTSTATUS_FAILED(
-        BCryptGenerateSymmetricKey(BCRYPT_AES_GCM_ALG_HANDLE, &childKey, nullptr, 0, decryptedKey, c_childKeySizeInBytes, 0));
+    try
+    {
+        const auto totalSize = GenerateSnapshotCorpus(positional[0], HexStringToBytes(UnexpandExportCode(positional[1])), options);
+        std::wcout << L"Generated " << options.FileCount << L" snapshots (" << totalSize << L" bytes) in: " << positional[0] << std::endl;
+    }
+    catch (...)
+    {
+        std::wcout << L"Generating the snapshot corpus has failed." << std::endl;
+    }
 
-    return childKey;
+    return 0;
 }
 
-std::vector<uint8_t> HexStringToBytes(const std::wstring& hexString)
+// RecallSnapshotsExport.exe query [query options] <indexPath>
+// Answers from the index alone; only with --export are the matching snapshots read and decrypted.
+int QueryCommand(int argc, wchar_t* argv[])
 {
-    std::vector<uint8_t> bytes;
-    if (hexString.length() % 2 != 0)
+    SnapshotQueryOptions options;
+    if (!TryParseQueryOptions(argc, argv, 2, options))
+    {
+        std::wcout << L"Usage: RecallSnapshotsExport.exe query [--from TIME] [--to TIME] [--app NAME] [--field KEY=VALUE] [--text WORDS] [--limit N] [--export OUTPUT RECOVERYKEY [--export-folder PATH] [--jobs N]] <indexPath | outputFolderPath>" << std::endl;
+        return 0;
+    }
+
+    std::vector<std::wstring> matches;
+    std::filesystem::path exportFolder;
+    try
+    {
+        std::filesystem::path indexPath(options.IndexPath);
+        if (std::filesystem::is_directory(indexPath))
+        {
+            indexPath /= SnapshotIndex::c_fileName;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const SnapshotIndex index(indexPath);
+        auto ids = index.Query(options.Query);
+        const auto total = ids.size();
+        if ((options.Limit > 0) && (ids.size() > options.Limit))
+        {
+            ids.resize(options.Limit);
+        }
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        for (const auto id : ids)
+        {
+            const auto name = index.Name(id);
+            matches.push_back(std::filesystem::path(std::u8string(name.begin(), name.end())).make_preferred().wstring());
+            std::wcout << FormatSnapshotTime(index.Time(id)) << L"  " << matches.back() << std::endl;
+        }
+        std::wcout << std::endl << total << L" of " << index.Size() << L" snapshots matched in " << elapsed.count() << L" ms." << std::endl;
+        exportFolder = options.ExportFolderPath.empty() ? index.ExportFolder() : std::filesystem::path(options.ExportFolderPath);
+    }
+    catch (...)
+    {
+        std::wcout << L"Querying the snapshot index has failed." << std::endl;
+        return 1;
+    }
+
+    if (options.ExportOutputPath.empty() || matches.empty())
     {
-        throw std::invalid_argument("Hex string must have an even length");
+        return 0;
     }
 
-    for (size_t i = 0; i < hexString.length(); i += 2)
+    ExportOptions exportOptions;
+    exportOptions.ExportFolderPath = exportFolder.wstring();
+    exportOptions.OutputFolderPath = options.ExportOutputPath;
+    exportOptions.Jobs = options.Jobs;
+    exportOptions.Files = std::move(matches);
+    std::wcout << L"Writing content to: " << exportOptions.OutputFolderPath << std::endl << std::endl;
+    try
+    {
+        exportOptions.ExportCode = UnexpandExportCode(options.ExportCode);
+        ExportSnapshotsToFolder(exportOptions);
+    }
+    catch (...)
     {
-        std::wstring byteString = hexString.substr(i, 2);
-        uint8_t byte = static_cast<uint8_t>(std::stoi(byteString, nullptr, 16));
-        bytes.push_back(byte);
+        std::wcout << L"Decryption of snapshot and metadata has failed." << std::endl;
     }
 
-    return bytes;
+    return 0;
 }
 
-struct EncryptedSnapshotHeader
+// Installed on std::wcout while a batch runs its jobs side by side. Each thread's output is held until the end of its
+// line and then written whole, prefixed with the thread's console label, so lines of different jobs never mix.
+class LabeledLineBuffer : public std::wstreambuf
 {
-    UINT32 Version;
-    UINT32 KeySize;
-    UINT32 ContentSize;
-    UINT32 ContentType;
+public:
+    explicit LabeledLineBuffer(std::wstreambuf* target) : m_target(target) {}
+
+protected:
+    int_type overflow(int_type character) override
+    {
+        if (traits_type::eq_int_type(character, traits_type::eof()))
+        {
+            return traits_type::not_eof(character);
+        }
+
+        t_line.push_back(traits_type::to_char_type(character));
+        if (t_line.back() == L'\n')
+        {
+            std::lock_guard lock(m_mutex);
+            if (t_line.size() > 1)
+            {
+                m_target->sputn(t_consoleLabel.data(), static_cast<std::streamsize>(t_consoleLabel.size()));
+            }
+            m_target->sputn(t_line.data(), static_cast<std::streamsize>(t_line.size()));
+            t_line.clear();
+        }
+        return character;
+    }
+
+    int sync() override
+    {
+        std::lock_guard lock(m_mutex);
+        return m_target->pubsync();
+    }
+
+private:
+    static inline thread_local std::wstring t_line;
+
+    std::wstreambuf* m_target;
+    std::mutex m_mutex;
 };
 
-winrt::IRandomAccessStream DecryptSnapshot(winrt::IRandomAccessStream const& inputStream, std::wstring const& exportCode)
+// RecallSnapshotsExport.exe batch [export options] [--parallel-jobs N] [--io-limit N] <jobFilePath>
+// Each job derives its export key once and runs the usual pipeline, on the worker threads all jobs share. Exits with
+// 1 if any job failed or had snapshots fail.
+int BatchCommand(int argc, wchar_t* argv[])
 {
-    std::vector<uint8_t> exportCodeBytes = HexStringToBytes(exportCode);
-    std::vector<uint8_t> exportKeyBytes(c_keySizeInBytes);
-    THROW_IF_NTSTATUS_FAILED(BCryptHash(
-        BCRYPT_SHA256_ALG_HANDLE,
-        nullptr,
-        0,
-        exportCodeBytes.data(),
-        static_cast<ULONG>(exportCodeBytes.size()),
-        exportKeyBytes.data(),
-        c_keySizeInBytes));
+    BatchOptions options;
+    if (!TryParseBatchOptions(argc, argv, 2, options))
+    {
+        std::wcout << L"Usage: RecallSnapshotsExport.exe batch [--parallel-jobs N] [--io-limit N] [export options] <jobFilePath>" << std::endl;
+        std::wcout << L"       Each line of the job file is \"<exportFolderPath> <outputFolderPath> <recoveryKey>\"; export options are those of a single export, except --verify, --watch, --report and --trace." << std::endl;
+        return 0;
+    }
 
-    wil::unique_bcrypt_key exportKey;
-    THROW_IF_NTSTATUS_FAILED(BCryptGenerateSymmetricKey(
-       BCRYPT_AES_GCM_ALG_HANDLE, &exportKey, nullptr, 0, exportKeyBytes.data(), static_cast<ULONG>(exportKeyBytes.size()), 0));
+    std::vector<ExportJob> jobs;
+    try
+    {
+        std::ifstream input(std::filesystem::path(options.JobFilePath), std::ios::binary);
+        if (!input)
+        {
+            throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), "The job file doesn't exist.");
+        }
+        const std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
 
-    winrt::DataReader reader(inputStream.GetInputStreamAt(0));
-    reader.LoadAsync(static_cast<uint32_t>(inputStream.Size())).get();
+        size_t errorLine = 0;
+        if (!TryParseJobFile(text, jobs, errorLine))
+        {
+            std::wcout << L"The job file is malformed at line " << errorLine << L"." << std::endl;
+            return 1;
+        }
+    }
+    catch (...)
+    {
+        std::wcout << L"Reading the job file has failed." << std::endl;
+        return 1;
+    }
 
-    if (reader.UnconsumedBufferLength() < sizeof(EncryptedSnapshotHeader))
+    // Two jobs writing to one output folder would overwrite each other's manifest and metadata.
+    std::map<std::filesystem::path, size_t> outputLines;
+    for (auto const& job : jobs)
     {
-        throw std::runtime_error("Insufficient data in the buffer.");
+        const auto output = std::filesystem::absolute(job.OutputFolderPath).lexically_normal();
+        if ((job.OutputFolderPath == L"-") || !outputLines.emplace(output, job.Line).second)
+        {
+            std::wcout << L"The job on line " << job.Line << L" writes to standard output or to the same output as another job." << std::endl;
+            return 1;
+        }
     }
 
-    EncryptedSnapshotHeader header{};
-    reader.ByteOrder(winrt::ByteOrder::LittleEndian);
+    std::wcout << L"Running " << jobs.size() << L" jobs from: " << options.JobFilePath << L", " << options.ParallelJobs << L" at a time on "
+        << options.Export.Jobs << L" worker threads." << std::endl << std::endl;
 
-    header.Version = reader.ReadUInt32();
-    header.KeySize = reader.ReadUInt32();
-    header.ContentSize = reader.ReadUInt32();
-    header.ContentType = reader.ReadUInt32();
+    const auto start = std::chrono::steady_clock::now();
+    FairScheduler scheduler(options.Export.Jobs, 2 * static_cast<size_t>(options.Export.Jobs));
+    ConcurrencyLimit ioLimit(options.IoLimit);
+    const SharedExportResources shared{ scheduler, ioLimit };
 
-    if (header.Version != 2)
+    // A job that could not run at all has no summary.
+    std::vector<std::optional<ExportSummary>> summaries(jobs.size());
+    std::atomic<size_t> nextJob{ 0 };
+    std::atomic<size_t> finishedJobs{ 0 };
+    LabeledLineBuffer console(std::wcout.rdbuf());
+    const auto consoleBuffer = std::wcout.rdbuf(&console);
+    std::vector<std::thread> runners;
+    for (size_t i = 0; i < (std::min)(jobs.size(), size_t{ options.ParallelJobs }); i++)
     {
-        throw std::runtime_error("Insufficient data header version.");
-    }
- 
-    std::vector<uint8_t> keybytes(header.KeySize);
-    reader.ReadBytes(keybytes);
-    wil::unique_bcrypt_key contentKey = DecryptExportKey(exportKey.get(), keybytes);
+        runners.emplace_back([&]
+        {
+            for (size_t index = nextJob++; index < jobs.size(); index = nextJob++)
+            {
+                auto const& job = jobs[index];
+                auto jobOptions = options.Export;
+                jobOptions.ExportFolderPath = job.ExportFolderPath;
+                jobOptions.OutputFolderPath = job.OutputFolderPath;
 
-    std::vector<uint8_t> contentbytes(header.ContentSize);
-    reader.ReadBytes(contentbytes);
-    std::vector<uint8_t> decryptedContent = DecryptPackedData(contentKey.get(), contentbytes);
+                t_consoleLabel = L"[" + std::to_wstring(index + 1) + L"] ";
+                std::wcout << L"Reading snapshots from: " << job.ExportFolderPath << std::endl;
+                std::wcout << L"Writing content to: " << job.OutputFolderPath << std::endl;
+                try
+                {
+                    jobOptions.ExportCode = UnexpandExportCode(job.ExportCode);
+                    summaries[index] = ExportSnapshotsToFolder(jobOptions, &shared);
+                }
+                catch (...)
+                {
+                    std::wcout << L"Decryption of snapshot and metadata has failed." << std::endl;
+                }
+                t_consoleLabel.clear();
 
-    winrt::InMemoryRandomAccessStream decryptedStream;
-    winrt::DataWriter dataWriter(decryptedStream);
-    dataWriter.WriteBytes(winrt::array_view<const uint8_t>(decryptedContent));
-    dataWriter.StoreAsync().get();
-    dataWriter.DetachStream();
-    return decryptedStream;
-}
+                std::wcout << L"Finished job " << (index + 1) << L" (line " << job.Line << L"); " << ++finishedJobs << L" of " << jobs.size()
+                    << L" done." << std::endl;
+            }
+        });
+    }
+    for (auto& runner : runners)
+    {
+        runner.join();
+    }
+    std::wcout.rdbuf(consoleBuffer);
 
-void WriteSnapshotToOutputFolder(winrt::StorageFolder const& outputFolder, winrt::hstring const& fileName, winrt::IRandomAccessStream const& decryptedStream)
-{
-    auto outputFile = outputFolder.CreateFileAsync(fileName + L".jpg", winrt::CreationCollisionOption::ReplaceExisting).get();
-    auto outputStream = outputFile.OpenAsync(winrt::FileAccessMode::ReadWrite).get();
-    winrt::DataReader reader(decryptedStream.GetInputStreamAt(0));
-    winrt::DataWriter writer(outputStream);
+    size_t failedJobs = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    std::wcout << std::endl;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        std::wcout << L"[" << (i + 1) << L"] " << jobs[i].ExportFolderPath << L": ";
+        auto const& summary = summaries[i];
+        if (!summary)
+        {
+            failedJobs++;
+            std::wcout << L"failed." << std::endl;
+            continue;
+        }
 
-    reader.LoadAsync(static_cast<uint32_t>(decryptedStream.Size())).get();
-    writer.WriteBuffer(reader.ReadBuffer(static_cast<uint32_t>(decryptedStream.Size())));
-    writer.StoreAsync().get();
-    writer.FlushAsync().get();
+        completed += summary->FilesCompleted;
+        failed += summary->FilesFailed;
+        failedJobs += ((summary->FilesFailed > 0) || summary->Incomplete) ? 1 : 0;
+        std::wcout << summary->FilesCompleted << L" exported, " << summary->FilesSkipped << L" skipped, " << summary->FilesFailed << L" failed";
+        wchar_t const* separator = L" (";
+        for (size_t stage = 0; stage < c_exportStageCount; stage++)
+        {
+            if (summary->FailuresByStage[stage] > 0)
+            {
+                std::wcout << separator << ExportStageName(static_cast<ExportStage>(stage)) << L": " << summary->FailuresByStage[stage];
+                separator = L", ";
+            }
+        }
+        std::wcout << ((separator[0] == L',') ? L")" : L"") << (summary->Incomplete ? L", incomplete" : L"") << L" in " << summary->Seconds
+            << L" s." << std::endl;
+    }
 
-    std::wcout << L"Decrypted screenshot: " << fileName.c_str() << L".jpg" << std::endl;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::wcout << std::endl << L"Ran " << jobs.size() << L" jobs (" << failedJobs << L" with failures) in " << elapsed.count() << L" s: "
+        << completed << L" snapshots exported, " << failed << L" failed." << std::endl;
+    return (failedJobs > 0) ? 1 : 0;
 }
 
-void WriteImageAndMetadataToOutputFolder(winrt::StorageFile const& file, winrt::StorageFolder const& outputFolder, std::wstring const& exportCode)
+// Discards everything written to it; the end-to-end benchmarks silence the per-file progress lines with it.
+class NullWideStreamBuffer : public std::wstreambuf
+{
+protected:
+    int_type overflow(int_type character) override
+    {
+        return traits_type::not_eof(character);
+    }
+};
+
+// The metadata stage as the export runs it by default: the MakerNote deserialized by WinRT and written as JSON, and
+// the index record taken from the same ValueSet.
+void RunMetadataBenchmarks(BenchmarkRunner& runner, BenchmarkOptions const& options)
 {
-    auto inputStream = file.OpenAsync(winrt::FileAccessMode::Read).get();
-    auto decryptedStream = DecryptSnapshot(inputStream, exportCode);
+    std::mt19937_64 random(options.Corpus.Seed);
+    const auto metadata = BuildSyntheticMetadata(options.Corpus, random);
+    const auto image = BuildSyntheticJpeg(metadata, options.Corpus.MinImageSize, random);
 
-    WriteSnapshotToOutputFolder(outputFolder, file.Name(), decryptedStream);
+    runner.Run(L"DeserializePropertySet", metadata.size(), [&]
+    {
+        return DeserializePropertySet(metadata).Size();
+    });
 
-    auto valueSet = TryGetSnapshotMetadataAsync(decryptedStream);
-    if (valueSet)
+    runner.Run(L"MetadataToJson", metadata.size(), [&]
     {
-        auto jsonObject = SerializeValueSet(valueSet);
-        WriteJSONToFile(jsonObject, file.Name(), outputFolder);
-    }
+        return TryGetSnapshotMetadata(image, JsonNumberStyle::Native).size();
+    });
+
+    const auto valueSet = DeserializePropertySet(metadata);
+    runner.Run(L"ExtractIndexRecord", metadata.size(), [&]
+    {
+        return ExtractIndexRecord(valueSet).Terms.size();
+    });
 }
 
-void ExportSnapshotsToFolder(std::wstring const& exportFolderPath, std::wstring const& outputFolderPath, std::wstring const& exportCode)
+// Exports a generated corpus with each I/O mode, on top of the portable micro-benchmarks.
+void RunExportBenchmarks(BenchmarkRunner& runner, BenchmarkOptions const& options)
 {
-    if (!std::filesystem::is_directory(outputFolderPath))
+    const std::pair<wchar_t const*, void (*)(ExportOptions&)> modes[] = {
+        { L"Export/buffered", [](ExportOptions&) {} },
+        { L"Export/mmap", [](ExportOptions& exportOptions) { exportOptions.UseMappedIo = true; } },
+        { L"Export/stream", [](ExportOptions& exportOptions) { exportOptions.UseStreaming = true; } },
+        { L"Export/batched", [](ExportOptions& exportOptions) { exportOptions.UseBatchedIo = true; } },
+        { L"Export/ndjson", [](ExportOptions& exportOptions) { exportOptions.MetadataFormat = MetadataOutputFormat::Ndjson; } },
+        { L"Export/tar", [](ExportOptions& exportOptions) { exportOptions.Archive = ArchiveOutputFormat::Tar; } },
+        { L"Export/zip", [](ExportOptions& exportOptions) { exportOptions.Archive = ArchiveOutputFormat::Zip; } },
+        { L"Export/thumbnails", [](ExportOptions& exportOptions) { exportOptions.ThumbnailScale = 4; } },
+    };
+    if (std::none_of(std::begin(modes), std::end(modes), [&](auto const& mode) { return runner.IsEnabled(mode.first); }))
     {
-        std::wcout << L"The output folder path doesn't exist." << std::endl;
-        std::wcout << L"Creating directory: " << outputFolderPath << std::endl << std::endl;
-        std::filesystem::create_directory(outputFolderPath);
+        return;
     }
 
-    winrt::StorageFolder exportFolder = winrt::StorageFolder::GetFolderFromPathAsync(exportFolderPath).get();
-    winrt::StorageFolder outputFolder = winrt::StorageFolder::GetFolderFromPathAsync(outputFolderPath).get();
+    const auto root = std::filesystem::temp_directory_path() / L"RecallSnapshotsExport.benchmark";
+    const auto corpusFolder = root / L"corpus";
+    const auto outputFolder = root / L"output";
+    std::filesystem::remove_all(root);
+    const auto corpusSize = GenerateSnapshotCorpus(corpusFolder, HexStringToBytes(c_benchmarkExportCode), options.Corpus);
 
-    auto files = exportFolder.GetFilesAsync().get();
-    for (auto const& file : files)
+    for (auto const& [name, configure] : modes)
     {
+        ExportOptions exportOptions;
+        exportOptions.ExportFolderPath = corpusFolder.wstring();
+        exportOptions.OutputFolderPath = outputFolder.wstring();
+        exportOptions.ExportCode = c_benchmarkExportCode;
+        configure(exportOptions);
+
+        NullWideStreamBuffer nullBuffer;
+        auto consoleBuffer = std::wcout.rdbuf(&nullBuffer);
         try
         {
-            WriteImageAndMetadataToOutputFolder(file, outputFolder, exportCode);
+            runner.Run(name, corpusSize, [&]
+            {
+                ExportSnapshotsToFolder(exportOptions);
+                return 1;
+            });
         }
         catch (...)
         {
-            std::wcout << L"Decryption of the file has failed. FileName: " << file.Name().c_str() << std::endl;
+            std::wcout.rdbuf(consoleBuffer);
+            throw;
         }
+        std::wcout.rdbuf(consoleBuffer);
+        std::filesystem::remove_all(outputFolder);
     }
+
+    std::filesystem::remove_all(root);
 }
 
-std::wstring UnexpandExportCode(std::wstring code)
+// RecallSnapshotsExport.exe benchmark [--filter TEXT] [--min-time MS] [corpus options]
+int BenchmarkCommand(int argc, wchar_t* argv[])
 {
-    if (code.size() > 32)
+    BenchmarkOptions options;
+    if (!TryParseBenchmarkOptions(argc, argv, 2, options))
     {
-        code.erase(std::remove(code.begin(), code.end(), ' '), code.end()); // Remove spaces
-        code.erase(std::remove(code.begin(), code.end(), '-'), code.end()); // Remove hyphens
+        std::wcout << L"Usage: RecallSnapshotsExport.exe benchmark [--filter TEXT] [--min-time MS] [--count N] [--min-size BYTES] [--max-size BYTES] [--properties N] [--depth N] [--array-length N] [--seed N]" << std::endl;
+        return 0;
     }
 
-    if (code.size() != 32)
+    BenchmarkRunner runner(options.MinimumTime, options.Filter);
+    try
     {
-        std::wcout << L"The export code has incorrect number of characters."<< std::endl;
+        RunSnapshotBenchmarks(runner, options);
+        RunMetadataBenchmarks(runner, options);
+        RunExportBenchmarks(runner, options);
+    }
+    catch (...)
+    {
+        std::wcout << L"Running the benchmarks has failed." << std::endl;
     }
 
-    return code;
+    runner.Print(std::wcout);
+    return 0;
 }
 
 int wmain(int argc, wchar_t *argv[])
 {
-    if (argc != 4)
+    if ((argc >= 2) && (std::wstring_view(argv[1]) == L"generate-corpus"))
+    {
+        return GenerateCorpusCommand(argc, argv);
+    }
+    if ((argc >= 2) && (std::wstring_view(argv[1]) == L"benchmark"))
+    {
+        return BenchmarkCommand(argc, argv);
+    }
+    if ((argc >= 2) && (std::wstring_view(argv[1]) == L"query"))
+    {
+        return QueryCommand(argc, argv);
+    }
+    if ((argc >= 2) && (std::wstring_view(argv[1]) == L"batch"))
+    {
+        return BatchCommand(argc, argv);
+    }
+
+    ExportOptions options;
+    if (!TryParseExportOptions(argc, argv, options))
     {
-        std::wcout << L"Usage: RecallSnapshotsExport.exe <exportFolderPath> <outputFolderPath> <recoveryKey>" << std::endl;
+        std::wcout << L"Usage: RecallSnapshotsExport.exe [--jobs N] [--mmap | --stream [--chunk-size BYTES] | --batched-io [--io-depth N]] [--recursive] [--pattern GLOB] [--prescan] [--memory-budget BYTES] [--incremental] [--index] [--watch] [--dedup] [--thumbnails 2|4|8] [--json-compat] [--metadata json|ndjson] [--archive tar|zip] [--quiet] [--report PATH] [--trace PATH] <exportFolderPath> <outputFolderPath> <recoveryKey>" << std::endl;
+        std::wcout << L"       RecallSnapshotsExport.exe --verify [--jobs N] [--mmap | --chunk-size BYTES] [--recursive] [--pattern GLOB] [--quiet] [--report PATH] [--trace PATH] <exportFolderPath> <recoveryKey>" << std::endl;
+        std::wcout << L"       RecallSnapshotsExport.exe query [--from TIME] [--to TIME] [--app NAME] [--field KEY=VALUE] [--text WORDS] [--limit N] [--export OUTPUT RECOVERYKEY] <indexPath | outputFolderPath>" << std::endl;
+        std::wcout << L"       RecallSnapshotsExport.exe batch [--parallel-jobs N] [--io-limit N] [export options] <jobFilePath>" << std::endl;
         return 0;
     }
 
-    std::wcout << L"Reading snapshots from: " << argv[1] << std::endl;
-    std::wcout << L"Writing content to: " << argv[2] << std::endl;
-    std::wcout << L"Recall export code: " << argv[3] << std::endl << std::endl;
+    // An archive written to standard output must not be interleaved with progress, so everything printed goes to
+    // standard error instead.
+    if ((options.Archive != ArchiveOutputFormat::None) && (options.OutputFolderPath == L"-"))
+    {
+        std::wcout.rdbuf(std::wcerr.rdbuf());
+    }
+
+    // An audit exits with 1 if any snapshot failed to verify, so scripts can act on it.
+    if (options.VerifyOnly)
+    {
+        std::wcout << L"Verifying snapshots in: " << options.ExportFolderPath << std::endl << std::endl;
+        try
+        {
+            options.ExportCode = UnexpandExportCode(options.ExportCode);
+            return VerifySnapshotsInFolder(options) ? 0 : 1;
+        }
+        catch (...)
+        {
+            std::wcout << L"Verification of the snapshots has failed." << std::endl;
+            return 1;
+        }
+    }
+
+    std::wcout << L"Reading snapshots from: " << options.ExportFolderPath << std::endl;
+    std::wcout << L"Writing content to: " << options.OutputFolderPath << std::endl;
+    std::wcout << L"Recall export code: " << options.ExportCode << std::endl << std::endl;
+    if (options.Watch)
+    {
+        SetConsoleCtrlHandler(StopWatchOnControl, TRUE);
+    }
 
     try
     {
-        ExportSnapshotsToFolder( argv[1] /*exportFolderPath*/, argv[2] /*outputFolderPath*/, UnexpandExportCode(argv[3]) /*exportCode*/ );
+        options.ExportCode = UnexpandExportCode(options.ExportCode);
+        ExportSnapshotsToFolder(options);
     }
     catch (...)
     {
@@ -322,4 +1931,4 @@ int wmain(int argc, wchar_t *argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,264 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "AesGcm.h"
+#include "ArchiveWriter.h"
+#include "Benchmark.h"
+#include "ContentHash.h"
+#include "CorpusGenerator.h"
+#include "DecryptionSession.h"
+#include "ExifReader.h"
+#include "JpegThumbnail.h"
+#include "SnapshotIndex.h"
+#include "SnapshotStore.h"
+
+// Any 32 hex digits make a valid export code; the benchmarks encrypt everything they decrypt under this one.
+constexpr wchar_t c_benchmarkExportCode[] = L"00112233445566778899AABBCCDDEEFF";
+
+struct BenchmarkOptions
+{
+    std::wstring Filter;
+    std::chrono::milliseconds MinimumTime{ 500 };
+
+    // Shapes the synthetic snapshots; the end-to-end benchmarks export FileCount of them per iteration.
+    CorpusOptions Corpus{ 32, 256 * 1024, 2 * 1024 * 1024, 12, 1, 16, 1 };
+};
+
+// Parses "[--filter TEXT] [--min-time MS] [corpus options]" from argv[first] on, i.e. after the benchmark subcommand.
+inline bool TryParseBenchmarkOptions(int argc, wchar_t* argv[], int first, BenchmarkOptions& options)
+{
+    std::vector<wchar_t*> corpusArguments;
+    for (int i = first; i < argc; i++)
+    {
+        const std::wstring argument = argv[i];
+        if (argument == L"--filter")
+        {
+            if (++i >= argc)
+            {
+                return false;
+            }
+            options.Filter = argv[i];
+        }
+        else if (argument == L"--min-time")
+        {
+            uint64_t milliseconds = 0;
+            if ((++i >= argc) || !details::TryParseCorpusNumber(argv[i], 600000, milliseconds))
+            {
+                return false;
+            }
+            options.MinimumTime = std::chrono::milliseconds(milliseconds);
+        }
+        else
+        {
+            corpusArguments.push_back(argv[i]);
+        }
+    }
+
+    std::vector<std::wstring> positional;
+    return TryParseCorpusOptions(corpusArguments, options.Corpus, positional) && positional.empty();
+}
+
+// Micro-benchmarks of the portable stages of an export: key derivation and unwrapping, AES-GCM on each
+// implementation the CPU supports (decrypting and authenticating only), whole-container and prefix-only decryption,
+// image hashing, finding the metadata in an image, thumbnails and index queries. Deserializing the metadata needs
+// WinRT and is measured by the command-line tool itself.
+inline void RunSnapshotBenchmarks(BenchmarkRunner& runner, BenchmarkOptions const& options)
+{
+    const auto exportCode = HexStringToBytes(c_benchmarkExportCode);
+    std::mt19937_64 random(options.Corpus.Seed);
+    const DecryptionSession session(exportCode);
+    const auto exportKey = DeriveExportKey(exportCode);
+
+    runner.Run(L"DeriveExportKey", 0, [&]
+    {
+        return DeriveExportKey(exportCode)[0];
+    });
+
+    runner.Run(L"DecryptionSession", 0, [&]
+    {
+        return static_cast<int>(DecryptionSession(exportCode).Backend());
+    });
+
+    const auto metadata = BuildSyntheticMetadata(options.Corpus, random);
+    const auto image = BuildSyntheticJpeg(metadata, options.Corpus.MinImageSize, random);
+    const auto container = SealSnapshotContainer(exportKey, image, random);
+
+    runner.Run(L"UnwrapContentKey", 0, [&]
+    {
+        std::array<uint8_t, c_childKeySizeInBytes> contentKey{};
+        session.UnwrapContentKey(ParseSnapshotContainer(container).WrappedKey, contentKey);
+        return contentKey[0];
+    });
+
+    // Raw AES-GCM throughput, per implementation and message size.
+    const std::array<uint8_t, AesGcm::KeySize> key{ 1 };
+    const std::array<uint8_t, AesGcm::NonceSize> nonce{};
+    for (auto implementation : { AesGcmImplementation::Software, AesGcmImplementation::AesNi, AesGcmImplementation::Vaes })
+    {
+        if (static_cast<int>(implementation) > static_cast<int>(GetBestAesGcmImplementation()))
+        {
+            continue;
+        }
+
+        const AesGcm aesGcm(key, implementation);
+        for (const size_t size : { size_t{ 4096 }, size_t{ 64 * 1024 }, size_t{ 1024 * 1024 }, size_t{ 16 * 1024 * 1024 } })
+        {
+            const auto suffix = std::wstring(AesGcmImplementationName(implementation)) + L"/" + std::to_wstring(size / 1024) + L"K";
+            const auto decryptName = L"AesGcmDecrypt/" + suffix;
+            const auto verifyName = L"AesGcmVerify/" + suffix;
+            if (!runner.IsEnabled(decryptName) && !runner.IsEnabled(verifyName))
+            {
+                continue;
+            }
+
+            std::vector<uint8_t> buffer(size);
+            details::FillRandom(random, buffer);
+            std::array<uint8_t, AesGcm::TagSize> tag{};
+            aesGcm.Encrypt(nonce, buffer, buffer, tag);
+            std::vector<uint8_t> plaintext(size);
+            runner.Run(decryptName, size, [&]
+            {
+                return aesGcm.Decrypt(nonce, buffer, tag, plaintext);
+            });
+
+            // Authenticate-only, as --verify checks content.
+            runner.Run(verifyName, size, [&]
+            {
+                return aesGcm.Verify(nonce, buffer, tag);
+            });
+        }
+    }
+
+    // Whole containers through the session, as the export pipeline decrypts them.
+    for (const size_t size : { options.Corpus.MinImageSize, options.Corpus.MaxImageSize })
+    {
+        const auto name = L"DecryptContainer/" + std::to_wstring(size / 1024) + L"K";
+        const auto prefixName = L"DecryptPrefix/" + std::to_wstring(size / 1024) + L"K";
+        if (!runner.IsEnabled(name) && !runner.IsEnabled(prefixName))
+        {
+            continue;
+        }
+
+        const auto sealed = SealSnapshotContainer(exportKey, BuildSyntheticJpeg(metadata, size, random), random);
+        std::vector<uint8_t> plaintext(DecryptionSession::GetDecryptedSize(sealed));
+        runner.Run(name, sealed.size(), [&]
+        {
+            return session.Decrypt(sealed, plaintext);
+        });
+
+        // What SnapshotStore does for metadata alone: authenticate everything, decrypt only the start.
+        std::vector<uint8_t> prefix(SnapshotStore::c_metadataPrefixSize);
+        runner.Run(prefixName, sealed.size(), [&]
+        {
+            return session.DecryptPrefix(sealed, prefix);
+        });
+    }
+
+    // --dedup hashes every decrypted image.
+    const auto largestImage = BuildSyntheticJpeg(metadata, options.Corpus.MaxImageSize, random);
+    runner.Run(L"Xxh3Hash64", largestImage.size(), [&]
+    {
+        return Xxh3Hash64(largestImage);
+    });
+
+    runner.Run(L"Crc32", largestImage.size(), [&]
+    {
+        return details::Crc32(largestImage);
+    });
+
+    runner.Run(L"FindSnapshotMetadata", 0, [&]
+    {
+        return FindSnapshotMetadata(image)->size();
+    });
+
+    // --thumbnails on a 4K screenshot: gradients under rows of dark, text-like marks, so the entropy-coded data is
+    // about as dense as a real capture's. 1/1 is the cost of a separate full decode and re-encode.
+    const std::wstring scaleNames[] = { L"ScaleJpeg/1_1", L"ScaleJpeg/1_2", L"ScaleJpeg/1_4", L"ScaleJpeg/1_8" };
+    if (std::any_of(std::begin(scaleNames), std::end(scaleNames), [&](auto const& name) { return runner.IsEnabled(name); }))
+    {
+        constexpr uint32_t c_screenWidth = 3840;
+        constexpr uint32_t c_screenHeight = 2160;
+        std::vector<uint8_t> pixels(size_t{ c_screenWidth } * c_screenHeight * 3);
+        for (uint32_t y = 0; y < c_screenHeight; y++)
+        {
+            for (uint32_t x = 0; x < c_screenWidth; x++)
+            {
+                auto* pixel = &pixels[(size_t{ y } * c_screenWidth + x) * 3];
+                const bool mark = ((y / 24) % 3 == 0) && ((random() & 3) == 0);
+                pixel[0] = mark ? 20 : static_cast<uint8_t>(x * 255 / c_screenWidth);
+                pixel[1] = mark ? 20 : static_cast<uint8_t>(y * 255 / c_screenHeight);
+                pixel[2] = mark ? 20 : 180;
+            }
+        }
+        const auto screenshot = EncodeJpeg(pixels, c_screenWidth, c_screenHeight, 3, 90);
+        for (unsigned i = 0; i < std::size(scaleNames); i++)
+        {
+            runner.Run(scaleNames[i], screenshot.size(), [&]
+            {
+                return ScaleJpeg(screenshot, 1u << i).size();
+            });
+        }
+    }
+
+    // The query command over an index of 100,000 snapshots a second apart, with records drawn from a smaller pool
+    // so that terms repeat the way application names and window titles do.
+    constexpr uint32_t c_indexedSnapshots = 100000;
+    static constexpr char const* c_appNames[] = { "msedge.exe", "winword.exe", "explorer.exe", "teams.exe", "notepad.exe" };
+    static constexpr char const* c_titleWords[] = {
+        "report", "quarterly", "draft", "meeting", "notes", "photo", "budget", "recall", "search", "review", "design", "plan",
+    };
+    std::vector<SnapshotIndexRecord> records(256);
+    for (auto& record : records)
+    {
+        record.Terms.push_back(FieldTerm("appname", c_appNames[random() % std::size(c_appNames)]));
+        std::string title;
+        for (int i = 0; i < 6; i++)
+        {
+            const std::string word = c_titleWords[random() % std::size(c_titleWords)];
+            title += (title.empty() ? "" : " ") + word;
+            record.Terms.push_back(WordTerm(word));
+        }
+        record.Terms.push_back(FieldTerm("windowtitle", title));
+        std::sort(record.Terms.begin(), record.Terms.end());
+        record.Terms.erase(std::unique(record.Terms.begin(), record.Terms.end()), record.Terms.end());
+    }
+    SnapshotIndexBuilder builder;
+    for (uint32_t i = 0; i < c_indexedSnapshots; i++)
+    {
+        auto record = records[random() % records.size()];
+        record.Name = "snapshot_" + std::to_string(i);
+        record.Time = 1704067200000 + int64_t{ i } * 1000;
+        builder.Add(std::move(record));
+    }
+    const auto indexPath = std::filesystem::temp_directory_path() / L"RecallSnapshotsExport-benchmark.index";
+    builder.Write(indexPath, std::filesystem::temp_directory_path());
+    {
+        const SnapshotIndex index(indexPath);
+        SnapshotQuery byApp;
+        byApp.AddField(L"AppName", L"msedge.exe");
+        runner.Run(L"Index/QueryApp", 0, [&]
+        {
+            return index.Query(byApp).size();
+        });
+
+        SnapshotQuery byDay = byApp;
+        byDay.From = 1704067200000 + 20000 * 1000;
+        byDay.To = *byDay.From + 86400 * 1000 / 4;
+        byDay.AddWords(L"quarterly budget");
+        runner.Run(L"Index/QueryRangeText", 0, [&]
+        {
+            return index.Query(byDay).size();
+        });
+    }
+    std::filesystem::remove(indexPath);
+}
@@ -0,0 +1,193 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <span>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#include <wil/resource.h>
+#include <wil/result.h>
+#endif
+
+#include "AesGcm.h"
+#include "Sha256.h"
+#include "SnapshotFormat.h"
+
+enum class CryptoBackend
+{
+    Native,  // AesGcm.h, dispatched at runtime to VAES, AES-NI or portable code.
+    BCrypt,  // Windows CNG.
+};
+
+// An AES-256-GCM key held by one of the crypto backends.
+class SnapshotCipher
+{
+public:
+    virtual ~SnapshotCipher() = default;
+
+    // Decrypts and authenticates 'ciphertext' into 'plaintext'. Throws on a tag mismatch.
+    virtual void Decrypt(
+        std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag, std::span<uint8_t> plaintext) const = 0;
+};
+
+class NativeSnapshotCipher final : public SnapshotCipher
+{
+public:
+    explicit NativeSnapshotCipher(std::span<uint8_t const> key) : m_aesGcm(key) {}
+
+    void Decrypt(
+        std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag, std::span<uint8_t> plaintext) const override
+    {
+        if (!m_aesGcm.Decrypt(nonce, ciphertext, tag, plaintext))
+        {
+            throw SnapshotException(c_hrAuthTagMismatch, "The authentication tag does not match.");
+        }
+    }
+
+private:
+    AesGcm m_aesGcm;
+};
+
+#if defined(_WIN32)
+inline HRESULT HResultFromBCryptStatus(NTSTATUS status)
+{
+    #define STATUS_AUTH_TAG_MISMATCH ((NTSTATUS)0xC000A002L)
+
+    RETURN_HR_IF_EXPECTED((HRESULT)STATUS_AUTH_TAG_MISMATCH, status == STATUS_AUTH_TAG_MISMATCH);
+    RETURN_IF_NTSTATUS_FAILED_EXPECTED(status);
+    return S_OK;
+}
+
+class BCryptSnapshotCipher final : public SnapshotCipher
+{
+public:
+    explicit BCryptSnapshotCipher(std::span<uint8_t const> key)
+    {
+        THROW_IF_NTSTATUS_FAILED(BCryptGenerateSymmetricKey(
+            BCRYPT_AES_GCM_ALG_HANDLE, &m_key, nullptr, 0, const_cast<uint8_t*>(key.data()), static_cast<ULONG>(key.size()), 0));
+    }
+
+    void Decrypt(
+        std::span<uint8_t const> nonce, std::span<uint8_t const> ciphertext, std::span<uint8_t const> tag, std::span<uint8_t> plaintext) const override
+    {
+        BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO authInfo{};
+        BCRYPT_INIT_AUTH_MODE_INFO(authInfo);
+        authInfo.pbNonce = const_cast<uint8_t*>(nonce.data());
+        authInfo.cbNonce = static_cast<ULONG>(nonce.size());
+        authInfo.pbTag = const_cast<uint8_t*>(tag.data());
+        authInfo.cbTag = static_cast<ULONG>(tag.size());
+
+        ULONG decryptedSize = 0;
+        THROW_IF_FAILED(HResultFromBCryptStatus(BCryptDecrypt(
+            m_key.get(),
+            const_cast<uint8_t*>(ciphertext.data()),
+            static_cast<ULONG>(ciphertext.size()),
+            &authInfo,
+            nullptr,
+            0,
+            plaintext.data(),
+            static_cast<ULONG>(plaintext.size()),
+            &decryptedSize,
+            0)));
+    }
+
+private:
+    wil::unique_bcrypt_key m_key;
+};
+#endif
+
+// The native backend is preferred whenever the CPU has AES instructions; CNG covers older Windows machines.
+inline CryptoBackend DefaultCryptoBackend()
+{
+#if defined(_WIN32)
+    return (GetBestAesGcmImplementation() == AesGcmImplementation::Software) ? CryptoBackend::BCrypt : CryptoBackend::Native;
+#else
+    return CryptoBackend::Native;
+#endif
+}
+
+inline std::unique_ptr<SnapshotCipher> CreateSnapshotCipher(std::span<uint8_t const> key, CryptoBackend backend = DefaultCryptoBackend())
+{
+    if (key.size() != c_keySizeInBytes)
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Invalid key size.");
+    }
+
+#if defined(_WIN32)
+    if (backend == CryptoBackend::BCrypt)
+    {
+        return std::make_unique<BCryptSnapshotCipher>(key);
+    }
+#endif
+
+    (void)backend;
+    return std::make_unique<NativeSnapshotCipher>(key);
+}
+
+// The export key is the SHA-256 of the decoded export code bytes.
+inline std::array<uint8_t, c_keySizeInBytes> DeriveExportKey(std::span<uint8_t const> exportCodeBytes)
+{
+    return Sha256::Hash(exportCodeBytes);
+}
+
+// Unwraps the per-snapshot child key (nonce | encrypted key | tag) with the export key into 'contentKey'.
+inline void UnwrapContentKey(
+    SnapshotCipher const& key, std::span<uint8_t const> encryptedKey, std::span<uint8_t, c_childKeySizeInBytes> contentKey)
+{
+    if (encryptedKey.size() != c_totalSizeInBytes)
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Invalid wrapped key size.");
+    }
+
+    key.Decrypt(
+        encryptedKey.first(c_nonceSizeInBytes),
+        encryptedKey.subspan(c_nonceSizeInBytes, c_childKeySizeInBytes),
+        encryptedKey.subspan(c_nonceSizeInBytes + c_childKeySizeInBytes, c_tagSizeInBytes),
+        contentKey);
+}
+
+inline std::unique_ptr<SnapshotCipher> DecryptExportKey(
+    SnapshotCipher const& key, std::span<uint8_t const> encryptedKey, CryptoBackend backend = DefaultCryptoBackend())
+{
+    uint8_t decryptedKey[c_childKeySizeInBytes] = { 0 };
+    UnwrapContentKey(key, encryptedKey, decryptedKey);
+
+    auto childKey = CreateSnapshotCipher(decryptedKey, backend);
+    details::SecureZeroBytes(decryptedKey, sizeof(decryptedKey));
+    return childKey;
+}
+
+// Decrypts content (ciphertext | tag) sealed under a zero nonce into 'output', returning the plaintext size.
+inline size_t DecryptPackedData(SnapshotCipher const& key, std::span<uint8_t const> payload, std::span<uint8_t> output)
+{
+    if ((payload.size() < c_tagSizeInBytes) || (output.size() < payload.size() - c_tagSizeInBytes))
+    {
+        throw SnapshotException(c_hrInvalidArgument, "Invalid payload size.");
+    }
+
+    const auto dataSize = payload.size() - c_tagSizeInBytes;
+    const uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
+    key.Decrypt(zeroNonce, payload.first(dataSize), payload.subspan(dataSize), output.first(dataSize));
+    return dataSize;
+}
+
+inline std::vector<uint8_t> DecryptPackedData(SnapshotCipher const& key, std::span<uint8_t const> payload)
+{
+    std::vector<uint8_t> decryptedContent(payload.size() >= c_tagSizeInBytes ? payload.size() - c_tagSizeInBytes : 0);
+    decryptedContent.resize(DecryptPackedData(key, payload, decryptedContent));
+    return decryptedContent;
+}
+
+// Decrypts a whole v2 snapshot container held in memory.
+inline std::vector<uint8_t> DecryptSnapshotContainer(
+    SnapshotCipher const& exportKey, std::span<uint8_t const> data, CryptoBackend backend = DefaultCryptoBackend())
+{
+    const auto container = ParseSnapshotContainer(data);
+    const auto contentKey = DecryptExportKey(exportKey, container.WrappedKey, backend);
+    return DecryptPackedData(*contentKey, container.Payload);
+}
@@ -0,0 +1,92 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+constexpr auto c_keySizeInBytes = 32;
+constexpr auto c_tagSizeInBytes = 16;
+constexpr auto c_nonceSizeInBytes = 12;
+constexpr auto c_childKeySizeInBytes = 32;
+constexpr auto c_totalSizeInBytes = c_nonceSizeInBytes + c_childKeySizeInBytes + c_tagSizeInBytes;
+constexpr uint32_t c_snapshotContainerVersion = 2;
+
+// HRESULTs reported by the portable snapshot core. They match what the BCrypt path has always surfaced.
+constexpr int32_t c_hrInvalidArgument = static_cast<int32_t>(0x80070057);  // E_INVALIDARG
+constexpr int32_t c_hrInvalidData = static_cast<int32_t>(0x8007000D);      // HRESULT_FROM_WIN32(ERROR_INVALID_DATA)
+constexpr int32_t c_hrAuthTagMismatch = static_cast<int32_t>(0xC000A002);  // STATUS_AUTH_TAG_MISMATCH
+
+class SnapshotException : public std::runtime_error
+{
+public:
+    SnapshotException(int32_t hr, const char* message) : std::runtime_error(message), m_hr(hr) {}
+
+    int32_t HResult() const noexcept
+    {
+        return m_hr;
+    }
+
+private:
+    int32_t m_hr;
+};
+
+// On-disk layout (little-endian): header, then KeySize bytes of wrapped child key (nonce | key | tag),
+// then ContentSize bytes of content encrypted under the child key with a zero nonce, tag appended.
+struct EncryptedSnapshotHeader
+{
+    uint32_t Version;
+    uint32_t KeySize;
+    uint32_t ContentSize;
+    uint32_t ContentType;
+};
+
+struct SnapshotContainer
+{
+    EncryptedSnapshotHeader Header;
+    std::span<uint8_t const> WrappedKey;
+    std::span<uint8_t const> Payload;
+};
+
+inline uint32_t ReadLittleEndian32(uint8_t const* bytes)
+{
+    return uint32_t{ bytes[0] } | (uint32_t{ bytes[1] } << 8) | (uint32_t{ bytes[2] } << 16) | (uint32_t{ bytes[3] } << 24);
+}
+
+inline EncryptedSnapshotHeader ReadSnapshotHeader(std::span<uint8_t const> data)
+{
+    if (data.size() < sizeof(EncryptedSnapshotHeader))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    EncryptedSnapshotHeader header{};
+    header.Version = ReadLittleEndian32(data.data());
+    header.KeySize = ReadLittleEndian32(data.data() + 4);
+    header.ContentSize = ReadLittleEndian32(data.data() + 8);
+    header.ContentType = ReadLittleEndian32(data.data() + 12);
+
+    if (header.Version != c_snapshotContainerVersion)
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data header version.");
+    }
+
+    return header;
+}
+
+inline SnapshotContainer ParseSnapshotContainer(std::span<uint8_t const> data)
+{
+    SnapshotContainer container{};
+    container.Header = ReadSnapshotHeader(data);
+
+    auto remaining = data.subspan(sizeof(EncryptedSnapshotHeader));
+    if ((remaining.size() < container.Header.KeySize) || (remaining.size() - container.Header.KeySize < container.Header.ContentSize))
+    {
+        throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+    }
+
+    container.WrappedKey = remaining.first(container.Header.KeySize);
+    container.Payload = remaining.subspan(container.Header.KeySize, container.Header.ContentSize);
+    return container;
+}
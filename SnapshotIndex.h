@@ -0,0 +1,816 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "ExportOptions.h"
+#include "FileIo.h"
+#include "JsonWriter.h"
+#include "MappedFile.h"
+#include "SnapshotFormat.h"
+
+// Capture time of a snapshot whose metadata has no DateTime.
+constexpr int64_t c_noSnapshotTime = INT64_MIN;
+
+// What the index keeps of one snapshot.
+struct SnapshotIndexRecord
+{
+    // The snapshot's path relative to the export folder, in UTF-8 with '/' separators.
+    std::string Name;
+
+    // The first top-level DateTime of its metadata, in milliseconds since the Unix epoch like the JSON, or
+    // c_noSnapshotTime.
+    int64_t Time = c_noSnapshotTime;
+
+    // Sorted and unique; see FieldTerm and WordTerm.
+    std::vector<std::string> Terms;
+};
+
+namespace details
+{
+    constexpr size_t c_maximumIndexedValueSize = 256;
+    constexpr size_t c_maximumIndexedWordSize = 64;
+
+    // UTF-8 with ASCII letters lowercased, which is as far as index matching folds case. 'readUnit(i)' returns the
+    // i-th UTF-16 (or, for wchar_t on POSIX, UTF-32) code unit.
+    template <typename ReadUnit>
+    std::string FoldIndexText(size_t length, ReadUnit&& readUnit)
+    {
+        std::string text;
+        text.reserve(length);
+        char encoded[4];
+        for (size_t i = 0; i < length;)
+        {
+            uint32_t codePoint = readUnit(i++);
+            if ((codePoint >= 0xD800) && (codePoint < 0xDC00) && (i < length))
+            {
+                const uint32_t next = readUnit(i);
+                if ((next >= 0xDC00) && (next < 0xE000))
+                {
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (next - 0xDC00);
+                    i++;
+                }
+            }
+            if (((codePoint >= 0xD800) && (codePoint < 0xE000)) || (codePoint > 0x10FFFF))
+            {
+                codePoint = 0xFFFD;
+            }
+            if ((codePoint >= 'A') && (codePoint <= 'Z'))
+            {
+                codePoint += 'a' - 'A';
+            }
+            text.append(encoded, AppendUtf8(encoded, codePoint) - encoded);
+        }
+        return text;
+    }
+
+    inline std::string FoldIndexText(std::wstring_view text)
+    {
+        return FoldIndexText(text.size(), [&](size_t i) { return static_cast<uint32_t>(text[i]); });
+    }
+
+    // Words are runs of ASCII letters and digits, and of anything non-ASCII, so that words in other scripts stay whole.
+    template <typename OnWord>
+    void SplitIndexWords(std::string_view text, OnWord&& onWord)
+    {
+        auto isWordByte = [](char c)
+        {
+            const auto byte = static_cast<uint8_t>(c);
+            return (byte >= 0x80) || ((byte >= '0') && (byte <= '9')) || ((byte >= 'a') && (byte <= 'z')) || ((byte >= 'A') && (byte <= 'Z'));
+        };
+
+        for (size_t i = 0; i < text.size();)
+        {
+            if (!isWordByte(text[i]))
+            {
+                i++;
+                continue;
+            }
+            const auto start = i;
+            while ((i < text.size()) && isWordByte(text[i]))
+            {
+                i++;
+            }
+            if (i - start <= c_maximumIndexedWordSize)
+            {
+                onWord(text.substr(start, i - start));
+            }
+        }
+    }
+}
+
+// The term for a string or GUID property, "f:<key>=<value>", with nested keys joined by '.' and the value cut to
+// c_maximumIndexedValueSize bytes. Both parts must already be folded.
+inline std::string FieldTerm(std::string_view key, std::string_view value)
+{
+    std::string term = "f:";
+    term.append(key);
+    term.push_back('=');
+    term.append(value.substr(0, details::c_maximumIndexedValueSize));
+    return term;
+}
+
+// The term for a word of a string property, "w:<word>". The word must already be folded.
+inline std::string WordTerm(std::string_view word)
+{
+    return "w:" + std::string(word);
+}
+
+// A lookup: every term must match, and the capture time must be in [From, To). Snapshots without a time only match
+// when neither bound is set. Results are in capture order.
+struct SnapshotQuery
+{
+    std::optional<int64_t> From;
+    std::optional<int64_t> To;
+    std::vector<std::string> Terms;
+
+    // Matches snapshots whose property 'key' (nested keys joined by '.') has exactly this value, ignoring ASCII case.
+    void AddField(std::wstring_view key, std::wstring_view value)
+    {
+        Terms.push_back(FieldTerm(details::FoldIndexText(key), details::FoldIndexText(value)));
+    }
+
+    // Matches snapshots with all of these words in their string properties, ignoring ASCII case.
+    void AddWords(std::wstring_view text)
+    {
+        details::SplitIndexWords(details::FoldIndexText(text), [&](std::string_view word) { Terms.push_back(WordTerm(word)); });
+    }
+};
+
+// Searchable index of an export's metadata, kept in the output folder: a time column sorted by capture time, and an
+// inverted index from every term to the snapshots that have it. Snapshot ids are positions in capture order, so a
+// time range is a contiguous run of ids found by binary search, and each term's posting list is a sorted run of
+// ids, stored as LEB128 deltas. The file is mapped and nothing is loaded up front, so a query costs two binary
+// searches and decoding the posting lists of its terms. Thread-safe for queries.
+//
+// Layout, little-endian:
+//   header       := "RSXI" version:u32 snapshotCount:u32 termCount:u32 exportFolderSize:u32 reserved:u32{3}
+//   times        := i64{snapshotCount}, ascending
+//   nameEnds     := u32{snapshotCount}, the end of each name in names
+//   termEnds     := u32{termCount}, the end of each term in terms
+//   postingEnds  := u32{termCount}, the end of each term's posting list in postings
+//   names, terms (sorted), postings, exportFolder := UTF-8 and LEB128 bytes
+class SnapshotIndex
+{
+public:
+    static constexpr wchar_t c_fileName[] = L"snapshots.index";
+
+    // Throws std::system_error (or, on Windows, a WIL exception) if the file cannot be mapped, and SnapshotException
+    // with c_hrInvalidData if it is not a valid index.
+    explicit SnapshotIndex(std::filesystem::path const& path) : m_file(MappedFile::OpenRead(path))
+    {
+        const auto data = m_file.Data();
+        if ((data.size() < c_headerSize) || (memcmp(data.data(), c_magic, sizeof(c_magic)) != 0) || (Read<uint32_t>(data.data() + 4) != c_version))
+        {
+            throw SnapshotException(c_hrInvalidData, "Not a snapshot index.");
+        }
+
+        m_snapshotCount = Read<uint32_t>(data.data() + 8);
+        m_termCount = Read<uint32_t>(data.data() + 12);
+        const uint64_t exportFolderSize = Read<uint32_t>(data.data() + 16);
+        const uint64_t tablesEnd = c_headerSize + 12 * uint64_t{ m_snapshotCount } + 8 * uint64_t{ m_termCount };
+        if (tablesEnd > data.size())
+        {
+            throw SnapshotException(c_hrInvalidData, "The snapshot index is truncated.");
+        }
+
+        m_times = data.data() + c_headerSize;
+        m_nameEnds = m_times + 8 * size_t{ m_snapshotCount };
+        m_termEnds = m_nameEnds + 4 * size_t{ m_snapshotCount };
+        m_postingEnds = m_termEnds + 4 * size_t{ m_termCount };
+
+        // Every offset is checked once here, so lookups need no bounds checks.
+        const auto namesSize = CheckEnds(m_nameEnds, m_snapshotCount);
+        const auto termsSize = CheckEnds(m_termEnds, m_termCount);
+        const auto postingsSize = CheckEnds(m_postingEnds, m_termCount);
+        if (tablesEnd + namesSize + termsSize + postingsSize + exportFolderSize != data.size())
+        {
+            throw SnapshotException(c_hrInvalidData, "The snapshot index is truncated.");
+        }
+        for (uint32_t id = 1; id < m_snapshotCount; id++)
+        {
+            if (Time(id) < Time(id - 1))
+            {
+                throw SnapshotException(c_hrInvalidData, "The snapshot index is not in capture order.");
+            }
+        }
+
+        m_names = reinterpret_cast<char const*>(data.data() + tablesEnd);
+        m_terms = m_names + namesSize;
+        m_postings = reinterpret_cast<uint8_t const*>(m_terms + termsSize);
+        m_exportFolder = std::string_view(reinterpret_cast<char const*>(m_postings + postingsSize), exportFolderSize);
+    }
+
+    SnapshotIndex(SnapshotIndex const&) = delete;
+    SnapshotIndex& operator=(SnapshotIndex const&) = delete;
+
+    uint32_t Size() const
+    {
+        return m_snapshotCount;
+    }
+
+    int64_t Time(uint32_t id) const
+    {
+        return Read<int64_t>(m_times + 8 * size_t{ id });
+    }
+
+    std::string_view Name(uint32_t id) const
+    {
+        return Entry(m_names, m_nameEnds, id);
+    }
+
+    // The export folder the snapshots were read from, so that matches can be decrypted.
+    std::filesystem::path ExportFolder() const
+    {
+        return std::filesystem::path(std::u8string(reinterpret_cast<char8_t const*>(m_exportFolder.data()), m_exportFolder.size()));
+    }
+
+    uint32_t TermCount() const
+    {
+        return m_termCount;
+    }
+
+    std::string_view Term(uint32_t term) const
+    {
+        return Entry(m_terms, m_termEnds, term);
+    }
+
+    // The ids of the snapshots with the term, ascending. Throws SnapshotException with c_hrInvalidData if the list
+    // is malformed.
+    std::vector<uint32_t> Postings(uint32_t term) const
+    {
+        std::vector<uint32_t> ids;
+        ForEachPosting(term, [&](uint32_t id)
+        {
+            ids.push_back(id);
+            return true;
+        });
+        return ids;
+    }
+
+    std::optional<uint32_t> FindTerm(std::string_view term) const
+    {
+        uint32_t low = 0;
+        uint32_t high = m_termCount;
+        while (low < high)
+        {
+            const auto middle = low + (high - low) / 2;
+            if (Term(middle) < term)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return ((low < m_termCount) && (Term(low) == term)) ? std::optional(low) : std::nullopt;
+    }
+
+    // The ids of the matching snapshots, in capture order. The shortest posting list gives the candidates, and
+    // each further list is merged against them as it is decoded; no list is decoded past the time range or the last
+    // candidate.
+    std::vector<uint32_t> Query(SnapshotQuery const& query) const
+    {
+        uint32_t first = 0;
+        uint32_t last = m_snapshotCount;
+        if (query.From || query.To)
+        {
+            first = LowerBound((std::max)(query.From.value_or(c_noSnapshotTime), c_noSnapshotTime + 1));
+            last = query.To ? LowerBound(*query.To) : m_snapshotCount;
+        }
+        if (first >= last)
+        {
+            return {};
+        }
+
+        std::vector<std::pair<uint32_t, uint32_t>> terms;  // Posting list size in bytes, term.
+        for (auto const& text : query.Terms)
+        {
+            const auto term = FindTerm(text);
+            if (!term)
+            {
+                return {};
+            }
+            terms.emplace_back(PostingsEnd(*term) - PostingsBegin(*term), *term);
+        }
+        std::sort(terms.begin(), terms.end());
+
+        std::vector<uint32_t> ids;
+        if (terms.empty())
+        {
+            ids.resize(last - first);
+            for (uint32_t i = 0; i < ids.size(); i++)
+            {
+                ids[i] = first + i;
+            }
+            return ids;
+        }
+
+        ForEachPosting(terms[0].second, [&](uint32_t id)
+        {
+            if (id >= last)
+            {
+                return false;
+            }
+            if (id >= first)
+            {
+                ids.push_back(id);
+            }
+            return true;
+        });
+
+        for (size_t i = 1; (i < terms.size()) && !ids.empty(); i++)
+        {
+            size_t candidate = 0;
+            size_t kept = 0;
+            ForEachPosting(terms[i].second, [&](uint32_t id)
+            {
+                while ((candidate < ids.size()) && (ids[candidate] < id))
+                {
+                    candidate++;
+                }
+                if ((candidate < ids.size()) && (ids[candidate] == id))
+                {
+                    ids[kept++] = ids[candidate++];
+                }
+                return candidate < ids.size();
+            });
+            ids.resize(kept);
+        }
+        return ids;
+    }
+
+private:
+    static constexpr char c_magic[4] = { 'R', 'S', 'X', 'I' };
+    static constexpr uint32_t c_version = 1;
+    static constexpr size_t c_headerSize = 32;
+
+    friend class SnapshotIndexBuilder;
+
+    template <typename T>
+    static T Read(uint8_t const* bytes)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        memcpy(&value, bytes, sizeof(T));  // The supported targets are all little-endian.
+        return value;
+    }
+
+    // Checks that a table of end offsets never goes backwards, and returns the last one.
+    static uint64_t CheckEnds(uint8_t const* ends, uint32_t count)
+    {
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const auto end = Read<uint32_t>(ends + 4 * size_t{ i });
+            if (end < previous)
+            {
+                throw SnapshotException(c_hrInvalidData, "The snapshot index is corrupt.");
+            }
+            previous = end;
+        }
+        return previous;
+    }
+
+    static std::string_view Entry(char const* blob, uint8_t const* ends, uint32_t index)
+    {
+        const auto begin = (index == 0) ? 0 : Read<uint32_t>(ends + 4 * size_t{ index - 1 });
+        return { blob + begin, Read<uint32_t>(ends + 4 * size_t{ index }) - begin };
+    }
+
+    uint32_t PostingsBegin(uint32_t term) const
+    {
+        return (term == 0) ? 0 : Read<uint32_t>(m_postingEnds + 4 * size_t{ term - 1 });
+    }
+
+    uint32_t PostingsEnd(uint32_t term) const
+    {
+        return Read<uint32_t>(m_postingEnds + 4 * size_t{ term });
+    }
+
+    // Decodes the term's posting list, calling 'onId(id)' for each id until it returns false.
+    template <typename OnId>
+    void ForEachPosting(uint32_t term, OnId&& onId) const
+    {
+        const auto end = PostingsEnd(term);
+        uint64_t id = 0;
+        bool firstId = true;
+        for (auto position = PostingsBegin(term); position < end;)
+        {
+            uint64_t delta = 0;
+            for (int shift = 0;; shift += 7)
+            {
+                if ((position >= end) || (shift > 28))
+                {
+                    throw SnapshotException(c_hrInvalidData, "The snapshot index is corrupt.");
+                }
+                const auto byte = m_postings[position++];
+                delta |= uint64_t{ byte & 0x7Fu } << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    break;
+                }
+            }
+            id += delta;
+            if ((id >= m_snapshotCount) || (!firstId && (delta == 0)))
+            {
+                throw SnapshotException(c_hrInvalidData, "The snapshot index is corrupt.");
+            }
+            firstId = false;
+            if (!onId(static_cast<uint32_t>(id)))
+            {
+                return;
+            }
+        }
+    }
+
+    uint32_t LowerBound(int64_t time) const
+    {
+        uint32_t low = 0;
+        uint32_t high = m_snapshotCount;
+        while (low < high)
+        {
+            const auto middle = low + (high - low) / 2;
+            if (Time(middle) < time)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    MappedFile m_file;
+    uint32_t m_snapshotCount = 0;
+    uint32_t m_termCount = 0;
+    uint8_t const* m_times = nullptr;
+    uint8_t const* m_nameEnds = nullptr;
+    uint8_t const* m_termEnds = nullptr;
+    uint8_t const* m_postingEnds = nullptr;
+    char const* m_names = nullptr;
+    char const* m_terms = nullptr;
+    uint8_t const* m_postings = nullptr;
+    std::string_view m_exportFolder;
+};
+
+// Collects a record per exported snapshot and writes them as a SnapshotIndex. A later record for a name replaces
+// the earlier one. Not thread-safe: the export pipeline calls it from its writer thread.
+class SnapshotIndexBuilder
+{
+public:
+    // Starts from the records of an existing index, which is how incremental exports extend it.
+    void Load(SnapshotIndex const& index)
+    {
+        std::vector<SnapshotIndexRecord> records(index.Size());
+        for (uint32_t id = 0; id < index.Size(); id++)
+        {
+            records[id].Name = index.Name(id);
+            records[id].Time = index.Time(id);
+        }
+        for (uint32_t term = 0; term < index.TermCount(); term++)
+        {
+            for (const auto id : index.Postings(term))
+            {
+                records[id].Terms.emplace_back(index.Term(term));
+            }
+        }
+        for (auto& record : records)
+        {
+            Add(std::move(record));
+        }
+    }
+
+    void Add(SnapshotIndexRecord record)
+    {
+        auto name = record.Name;
+        m_records.insert_or_assign(std::move(name), std::move(record));
+    }
+
+    size_t Size() const
+    {
+        return m_records.size();
+    }
+
+    // Writes the index to a temporary file that then replaces 'path', so an earlier index is never left half
+    // overwritten. Throws std::system_error if it cannot be written.
+    void Write(std::filesystem::path const& path, std::filesystem::path const& exportFolder) const
+    {
+        std::vector<SnapshotIndexRecord const*> records;
+        records.reserve(m_records.size());
+        for (auto const& [name, record] : m_records)
+        {
+            records.push_back(&record);
+        }
+        std::sort(records.begin(), records.end(), [](auto const* left, auto const* right)
+        {
+            return (left->Time != right->Time) ? (left->Time < right->Time) : (left->Name < right->Name);
+        });
+
+        std::map<std::string_view, std::vector<uint32_t>> postings;
+        for (uint32_t id = 0; id < records.size(); id++)
+        {
+            for (auto const& term : records[id]->Terms)
+            {
+                postings[term].push_back(id);
+            }
+        }
+
+        const auto folder = exportFolder.u8string();
+        std::string header(SnapshotIndex::c_headerSize, '\0');
+        memcpy(header.data(), SnapshotIndex::c_magic, sizeof(SnapshotIndex::c_magic));
+        Put<uint32_t>(header, 4, SnapshotIndex::c_version);
+        Put<uint32_t>(header, 8, static_cast<uint32_t>(records.size()));
+        Put<uint32_t>(header, 12, static_cast<uint32_t>(postings.size()));
+        Put<uint32_t>(header, 16, static_cast<uint32_t>(folder.size()));
+
+        std::string times;
+        std::string nameEnds;
+        std::string names;
+        for (auto const* record : records)
+        {
+            Append<int64_t>(times, record->Time);
+            names += record->Name;
+            Append<uint32_t>(nameEnds, CheckedSize(names.size()));
+        }
+
+        std::string termEnds;
+        std::string postingEnds;
+        std::string terms;
+        std::string encoded;
+        for (auto const& [term, ids] : postings)
+        {
+            terms += term;
+            Append<uint32_t>(termEnds, CheckedSize(terms.size()));
+            uint32_t previous = 0;
+            for (const auto id : ids)
+            {
+                for (auto delta = id - previous; ; delta >>= 7)
+                {
+                    encoded.push_back(static_cast<char>((delta & 0x7F) | ((delta >= 0x80) ? 0x80 : 0)));
+                    if (delta < 0x80)
+                    {
+                        break;
+                    }
+                }
+                previous = id;
+            }
+            Append<uint32_t>(postingEnds, CheckedSize(encoded.size()));
+        }
+
+        std::string file;
+        file.reserve(header.size() + times.size() + nameEnds.size() + termEnds.size() + postingEnds.size() + names.size() + terms.size() +
+            encoded.size() + folder.size());
+        for (auto const* section : { &header, &times, &nameEnds, &termEnds, &postingEnds, &names, &terms, &encoded })
+        {
+            file += *section;
+        }
+        file.append(reinterpret_cast<char const*>(folder.data()), folder.size());
+
+        auto temporaryPath = path;
+        temporaryPath += L".tmp";
+        if (const auto error = details::WriteWholeFile(temporaryPath, { reinterpret_cast<uint8_t const*>(file.data()), file.size() }))
+        {
+            std::error_code ignored;
+            std::filesystem::remove(temporaryPath, ignored);
+            throw std::system_error(error, "Writing the snapshot index has failed.");
+        }
+        std::filesystem::rename(temporaryPath, path);
+    }
+
+private:
+    template <typename T>
+    static void Put(std::string& buffer, size_t offset, T value)
+    {
+        memcpy(buffer.data() + offset, &value, sizeof(T));  // The supported targets are all little-endian.
+    }
+
+    template <typename T>
+    static void Append(std::string& buffer, T value)
+    {
+        buffer.append(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    static uint32_t CheckedSize(size_t size)
+    {
+        if (size > UINT32_MAX)
+        {
+            throw std::system_error(std::make_error_code(std::errc::file_too_large), "The snapshot index is too large.");
+        }
+        return static_cast<uint32_t>(size);
+    }
+
+    std::unordered_map<std::string, SnapshotIndexRecord> m_records;
+};
+
+// Milliseconds since the Unix epoch, as "2024-05-01T09:30:00.000Z", or "-" for c_noSnapshotTime.
+inline std::wstring FormatSnapshotTime(int64_t time)
+{
+    if (time == c_noSnapshotTime)
+    {
+        return L"-";
+    }
+
+    using namespace std::chrono;
+    const sys_time<milliseconds> point{ milliseconds(time) };
+    const auto day = floor<days>(point);
+    const year_month_day date(day);
+    const hh_mm_ss clock(point - day);
+    wchar_t text[40];
+    swprintf(text, std::size(text), L"%04d-%02u-%02uT%02d:%02d:%02d.%03dZ", static_cast<int>(date.year()), static_cast<unsigned>(date.month()),
+        static_cast<unsigned>(date.day()), static_cast<int>(clock.hours().count()), static_cast<int>(clock.minutes().count()),
+        static_cast<int>(clock.seconds().count()), static_cast<int>(clock.subseconds().count()));
+    return text;
+}
+
+// Accepts milliseconds since the Unix epoch, or a UTC time as "YYYY-MM-DD", "YYYY-MM-DDTHH:MM" or
+// "YYYY-MM-DDTHH:MM:SS", optionally followed by 'Z'.
+inline bool TryParseSnapshotTime(std::wstring text, int64_t& time)
+{
+    if (!text.empty() && (text.find_first_not_of(L"0123456789") == std::wstring::npos))
+    {
+        try
+        {
+            time = static_cast<int64_t>(std::stoll(text));
+            return true;
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+
+    if (!text.empty() && (text.back() == L'Z'))
+    {
+        text.pop_back();
+    }
+
+    // Each shape is matched exactly: '9' stands for a digit and anything else for itself.
+    static constexpr std::wstring_view c_shapes[] = { L"9999-99-99", L"9999-99-99T99:99", L"9999-99-99T99:99:99" };
+    if (std::none_of(std::begin(c_shapes), std::end(c_shapes), [&](std::wstring_view shape)
+    {
+        return (shape.size() == text.size()) &&
+            std::equal(shape.begin(), shape.end(), text.begin(), [](wchar_t s, wchar_t c) { return (s == L'9') ? ((c >= L'0') && (c <= L'9')) : (s == c); });
+    }))
+    {
+        return false;
+    }
+
+    auto number = [&](size_t offset, size_t length)
+    {
+        unsigned value = 0;
+        for (size_t i = offset; i < offset + length; i++)
+        {
+            value = value * 10 + (text[i] - L'0');
+        }
+        return value;
+    };
+    const auto hour = (text.size() > 10) ? number(11, 2) : 0;
+    const auto minute = (text.size() > 10) ? number(14, 2) : 0;
+    const auto second = (text.size() > 16) ? number(17, 2) : 0;
+    if ((hour > 23) || (minute > 59) || (second > 59))
+    {
+        return false;
+    }
+
+    using namespace std::chrono;
+    const year_month_day date{ std::chrono::year(static_cast<int>(number(0, 4))), std::chrono::month(number(5, 2)), std::chrono::day(number(8, 2)) };
+    if (!date.ok())
+    {
+        return false;
+    }
+    time = duration_cast<milliseconds>((sys_days(date) + hours(hour) + minutes(minute) + seconds(second)).time_since_epoch()).count();
+    return true;
+}
+
+struct SnapshotQueryOptions
+{
+    // The index file, or the output folder holding it.
+    std::wstring IndexPath;
+
+    SnapshotQuery Query;
+
+    // At most this many matches are printed or exported; 0 for all.
+    size_t Limit = 0;
+
+    // --export: decrypt the matches into this folder with this export code, from the export folder the index
+    // recorded unless another is given.
+    std::wstring ExportOutputPath;
+    std::wstring ExportCode;
+    std::wstring ExportFolderPath;
+    unsigned Jobs = (std::max)(1u, std::thread::hardware_concurrency());
+};
+
+// Parses "query [--from TIME] [--to TIME] [--app NAME] [--field KEY=VALUE] [--text WORDS] [--limit N]
+// [--export OUTPUT CODE] [--export-folder PATH] [--jobs N] <indexPath>", starting at argv[first].
+inline bool TryParseQueryOptions(int argc, wchar_t* argv[], int first, SnapshotQueryOptions& options)
+{
+    std::vector<std::wstring> positional;
+    for (int i = first; i < argc; i++)
+    {
+        const std::wstring argument = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        if ((argument == L"--from") || (argument == L"--to"))
+        {
+            int64_t time = 0;
+            if (!hasValue || !TryParseSnapshotTime(argv[++i], time))
+            {
+                return false;
+            }
+            ((argument == L"--from") ? options.Query.From : options.Query.To) = time;
+        }
+        else if (argument == L"--app")
+        {
+            if (!hasValue)
+            {
+                return false;
+            }
+            options.Query.AddField(L"AppName", argv[++i]);
+        }
+        else if (argument == L"--field")
+        {
+            const std::wstring field = hasValue ? argv[++i] : L"";
+            const auto equals = field.find(L'=');
+            if ((equals == std::wstring::npos) || (equals == 0))
+            {
+                return false;
+            }
+            options.Query.AddField(std::wstring_view(field).substr(0, equals), std::wstring_view(field).substr(equals + 1));
+        }
+        else if (argument == L"--text")
+        {
+            if (!hasValue)
+            {
+                return false;
+            }
+            options.Query.AddWords(argv[++i]);
+        }
+        else if (argument == L"--limit")
+        {
+            unsigned limit = 0;
+            if (!hasValue || !TryParseUnsigned(argv[++i], limit))
+            {
+                return false;
+            }
+            options.Limit = limit;
+        }
+        else if ((argument == L"--jobs") || (argument == L"-j"))
+        {
+            if (!hasValue || !TryParseUnsigned(argv[++i], options.Jobs))
+            {
+                return false;
+            }
+        }
+        else if (argument == L"--export")
+        {
+            if (i + 2 >= argc)
+            {
+                return false;
+            }
+            options.ExportOutputPath = argv[++i];
+            options.ExportCode = argv[++i];
+        }
+        else if (argument == L"--export-folder")
+        {
+            if (!hasValue)
+            {
+                return false;
+            }
+            options.ExportFolderPath = argv[++i];
+        }
+        else if (argument.starts_with(L"--"))
+        {
+            return false;
+        }
+        else
+        {
+            positional.push_back(argument);
+        }
+    }
+
+    if (positional.size() != 1)
+    {
+        return false;
+    }
+    options.IndexPath = positional[0];
+    return true;
+}
@@ -0,0 +1,386 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.h"
+#include "DecryptionSession.h"
+#include "DirectoryScanner.h"
+#include "ExifReader.h"
+#include "FileIo.h"
+#include "JsonWriter.h"
+
+#if defined(_WIN32)
+#include "JsonHelper.h"
+#endif
+
+struct SnapshotStoreOptions
+{
+    ScanOptions Scan;
+
+    // Upper bounds on the decrypted images and on the parsed metadata kept in memory.
+    size_t ImageCacheSize = size_t{ 256 } << 20;
+    size_t MetadataCacheSize = size_t{ 32 } << 20;
+
+    JsonNumberStyle NumberStyle = JsonNumberStyle::Native;
+};
+
+// One snapshot of the export folder.
+struct SnapshotEntry
+{
+    std::filesystem::path Path;
+    std::filesystem::path RelativePath;
+};
+
+// A decrypted image. The plaintext was decrypted over the container it came from, which it keeps.
+class SnapshotImage
+{
+public:
+    SnapshotImage(PooledBuffer container, std::span<uint8_t const> data) : m_container(std::move(container)), m_data(data) {}
+
+    SnapshotImage(SnapshotImage const&) = delete;
+    SnapshotImage& operator=(SnapshotImage const&) = delete;
+
+    std::span<uint8_t const> Data() const
+    {
+        return m_data;
+    }
+
+    size_t MemorySize() const
+    {
+        return m_container.capacity();
+    }
+
+private:
+    PooledBuffer m_container;
+    std::span<uint8_t const> m_data;
+};
+
+// A snapshot's metadata: the serialized PropertySet from its Exif MakerNote and, on Windows, its JSON as the export
+// writes it. Both are empty (and the JSON "{}") for an image without one. Other platforms have no deserializer for the
+// PropertySet, so there the JSON is left empty and only the serialized bytes are available.
+class SnapshotMetadata
+{
+public:
+    // Throws SnapshotException with c_hrInvalidData if the PropertySet cannot be deserialized.
+    SnapshotMetadata(std::span<uint8_t const> propertySet, JsonNumberStyle numberStyle) : m_propertySet(propertySet.begin(), propertySet.end())
+    {
+        JsonWriter writer(m_json, numberStyle);
+        if (m_propertySet.empty())
+        {
+            writer.BeginObject();
+            writer.EndObject();
+            return;
+        }
+
+#if defined(_WIN32)
+        winrt::ValueSet valueSet{ nullptr };
+        try
+        {
+            valueSet = DeserializePropertySet(m_propertySet);
+        }
+        catch (winrt::hresult_error const&)
+        {
+            throw SnapshotException(c_hrInvalidData, "The snapshot metadata is not a recognized PropertySet.");
+        }
+        SerializeValueSet(valueSet, writer);
+#endif
+    }
+
+    SnapshotMetadata(SnapshotMetadata const&) = delete;
+    SnapshotMetadata& operator=(SnapshotMetadata const&) = delete;
+
+    std::span<uint8_t const> PropertySet() const
+    {
+        return m_propertySet;
+    }
+
+    std::string const& Json() const
+    {
+        return m_json;
+    }
+
+    size_t MemorySize() const
+    {
+        return sizeof(*this) + m_propertySet.capacity() + m_json.capacity();
+    }
+
+private:
+    std::vector<uint8_t> m_propertySet;
+    std::string m_json;
+};
+
+struct SnapshotCacheStatistics
+{
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    size_t Entries = 0;
+    size_t Bytes = 0;
+};
+
+namespace details
+{
+    // Least-recently-used map from snapshot index to an immutable value, bounded by the values' MemorySize(). A value
+    // still being loaded is in the map as a future, so concurrent readers of the same snapshot share one load instead
+    // of each decrypting it; a load that throws is not cached, and its waiters get the same exception. Values are
+    // shared, so evicting one never invalidates a reader still holding it. Thread-safe.
+    template <typename T>
+    class SnapshotCache
+    {
+    public:
+        explicit SnapshotCache(size_t capacity) : m_capacity(capacity) {}
+
+        // Returns the cached value, or the one 'load()' returns.
+        template <typename Load>
+        std::shared_ptr<T const> GetOrLoad(size_t key, Load&& load)
+        {
+            std::unique_lock lock(m_mutex);
+            if (const auto found = m_entries.find(key); found != m_entries.end())
+            {
+                m_order.splice(m_order.begin(), m_order, found->second.Position);
+                m_hits++;
+                auto value = found->second.Value;
+                lock.unlock();
+                return value.get();
+            }
+
+            m_misses++;
+            std::promise<std::shared_ptr<T const>> promise;
+            m_order.push_front(key);
+            m_entries.emplace(key, Entry{ promise.get_future().share(), m_order.begin() });
+            lock.unlock();
+
+            std::shared_ptr<T const> value;
+            try
+            {
+                value = load();
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+                lock.lock();
+                const auto found = m_entries.find(key);
+                m_order.erase(found->second.Position);
+                m_entries.erase(found);
+                throw;
+            }
+            promise.set_value(value);
+
+            lock.lock();
+            auto& entry = m_entries.at(key);
+            entry.Size = value->MemorySize();
+            entry.Loaded = true;
+            m_bytes += entry.Size;
+            Evict();
+            return value;
+        }
+
+        // The value if it is cached and loaded, without loading it or counting a hit or miss.
+        std::shared_ptr<T const> TryGet(size_t key) const
+        {
+            std::lock_guard lock(m_mutex);
+            const auto found = m_entries.find(key);
+            return ((found != m_entries.end()) && found->second.Loaded) ? found->second.Value.get() : nullptr;
+        }
+
+        void Clear()
+        {
+            std::lock_guard lock(m_mutex);
+            for (auto position = m_order.begin(); position != m_order.end();)
+            {
+                const auto found = m_entries.find(*position);
+                if (!found->second.Loaded)
+                {
+                    ++position;
+                    continue;
+                }
+                m_bytes -= found->second.Size;
+                m_entries.erase(found);
+                position = m_order.erase(position);
+            }
+        }
+
+        SnapshotCacheStatistics Statistics() const
+        {
+            std::lock_guard lock(m_mutex);
+            return { m_hits, m_misses, m_entries.size(), m_bytes };
+        }
+
+    private:
+        struct Entry
+        {
+            std::shared_future<std::shared_ptr<T const>> Value;
+            typename std::list<size_t>::iterator Position;
+            size_t Size = 0;
+            bool Loaded = false;
+        };
+
+        // Drops the least recently used loaded values until the rest fit. A value larger than the whole cache is
+        // dropped as soon as it has been returned.
+        void Evict()
+        {
+            for (auto position = m_order.end(); (m_bytes > m_capacity) && (position != m_order.begin());)
+            {
+                --position;
+                const auto found = m_entries.find(*position);
+                if (!found->second.Loaded)
+                {
+                    continue;
+                }
+                m_bytes -= found->second.Size;
+                m_entries.erase(found);
+                position = m_order.erase(position);
+            }
+        }
+
+        size_t m_capacity;
+        mutable std::mutex m_mutex;
+        std::list<size_t> m_order;  // Most recently used first.
+        std::unordered_map<size_t, Entry> m_entries;
+        size_t m_bytes = 0;
+        uint64_t m_hits = 0;
+        uint64_t m_misses = 0;
+    };
+}
+
+// Random access to the snapshots of an export folder, for tools that only look at a few of them: snapshots are
+// decrypted one at a time on demand and kept in memory only, never written out. Opening the store lists the folder
+// (sorted by relative path, which for Recall's timestamped names is capture order); nothing is read until a snapshot
+// is asked for. Metadata is read without decrypting the whole image: the container is still authenticated in full,
+// but only the start of the image, where the Exif segment is, gets decrypted. Recently used images and metadata are
+// kept in two LRU caches bounded by SnapshotStoreOptions. Metadata is parsed with the native PropertySet parser only;
+// the WinRT fallback the export tool has is not available here. Thread-safe.
+class SnapshotStore
+{
+public:
+    // Bytes of an image decrypted to find its metadata. The Exif APP1 segment holding it is at most 64 KB and comes
+    // right after the start of the image, behind at most a JFIF segment or two.
+    static constexpr size_t c_metadataPrefixSize = 256 * 1024;
+
+    // 'exportCode' is the 32 hex digits of the export code, without dashes. Throws std::filesystem_error if the
+    // folder cannot be listed.
+    SnapshotStore(std::filesystem::path const& exportFolder, std::wstring const& exportCode, SnapshotStoreOptions options = {}) :
+        m_session(exportCode), m_options(std::move(options)), m_images(m_options.ImageCacheSize), m_metadata(m_options.MetadataCacheSize)
+    {
+        ScanDirectory(exportFolder, m_options.Scan, [this](ScannedFile file)
+        {
+            m_entries.push_back({ std::move(file.Path), std::move(file.RelativePath) });
+        });
+        std::sort(m_entries.begin(), m_entries.end(), [](SnapshotEntry const& left, SnapshotEntry const& right) { return left.RelativePath < right.RelativePath; });
+    }
+
+    SnapshotStore(SnapshotStore const&) = delete;
+    SnapshotStore& operator=(SnapshotStore const&) = delete;
+
+    std::span<SnapshotEntry const> Entries() const
+    {
+        return m_entries;
+    }
+
+    std::optional<size_t> Find(std::filesystem::path const& relativePath) const
+    {
+        const auto found = std::lower_bound(m_entries.begin(), m_entries.end(), relativePath,
+            [](SnapshotEntry const& entry, std::filesystem::path const& path) { return entry.RelativePath < path; });
+        if ((found == m_entries.end()) || (found->RelativePath != relativePath))
+        {
+            return std::nullopt;
+        }
+        return static_cast<size_t>(found - m_entries.begin());
+    }
+
+    // Reads, authenticates and decrypts the snapshot's image, unless it is cached. Throws std::out_of_range for an
+    // index past Entries(), std::system_error if the file cannot be read, and SnapshotException if it does not
+    // decrypt.
+    std::shared_ptr<SnapshotImage const> Image(size_t index)
+    {
+        auto const& entry = m_entries.at(index);
+        return m_images.GetOrLoad(index, [&]
+        {
+            auto container = ReadContainer(entry.Path);
+            const auto plaintext = m_session.DecryptInPlace({ container.data(), container.size() });
+            return std::make_shared<SnapshotImage const>(std::move(container), plaintext);
+        });
+    }
+
+    // The snapshot's parsed metadata, unless it is cached. It is taken from the image if that is cached; otherwise
+    // only the start of the image is decrypted. Throws like Image, and on Windows SnapshotException with
+    // c_hrInvalidData if the metadata cannot be deserialized.
+    std::shared_ptr<SnapshotMetadata const> Metadata(size_t index)
+    {
+        auto const& entry = m_entries.at(index);
+        return m_metadata.GetOrLoad(index, [&]
+        {
+            if (const auto image = m_images.TryGet(index))
+            {
+                return ParseMetadata(image->Data());
+            }
+
+            auto container = ReadContainer(entry.Path);
+            const auto imageSize = DecryptionSession::GetDecryptedSize({ container.data(), container.size() });
+            auto prefix = BufferPool::Shared().Acquire((std::min)(imageSize, c_metadataPrefixSize));
+            m_session.DecryptPrefix({ container.data(), container.size() }, { prefix.data(), prefix.size() });
+
+            // An Exif segment cut off by the end of the prefix is not found, so a snapshot without metadata in its
+            // first c_metadataPrefixSize bytes is decrypted in full to be sure.
+            if (FindSnapshotMetadata({ prefix.data(), prefix.size() }) || (prefix.size() == imageSize))
+            {
+                return ParseMetadata({ prefix.data(), prefix.size() });
+            }
+            return ParseMetadata(m_session.DecryptInPlace({ container.data(), container.size() }));
+        });
+    }
+
+    // Drops every cached image and metadata that is not being loaded.
+    void ClearCache()
+    {
+        m_images.Clear();
+        m_metadata.Clear();
+    }
+
+    SnapshotCacheStatistics ImageCacheStatistics() const
+    {
+        return m_images.Statistics();
+    }
+
+    SnapshotCacheStatistics MetadataCacheStatistics() const
+    {
+        return m_metadata.Statistics();
+    }
+
+private:
+    static PooledBuffer ReadContainer(std::filesystem::path const& path)
+    {
+        PooledBuffer container;
+        if (const auto error = details::ReadWholeFile(path, container))
+        {
+            throw std::system_error(error, "Reading the snapshot has failed.");
+        }
+        return container;
+    }
+
+    std::shared_ptr<SnapshotMetadata const> ParseMetadata(std::span<uint8_t const> image) const
+    {
+        const auto propertySet = FindSnapshotMetadata(image);
+        return std::make_shared<SnapshotMetadata const>(propertySet ? *propertySet : std::span<uint8_t const>(), m_options.NumberStyle);
+    }
+
+    DecryptionSession m_session;
+    SnapshotStoreOptions m_options;
+    std::vector<SnapshotEntry> m_entries;
+    details::SnapshotCache<SnapshotImage> m_images;
+    details::SnapshotCache<SnapshotMetadata> m_metadata;
+};
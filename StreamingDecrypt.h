@@ -0,0 +1,180 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "AesGcm.h"
+#include "BufferPool.h"
+#include "DecryptionSession.h"
+#include "SnapshotFormat.h"
+
+constexpr size_t c_defaultStreamingChunkSize = 1024 * 1024;
+
+namespace details
+{
+    inline void ReadExactly(std::ifstream& input, uint8_t* buffer, size_t size)
+    {
+        input.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+        if (static_cast<size_t>(input.gcount()) != size)
+        {
+            throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+        }
+    }
+
+    // Opens the container at 'inputPath', checks its header, reads the trailing tag and unwraps the content key into
+    // 'aesGcm'. Leaves 'input' at the start of the ciphertext and returns the ciphertext size.
+    inline uint64_t OpenStreamedSnapshot(DecryptionSession const& session, std::filesystem::path const& inputPath, std::ifstream& input,
+        std::span<uint8_t, c_tagSizeInBytes> tag, std::optional<AesGcm>& aesGcm)
+    {
+        input.open(inputPath, std::ios::binary);
+        if (!input)
+        {
+            throw SnapshotException(c_hrInvalidArgument, "Unable to open the snapshot container.");
+        }
+
+        const uint64_t fileSize = std::filesystem::file_size(inputPath);
+
+        uint8_t headerBytes[sizeof(EncryptedSnapshotHeader)];
+        ReadExactly(input, headerBytes, sizeof(headerBytes));
+        const auto header = ReadSnapshotHeader(headerBytes);
+        if (header.KeySize != c_totalSizeInBytes)
+        {
+            throw SnapshotException(c_hrInvalidArgument, "Invalid wrapped key size.");
+        }
+
+        const uint64_t payloadOffset = sizeof(EncryptedSnapshotHeader) + uint64_t{ header.KeySize };
+        if ((fileSize < payloadOffset) || (fileSize - payloadOffset < header.ContentSize) || (header.ContentSize < c_tagSizeInBytes))
+        {
+            throw SnapshotException(c_hrInvalidData, "Insufficient data in the buffer.");
+        }
+        const uint64_t dataSize = uint64_t{ header.ContentSize } - c_tagSizeInBytes;
+
+        std::array<uint8_t, c_totalSizeInBytes> wrappedKey{};
+        ReadExactly(input, wrappedKey.data(), wrappedKey.size());
+
+        // The tag trails the ciphertext; fetch it first so it is at hand when the last chunk has been hashed.
+        input.seekg(static_cast<std::streamoff>(payloadOffset + dataSize));
+        ReadExactly(input, tag.data(), tag.size());
+        input.seekg(static_cast<std::streamoff>(payloadOffset));
+
+        std::array<uint8_t, c_childKeySizeInBytes> contentKey{};
+        try
+        {
+            session.UnwrapContentKey(wrappedKey, contentKey);
+            aesGcm.emplace(contentKey);
+        }
+        catch (...)
+        {
+            SecureZeroBytes(contentKey.data(), contentKey.size());
+            throw;
+        }
+        SecureZeroBytes(contentKey.data(), contentKey.size());
+        return dataSize;
+    }
+}
+
+// Decrypts the container at 'inputPath' into 'outputPath' without ever holding more than 'chunkSize' bytes of
+// the payload in memory. Plaintext goes to '<outputPath>.partial' and is only renamed into place once the tag has
+// verified, so a truncated or tampered container never leaves a partial image behind. Always uses the native
+// AES-GCM implementation, since CNG cannot carry GHASH across calls without chaining the whole payload through one
+// key handle. Returns the plaintext size.
+inline uint64_t DecryptSnapshotFile(
+    DecryptionSession const& session,
+    std::filesystem::path const& inputPath,
+    std::filesystem::path const& outputPath,
+    size_t chunkSize = c_defaultStreamingChunkSize)
+{
+    std::ifstream input;
+    std::array<uint8_t, c_tagSizeInBytes> tag{};
+    std::optional<AesGcm> aesGcm;
+    const auto dataSize = details::OpenStreamedSnapshot(session, inputPath, input, tag, aesGcm);
+
+    auto partialPath = outputPath;
+    partialPath += L".partial";
+    try
+    {
+        std::ofstream output(partialPath, std::ios::binary | std::ios::trunc);
+        if (!output)
+        {
+            throw SnapshotException(c_hrInvalidArgument, "Unable to create the output file.");
+        }
+
+        // Keep chunks block-aligned so every Update after the first goes straight to the bulk path.
+        chunkSize = (std::max)(chunkSize - chunkSize % details::c_aesBlockSize, details::c_aesBlockSize);
+        auto chunk = BufferPool::Shared().Acquire(static_cast<size_t>((std::min)(uint64_t{ chunkSize }, dataSize)));
+
+        const uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
+        AesGcmDecryptor decryptor(*aesGcm, zeroNonce);
+        for (uint64_t remaining = dataSize; remaining > 0;)
+        {
+            const auto size = static_cast<size_t>((std::min)(uint64_t{ chunk.size() }, remaining));
+            details::ReadExactly(input, chunk.data(), size);
+            decryptor.Update({ chunk.data(), size }, { chunk.data(), size });
+            output.write(reinterpret_cast<char const*>(chunk.data()), static_cast<std::streamsize>(size));
+            remaining -= size;
+        }
+
+        if (!decryptor.Finish(tag))
+        {
+            throw SnapshotException(c_hrAuthTagMismatch, "The authentication tag does not match.");
+        }
+
+        output.close();
+        if (!output)
+        {
+            throw SnapshotException(c_hrInvalidData, "Unable to write the output file.");
+        }
+
+        std::filesystem::rename(partialPath, outputPath);
+    }
+    catch (...)
+    {
+        std::error_code error;
+        std::filesystem::remove(partialPath, error);
+        throw;
+    }
+
+    return dataSize;
+}
+
+// Checks the container at 'inputPath' the same way DecryptSnapshotFile does, but only authenticates the payload: no
+// plaintext is produced and nothing is written. Throws SnapshotException with c_hrAuthTagMismatch if the content
+// (or, when the export code is wrong, the wrapped key) does not authenticate, and with another code if the
+// container is malformed. Returns the ciphertext size.
+inline uint64_t VerifySnapshotFile(
+    DecryptionSession const& session,
+    std::filesystem::path const& inputPath,
+    size_t chunkSize = c_defaultStreamingChunkSize)
+{
+    std::ifstream input;
+    std::array<uint8_t, c_tagSizeInBytes> tag{};
+    std::optional<AesGcm> aesGcm;
+    const auto dataSize = details::OpenStreamedSnapshot(session, inputPath, input, tag, aesGcm);
+
+    chunkSize = (std::max)(chunkSize - chunkSize % details::c_aesBlockSize, details::c_aesBlockSize);
+    auto chunk = BufferPool::Shared().Acquire(static_cast<size_t>((std::min)(uint64_t{ chunkSize }, dataSize)));
+
+    const uint8_t zeroNonce[c_nonceSizeInBytes] = { 0 };
+    AesGcmAuthenticator authenticator(*aesGcm, zeroNonce);
+    for (uint64_t remaining = dataSize; remaining > 0;)
+    {
+        const auto size = static_cast<size_t>((std::min)(uint64_t{ chunk.size() }, remaining));
+        details::ReadExactly(input, chunk.data(), size);
+        authenticator.Update({ chunk.data(), size });
+        remaining -= size;
+    }
+
+    if (!authenticator.Finish(tag))
+    {
+        throw SnapshotException(c_hrAuthTagMismatch, "The authentication tag does not match.");
+    }
+    return dataSize;
+}
@@ -0,0 +1,177 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.h"
+
+// Fixed-size thread pool. Tasks submitted from outside go through a bounded injection queue (so producers are
+// throttled); tasks submitted from a worker go to that worker's own deque, are run LIFO while their data is
+// still in cache, and are stolen FIFO by idle workers.
+class WorkStealingPool
+{
+public:
+    WorkStealingPool(unsigned threadCount, size_t injectionCapacity) : m_injectionQueue(injectionCapacity)
+    {
+        threadCount = (threadCount > 0) ? threadCount : 1;
+        for (unsigned i = 0; i < threadCount; i++)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+        for (unsigned i = 0; i < threadCount; i++)
+        {
+            m_workers[i]->Thread = std::thread([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        WaitIdle();
+        {
+            std::lock_guard lock(m_idleMutex);
+            m_stopping = true;
+        }
+        m_idleCondition.notify_all();
+        m_injectionQueue.Close();
+        for (auto& worker : m_workers)
+        {
+            worker->Thread.join();
+        }
+    }
+
+    WorkStealingPool(WorkStealingPool const&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+    unsigned ThreadCount() const
+    {
+        return static_cast<unsigned>(m_workers.size());
+    }
+
+    // Tasks submitted but not yet started, across the injection queue and every worker's deque.
+    size_t QueuedTasks() const
+    {
+        return m_queuedTasks.load();
+    }
+
+    // Tasks must not throw.
+    void Submit(std::function<void()> task)
+    {
+        m_outstandingTasks.fetch_add(1);
+        m_queuedTasks.fetch_add(1);
+        if (t_currentPool == this)
+        {
+            auto& worker = *m_workers[t_currentWorker];
+            std::lock_guard lock(worker.Mutex);
+            worker.Tasks.push_back(std::move(task));
+        }
+        else
+        {
+            m_injectionQueue.Push(std::move(task));
+        }
+
+        {
+            std::lock_guard lock(m_idleMutex);
+        }
+        m_idleCondition.notify_one();
+    }
+
+    // Blocks until every submitted task, including the ones they submitted in turn, has finished.
+    void WaitIdle()
+    {
+        std::unique_lock lock(m_idleMutex);
+        m_allDone.wait(lock, [&] { return m_outstandingTasks.load() == 0; });
+    }
+
+private:
+    struct Worker
+    {
+        std::mutex Mutex;
+        std::deque<std::function<void()>> Tasks;
+        std::thread Thread;
+    };
+
+    bool TryTakeTask(size_t index, std::function<void()>& task)
+    {
+        {
+            auto& own = *m_workers[index];
+            std::lock_guard lock(own.Mutex);
+            if (!own.Tasks.empty())
+            {
+                task = std::move(own.Tasks.back());
+                own.Tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < m_workers.size(); offset++)
+        {
+            auto& victim = *m_workers[(index + offset) % m_workers.size()];
+            std::lock_guard lock(victim.Mutex);
+            if (!victim.Tasks.empty())
+            {
+                task = std::move(victim.Tasks.front());
+                victim.Tasks.pop_front();
+                return true;
+            }
+        }
+
+        if (auto injected = m_injectionQueue.TryPop())
+        {
+            task = std::move(*injected);
+            return true;
+        }
+
+        return false;
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        t_currentPool = this;
+        t_currentWorker = index;
+
+        for (;;)
+        {
+            std::function<void()> task;
+            if (TryTakeTask(index, task))
+            {
+                m_queuedTasks.fetch_sub(1);
+                task();
+                task = nullptr;
+
+                if (m_outstandingTasks.fetch_sub(1) == 1)
+                {
+                    std::lock_guard lock(m_idleMutex);
+                    m_allDone.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock lock(m_idleMutex);
+            m_idleCondition.wait(lock, [&] { return m_stopping || (m_queuedTasks.load() > 0); });
+            if (m_stopping && (m_queuedTasks.load() == 0))
+            {
+                return;
+            }
+        }
+    }
+
+    static inline thread_local WorkStealingPool* t_currentPool = nullptr;
+    static inline thread_local size_t t_currentWorker = 0;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    BoundedQueue<std::function<void()>> m_injectionQueue;
+    std::atomic<size_t> m_queuedTasks{ 0 };
+    std::atomic<size_t> m_outstandingTasks{ 0 };
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCondition;
+    std::condition_variable m_allDone;
+    bool m_stopping = false;
+};
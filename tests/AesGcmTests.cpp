@@ -0,0 +1,207 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <random>
+#include <vector>
+
+#include "AesGcm.h"
+#include "TestHarness.h"
+
+namespace
+{
+    // Every implementation the CPU can run; the AesGcm constructor falls back to the best one for the others.
+    std::vector<AesGcmImplementation> SupportedImplementations()
+    {
+        std::vector<AesGcmImplementation> implementations;
+        for (int i = 0; i <= static_cast<int>(GetBestAesGcmImplementation()); i++)
+        {
+            implementations.push_back(static_cast<AesGcmImplementation>(i));
+        }
+        return implementations;
+    }
+
+    std::vector<uint8_t> RandomBytes(std::mt19937_64& random, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    struct KnownAnswer
+    {
+        char const* Key;
+        char const* Nonce;
+        char const* Plaintext;
+        char const* Ciphertext;
+        char const* Tag;
+    };
+
+    // AES-256 cases without additional data from the GCM specification (McGrew and Viega), test cases 13 to 15.
+    constexpr KnownAnswer c_knownAnswers[] = {
+        { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "", "",
+            "530f8afbc74536b9a963b4f1c4cb738b" },
+        { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+            "00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18", "d0d1c8a799996bf0265b98b5d48ab919" },
+        { "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+            "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+            "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+            "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+            "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+            "b094dac5d93471bdec1a502270e3cc6c" },
+    };
+
+    constexpr size_t c_roundTripSizes[] = { 0, 1, 15, 16, 17, 127, 128, 129, 255, 256, 257, 1000, 4096, 4097, 65536 + 13 };
+}
+
+TEST_CASE("AesGcm.KnownAnswers")
+{
+    for (const auto implementation : SupportedImplementations())
+    {
+        for (auto const& knownAnswer : c_knownAnswers)
+        {
+            const auto key = testing::FromHex(knownAnswer.Key);
+            const auto nonce = testing::FromHex(knownAnswer.Nonce);
+            const auto plaintext = testing::FromHex(knownAnswer.Plaintext);
+            const auto ciphertext = testing::FromHex(knownAnswer.Ciphertext);
+            const auto tag = testing::FromHex(knownAnswer.Tag);
+            const AesGcm aesGcm(key, implementation);
+
+            std::vector<uint8_t> encrypted(plaintext.size());
+            uint8_t encryptedTag[AesGcm::TagSize];
+            aesGcm.Encrypt(nonce, plaintext, encrypted, encryptedTag);
+            CHECK(testing::Equal(encrypted, ciphertext));
+            CHECK(testing::Equal(encryptedTag, tag));
+
+            std::vector<uint8_t> decrypted(ciphertext.size());
+            CHECK(aesGcm.Decrypt(nonce, ciphertext, tag, decrypted));
+            CHECK(testing::Equal(decrypted, plaintext));
+            CHECK(aesGcm.Verify(nonce, ciphertext, tag));
+        }
+    }
+}
+
+TEST_CASE("AesGcm.RoundTrip")
+{
+    std::mt19937_64 random(1);
+    for (const auto implementation : SupportedImplementations())
+    {
+        for (const auto size : c_roundTripSizes)
+        {
+            const auto key = RandomBytes(random, 32);
+            const auto nonce = RandomBytes(random, 12);
+            const auto plaintext = RandomBytes(random, size);
+            const AesGcm aesGcm(key, implementation);
+
+            std::vector<uint8_t> ciphertext(size);
+            uint8_t tag[AesGcm::TagSize];
+            aesGcm.Encrypt(nonce, plaintext, ciphertext, tag);
+
+            // Every implementation must produce what the portable one does.
+            std::vector<uint8_t> reference(size);
+            uint8_t referenceTag[AesGcm::TagSize];
+            AesGcm(key, AesGcmImplementation::Software).Encrypt(nonce, plaintext, reference, referenceTag);
+            CHECK(testing::Equal(ciphertext, reference));
+            CHECK(testing::Equal(tag, referenceTag));
+
+            std::vector<uint8_t> decrypted(size);
+            CHECK(aesGcm.Decrypt(nonce, ciphertext, tag, decrypted));
+            CHECK(testing::Equal(decrypted, plaintext));
+
+            auto inPlace = ciphertext;
+            CHECK(aesGcm.Decrypt(nonce, inPlace, tag, inPlace));
+            CHECK(testing::Equal(inPlace, plaintext));
+
+            tag[0] ^= 1;
+            CHECK(!aesGcm.Decrypt(nonce, ciphertext, tag, decrypted));
+            CHECK(!aesGcm.Verify(nonce, ciphertext, tag));
+            tag[0] ^= 1;
+            if (size > 0)
+            {
+                ciphertext[size / 2] ^= 0x80;
+                CHECK(!aesGcm.Verify(nonce, ciphertext, tag));
+            }
+        }
+    }
+}
+
+TEST_CASE("AesGcm.ChunkedDecrypt")
+{
+    std::mt19937_64 random(2);
+    for (const auto implementation : SupportedImplementations())
+    {
+        for (int trial = 0; trial < 50; trial++)
+        {
+            const auto key = RandomBytes(random, 32);
+            const auto nonce = RandomBytes(random, 12);
+            const auto plaintext = RandomBytes(random, random() % 20000);
+            const AesGcm aesGcm(key, implementation);
+
+            std::vector<uint8_t> ciphertext(plaintext.size());
+            uint8_t tag[AesGcm::TagSize];
+            aesGcm.Encrypt(nonce, plaintext, ciphertext, tag);
+
+            // Chunks of any size, most of which leave a partial block for the next Update.
+            std::vector<uint8_t> decrypted(plaintext.size());
+            AesGcmDecryptor decryptor(aesGcm, nonce);
+            for (size_t offset = 0; offset < ciphertext.size();)
+            {
+                const auto size = (std::min)(ciphertext.size() - offset, static_cast<size_t>(random() % 700));
+                decryptor.Update({ ciphertext.data() + offset, size }, { decrypted.data() + offset, size });
+                offset += size;
+            }
+            CHECK(decryptor.Finish(tag));
+            CHECK(testing::Equal(decrypted, plaintext));
+        }
+    }
+}
+
+TEST_CASE("AesGcm.ChunkedVerify")
+{
+    std::mt19937_64 random(3);
+    for (const auto implementation : SupportedImplementations())
+    {
+        for (int trial = 0; trial < 50; trial++)
+        {
+            const auto key = RandomBytes(random, 32);
+            const auto nonce = RandomBytes(random, 12);
+            const auto plaintext = RandomBytes(random, random() % 20000);
+            const AesGcm aesGcm(key, implementation);
+
+            std::vector<uint8_t> ciphertext(plaintext.size());
+            uint8_t tag[AesGcm::TagSize];
+            aesGcm.Encrypt(nonce, plaintext, ciphertext, tag);
+
+            // Odd-sized chunks, including ones too short to complete the partial block left by the chunk before.
+            AesGcmAuthenticator authenticator(aesGcm, nonce);
+            for (size_t offset = 0; offset < ciphertext.size();)
+            {
+                const auto size = (std::min)(ciphertext.size() - offset, static_cast<size_t>((random() % 2 == 0) ? random() % 8 : random() % 700));
+                authenticator.Update({ ciphertext.data() + offset, size });
+                offset += size;
+            }
+            CHECK(authenticator.Finish(tag));
+        }
+    }
+}
+
+TEST_CASE("AesGcm.VerifyOneByteAtATime")
+{
+    std::mt19937_64 random(4);
+    const auto key = RandomBytes(random, 32);
+    const auto nonce = RandomBytes(random, 12);
+    const auto plaintext = RandomBytes(random, 100);
+    const AesGcm aesGcm(key);
+
+    std::vector<uint8_t> ciphertext(plaintext.size());
+    uint8_t tag[AesGcm::TagSize];
+    aesGcm.Encrypt(nonce, plaintext, ciphertext, tag);
+
+    AesGcmAuthenticator authenticator(aesGcm, nonce);
+    for (const auto byte : ciphertext)
+    {
+        authenticator.Update({ &byte, 1 });
+    }
+    CHECK(authenticator.Finish(tag));
+}
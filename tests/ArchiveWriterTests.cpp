@@ -0,0 +1,358 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ArchiveWriter.h"
+#include "TestHarness.h"
+
+namespace
+{
+    std::vector<uint8_t> RandomBytes(std::mt19937_64& random, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    std::vector<uint8_t> ReadFileBytes(std::filesystem::path const& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+    }
+
+    uint64_t ReadLittleEndian(std::span<uint8_t const> bytes, size_t offset, size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t i = size; i-- > 0;)
+        {
+            value = (value << 8) | bytes[offset + i];
+        }
+        return value;
+    }
+
+    // The bit-at-a-time CRC-32 the slicing tables are derived from.
+    uint32_t ReferenceCrc32(std::span<uint8_t const> data)
+    {
+        uint32_t crc = 0xFFFFFFFF;
+        for (const auto byte : data)
+        {
+            crc ^= byte;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0u);
+            }
+        }
+        return ~crc;
+    }
+
+    struct ArchiveEntry
+    {
+        std::string Name;
+        std::vector<uint8_t> Data;
+    };
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+
+    std::vector<uint8_t> WriteArchive(ArchiveFormat format, std::filesystem::path const& path, std::vector<ArchiveEntry> const& entries)
+    {
+        ArchiveWriter writer(format, path);
+        for (auto const& entry : entries)
+        {
+            writer.Add(std::filesystem::path(std::u8string(entry.Name.begin(), entry.Name.end())), entry.Data);
+        }
+        writer.Finish();
+        CHECK(writer.EntryCount() == entries.size());
+
+        auto archive = ReadFileBytes(path);
+        CHECK(writer.Size() == archive.size());
+        return archive;
+    }
+
+    std::string_view TarField(std::span<uint8_t const> header, size_t offset, size_t width)
+    {
+        const std::string_view field(reinterpret_cast<char const*>(header.data()) + offset, width);
+        return field.substr(0, field.find('\0'));
+    }
+
+    uint64_t TarNumber(std::span<uint8_t const> header, size_t offset, size_t width)
+    {
+        uint64_t value = 0;
+        for (const auto digit : TarField(header, offset, width))
+        {
+            CHECK((digit >= '0') && (digit <= '7'));
+            value = value * 8 + static_cast<uint64_t>(digit - '0');
+        }
+        return value;
+    }
+
+    // Reads a tar archive the way a ustar reader with pax support would, checking each header's checksum and the
+    // end-of-archive blocks. Fails the test and stops at the first structural error.
+    std::vector<ArchiveEntry> ReadTar(std::span<uint8_t const> archive, std::vector<std::string>& rawNames)
+    {
+        std::vector<ArchiveEntry> entries;
+        std::string paxPath;
+        CHECK(archive.size() % 512 == 0);
+        for (size_t offset = 0; offset + 512 <= archive.size();)
+        {
+            const auto header = archive.subspan(offset, 512);
+            if (std::all_of(header.begin(), header.end(), [](uint8_t byte) { return byte == 0; }))
+            {
+                CHECK(offset + 1024 == archive.size());
+                CHECK(std::all_of(archive.begin() + offset, archive.end(), [](uint8_t byte) { return byte == 0; }));
+                return entries;
+            }
+
+            uint32_t checksum = 0;
+            for (size_t i = 0; i < 512; i++)
+            {
+                checksum += ((i >= 148) && (i < 156)) ? ' ' : header[i];
+            }
+            CHECK(TarNumber(header, 148, 7) == checksum);
+            CHECK(TarField(header, 257, 6) == "ustar");
+
+            const auto size = TarNumber(header, 124, 12);
+            const auto type = static_cast<char>(header[156]);
+            const auto data = archive.subspan(offset + 512, size);
+            offset += 512 + (size + 511) / 512 * 512;
+            if (offset > archive.size())
+            {
+                CHECK(!"entry past the end of the archive");
+                return entries;
+            }
+
+            if (type == 'x')
+            {
+                // "<length> path=<name>\n", where the length is that of the whole record.
+                const std::string_view record(reinterpret_cast<char const*>(data.data()), data.size());
+                const auto space = record.find(' ');
+                CHECK(std::stoul(std::string(record.substr(0, space))) == record.size());
+                CHECK(record.substr(space + 1, 5) == "path=");
+                CHECK(record.back() == '\n');
+                paxPath = record.substr(space + 6, record.size() - space - 7);
+                continue;
+            }
+
+            CHECK(type == '0');
+            const auto prefix = TarField(header, 345, 155);
+            std::string rawName(TarField(header, 0, 100));
+            rawNames.push_back(prefix.empty() ? rawName : std::string(prefix) + "|" + rawName);
+            auto name = paxPath.empty() ? (prefix.empty() ? rawName : std::string(prefix) + "/" + rawName) : paxPath;
+            entries.push_back({ std::move(name), { data.begin(), data.end() } });
+            paxPath.clear();
+        }
+
+        CHECK(!"no end-of-archive blocks");
+        return entries;
+    }
+
+    // Reads a ZIP archive from its central directory, as unzip does, checking every offset and length it records
+    // against the local headers and the end records. Fails the test and stops at the first structural error.
+    std::vector<ArchiveEntry> ReadZip(std::span<uint8_t const> archive, bool expectZip64End)
+    {
+        std::vector<ArchiveEntry> entries;
+        if (archive.size() < 22)
+        {
+            CHECK(!"too short for an end of central directory record");
+            return entries;
+        }
+
+        const auto endOffset = archive.size() - 22;
+        CHECK(ReadLittleEndian(archive, endOffset, 4) == 0x06054b50);
+        uint64_t entryCount = ReadLittleEndian(archive, endOffset + 10, 2);
+        uint64_t directorySize = ReadLittleEndian(archive, endOffset + 12, 4);
+        uint64_t directoryOffset = ReadLittleEndian(archive, endOffset + 16, 4);
+        CHECK(ReadLittleEndian(archive, endOffset + 8, 2) == entryCount);
+
+        const bool hasZip64End = (endOffset >= 20) && (ReadLittleEndian(archive, endOffset - 20, 4) == 0x07064b50);
+        CHECK(hasZip64End == expectZip64End);
+        if (hasZip64End)
+        {
+            // The locator points at the ZIP64 end record, which sits right before it and has the real counts.
+            const auto zip64EndOffset = ReadLittleEndian(archive, endOffset - 12, 8);
+            CHECK(zip64EndOffset + 56 == endOffset - 20);
+            CHECK(ReadLittleEndian(archive, zip64EndOffset, 4) == 0x06064b50);
+            CHECK(ReadLittleEndian(archive, zip64EndOffset + 4, 8) == 44);
+            CHECK(entryCount == 0xFFFF);
+            entryCount = ReadLittleEndian(archive, zip64EndOffset + 32, 8);
+            CHECK(ReadLittleEndian(archive, zip64EndOffset + 24, 8) == entryCount);
+            directorySize = ReadLittleEndian(archive, zip64EndOffset + 40, 8);
+            directoryOffset = ReadLittleEndian(archive, zip64EndOffset + 48, 8);
+            CHECK(directoryOffset + directorySize == zip64EndOffset);
+        }
+        else
+        {
+            CHECK(directoryOffset + directorySize == endOffset);
+        }
+
+        size_t offset = directoryOffset;
+        uint64_t localOffset = 0;
+        for (uint64_t i = 0; i < entryCount; i++)
+        {
+            if ((offset + 46 > archive.size()) || (ReadLittleEndian(archive, offset, 4) != 0x02014b50))
+            {
+                CHECK(!"missing central directory header");
+                return entries;
+            }
+            const auto crc = ReadLittleEndian(archive, offset + 16, 4);
+            const auto size = ReadLittleEndian(archive, offset + 20, 4);
+            const auto nameLength = ReadLittleEndian(archive, offset + 28, 2);
+            const auto extraLength = ReadLittleEndian(archive, offset + 30, 2);
+            const auto headerOffset = ReadLittleEndian(archive, offset + 42, 4);
+            CHECK(ReadLittleEndian(archive, offset + 24, 4) == size);
+            CHECK(ReadLittleEndian(archive, offset + 10, 2) == 0);  // Stored.
+            CHECK(extraLength == 0);
+            const std::string name(reinterpret_cast<char const*>(archive.data()) + offset + 46, nameLength);
+            offset += 46 + nameLength + extraLength;
+
+            // Entries are written back to back, so each local header starts where the previous entry ended.
+            CHECK(headerOffset == localOffset);
+            if ((headerOffset + 30 > directoryOffset) || (ReadLittleEndian(archive, headerOffset, 4) != 0x04034b50))
+            {
+                CHECK(!"missing local header");
+                return entries;
+            }
+            CHECK(ReadLittleEndian(archive, headerOffset + 14, 4) == crc);
+            CHECK(ReadLittleEndian(archive, headerOffset + 18, 4) == size);
+            CHECK(ReadLittleEndian(archive, headerOffset + 26, 2) == nameLength);
+            const auto dataOffset = headerOffset + 30 + nameLength + ReadLittleEndian(archive, headerOffset + 28, 2);
+            CHECK(std::string_view(reinterpret_cast<char const*>(archive.data()) + headerOffset + 30, nameLength) == name);
+            if (dataOffset + size > directoryOffset)
+            {
+                CHECK(!"entry data past the central directory");
+                return entries;
+            }
+
+            const auto data = archive.subspan(dataOffset, size);
+            CHECK(details::Crc32(data) == crc);
+            entries.push_back({ name, { data.begin(), data.end() } });
+            localOffset = dataOffset + size;
+        }
+        CHECK(offset == directoryOffset + directorySize);
+        CHECK(localOffset == directoryOffset);
+        return entries;
+    }
+
+    bool SameEntries(std::vector<ArchiveEntry> const& left, std::vector<ArchiveEntry> const& right)
+    {
+        return std::equal(left.begin(), left.end(), right.begin(), right.end(), [](auto const& a, auto const& b)
+        {
+            return (a.Name == b.Name) && testing::Equal(a.Data, b.Data);
+        });
+    }
+}
+
+TEST_CASE("ArchiveWriter.Crc32")
+{
+    const std::string_view check = "123456789";
+    CHECK(details::Crc32({ reinterpret_cast<uint8_t const*>(check.data()), check.size() }) == 0xCBF43926);
+    CHECK(details::Crc32({}) == 0);
+
+    // Every alignment and tail length of the eight-byte loop, whole and continued from a split.
+    std::mt19937_64 random(1);
+    const auto data = RandomBytes(random, 100);
+    for (size_t size = 0; size <= data.size(); size++)
+    {
+        const std::span<uint8_t const> prefix(data.data(), size);
+        CHECK(details::Crc32(prefix) == ReferenceCrc32(prefix));
+        for (size_t split = 0; split <= size; split += 7)
+        {
+            CHECK(details::Crc32(prefix.subspan(split), details::Crc32(prefix.first(split))) == ReferenceCrc32(prefix));
+        }
+    }
+}
+
+// Names that fit the name field, split into the ustar prefix, or need a pax header.
+TEST_CASE("ArchiveWriter.TarNames")
+{
+    std::mt19937_64 random(2);
+    const TemporaryFolder folder;
+    const std::string hundred(100, 'a');
+    const auto prefix = std::string(150, 'p');
+    const std::vector<ArchiveEntry> entries = {
+        { "short.jpg", RandomBytes(random, 1000) },
+        { hundred, RandomBytes(random, 512) },
+        { prefix + "/" + std::string(99, 'n'), RandomBytes(random, 513) },
+        { std::string(101, 'x'), RandomBytes(random, 20) },
+        { std::string(160, 'd') + "/" + std::string(20, 'n'), RandomBytes(random, 1) },
+        { "empty.json", {} },
+        { "last.jpg", RandomBytes(random, 70000) },
+    };
+
+    const auto archive = WriteArchive(ArchiveFormat::Tar, folder.Path / "archive.tar", entries);
+    std::vector<std::string> rawNames;
+    CHECK(SameEntries(ReadTar(archive, rawNames), entries));
+    CHECK(rawNames.size() == entries.size());
+    if (rawNames.size() == entries.size())
+    {
+        CHECK(rawNames[0] == "short.jpg");
+        CHECK(rawNames[1] == hundred);
+        CHECK(rawNames[2] == prefix + "|" + std::string(99, 'n'));
+
+        // The pax record carries the name; the header keeps as much of it as fits.
+        CHECK(rawNames[3] == std::string(100, 'x'));
+        CHECK(rawNames[4] == std::string(100, 'd'));
+    }
+}
+
+TEST_CASE("ArchiveWriter.Zip")
+{
+    std::mt19937_64 random(3);
+    const TemporaryFolder folder;
+    const std::vector<ArchiveEntry> entries = {
+        { "a.jpg", RandomBytes(random, 1000) },
+        { "empty.json", {} },
+        { "sub/b.jpg", RandomBytes(random, ArchiveOutput::c_bufferSize + 3) },
+        { "\xC3\xA9t\xC3\xA9.json", RandomBytes(random, 17) },
+    };
+
+    const auto archive = WriteArchive(ArchiveFormat::Zip, folder.Path / "archive.zip", entries);
+    CHECK(SameEntries(ReadZip(archive, false), entries));
+
+    const auto empty = WriteArchive(ArchiveFormat::Zip, folder.Path / "empty.zip", {});
+    CHECK(empty.size() == 22);
+    CHECK(ReadZip(empty, false).empty());
+}
+
+// 0xFFFF entries no longer fit the classic end record's count, so the ZIP64 end records are written.
+TEST_CASE("ArchiveWriter.Zip64End")
+{
+    const TemporaryFolder folder;
+    std::vector<ArchiveEntry> entries;
+    for (size_t i = 0; i < 0xFFFF; i++)
+    {
+        entries.push_back({ std::to_string(i), { static_cast<uint8_t>(i) } });
+    }
+
+    const auto archive = WriteArchive(ArchiveFormat::Zip, folder.Path / "archive.zip", entries);
+    CHECK(SameEntries(ReadZip(archive, true), entries));
+
+    entries.pop_back();
+    const auto classic = WriteArchive(ArchiveFormat::Zip, folder.Path / "classic.zip", entries);
+    CHECK(SameEntries(ReadZip(classic, false), entries));
+}
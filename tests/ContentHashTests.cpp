@@ -0,0 +1,74 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <vector>
+
+#include "ContentHash.h"
+#include "TestHarness.h"
+
+namespace
+{
+    struct HashVector
+    {
+        size_t Size;
+        uint64_t Hash;
+    };
+
+    // XXH3_64bits with the default secret and seed, from the reference implementation (xxHash 0.8) over the first
+    // 'Size' bytes of TestInput(). The sizes cover each length class: empty, 1-3, 4-8, 9-16, 17-128, 129-240, and
+    // the long-input path with a partial stripe, whole blocks and a partial block.
+    constexpr HashVector c_hashVectors[] = {
+        { 0, 0x2D06800538D394C2ull },
+        { 1, 0x4C5CCA45D0F4811Full },
+        { 3, 0x6E3E2670E61106ACull },
+        { 4, 0x5C4C63133443D03Full },
+        { 8, 0xF9FD4DD0B04D78F5ull },
+        { 9, 0x7C20DF9712C26EDFull },
+        { 16, 0x86ABF6BACCEA0858ull },
+        { 17, 0xB58BF5DC5022D071ull },
+        { 128, 0x10D17F72C0CCBA41ull },
+        { 129, 0x1648BDC3DB49D1A2ull },
+        { 240, 0xB6CFAF343FAB81E6ull },
+        { 241, 0x956CAE592C67279Eull },
+        { 1024, 0x9FB9947417C15B80ull },
+        { 1025, 0xFE1B47100B1D79D8ull },
+        { 4096, 0x0DAED5401DB51994ull },
+    };
+
+    std::vector<uint8_t> TestInput()
+    {
+        std::vector<uint8_t> input(4096);
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            input[i] = static_cast<uint8_t>((i * 131 + 7) ^ (i >> 8));
+        }
+        return input;
+    }
+}
+
+TEST_CASE("ContentHash.Xxh3Vectors")
+{
+    const auto input = TestInput();
+    for (auto const& vector : c_hashVectors)
+    {
+        CHECK(Xxh3Hash64({ input.data(), vector.Size }) == vector.Hash);
+    }
+}
+
+TEST_CASE("ContentHash.Xxh3IgnoresAlignment")
+{
+    const auto input = TestInput();
+    for (auto const& vector : c_hashVectors)
+    {
+        if (vector.Size + 7 > input.size())
+        {
+            continue;
+        }
+
+        std::vector<uint8_t> shifted(vector.Size + 7);
+        for (size_t offset = 1; offset < 8; offset++)
+        {
+            std::copy(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(vector.Size), shifted.begin() + static_cast<std::ptrdiff_t>(offset));
+            CHECK(Xxh3Hash64({ shifted.data() + offset, vector.Size }) == vector.Hash);
+        }
+    }
+}
@@ -0,0 +1,202 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "DirectoryScanner.h"
+#include "TestHarness.h"
+
+namespace
+{
+    struct PatternCase
+    {
+        std::string_view Name;
+        std::string_view Pattern;
+        bool Matches;
+    };
+
+    constexpr PatternCase c_patternCases[] = {
+        { "a.jpg", "", false },  // IsScanMatch, not the matcher, treats an empty pattern as matching everything.
+        { "", "", true },
+        { "", "*", true },
+        { "", "?", false },
+        { "a.jpg", "a.jpg", true },
+        { "a.jpg", "A.jpg", false },
+        { "a.jpg", "a.jp", false },
+        { "a.jp", "a.jpg", false },
+        { "a.jpg", "*", true },
+        { "a.jpg", "*.jpg", true },
+        { "a.jpg.json", "*.jpg", false },
+        { "a.jpg", "*.json", false },
+        { "a.jpg", "?.jpg", true },
+        { "ab.jpg", "?.jpg", false },
+        { ".jpg", "?.jpg", false },
+        { "a.jpg", "???*?", true },
+        { "a.jpg", "??????", false },
+        { "a.jpg", "a*", true },
+        { "a.jpg", "*a*", true },
+        { "a.jpg", "**.jpg", true },
+        { "a.jpg", "a.jpg*", true },
+        { "a.jpg", "a.jpg*?", false },
+        // Backtracking: the first 'b' and the first "bc" tried are the wrong ones.
+        { "aXbYbZc", "a*b*c", true },
+        { "aXbYbZc", "a*b?c", true },
+        { "aXbYbZ", "a*b*c", false },
+        { "abcbcbd", "*bc*d", true },
+        { "abcbcbd", "*bcd", false },
+        { "mississippi", "m*iss*ppi", true },
+        { "mississippi", "m*iss*iss*ppi", true },
+        { "mississippi", "m*iss*iss*iss*", false },
+        { "snapshot-2024-05-01.jpg", "snapshot-*-05-??.jpg", true },
+        { "snapshot-2024-06-01.jpg", "snapshot-*-05-??.jpg", false },
+    };
+
+    void TouchFile(std::filesystem::path const& path)
+    {
+        std::ofstream output(path, std::ios::binary);
+        output << "x";
+    }
+
+    // The files a scan reports, as generic relative paths in order.
+    std::vector<std::string> Scan(std::filesystem::path const& root, bool recursive, std::string_view pattern = {})
+    {
+        ScanOptions options;
+        options.Recursive = recursive;
+        options.Pattern = std::filesystem::path(pattern).native();
+
+        std::vector<std::string> files;
+        ScanDirectory(root, options, [&](ScannedFile const& file)
+        {
+            CHECK(file.Path == root / file.RelativePath);
+            files.push_back(file.RelativePath.generic_string());
+        });
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+}
+
+TEST_CASE("DirectoryScanner.NamePattern")
+{
+    for (auto const& patternCase : c_patternCases)
+    {
+        const bool matches = MatchesNamePattern(patternCase.Name, patternCase.Pattern);
+        if (matches != patternCase.Matches)
+        {
+            std::fprintf(stderr, "\"%.*s\" against \"%.*s\"\n", static_cast<int>(patternCase.Name.size()), patternCase.Name.data(),
+                static_cast<int>(patternCase.Pattern.size()), patternCase.Pattern.data());
+        }
+        CHECK(matches == patternCase.Matches);
+    }
+
+    // Windows paths are wide.
+    CHECK(MatchesNamePattern(std::wstring_view(L"aXbYbZc"), std::wstring_view(L"a*b*c")));
+    CHECK(!MatchesNamePattern(std::wstring_view(L"aXbYbZ"), std::wstring_view(L"a*b*c")));
+}
+
+// Links to files count as files; links to folders, including one that would loop back to the root, are not followed.
+TEST_CASE("DirectoryScanner.Recursive")
+{
+    const TemporaryFolder folder;
+    const auto& root = folder.Path;
+    std::filesystem::create_directories(root / "sub" / "deeper");
+    std::filesystem::create_directories(root / "empty");
+    TouchFile(root / "a.jpg");
+    TouchFile(root / "b.txt");
+    TouchFile(root / "sub" / "c.jpg");
+    TouchFile(root / "sub" / "deeper" / "d.jpg");
+
+    std::error_code error;
+    std::filesystem::create_directory_symlink(root / "sub", root / "link", error);
+    if (!error)
+    {
+        std::filesystem::create_directory_symlink(root, root / "sub" / "loop", error);
+    }
+    if (!error)
+    {
+        std::filesystem::create_symlink(root / "sub" / "c.jpg", root / "file-link.jpg", error);
+    }
+    if (!error)
+    {
+        std::filesystem::create_symlink(root / "missing.jpg", root / "dangling.jpg", error);
+    }
+    const bool hasLinks = !error;
+    if (!hasLinks)
+    {
+        // Creating links needs a privilege on Windows.
+        std::printf("symbolic links are unavailable (%s); scanning without them\n", error.message().c_str());
+    }
+
+    auto expected = std::vector<std::string>{ "a.jpg", "b.txt", "sub/c.jpg", "sub/deeper/d.jpg" };
+    if (hasLinks)
+    {
+        expected.insert(expected.begin() + 2, "file-link.jpg");
+    }
+    CHECK(Scan(root, true) == expected);
+
+    expected.erase(std::remove(expected.begin(), expected.end(), "b.txt"), expected.end());
+    CHECK(Scan(root, true, "*.jpg") == expected);
+
+    expected = { "a.jpg", "b.txt" };
+    if (hasLinks)
+    {
+        expected.push_back("file-link.jpg");
+    }
+    CHECK(Scan(root, false) == expected);
+    CHECK(Scan(root / "empty", true).empty());
+}
+
+// Enough entries that listing the folder takes several 64 KB batches.
+TEST_CASE("DirectoryScanner.LargeFolder")
+{
+    const TemporaryFolder folder;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 3000; i++)
+    {
+        auto name = "snapshot-with-a-fairly-long-name-" + std::to_string(10000 + i);
+        TouchFile(folder.Path / name);
+        expected.push_back(std::move(name));
+    }
+    std::sort(expected.begin(), expected.end());
+    CHECK(Scan(folder.Path, false) == expected);
+    CHECK(Scan(folder.Path, false, "*-1234?").size() == 10);
+}
+
+TEST_CASE("DirectoryScanner.MissingFolder")
+{
+    const TemporaryFolder folder;
+    bool thrown = false;
+    try
+    {
+        Scan(folder.Path / "missing", true);
+    }
+    catch (std::system_error const&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
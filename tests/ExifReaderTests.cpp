@@ -0,0 +1,282 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <initializer_list>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "CorpusGenerator.h"
+#include "ExifReader.h"
+#include "TestHarness.h"
+
+namespace
+{
+    std::vector<uint8_t> RandomBytes(std::mt19937_64& random, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    // A TIFF block like the one Recall writes: IFD0 holds only the Exif IFD pointer, and the Exif IFD only the
+    // MakerNote, inline when it fits in four bytes and after the IFDs otherwise. The offsets can be overridden to
+    // point anywhere.
+    struct TiffLayout
+    {
+        bool BigEndian = false;
+        std::vector<uint8_t> MakerNote;
+        uint16_t MakerNoteType = 7;  // UNDEFINED
+        std::optional<uint32_t> Ifd0Offset;
+        std::optional<uint32_t> ExifIfdOffset;
+        std::optional<uint32_t> MakerNoteOffset;
+    };
+
+    std::vector<uint8_t> BuildTiff(TiffLayout const& layout)
+    {
+        std::vector<uint8_t> tiff;
+        auto append16 = [&](uint32_t value)
+        {
+            const uint8_t bytes[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+            tiff.insert(tiff.end(), { bytes[layout.BigEndian ? 1 : 0], bytes[layout.BigEndian ? 0 : 1] });
+        };
+        auto append32 = [&](uint32_t value)
+        {
+            append16(layout.BigEndian ? (value >> 16) : (value & 0xFFFF));
+            append16(layout.BigEndian ? (value & 0xFFFF) : (value >> 16));
+        };
+
+        constexpr uint32_t c_exifIfdOffset = 8 + 2 + 12 + 4;
+        constexpr uint32_t c_makerNoteOffset = c_exifIfdOffset + 2 + 12 + 4;
+        tiff.insert(tiff.end(), { static_cast<uint8_t>(layout.BigEndian ? 'M' : 'I'), static_cast<uint8_t>(layout.BigEndian ? 'M' : 'I') });
+        append16(42);
+        append32(layout.Ifd0Offset.value_or(8));
+        append16(1);
+        append16(details::c_tiffExifIfdPointerTag);
+        append16(4);  // LONG
+        append32(1);
+        append32(layout.ExifIfdOffset.value_or(c_exifIfdOffset));
+        append32(0);
+        append16(1);
+        append16(c_exifMakerNoteTag);
+        append16(layout.MakerNoteType);
+        append32(static_cast<uint32_t>(layout.MakerNote.size()));
+        if (layout.MakerNote.size() <= 4)
+        {
+            auto inlineValue = layout.MakerNote;
+            inlineValue.resize(4);
+            tiff.insert(tiff.end(), inlineValue.begin(), inlineValue.end());
+            append32(0);
+        }
+        else
+        {
+            append32(layout.MakerNoteOffset.value_or(c_makerNoteOffset));
+            append32(0);
+            tiff.insert(tiff.end(), layout.MakerNote.begin(), layout.MakerNote.end());
+        }
+        return tiff;
+    }
+
+    std::vector<uint8_t> Segment(uint8_t marker, std::span<uint8_t const> payload)
+    {
+        std::vector<uint8_t> segment = { 0xFF, marker };
+        details::AppendBigEndian16(segment, payload.size() + 2);
+        segment.insert(segment.end(), payload.begin(), payload.end());
+        return segment;
+    }
+
+    std::vector<uint8_t> ExifApp1(std::span<uint8_t const> tiff)
+    {
+        std::vector<uint8_t> payload = { 'E', 'x', 'i', 'f', 0, 0 };
+        payload.insert(payload.end(), tiff.begin(), tiff.end());
+        return Segment(details::c_jpegApp1, payload);
+    }
+
+    // SOI, the given segments, then a scan and EOI.
+    std::vector<uint8_t> BuildJpeg(std::initializer_list<std::vector<uint8_t>> segments)
+    {
+        std::vector<uint8_t> jpeg = { 0xFF, 0xD8 };
+        for (auto const& segment : segments)
+        {
+            jpeg.insert(jpeg.end(), segment.begin(), segment.end());
+        }
+        jpeg.insert(jpeg.end(), { 0xFF, 0xDA, 0, 2, 0x12, 0x34, 0xFF, 0xD9 });
+        return jpeg;
+    }
+
+    // Whether 'value' is 'expected', viewed in place inside 'jpeg'.
+    bool IsViewOf(std::optional<std::span<uint8_t const>> value, std::span<uint8_t const> jpeg, std::span<uint8_t const> expected)
+    {
+        return value && (value->data() >= jpeg.data()) && (value->data() + value->size() <= jpeg.data() + jpeg.size()) &&
+            testing::Equal(*value, expected);
+    }
+}
+
+TEST_CASE("ExifReader.SyntheticSnapshot")
+{
+    std::mt19937_64 random(1);
+    const auto metadata = RandomBytes(random, 3000);
+    const auto jpeg = BuildSyntheticJpeg(metadata, 100000, random);
+    CHECK(IsViewOf(FindSnapshotMetadata(jpeg), jpeg, metadata));
+    CHECK(!FindExifTag(jpeg, 0x9003));  // DateTimeOriginal
+}
+
+TEST_CASE("ExifReader.BigEndian")
+{
+    std::mt19937_64 random(2);
+    for (const bool bigEndian : { false, true })
+    {
+        TiffLayout layout;
+        layout.BigEndian = bigEndian;
+        layout.MakerNote = RandomBytes(random, 300);
+        const auto jpeg = BuildJpeg({ ExifApp1(BuildTiff(layout)) });
+        CHECK(IsViewOf(FindSnapshotMetadata(jpeg), jpeg, layout.MakerNote));
+
+        // A SHORT count of 150 is the same 300 bytes, sized by the type in the entry's own byte order.
+        layout.MakerNoteType = 3;
+        auto tiff = BuildTiff(layout);
+        const auto countOffset = 8 + 2 + 12 + 4 + 2 + 4;
+        tiff[countOffset + (bigEndian ? 3 : 0)] = 150;
+        tiff[countOffset + (bigEndian ? 2 : 1)] = 0;
+        const auto shorts = BuildJpeg({ ExifApp1(tiff) });
+        CHECK(IsViewOf(FindSnapshotMetadata(shorts), shorts, layout.MakerNote));
+    }
+}
+
+// Values of up to four bytes are stored in the entry itself, in place of an offset.
+TEST_CASE("ExifReader.InlineMakerNote")
+{
+    for (const bool bigEndian : { false, true })
+    {
+        for (size_t size = 0; size <= 5; size++)
+        {
+            TiffLayout layout;
+            layout.BigEndian = bigEndian;
+            layout.MakerNote = { 0xA1, 0xB2, 0xC3, 0xD4, 0xE5 };
+            layout.MakerNote.resize(size);
+            const auto jpeg = BuildJpeg({ ExifApp1(BuildTiff(layout)) });
+            const auto value = FindSnapshotMetadata(jpeg);
+            CHECK(IsViewOf(value, jpeg, layout.MakerNote));
+
+            // Inline values sit right after the entry's count, 12 bytes into the TIFF block's second entry.
+            const auto entryValue = jpeg.data() + 2 + 4 + 6 + 8 + 2 + 12 + 4 + 2 + 8;
+            CHECK(!value || (size > 4) || (value->data() == entryValue));
+        }
+    }
+}
+
+// APP1 segments that are not Exif, such as XMP, are skipped, and so are other segments and fill bytes.
+TEST_CASE("ExifReader.SkipsOtherSegments")
+{
+    std::mt19937_64 random(3);
+    TiffLayout layout;
+    layout.MakerNote = RandomBytes(random, 100);
+    const auto exif = ExifApp1(BuildTiff(layout));
+    constexpr char c_xmp[] = "http://ns.adobe.com/xap/1.0/\0<x:xmpmeta/>";
+    const auto xmp = Segment(details::c_jpegApp1, { reinterpret_cast<uint8_t const*>(c_xmp), sizeof(c_xmp) - 1 });
+    const uint8_t shortExif[] = { 'E', 'x', 'i', 'f' };
+    const auto comment = Segment(0xFE, RandomBytes(random, 500));
+    const std::vector<uint8_t> fill = { 0xFF, 0xFF };
+
+    for (auto const& jpeg : {
+        BuildJpeg({ xmp, exif }),
+        BuildJpeg({ Segment(details::c_jpegApp1, shortExif), comment, exif }),
+        BuildJpeg({ Segment(details::c_jpegApp1, {}), exif }),
+        BuildJpeg({ fill, exif }),
+        BuildJpeg({ comment, fill, xmp, exif, xmp }),
+    })
+    {
+        CHECK(IsViewOf(FindSnapshotMetadata(jpeg), jpeg, layout.MakerNote));
+    }
+
+    // Only the first Exif APP1 is read, and nothing after the scan starts.
+    TiffLayout other;
+    other.MakerNote = RandomBytes(random, 100);
+    const auto twice = BuildJpeg({ exif, ExifApp1(BuildTiff(other)) });
+    CHECK(IsViewOf(FindSnapshotMetadata(twice), twice, layout.MakerNote));
+    auto afterScan = BuildJpeg({ xmp });
+    afterScan.insert(afterScan.end() - 2, exif.begin(), exif.end());
+    CHECK(!FindSnapshotMetadata(afterScan));
+    CHECK(!FindSnapshotMetadata(BuildJpeg({ xmp })));
+}
+
+// Every prefix of a snapshot, including ones that end inside the APP1 segment and the TIFF block.
+TEST_CASE("ExifReader.TruncatedApp1")
+{
+    std::mt19937_64 random(4);
+    TiffLayout layout;
+    layout.MakerNote = RandomBytes(random, 100);
+    const auto jpeg = BuildJpeg({ ExifApp1(BuildTiff(layout)) });
+    for (size_t size = 0; size < jpeg.size(); size++)
+    {
+        CHECK(!FindSnapshotMetadata(std::span(jpeg).first(size)) || (size >= jpeg.size() - 8));
+    }
+
+    // APP1 segments that are whole but hold only part of the TIFF block; the MakerNote comes last, so every cut
+    // loses some of it.
+    const auto tiff = BuildTiff(layout);
+    for (size_t size = 0; size < tiff.size(); size++)
+    {
+        const auto cut = BuildJpeg({ ExifApp1(std::span(tiff).first(size)) });
+        CHECK(!FindSnapshotMetadata(cut));
+    }
+}
+
+// Offsets and counts that point past the TIFF block, or wrap around, are rejected rather than followed.
+TEST_CASE("ExifReader.OffsetsPastTheEnd")
+{
+    std::mt19937_64 random(5);
+    for (const bool bigEndian : { false, true })
+    {
+        TiffLayout valid;
+        valid.BigEndian = bigEndian;
+        valid.MakerNote = RandomBytes(random, 100);
+        const auto size = static_cast<uint32_t>(BuildTiff(valid).size());
+
+        for (const uint32_t offset : { size, size - 1, size + 1000, 0xFFFFFFF0u, 0xFFFFFFFFu })
+        {
+            for (int field = 0; field < 3; field++)
+            {
+                auto layout = valid;
+                (field == 0 ? layout.Ifd0Offset : (field == 1) ? layout.ExifIfdOffset : layout.MakerNoteOffset) = offset;
+                const auto jpeg = BuildJpeg({ ExifApp1(BuildTiff(layout)) });
+                CHECK(!FindSnapshotMetadata(jpeg));
+            }
+        }
+
+        // A MakerNote that starts inside the block but runs past its end.
+        auto layout = valid;
+        layout.MakerNoteOffset = size - 50;
+        const auto jpeg = BuildJpeg({ ExifApp1(BuildTiff(layout)) });
+        CHECK(!FindSnapshotMetadata(jpeg));
+
+        // An IFD whose entry count runs past the end.
+        auto tiff = BuildTiff(valid);
+        tiff[8 + (bigEndian ? 0 : 1)] = 0x10;
+        const auto manyEntries = BuildJpeg({ ExifApp1(tiff) });
+        CHECK(!FindSnapshotMetadata(manyEntries));
+    }
+}
+
+// Random damage anywhere in the TIFF block never reads outside the image; the sanitizer builds check that.
+TEST_CASE("ExifReader.RandomDamage")
+{
+    std::mt19937_64 random(6);
+    for (int i = 0; i < 2000; i++)
+    {
+        TiffLayout layout;
+        layout.BigEndian = (i % 2) != 0;
+        layout.MakerNote = RandomBytes(random, random() % 40);
+        auto tiff = BuildTiff(layout);
+        for (auto damage = 1 + random() % 4; damage > 0; damage--)
+        {
+            tiff[random() % tiff.size()] = static_cast<uint8_t>(random());
+        }
+        const auto jpeg = BuildJpeg({ ExifApp1(tiff) });
+        const auto value = FindSnapshotMetadata(jpeg);
+        CHECK(!value || ((value->data() >= jpeg.data()) && (value->data() + value->size() <= jpeg.data() + jpeg.size())));
+    }
+}
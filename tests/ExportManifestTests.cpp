@@ -0,0 +1,246 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ExportManifest.h"
+#include "TestHarness.h"
+
+namespace
+{
+    SnapshotFingerprint RandomFingerprint(std::mt19937_64& random)
+    {
+        SnapshotFingerprint fingerprint;
+        fingerprint.FileSize = random() >> 20;
+        fingerprint.LastWriteTime = static_cast<int64_t>(random());
+        fingerprint.Header.Version = 2;
+        fingerprint.Header.KeySize = 32;
+        fingerprint.Header.ContentSize = static_cast<uint32_t>(random());
+        fingerprint.Header.ContentType = static_cast<uint32_t>(random() % 4);
+        fingerprint.TagHash = random();
+        return fingerprint;
+    }
+
+    std::vector<uint8_t> ReadFileBytes(std::filesystem::path const& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+    }
+
+    void WriteFileBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+
+    constexpr size_t c_headerSize = 8;
+
+    // Writes one Complete record per name, flushing after each, and returns the file's length after every flush.
+    std::vector<uint64_t> WriteRecords(std::filesystem::path const& path, std::vector<ManifestEntry> const& entries)
+    {
+        std::vector<uint64_t> lengths;
+        ExportManifest manifest(path);
+        for (auto const& entry : entries)
+        {
+            manifest.Record(entry);
+            manifest.Flush();
+            lengths.push_back(std::filesystem::file_size(path));
+        }
+        return lengths;
+    }
+
+    std::vector<ManifestEntry> RandomEntries(std::mt19937_64& random, size_t count)
+    {
+        std::vector<ManifestEntry> entries;
+        for (size_t i = 0; i < count; i++)
+        {
+            entries.push_back({ "snapshot" + std::to_string(i), RandomFingerprint(random), ManifestStatus::Complete });
+        }
+        return entries;
+    }
+}
+
+TEST_CASE("ExportManifest.RoundTrip")
+{
+    std::mt19937_64 random(1);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "export.manifest";
+    const auto complete = RandomFingerprint(random);
+    const auto failed = RandomFingerprint(random);
+    {
+        ExportManifest manifest(path);
+        CHECK(manifest.Size() == 0);
+        CHECK(std::filesystem::file_size(path) == c_headerSize);
+        manifest.Record({ "complete", complete, ManifestStatus::Complete });
+        manifest.Record({ u8"sub/\u00e9t\u00e9", complete, ManifestStatus::Complete });
+        manifest.Record({ "failed", failed, ManifestStatus::Failed });
+        CHECK(manifest.Size() == 3);
+
+        // Records are buffered until Flush, or until the manifest is closed.
+        CHECK(std::filesystem::file_size(path) == c_headerSize);
+        CHECK(manifest.IsUpToDate("complete", complete));
+    }
+    const auto length = std::filesystem::file_size(path);
+    CHECK(length > c_headerSize);
+
+    const ExportManifest manifest(path);
+    CHECK(manifest.Size() == 3);
+    CHECK(std::filesystem::file_size(path) == length);
+    CHECK(manifest.IsUpToDate("complete", complete));
+    CHECK(manifest.IsUpToDate(u8"sub/\u00e9t\u00e9", complete));
+    CHECK(!manifest.IsUpToDate("failed", failed));
+    CHECK(!manifest.IsUpToDate("missing", complete));
+
+    // Any change to the input makes it out of date.
+    for (int field = 0; field < 7; field++)
+    {
+        auto changed = complete;
+        switch (field)
+        {
+        case 0: changed.FileSize++; break;
+        case 1: changed.LastWriteTime++; break;
+        case 2: changed.Header.Version++; break;
+        case 3: changed.Header.KeySize++; break;
+        case 4: changed.Header.ContentSize++; break;
+        case 5: changed.Header.ContentType++; break;
+        default: changed.TagHash++; break;
+        }
+        CHECK(!manifest.IsUpToDate("complete", changed));
+    }
+}
+
+// The last record for a name wins, whether it was written in the same run or a later one.
+TEST_CASE("ExportManifest.LaterRecordsSupersede")
+{
+    std::mt19937_64 random(2);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "export.manifest";
+    const auto first = RandomFingerprint(random);
+    const auto second = RandomFingerprint(random);
+    {
+        ExportManifest manifest(path);
+        manifest.Record({ "a", first, ManifestStatus::Complete });
+        manifest.Record({ "a", first, ManifestStatus::Failed });
+        manifest.Record({ "b", first, ManifestStatus::Failed });
+        manifest.Record({ "b", first, ManifestStatus::Complete });
+        manifest.Record({ "c", first, ManifestStatus::Complete });
+        CHECK(manifest.Size() == 3);
+        CHECK(!manifest.IsUpToDate("a", first));
+        CHECK(manifest.IsUpToDate("b", first));
+    }
+    {
+        ExportManifest manifest(path);
+        CHECK(manifest.Size() == 3);
+        CHECK(!manifest.IsUpToDate("a", first));
+        CHECK(manifest.IsUpToDate("b", first));
+        CHECK(manifest.IsUpToDate("c", first));
+        manifest.Record({ "a", second, ManifestStatus::Complete });
+        manifest.Record({ "c", second, ManifestStatus::Complete });
+    }
+
+    const ExportManifest manifest(path);
+    CHECK(manifest.Size() == 3);
+    CHECK(manifest.IsUpToDate("a", second));
+    CHECK(manifest.IsUpToDate("b", first));
+    CHECK(!manifest.IsUpToDate("c", first));
+    CHECK(manifest.IsUpToDate("c", second));
+}
+
+// A record cut off at any byte is dropped, the file is truncated back to the records before it, and new records are
+// appended after those.
+TEST_CASE("ExportManifest.TruncatedTail")
+{
+    std::mt19937_64 random(3);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "export.manifest";
+    const auto entries = RandomEntries(random, 3);
+    const auto lengths = WriteRecords(path, entries);
+    const auto complete = ReadFileBytes(path);
+
+    for (auto length = lengths[1] + 1; length < lengths[2]; length++)
+    {
+        WriteFileBytes(path, { complete.data(), static_cast<size_t>(length) });
+        {
+            ExportManifest manifest(path);
+            CHECK(manifest.Size() == 2);
+            CHECK(std::filesystem::file_size(path) == lengths[1]);
+            CHECK(manifest.IsUpToDate(entries[1].Name, entries[1].Fingerprint));
+            CHECK(!manifest.IsUpToDate(entries[2].Name, entries[2].Fingerprint));
+            manifest.Record(entries[2]);
+        }
+
+        const ExportManifest manifest(path);
+        CHECK(manifest.Size() == 3);
+        CHECK(manifest.IsUpToDate(entries[2].Name, entries[2].Fingerprint));
+        CHECK(testing::Equal(ReadFileBytes(path), complete));
+    }
+}
+
+// A record whose bytes no longer match its checksum ends the manifest there, like a torn one.
+TEST_CASE("ExportManifest.CorruptRecord")
+{
+    std::mt19937_64 random(4);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "export.manifest";
+    const auto entries = RandomEntries(random, 4);
+    const auto lengths = WriteRecords(path, entries);
+    const auto complete = ReadFileBytes(path);
+
+    // Every byte of the third record: its size, its checksum and its body.
+    for (auto offset = lengths[1]; offset < lengths[2]; offset++)
+    {
+        auto corrupt = complete;
+        corrupt[offset] ^= 0x10;
+        WriteFileBytes(path, corrupt);
+
+        const ExportManifest manifest(path);
+        CHECK(manifest.Size() == 2);
+        CHECK(std::filesystem::file_size(path) == lengths[1]);
+        CHECK(manifest.IsUpToDate(entries[0].Name, entries[0].Fingerprint));
+        CHECK(!manifest.IsUpToDate(entries[3].Name, entries[3].Fingerprint));
+    }
+
+    // Garbage after the last record is dropped too.
+    auto extended = complete;
+    extended.insert(extended.end(), 100, 0xAB);
+    WriteFileBytes(path, extended);
+    {
+        const ExportManifest manifest(path);
+        CHECK(manifest.Size() == 4);
+        CHECK(std::filesystem::file_size(path) == lengths[3]);
+    }
+
+    // A file that is not a manifest, or one from another version, is started over.
+    for (const size_t offset : { size_t{ 0 }, size_t{ 4 } })
+    {
+        auto foreign = complete;
+        foreign[offset] ^= 0x01;
+        WriteFileBytes(path, foreign);
+
+        const ExportManifest manifest(path);
+        CHECK(manifest.Size() == 0);
+        CHECK(std::filesystem::file_size(path) == c_headerSize);
+    }
+}
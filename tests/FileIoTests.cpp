@@ -0,0 +1,245 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "FileIo.h"
+#include "TestHarness.h"
+
+namespace
+{
+    // Small enough that the larger test files span many chunks of the io_uring buffer pool, and a queue shorter than
+    // the number of requests each case submits.
+    constexpr size_t c_bufferSize = 4096;
+    constexpr unsigned c_queueDepth = 4;
+
+    // Empty, within one buffer, exactly one, one byte over, and many buffers.
+    constexpr size_t c_fileSizes[] = { 0, 1, c_bufferSize - 1, c_bufferSize, c_bufferSize + 1, c_bufferSize * 10 + 17, 1000000 };
+
+    // Runs 'body' on a new instance of every backend this system can run, naming the backend of any failure.
+    void ForEachBackend(std::function<void(FileIoBackend&)> const& body)
+    {
+        std::vector<std::function<std::unique_ptr<FileIoBackend>()>> factories;
+        factories.push_back([] { return std::make_unique<ThreadPoolFileIo>(c_queueDepth); });
+#if defined(FILEIO_IO_URING)
+        factories.push_back([]() -> std::unique_ptr<FileIoBackend> { return std::make_unique<IoUringFileIo>(c_queueDepth, c_bufferSize); });
+#endif
+
+        for (auto const& factory : factories)
+        {
+            std::unique_ptr<FileIoBackend> io;
+            try
+            {
+                io = factory();
+            }
+            catch (std::system_error const& error)
+            {
+                std::printf("skipping a backend that is unavailable here: %s\n", error.what());
+                continue;
+            }
+
+            const bool failedBefore = testing::CurrentTestFailed();
+            testing::CurrentTestFailed() = false;
+            body(*io);
+            if (testing::CurrentTestFailed())
+            {
+                std::fprintf(stderr, "  with the %ls backend\n", io->Name());
+            }
+            testing::CurrentTestFailed() = testing::CurrentTestFailed() || failedBefore;
+        }
+    }
+
+    std::vector<uint8_t> RandomBytes(std::mt19937_64& random, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    void WriteFileBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    std::vector<uint8_t> ReadFileBytes(std::filesystem::path const& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+    }
+
+    // Reaps everything in flight and returns the completions in user data order, which must be 0 to count - 1.
+    std::vector<FileIoCompletion> ReapAll(FileIoBackend& io, size_t count)
+    {
+        std::vector<FileIoCompletion> reaped;
+        while (io.InFlight() > 0)
+        {
+            const auto before = reaped.size();
+            CHECK(io.Reap(reaped, 1) == reaped.size() - before);
+            CHECK(reaped.size() > before);
+        }
+
+        std::vector<FileIoCompletion> completions(count);
+        std::vector<bool> seen(count);
+        CHECK(reaped.size() == count);
+        for (auto& completion : reaped)
+        {
+            CHECK((completion.UserData < count) && !seen[completion.UserData]);
+            if ((completion.UserData < count) && !seen[completion.UserData])
+            {
+                seen[completion.UserData] = true;
+                completions[completion.UserData] = std::move(completion);
+            }
+        }
+        return completions;
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+}
+
+// Several files of every size, many more than the queue depth, read in one batch.
+TEST_CASE("FileIo.Read")
+{
+    std::mt19937_64 random(1);
+    const TemporaryFolder folder;
+    std::vector<std::vector<uint8_t>> contents;
+    for (size_t i = 0; i < std::size(c_fileSizes) * 3; i++)
+    {
+        contents.push_back(RandomBytes(random, c_fileSizes[i % std::size(c_fileSizes)]));
+        WriteFileBytes(folder.Path / std::to_string(i), contents.back());
+    }
+
+    ForEachBackend([&](FileIoBackend& io)
+    {
+        for (size_t i = 0; i < contents.size(); i++)
+        {
+            io.SubmitRead(folder.Path / std::to_string(i), i);
+        }
+        CHECK(io.InFlight() == contents.size());
+
+        const auto completions = ReapAll(io, contents.size());
+        for (size_t i = 0; i < completions.size(); i++)
+        {
+            CHECK(!completions[i].Error);
+            CHECK(testing::Equal(completions[i].Data, contents[i]));
+        }
+    });
+}
+
+// The same files written in one batch, over existing files that are longer, so they must be truncated.
+TEST_CASE("FileIo.Write")
+{
+    std::mt19937_64 random(2);
+    const TemporaryFolder folder;
+    std::vector<std::vector<uint8_t>> contents;
+    for (size_t i = 0; i < std::size(c_fileSizes) * 3; i++)
+    {
+        contents.push_back(RandomBytes(random, c_fileSizes[i % std::size(c_fileSizes)]));
+    }
+
+    ForEachBackend([&](FileIoBackend& io)
+    {
+        for (size_t i = 0; i < contents.size(); i++)
+        {
+            WriteFileBytes(folder.Path / std::to_string(i), RandomBytes(random, contents[i].size() + 100));
+            io.SubmitWrite(folder.Path / std::to_string(i), contents[i], i);
+        }
+
+        const auto completions = ReapAll(io, contents.size());
+        for (size_t i = 0; i < completions.size(); i++)
+        {
+            CHECK(!completions[i].Error);
+            CHECK(completions[i].Data.empty());
+            CHECK(testing::Equal(ReadFileBytes(folder.Path / std::to_string(i)), contents[i]));
+        }
+    });
+}
+
+// Failed requests complete with their error, without holding up the requests around them.
+TEST_CASE("FileIo.Missing")
+{
+    std::mt19937_64 random(3);
+    const TemporaryFolder folder;
+    const auto contents = RandomBytes(random, c_bufferSize * 3);
+    WriteFileBytes(folder.Path / "present", contents);
+
+    ForEachBackend([&](FileIoBackend& io)
+    {
+        for (size_t i = 0; i < c_queueDepth * 3; i += 3)
+        {
+            io.SubmitRead(folder.Path / "missing", i);
+            io.SubmitRead(folder.Path / "present", i + 1);
+            io.SubmitWrite(folder.Path / "missing" / "output", contents, i + 2);
+        }
+
+        const auto completions = ReapAll(io, c_queueDepth * 3);
+        for (size_t i = 0; i < completions.size(); i += 3)
+        {
+            CHECK(completions[i].Error == std::errc::no_such_file_or_directory);
+            CHECK(completions[i].Data.empty());
+            CHECK(!completions[i + 1].Error);
+            CHECK(testing::Equal(completions[i + 1].Data, contents));
+            CHECK(completions[i + 2].Error == std::errc::no_such_file_or_directory);
+        }
+        CHECK(!std::filesystem::exists(folder.Path / "missing"));
+    });
+}
+
+// Reap returns once 'minimum' requests have finished, and the rest stay in flight for later calls.
+TEST_CASE("FileIo.ReapMinimum")
+{
+    std::mt19937_64 random(4);
+    const TemporaryFolder folder;
+    const auto contents = RandomBytes(random, c_bufferSize * 2 + 1);
+    WriteFileBytes(folder.Path / "file", contents);
+
+    ForEachBackend([&](FileIoBackend& io)
+    {
+        constexpr size_t c_requests = c_queueDepth * 4;
+        for (size_t i = 0; i < c_requests; i++)
+        {
+            io.SubmitRead(folder.Path / "file", i);
+        }
+
+        std::vector<FileIoCompletion> completions;
+        const auto reaped = io.Reap(completions, c_queueDepth);
+        CHECK((reaped >= c_queueDepth) && (reaped == completions.size()));
+        CHECK(io.InFlight() == c_requests - reaped);
+
+        io.Reap(completions, c_requests);
+        CHECK(completions.size() == c_requests);
+        CHECK(io.InFlight() == 0);
+        CHECK(io.Reap(completions, 1) == 0);
+        for (auto const& completion : completions)
+        {
+            CHECK(!completion.Error && testing::Equal(completion.Data, contents));
+        }
+    });
+}
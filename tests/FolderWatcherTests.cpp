@@ -0,0 +1,178 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CorpusGenerator.h"
+#include "FolderWatcher.h"
+#include "SnapshotCrypto.h"
+#include "TestHarness.h"
+
+namespace
+{
+    const std::vector<uint8_t> c_exportCodeBytes = testing::FromHex("00112233445566778899aabbccddeeff");
+
+    std::vector<uint8_t> BuildContainer(std::mt19937_64& random)
+    {
+        return SealSnapshotContainer(DeriveExportKey(c_exportCodeBytes), BuildSyntheticJpeg({}, 5000, random), random);
+    }
+
+    void WriteFileBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes, bool append = false)
+    {
+        std::ofstream output(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+        output.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    SnapshotFileState CheckBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes)
+    {
+        WriteFileBytes(path, bytes);
+        return CheckSnapshotFile(path, bytes.size());
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+
+    // Runs WatchSnapshotFolder on its own thread, recording the files it hands over, until destroyed.
+    class WatchThread
+    {
+    public:
+        WatchThread(std::filesystem::path const& root, ScanOptions const& options) : m_watcher(root, options.Recursive)
+        {
+            m_thread = std::thread([this, root, options]
+            {
+                WatchSnapshotFolder(m_watcher, root, options, m_stop, [this](ScannedFile const& file)
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_handed.push_back(file.RelativePath.generic_string());
+                });
+            });
+        }
+
+        ~WatchThread()
+        {
+            m_stop = true;
+            m_thread.join();
+        }
+
+        std::vector<std::string> Handed()
+        {
+            std::lock_guard lock(m_mutex);
+            return m_handed;
+        }
+
+        // Waits up to 'timeout' for at least 'count' files to have been handed over.
+        bool WaitForHanded(size_t count, std::chrono::milliseconds timeout)
+        {
+            const auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (Handed().size() < count)
+            {
+                if (std::chrono::steady_clock::now() > deadline)
+                {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return true;
+        }
+
+    private:
+        FolderWatcher m_watcher;
+        std::atomic<bool> m_stop{ false };
+        std::mutex m_mutex;
+        std::vector<std::string> m_handed;
+        std::thread m_thread;
+    };
+
+    // Long enough for several rounds of the watch loop, even where it falls back to polling.
+    constexpr auto c_settleTime = c_watchPollInterval * 3;
+    constexpr auto c_handOverTimeout = std::chrono::seconds(10);
+}
+
+TEST_CASE("FolderWatcher.CheckSnapshotFile")
+{
+    std::mt19937_64 random(1);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "snapshot";
+    const auto container = BuildContainer(random);
+    const auto contentStart = sizeof(EncryptedSnapshotHeader) + c_totalSizeInBytes;
+
+    // Every prefix is still being written: before the header, inside the key, and inside the content.
+    for (const size_t size : { size_t{ 0 }, size_t{ 1 }, sizeof(EncryptedSnapshotHeader) - 1, sizeof(EncryptedSnapshotHeader), contentStart - 1,
+        contentStart, container.size() / 2, container.size() - 1 })
+    {
+        CHECK(CheckBytes(path, { container.data(), size }) == SnapshotFileState::Incomplete);
+    }
+    CHECK(CheckBytes(path, container) == SnapshotFileState::Complete);
+
+    // Bytes past the declared end do not make a container incomplete.
+    auto extended = container;
+    extended.push_back(0);
+    CHECK(CheckBytes(path, extended) == SnapshotFileState::Complete);
+
+    // A header no amount of writing can fix, whether or not the rest has arrived.
+    for (const size_t field : { size_t{ 0 }, size_t{ 4 }, size_t{ 8 } })
+    {
+        auto malformed = container;
+        const uint32_t value = (field == 8) ? c_tagSizeInBytes - 1 : 7;
+        memcpy(malformed.data() + field, &value, sizeof(value));
+        CHECK(CheckBytes(path, malformed) == SnapshotFileState::Malformed);
+        CHECK(CheckBytes(path, { malformed.data(), sizeof(EncryptedSnapshotHeader) }) == SnapshotFileState::Malformed);
+    }
+
+    // A size taken before the file was cut short.
+    WriteFileBytes(path, { container.data(), 8 });
+    CHECK(CheckSnapshotFile(path, container.size()) == SnapshotFileState::Incomplete);
+}
+
+// A container written in two parts is handed over once, after the second; files already there are handed over by the
+// first listing, and files that do not match the pattern never are.
+TEST_CASE("FolderWatcher.HandsOverCompleteFilesOnce")
+{
+    std::mt19937_64 random(2);
+    const TemporaryFolder folder;
+    const auto existing = BuildContainer(random);
+    const auto written = BuildContainer(random);
+    WriteFileBytes(folder.Path / "snapshot-existing", existing);
+    WriteFileBytes(folder.Path / "other", existing);
+
+    ScanOptions options;
+    options.Pattern = std::filesystem::path("snapshot-*").native();
+    WatchThread watch(folder.Path, options);
+    CHECK(watch.WaitForHanded(1, c_handOverTimeout));
+
+    const auto split = written.size() / 2;
+    WriteFileBytes(folder.Path / "snapshot-written", { written.data(), split });
+    std::this_thread::sleep_for(c_settleTime);
+    CHECK((watch.Handed() == std::vector<std::string>{ "snapshot-existing" }));
+
+    WriteFileBytes(folder.Path / "snapshot-written", std::span(written).subspan(split), true);
+    CHECK(watch.WaitForHanded(2, c_handOverTimeout));
+
+    // Closing the file again after writing nothing is a change notification, but not a new version of the file.
+    WriteFileBytes(folder.Path / "snapshot-written", {}, true);
+    std::this_thread::sleep_for(c_settleTime);
+    CHECK((watch.Handed() == std::vector<std::string>{ "snapshot-existing", "snapshot-written" }));
+}
@@ -0,0 +1,182 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "CorpusGenerator.h"
+#include "DecryptionSession.h"
+#include "SnapshotCrypto.h"
+#include "SnapshotFormat.h"
+#include "StreamingDecrypt.h"
+#include "TestHarness.h"
+
+namespace
+{
+    const std::vector<uint8_t> c_exportCodeBytes = testing::FromHex("00112233445566778899aabbccddeeff");
+
+    std::vector<uint8_t> RandomBytes(std::mt19937_64& random, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    std::vector<uint8_t> SealForTest(std::span<uint8_t const> plaintext, std::mt19937_64& random)
+    {
+        const auto exportKey = DeriveExportKey(c_exportCodeBytes);
+        return SealSnapshotContainer(exportKey, plaintext, random);
+    }
+
+    std::vector<uint8_t> ReadFileBytes(std::filesystem::path const& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+    }
+
+    void WriteFileBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+}
+
+TEST_CASE("SnapshotFormat.ParseContainer")
+{
+    std::mt19937_64 random(3);
+    const auto plaintext = RandomBytes(random, 1000);
+    const auto container = SealForTest(plaintext, random);
+
+    const auto parsed = ParseSnapshotContainer(container);
+    CHECK(parsed.Header.Version == c_snapshotContainerVersion);
+    CHECK(parsed.Header.KeySize == c_totalSizeInBytes);
+    CHECK(parsed.Header.ContentSize == plaintext.size() + c_tagSizeInBytes);
+    CHECK(parsed.WrappedKey.data() == container.data() + sizeof(EncryptedSnapshotHeader));
+    CHECK(parsed.WrappedKey.size() == c_totalSizeInBytes);
+    CHECK(parsed.Payload.data() == container.data() + sizeof(EncryptedSnapshotHeader) + c_totalSizeInBytes);
+    CHECK(parsed.Payload.size() == plaintext.size() + c_tagSizeInBytes);
+    CHECK(DecryptionSession::GetDecryptedSize(container) == plaintext.size());
+
+    // Trailing bytes after the payload are ignored.
+    auto padded = container;
+    padded.resize(padded.size() + 5);
+    CHECK(ParseSnapshotContainer(padded).Payload.size() == parsed.Payload.size());
+}
+
+TEST_CASE("SnapshotFormat.RejectsMalformedContainers")
+{
+    std::mt19937_64 random(4);
+    const auto container = SealForTest(RandomBytes(random, 100), random);
+
+    CHECK_THROWS_HRESULT(ReadSnapshotHeader(std::span(container).first(sizeof(EncryptedSnapshotHeader) - 1)), c_hrInvalidData);
+    CHECK_THROWS_HRESULT(ParseSnapshotContainer(std::span(container).first(container.size() - 1)), c_hrInvalidData);
+    CHECK_THROWS_HRESULT(ParseSnapshotContainer(std::span(container).first(sizeof(EncryptedSnapshotHeader) + 10)), c_hrInvalidData);
+
+    auto wrongVersion = container;
+    wrongVersion[0] = 3;
+    CHECK_THROWS_HRESULT(ParseSnapshotContainer(wrongVersion), c_hrInvalidData);
+
+    // Sizes that would overflow a 32-bit sum must not wrap around the bounds check.
+    auto hugeKey = container;
+    hugeKey[4] = hugeKey[5] = hugeKey[6] = hugeKey[7] = 0xFF;
+    CHECK_THROWS_HRESULT(ParseSnapshotContainer(hugeKey), c_hrInvalidData);
+    auto hugeContent = container;
+    hugeContent[8] = hugeContent[9] = hugeContent[10] = hugeContent[11] = 0xFF;
+    CHECK_THROWS_HRESULT(ParseSnapshotContainer(hugeContent), c_hrInvalidData);
+}
+
+TEST_CASE("SnapshotCrypto.DecryptContainer")
+{
+    std::mt19937_64 random(5);
+    const DecryptionSession session(c_exportCodeBytes);
+    const auto exportKey = DeriveExportKey(c_exportCodeBytes);
+    const auto cipher = CreateSnapshotCipher(exportKey);
+    for (const size_t size : { 0, 1, 16, 4095, 100000 })
+    {
+        const auto plaintext = RandomBytes(random, size);
+        auto container = SealForTest(plaintext, random);
+        CHECK(testing::Equal(DecryptSnapshotContainer(*cipher, container), plaintext));
+
+        std::vector<uint8_t> output(DecryptionSession::GetDecryptedSize(container));
+        CHECK(session.Decrypt(container, output) == size);
+        CHECK(testing::Equal(output, plaintext));
+        session.Verify(container);
+
+        container[container.size() - 1] ^= 1;
+        CHECK_THROWS_HRESULT(session.Decrypt(container, output), c_hrAuthTagMismatch);
+        CHECK_THROWS_HRESULT(session.Verify(container), c_hrAuthTagMismatch);
+    }
+
+    // A different export code fails to unwrap the content key.
+    const auto container = SealForTest(RandomBytes(random, 100), random);
+    const DecryptionSession wrongSession(testing::FromHex("ffeeddccbbaa99887766554433221100"));
+    std::vector<uint8_t> output(100);
+    CHECK_THROWS_HRESULT(wrongSession.Decrypt(container, output), c_hrAuthTagMismatch);
+}
+
+TEST_CASE("StreamingDecrypt.ChunkedFiles")
+{
+    std::mt19937_64 random(6);
+    const TemporaryFolder folder;
+    const DecryptionSession session(c_exportCodeBytes);
+    const auto inputPath = folder.Path / "snapshot";
+    const auto outputPath = folder.Path / "snapshot.jpg";
+
+    for (const size_t size : { 0, 1, 15, 16, 17, 1000, 65536, 200001 })
+    {
+        const auto plaintext = RandomBytes(random, size);
+        WriteFileBytes(inputPath, SealForTest(plaintext, random));
+
+        // Chunk sizes are rounded down to whole blocks; each of these ends the payload on a partial chunk.
+        for (const size_t chunkSize : { size_t{ 1 }, size_t{ 16 }, size_t{ 100 }, size_t{ 4096 }, size_t{ 65537 }, c_defaultStreamingChunkSize })
+        {
+            std::filesystem::remove(outputPath);
+            CHECK(DecryptSnapshotFile(session, inputPath, outputPath, chunkSize) == size);
+            CHECK(testing::Equal(ReadFileBytes(outputPath), plaintext));
+            CHECK(VerifySnapshotFile(session, inputPath, chunkSize) == size);
+        }
+    }
+}
+
+TEST_CASE("StreamingDecrypt.TamperedFileLeavesNoOutput")
+{
+    std::mt19937_64 random(7);
+    const TemporaryFolder folder;
+    const DecryptionSession session(c_exportCodeBytes);
+    const auto inputPath = folder.Path / "snapshot";
+    const auto outputPath = folder.Path / "snapshot.jpg";
+
+    auto container = SealForTest(RandomBytes(random, 50000), random);
+    container[container.size() / 2] ^= 0x40;
+    WriteFileBytes(inputPath, container);
+
+    CHECK_THROWS_HRESULT(DecryptSnapshotFile(session, inputPath, outputPath, 4096), c_hrAuthTagMismatch);
+    CHECK(!std::filesystem::exists(outputPath));
+    CHECK(!std::filesystem::exists(folder.Path / "snapshot.jpg.partial"));
+    CHECK_THROWS_HRESULT(VerifySnapshotFile(session, inputPath, 4096), c_hrAuthTagMismatch);
+
+    WriteFileBytes(inputPath, std::span(container).first(container.size() - 1));
+    CHECK_THROWS_HRESULT(VerifySnapshotFile(session, inputPath), c_hrInvalidData);
+}
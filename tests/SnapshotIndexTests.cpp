@@ -0,0 +1,385 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "SnapshotIndex.h"
+#include "TestHarness.h"
+
+namespace
+{
+    std::vector<uint8_t> ReadFileBytes(std::filesystem::path const& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+    }
+
+    void WriteFileBytes(std::filesystem::path const& path, std::span<uint8_t const> bytes)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+
+    // Terms from common to rare, so posting lists range from dense (one-byte deltas) to sparse (multi-byte ones).
+    std::vector<std::string> Vocabulary()
+    {
+        std::vector<std::string> terms = { FieldTerm("appname", "msedge.exe"), FieldTerm("appname", "code.exe"), FieldTerm("windowtitle", "inbox") };
+        for (const auto word : { "report", "quarterly", "budget", "meeting", "draft", "invoice", "travel", "photo", "notes" })
+        {
+            terms.push_back(WordTerm(word));
+        }
+        return terms;
+    }
+
+    // Records with random times, about one in eight without one, and a random subset of the vocabulary where the
+    // i-th term is held by roughly one record in 2^i.
+    std::vector<SnapshotIndexRecord> RandomRecords(std::mt19937_64& random, size_t count, std::string_view prefix)
+    {
+        const auto vocabulary = Vocabulary();
+        std::vector<SnapshotIndexRecord> records(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            records[i].Name = std::string(prefix) + std::to_string(i) + ".jpg";
+            records[i].Time = (random() % 8 == 0) ? c_noSnapshotTime : static_cast<int64_t>(1'700'000'000'000 + random() % 1000 * 1000);
+            for (size_t term = 0; term < vocabulary.size(); term++)
+            {
+                if (random() % (size_t{ 1 } << term) == 0)
+                {
+                    records[i].Terms.push_back(vocabulary[term]);
+                }
+            }
+            std::sort(records[i].Terms.begin(), records[i].Terms.end());
+        }
+        return records;
+    }
+
+    // The index's capture order: by time, then by name.
+    std::vector<SnapshotIndexRecord> CaptureOrder(std::vector<SnapshotIndexRecord> records)
+    {
+        std::sort(records.begin(), records.end(), [](auto const& left, auto const& right)
+        {
+            return (left.Time != right.Time) ? (left.Time < right.Time) : (left.Name < right.Name);
+        });
+        return records;
+    }
+
+    // What Query must return, by checking every record.
+    std::vector<uint32_t> ExpectedMatches(std::vector<SnapshotIndexRecord> const& ordered, SnapshotQuery const& query)
+    {
+        std::vector<uint32_t> ids;
+        for (uint32_t id = 0; id < ordered.size(); id++)
+        {
+            auto const& record = ordered[id];
+            const bool bounded = query.From || query.To;
+            if ((bounded && (record.Time == c_noSnapshotTime)) || (query.From && (record.Time < *query.From)) || (query.To && (record.Time >= *query.To)))
+            {
+                continue;
+            }
+            if (std::all_of(query.Terms.begin(), query.Terms.end(), [&](auto const& term)
+            {
+                return std::binary_search(record.Terms.begin(), record.Terms.end(), term);
+            }))
+            {
+                ids.push_back(id);
+            }
+        }
+        return ids;
+    }
+
+    // Checks every snapshot, every term's posting list, and a spread of queries against the records.
+    void CheckIndex(SnapshotIndex const& index, std::vector<SnapshotIndexRecord> const& records, std::mt19937_64& random)
+    {
+        const auto ordered = CaptureOrder(records);
+        CHECK(index.Size() == ordered.size());
+        if (index.Size() != ordered.size())
+        {
+            return;
+        }
+        for (uint32_t id = 0; id < index.Size(); id++)
+        {
+            CHECK(index.Name(id) == ordered[id].Name);
+            CHECK(index.Time(id) == ordered[id].Time);
+        }
+
+        for (uint32_t term = 0; term < index.TermCount(); term++)
+        {
+            SnapshotQuery query;
+            query.Terms.emplace_back(index.Term(term));
+            CHECK(index.FindTerm(index.Term(term)) == term);
+            CHECK(index.Postings(term) == ExpectedMatches(ordered, query));
+            CHECK((term == 0) || (index.Term(term - 1) < index.Term(term)));
+        }
+
+        const auto vocabulary = Vocabulary();
+        for (int i = 0; i < 300; i++)
+        {
+            // Bounds are taken from the records' own times, so they land both on and between them.
+            SnapshotQuery query;
+            auto boundary = [&]() -> int64_t
+            {
+                const auto time = ordered[random() % ordered.size()].Time;
+                return (time == c_noSnapshotTime) ? 1'700'000'500'000 : time + static_cast<int64_t>(random() % 3) - 1;
+            };
+            if (random() % 2)
+            {
+                query.From = boundary();
+            }
+            if (random() % 2)
+            {
+                query.To = boundary();
+            }
+            for (auto terms = random() % 4; terms > 0; terms--)
+            {
+                query.Terms.push_back(vocabulary[random() % vocabulary.size()]);
+            }
+            CHECK(index.Query(query) == ExpectedMatches(ordered, query));
+        }
+    }
+}
+
+TEST_CASE("SnapshotIndex.Query")
+{
+    std::mt19937_64 random(1);
+    const TemporaryFolder folder;
+    const auto records = RandomRecords(random, 2000, "snapshot");
+
+    SnapshotIndexBuilder builder;
+    for (auto const& record : records)
+    {
+        builder.Add(record);
+    }
+    builder.Write(folder.Path / "snapshots.index", folder.Path / "export");
+    CHECK(!std::filesystem::exists(folder.Path / "snapshots.index.tmp"));
+
+    const SnapshotIndex index(folder.Path / "snapshots.index");
+    CHECK(index.ExportFolder() == folder.Path / "export");
+    std::vector<std::string> distinctTerms;
+    for (auto const& record : records)
+    {
+        distinctTerms.insert(distinctTerms.end(), record.Terms.begin(), record.Terms.end());
+    }
+    std::sort(distinctTerms.begin(), distinctTerms.end());
+    distinctTerms.erase(std::unique(distinctTerms.begin(), distinctTerms.end()), distinctTerms.end());
+    CHECK(index.TermCount() == distinctTerms.size());
+    CheckIndex(index, records, random);
+
+    // Snapshots without a time come first and match only unbounded queries, even with From at c_noSnapshotTime.
+    SnapshotQuery all;
+    CHECK(index.Query(all).size() == records.size());
+    CHECK(index.Time(0) == c_noSnapshotTime);
+    SnapshotQuery fromNoTime;
+    fromNoTime.From = c_noSnapshotTime;
+    const auto timed = index.Query(fromNoTime);
+    CHECK(!timed.empty() && (timed.size() < records.size()));
+    for (const auto id : timed)
+    {
+        CHECK(index.Time(id) != c_noSnapshotTime);
+    }
+
+    // An empty or inverted range, and a term no snapshot has.
+    SnapshotQuery empty;
+    empty.From = 1'700'000'500'000;
+    empty.To = 1'700'000'500'000;
+    CHECK(index.Query(empty).empty());
+    empty.To = 0;
+    CHECK(index.Query(empty).empty());
+    SnapshotQuery missing;
+    missing.Terms = { WordTerm("report"), WordTerm("absent") };
+    CHECK(index.Query(missing).empty());
+    CHECK(!index.FindTerm(WordTerm("absent")));
+}
+
+TEST_CASE("SnapshotIndex.QueryTerms")
+{
+    SnapshotQuery query;
+    query.AddField(L"AppName", L"MSEdge.EXE");
+    query.AddWords(L"Quarterly REPORT, draft-2");
+    CHECK((query.Terms == std::vector<std::string>{ FieldTerm("appname", "msedge.exe"), WordTerm("quarterly"), WordTerm("report"),
+        WordTerm("draft"), WordTerm("2") }));
+}
+
+// Posting deltas of 0, 127, 128, 16383 and 16384, the boundaries of one-, two- and three-byte LEB128.
+TEST_CASE("SnapshotIndex.Leb128Postings")
+{
+    const TemporaryFolder folder;
+    const std::vector<uint32_t> ids = { 0, 127, 255, 255 + 16384, 255 + 16384 + 16383 };
+    SnapshotIndexBuilder builder;
+    for (uint32_t id = 0; id <= ids.back(); id++)
+    {
+        SnapshotIndexRecord record;
+        record.Name = std::to_string(100000 + id);
+        record.Time = id;
+        if (std::binary_search(ids.begin(), ids.end(), id))
+        {
+            record.Terms.push_back(WordTerm("sparse"));
+        }
+        builder.Add(std::move(record));
+    }
+    builder.Write(folder.Path / "snapshots.index", "x");
+
+    // With a single term, its postings are the bytes before the one-byte export folder.
+    const auto bytes = ReadFileBytes(folder.Path / "snapshots.index");
+    const auto expected = testing::FromHex("007f8001808001ff7f");
+    CHECK(testing::Equal(std::span(bytes).subspan(bytes.size() - 1 - expected.size(), expected.size()), expected));
+
+    const SnapshotIndex index(folder.Path / "snapshots.index");
+    CHECK(index.Postings(0) == ids);
+    SnapshotQuery query;
+    query.Terms = { WordTerm("sparse") };
+    query.From = 128;
+    query.To = 255 + 16384 + 1;
+    CHECK(index.Query(query) == std::vector<uint32_t>(ids.begin() + 2, ids.begin() + 4));
+}
+
+// An incremental export loads the previous index, replaces and adds records, and writes it back over the old file.
+TEST_CASE("SnapshotIndex.LoadAndRewrite")
+{
+    std::mt19937_64 random(2);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "snapshots.index";
+    auto records = RandomRecords(random, 500, "first");
+    {
+        SnapshotIndexBuilder builder;
+        for (auto const& record : records)
+        {
+            builder.Add(record);
+        }
+        builder.Write(path, folder.Path);
+    }
+
+    SnapshotIndexBuilder builder;
+    {
+        const SnapshotIndex index(path);
+        builder.Load(index);
+    }
+    CHECK(builder.Size() == records.size());
+
+    auto changed = RandomRecords(random, 100, "first");
+    auto added = RandomRecords(random, 300, "second");
+    for (auto const& record : changed)
+    {
+        builder.Add(record);
+    }
+    for (auto const& record : added)
+    {
+        builder.Add(record);
+    }
+    std::copy(changed.begin(), changed.end(), records.begin());
+    records.insert(records.end(), added.begin(), added.end());
+    CHECK(builder.Size() == records.size());
+    builder.Write(path, folder.Path);
+
+    const SnapshotIndex index(path);
+    CheckIndex(index, records, random);
+}
+
+TEST_CASE("SnapshotIndex.RejectsCorruptFiles")
+{
+    std::mt19937_64 random(3);
+    const TemporaryFolder folder;
+    const auto path = folder.Path / "snapshots.index";
+    SnapshotIndexBuilder builder;
+    for (auto const& record : RandomRecords(random, 20, "snapshot"))
+    {
+        builder.Add(record);
+    }
+    builder.Write(path, "export");
+    const auto valid = ReadFileBytes(path);
+    const auto corrupt = folder.Path / "corrupt.index";
+
+    // Every truncation, and a trailing byte.
+    for (size_t size = 0; size < valid.size(); size++)
+    {
+        WriteFileBytes(corrupt, { valid.data(), size });
+        CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+    }
+    auto extended = valid;
+    extended.push_back(0);
+    WriteFileBytes(corrupt, extended);
+    CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+
+    const SnapshotIndex index(path);
+    const auto snapshotCount = index.Size();
+    const auto termCount = index.TermCount();
+    auto patched = [&](size_t offset, std::span<uint8_t const> bytes)
+    {
+        auto copy = valid;
+        std::copy(bytes.begin(), bytes.end(), copy.begin() + offset);
+        WriteFileBytes(corrupt, copy);
+    };
+    const uint8_t zero32[4] = {};
+
+    // Another magic or version.
+    const uint8_t magic[4] = { 'R', 'S', 'X', 'J' };
+    patched(0, magic);
+    CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+    const uint8_t version2[4] = { 2, 0, 0, 0 };
+    patched(4, version2);
+    CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+
+    // Times out of capture order: the last snapshot's time set to 0, before every other.
+    const uint8_t zero64[8] = {};
+    patched(32 + 8 * (size_t{ snapshotCount } - 1), zero64);
+    CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+
+    // A name end that goes backwards.
+    const auto nameEnds = 32 + 8 * size_t{ snapshotCount };
+    patched(nameEnds + 4, zero32);
+    CHECK_THROWS_HRESULT(SnapshotIndex(corrupt), c_hrInvalidData);
+
+    // Posting lists with an id past the last snapshot, a repeated id, and an unterminated LEB128 number. The bytes
+    // are rewritten in place, so the file still opens and the error surfaces when the list is decoded. With 20
+    // snapshots every delta is a single byte.
+    const auto postingEnds = nameEnds + 4 * size_t{ snapshotCount } + 4 * size_t{ termCount };
+    auto postingEnd = [&](uint32_t term)
+    {
+        uint32_t end = 0;
+        memcpy(&end, valid.data() + postingEnds + 4 * size_t{ term }, 4);
+        return size_t{ end };
+    };
+    const auto postings = valid.size() - std::string_view("export").size() - postingEnd(termCount - 1);
+    uint32_t term = 0;
+    while (index.Postings(term).size() < 2)
+    {
+        term++;
+    }
+    const auto begin = postings + ((term == 0) ? 0 : postingEnd(term - 1));
+    const auto end = postings + postingEnd(term);
+    SnapshotQuery query;
+    query.Terms.emplace_back(index.Term(term));
+
+    auto checkDamaged = [&](size_t offset, uint8_t byte)
+    {
+        patched(offset, { &byte, 1 });
+        const SnapshotIndex damaged(corrupt);
+        CHECK_THROWS_HRESULT(damaged.Postings(term), c_hrInvalidData);
+        CHECK_THROWS_HRESULT(damaged.Query(query), c_hrInvalidData);
+    };
+    checkDamaged(begin, 0x7F);
+    checkDamaged(begin + 1, 0x00);
+    checkDamaged(end - 1, 0x80);
+}
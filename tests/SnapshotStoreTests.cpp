@@ -0,0 +1,124 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CorpusGenerator.h"
+#include "SnapshotStore.h"
+#include "TestHarness.h"
+
+#if defined(_WIN32)
+#include "JsonHelper.h"
+#endif
+
+namespace
+{
+    const std::vector<uint8_t> c_exportCodeBytes = testing::FromHex("00112233445566778899aabbccddeeff");
+    const std::wstring c_exportCode = L"00112233445566778899aabbccddeeff";
+
+    void WriteSnapshot(std::filesystem::path const& path, std::span<uint8_t const> image, std::mt19937_64& random)
+    {
+        const auto container = SealSnapshotContainer(DeriveExportKey(c_exportCodeBytes), image, random);
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<char const*>(container.data()), static_cast<std::streamsize>(container.size()));
+    }
+
+    // The MakerNote of the test snapshots. On Windows it is written by the WinRT serializer, so that the store can
+    // deserialize it; elsewhere the store only carries the bytes through, so any will do.
+    std::vector<uint8_t> BuildTestPropertySet([[maybe_unused]] std::mt19937_64& random)
+    {
+#if defined(_WIN32)
+        winrt::ValueSet valueSet;
+        valueSet.Insert(L"AppName", winrt::PropertyValue::CreateString(L"msedge.exe"));
+        valueSet.Insert(L"WindowTitle", winrt::PropertyValue::CreateString(L"Quarterly \"report\""));
+        valueSet.Insert(L"ProcessId", winrt::PropertyValue::CreateUInt32(4242));
+        return SerializePropertySet(valueSet);
+#else
+        std::vector<uint8_t> bytes(3000);
+        details::FillRandom(random, bytes);
+        return bytes;
+#endif
+    }
+
+    // What the export writes for the same PropertySet.
+    std::string ExpectedJson([[maybe_unused]] std::span<uint8_t const> propertySet)
+    {
+        std::string json;
+#if defined(_WIN32)
+        JsonWriter writer(json);
+        SerializeValueSet(DeserializePropertySet(propertySet), writer);
+#endif
+        return json;
+    }
+
+    // A folder under the system temporary directory, removed with everything in it when the test is done.
+    struct TemporaryFolder
+    {
+        TemporaryFolder()
+        {
+            Path = std::filesystem::temp_directory_path() / ("RecallSnapshotsExportTests-" + std::to_string(std::random_device()()));
+            std::filesystem::create_directories(Path);
+        }
+
+        ~TemporaryFolder()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(Path, error);
+        }
+
+        std::filesystem::path Path;
+    };
+}
+
+TEST_CASE("SnapshotStore.Metadata")
+{
+    std::mt19937_64 random(8);
+    const TemporaryFolder folder;
+    const auto metadata = BuildTestPropertySet(random);
+
+    // The second image is larger than the metadata prefix, so its metadata is read from a partial decryption.
+    const auto small = BuildSyntheticJpeg(metadata, 10000, random);
+    const auto large = BuildSyntheticJpeg(metadata, SnapshotStore::c_metadataPrefixSize * 2, random);
+    WriteSnapshot(folder.Path / "a", small, random);
+    WriteSnapshot(folder.Path / "b", large, random);
+    WriteSnapshot(folder.Path / "c", BuildSyntheticJpeg({}, 1000, random), random);
+
+    SnapshotStore store(folder.Path, c_exportCode);
+    CHECK(store.Entries().size() == 3);
+    CHECK(store.Find("b") == 1);
+    CHECK(!store.Find("d"));
+
+    const auto expected = ExpectedJson(metadata);
+    for (const size_t index : { size_t{ 0 }, size_t{ 1 } })
+    {
+        const auto parsed = store.Metadata(index);
+        CHECK(parsed->Json() == expected);
+        CHECK(testing::Equal(parsed->PropertySet(), metadata));
+    }
+    CHECK(store.Metadata(2)->Json() == "{}");
+
+    CHECK(testing::Equal(store.Image(1)->Data(), large));
+    store.ClearCache();
+    CHECK(store.MetadataCacheStatistics().Entries == 0);
+}
+
+#if defined(_WIN32)
+// Bytes the WinRT serializer rejects.
+TEST_CASE("SnapshotStore.UnrecognizedMetadata")
+{
+    std::mt19937_64 random(9);
+    const TemporaryFolder folder;
+    const uint8_t garbage[] = { 0xFF, 0xFF, 0xFF, 0xFF, 1, 2, 3 };
+    WriteSnapshot(folder.Path / "a", BuildSyntheticJpeg(garbage, 1000, random), random);
+
+    SnapshotStore store(folder.Path, c_exportCode);
+    CHECK_THROWS_HRESULT(store.Metadata(0), c_hrInvalidData);
+
+    // A failed load is not cached.
+    CHECK(store.MetadataCacheStatistics().Entries == 0);
+    CHECK_THROWS_HRESULT(store.Metadata(0), c_hrInvalidData);
+}
+#endif
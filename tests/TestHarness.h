@@ -0,0 +1,135 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A minimal test runner for the portable core, so the tests build wherever the headers do without another dependency.
+// Each test executable defines its cases with TEST_CASE and gets main() from TestMain.cpp; a failed CHECK marks the
+// case as failed and carries on, and an exception escaping a case fails it.
+namespace testing
+{
+    struct TestCase
+    {
+        char const* Name;
+        std::function<void()> Body;
+    };
+
+    inline std::vector<TestCase>& Registry()
+    {
+        static std::vector<TestCase> testCases;
+        return testCases;
+    }
+
+    inline bool& CurrentTestFailed()
+    {
+        static bool failed = false;
+        return failed;
+    }
+
+    struct Registrar
+    {
+        Registrar(char const* name, std::function<void()> body)
+        {
+            Registry().push_back({ name, std::move(body) });
+        }
+    };
+
+    inline void ReportFailure(char const* file, int line, char const* expression)
+    {
+        std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", file, line, expression);
+        CurrentTestFailed() = true;
+    }
+
+    inline std::vector<uint8_t> FromHex(std::string_view hex)
+    {
+        const auto nibble = [](char character)
+        {
+            return static_cast<uint8_t>((character <= '9') ? (character - '0') : ((character | 0x20) - 'a' + 10));
+        };
+
+        std::vector<uint8_t> bytes(hex.size() / 2);
+        for (size_t i = 0; i < bytes.size(); i++)
+        {
+            bytes[i] = static_cast<uint8_t>((nibble(hex[2 * i]) << 4) | nibble(hex[2 * i + 1]));
+        }
+        return bytes;
+    }
+
+    inline bool Equal(std::span<uint8_t const> left, std::span<uint8_t const> right)
+    {
+        return (left.size() == right.size()) && std::equal(left.begin(), left.end(), right.begin());
+    }
+
+    // Runs every case whose name contains 'filter', or all of them, and returns the process exit code.
+    inline int RunTests(std::string_view filter)
+    {
+        int failures = 0;
+        for (auto const& testCase : Registry())
+        {
+            if (!filter.empty() && (std::string_view(testCase.Name).find(filter) == std::string_view::npos))
+            {
+                continue;
+            }
+
+            CurrentTestFailed() = false;
+            try
+            {
+                testCase.Body();
+            }
+            catch (std::exception const& exception)
+            {
+                std::fprintf(stderr, "%s: unexpected exception: %s\n", testCase.Name, exception.what());
+                CurrentTestFailed() = true;
+            }
+
+            std::printf("[%s] %s\n", CurrentTestFailed() ? "FAILED" : "passed", testCase.Name);
+            failures += CurrentTestFailed() ? 1 : 0;
+        }
+        return (failures == 0) ? 0 : 1;
+    }
+}
+
+#define TEST_CONCATENATE_INNER(a, b) a##b
+#define TEST_CONCATENATE(a, b) TEST_CONCATENATE_INNER(a, b)
+
+#define TEST_CASE(name) \
+    static void TEST_CONCATENATE(TestBody_, __LINE__)(); \
+    static const testing::Registrar TEST_CONCATENATE(t_testRegistrar_, __LINE__)(name, TEST_CONCATENATE(TestBody_, __LINE__)); \
+    static void TEST_CONCATENATE(TestBody_, __LINE__)()
+
+#define CHECK(expression) \
+    do \
+    { \
+        if (!(expression)) \
+        { \
+            testing::ReportFailure(__FILE__, __LINE__, #expression); \
+        } \
+    } while (false)
+
+// Checks that 'expression' throws SnapshotException with the given HRESULT.
+#define CHECK_THROWS_HRESULT(expression, hr) \
+    do \
+    { \
+        bool thrown = false; \
+        try \
+        { \
+            static_cast<void>(expression); \
+        } \
+        catch (SnapshotException const& exception) \
+        { \
+            thrown = (exception.HResult() == (hr)); \
+        } \
+        if (!thrown) \
+        { \
+            testing::ReportFailure(__FILE__, __LINE__, #expression " throws " #hr); \
+        } \
+    } while (false)
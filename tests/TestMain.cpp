@@ -0,0 +1,9 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include "TestHarness.h"
+
+// Usage: <test executable> [filter]
+int main(int argc, char* argv[])
+{
+    return testing::RunTests((argc > 1) ? argv[1] : "");
+}